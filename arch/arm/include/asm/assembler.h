@@ -53,9 +53,10 @@
 #endif
 
 /*
- * Data preload for architectures that support it
+ * Data preload for architectures that support it, unless none of the
+ * supported cores does anything with it.
  */
-#if __LINUX_ARM_ARCH__ >= 5
+#if __LINUX_ARM_ARCH__ >= 5 && !defined(CONFIG_CPU_PLD_NOP)
 #define PLD(code...)	code
 #else
 #define PLD(code...)
@@ -68,9 +69,10 @@
  * set to write-allocate (this would need further testing on XScale when WA
  * is used).
  *
- * On Feroceon there is much to gain however, regardless of cache mode.
+ * On Feroceon there is much to gain however, regardless of cache mode,
+ * and Cortex-A5 benefits from it as well.  See CONFIG_CPU_COPY_CALGN.
  */
-#ifdef CONFIG_CPU_FEROCEON
+#ifdef CONFIG_CPU_COPY_CALGN
 #define CALGN(code...) code
 #else
 #define CALGN(code...)
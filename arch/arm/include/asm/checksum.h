@@ -10,6 +10,7 @@
 #define __ASM_ARM_CHECKSUM_H
 
 #include <linux/in6.h>
+#include <asm/uaccess.h>
 
 /*
  * computes the checksum of a memory block at buff, length len,
@@ -39,6 +40,25 @@ csum_partial_copy_nocheck(const void *src, void *dst, int len, __wsum sum);
 __wsum
 csum_partial_copy_from_user(const void __user *src, void *dst, int len, __wsum sum, int *err_ptr);
 
+__wsum
+csum_partial_copy_to_user(const void *src, void __user *dst, int len, __wsum sum, int *err_ptr);
+
+/*
+ * Copy and checksum to user space in one pass
+ */
+#define HAVE_CSUM_COPY_USER
+static inline __wsum
+csum_and_copy_to_user(const void *src, void __user *dst, int len, __wsum sum, int *err_ptr)
+{
+	if (access_ok(VERIFY_WRITE, dst, len))
+		return csum_partial_copy_to_user(src, dst, len, sum, err_ptr);
+
+	if (len)
+		*err_ptr = -EFAULT;
+
+	return (__force __wsum)-1; /* invalid checksum */
+}
+
 /*
  * 	Fold a partial checksum without adding pseudo headers
  */
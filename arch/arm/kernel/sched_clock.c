@@ -113,12 +113,19 @@ void __init setup_sched_clock_needs_suspend(u32 (*read)(void), int bits,
 void __init setup_sched_clock(u32 (*read)(void), int bits, unsigned long rate)
 {
 	unsigned long r, w;
-	u64 res, wrap;
+	u64 res, wrap, now;
 	char r_unit;
 
 	BUG_ON(bits > 32);
 	WARN_ON(!irqs_disabled());
 	WARN_ON(read_sched_clock != jiffy_sched_clock_read);
+
+	/*
+	 * Timers provided by platform devices (e.g. the AT91 TC blocks)
+	 * can only replace the jiffy clock after sched_clock_postinit():
+	 * carry on from the current value so sched_clock() stays monotonic.
+	 */
+	now = sched_clock();
 	read_sched_clock = read;
 	sched_clock_mask = (1 << bits) - 1;
 
@@ -153,9 +160,14 @@ void __init setup_sched_clock(u32 (*read)(void), int bits, unsigned long rate)
 	update_sched_clock();
 
 	/*
-	 * Ensure that sched_clock() starts off at 0ns
+	 * Ensure that sched_clock() starts off at 0ns, or where the jiffy
+	 * clock left it when registered late.
 	 */
-	cd.epoch_ns = 0;
+	cd.epoch_ns = now;
+
+	/* a late registration must not wait for the jiffy clock's wrap */
+	if (timer_pending(&sched_clock_timer))
+		sched_clock_poll(sched_clock_timer.data);
 
 	pr_debug("Registered %pF as sched_clock source\n", read);
 }
@@ -0,0 +1,570 @@
+/*
+ * linux/arch/arm/lib/copy-test.c
+ *
+ * Self test and benchmark for memcpy(), copy_{to,from}_user(),
+ * copy_page() and the checksum and copy routines.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The self test checks every length up to a few cache lines and a set of
+ * larger ones, for all source word alignments and all destination cache
+ * line alignments, which covers every path of copy_template.S.  User
+ * faults in the middle of a copy are checked as well.  The checksum
+ * routines are compared against the algorithm of lib/checksum.c for
+ * random alignments, lengths and initial sums.
+ *
+ * The benchmark then reports the bandwidth of each routine for a range
+ * of sizes, with the destination cache line aligned or not and with the
+ * source word aligned or not, so that the effect of CONFIG_CPU_PLD_NOP
+ * and CONFIG_CPU_COPY_CALGN can be measured on a given system.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/uaccess.h>
+#include <net/checksum.h>
+
+static unsigned int bench_ms = 100;
+module_param(bench_ms, uint, 0444);
+MODULE_PARM_DESC(bench_ms, "run time of each benchmark in ms, 0 to skip");
+
+#define TEST_SLACK	64
+#define TEST_MAX_LEN	(2 * PAGE_SIZE)
+#define TEST_BUF_SIZE	(TEST_MAX_LEN + 2 * TEST_SLACK)
+#define TEST_GUARD	0x5a
+
+#define CSUM_TESTS	4096
+#define CSUM_MAX_LEN	1600
+
+#define BENCH_MAX_LEN	(256 * 1024)
+#define BENCH_PKT_LEN	1500
+#define BENCH_BUF_SIZE	(BENCH_MAX_LEN + TEST_SLACK)
+
+static const unsigned int test_lengths[] = {
+	511, 512, 513, 1023, 1024, 1025, 4095, 4096, 4097, TEST_MAX_LEN - 7,
+	TEST_MAX_LEN,
+};
+
+static const unsigned int bench_lengths[] = {
+	64, 256, 1024, 4096, 16384, BENCH_MAX_LEN,
+};
+
+static const struct {
+	unsigned int src, dst;
+} bench_offsets[] = {
+	{ 0, 0 },	/* all aligned */
+	{ 0, 4 },	/* destination not cache line aligned */
+	{ 1, 0 },	/* source not word aligned */
+};
+
+enum copy_kind { COPY_MEMCPY, COPY_TO_USER, COPY_FROM_USER };
+
+static const char * const copy_names[] = {
+	[COPY_MEMCPY]		= "memcpy",
+	[COPY_TO_USER]		= "copy_to_user",
+	[COPY_FROM_USER]	= "copy_from_user",
+};
+
+static u8 *kbuf_src, *kbuf_dst, *kbuf_chk;
+static unsigned long ubuf;
+
+static inline u8 test_pattern(unsigned int i)
+{
+	return (i * 13) ^ (i >> 8);
+}
+
+static int fill_user(unsigned long addr, unsigned int len, int guard)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		if (put_user(guard < 0 ? test_pattern(i) : guard,
+			     (u8 __user *)addr + i))
+			return -EFAULT;
+
+	return 0;
+}
+
+static int read_user(u8 *to, unsigned long addr, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		if (get_user(to[i], (u8 __user *)addr + i))
+			return -EFAULT;
+
+	return 0;
+}
+
+/*
+ * The TEST_SLACK bytes around the destination must hold the guard value
+ * and the copy must match the pattern from the source offset on.
+ */
+static int check_copy(const u8 *buf, unsigned int soff, unsigned int doff,
+		      unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < doff; i++)
+		if (buf[i] != TEST_GUARD)
+			return -EINVAL;
+	for (i = 0; i < len; i++)
+		if (buf[doff + i] != test_pattern(soff + i))
+			return -EINVAL;
+	for (i = doff + len; i < doff + len + TEST_SLACK; i++)
+		if (buf[i] != TEST_GUARD)
+			return -EINVAL;
+
+	return 0;
+}
+
+static int test_one(enum copy_kind kind, unsigned int soff,
+		    unsigned int doff, unsigned int len)
+{
+	unsigned int span = doff + len + TEST_SLACK;
+	unsigned long left = 0;
+	int ret;
+
+	switch (kind) {
+	case COPY_MEMCPY:
+		memset(kbuf_dst, TEST_GUARD, span);
+		memcpy(kbuf_dst + doff, kbuf_src + soff, len);
+		return check_copy(kbuf_dst, soff, doff, len);
+
+	case COPY_TO_USER:
+		ret = fill_user(ubuf, span, TEST_GUARD);
+		if (ret)
+			return ret;
+		left = copy_to_user((void __user *)ubuf + doff,
+				    kbuf_src + soff, len);
+		ret = read_user(kbuf_chk, ubuf, span);
+		if (ret)
+			return ret;
+		break;
+
+	case COPY_FROM_USER:
+		memset(kbuf_chk, TEST_GUARD, span);
+		left = copy_from_user(kbuf_chk + doff,
+				      (void __user *)ubuf + soff, len);
+		break;
+	}
+
+	if (left)
+		return -EFAULT;
+
+	return check_copy(kbuf_chk, soff, doff, len);
+}
+
+static int test_copy(enum copy_kind kind)
+{
+	unsigned int soff, doff, len, i;
+	int ret;
+
+	/* copy_from_user reads the pattern from the user buffer */
+	if (kind == COPY_FROM_USER) {
+		ret = fill_user(ubuf, TEST_BUF_SIZE, -1);
+		if (ret)
+			return ret;
+	}
+
+	for (soff = 0; soff < 8; soff++) {
+		for (doff = 0; doff < 32; doff++) {
+			for (len = 0; len < 260; len++) {
+				ret = test_one(kind, soff, doff, len);
+				if (ret)
+					goto fail;
+			}
+			for (i = 0; i < ARRAY_SIZE(test_lengths); i++) {
+				len = test_lengths[i];
+				ret = test_one(kind, soff, doff, len);
+				if (ret)
+					goto fail;
+			}
+		}
+	}
+
+	return 0;
+
+fail:
+	pr_err("copy-test: %s failed, src+%u dst+%u len %u (%d)\n",
+	       copy_names[kind], soff, doff, len, ret);
+	return ret;
+}
+
+/*
+ * Copies running into an unmapped page must stop there, report what was
+ * not copied and, for copy_from_user, clear the rest of the destination.
+ */
+static int test_fault(void)
+{
+	unsigned long map, edge;
+	void __user *uptr;
+	unsigned int head, tail, base, done, i;
+	unsigned long left;
+	int ret = 0;
+
+	map = vm_mmap(NULL, 0, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE,
+		      MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (IS_ERR_VALUE(map))
+		return map;
+
+	edge = map + PAGE_SIZE;
+	ret = fill_user(map, PAGE_SIZE, -1);
+	if (!ret)
+		ret = vm_munmap(edge, PAGE_SIZE);
+	if (ret)
+		goto out;
+
+	for (head = 1; head <= 300; head += 37) {
+		for (tail = 1; tail <= 300; tail += 53) {
+			uptr = (void __user *)edge - head;
+			memset(kbuf_chk, TEST_GUARD, head + tail);
+			left = copy_from_user(kbuf_chk, uptr, head + tail);
+			if (left < tail || left > head + tail)
+				goto fail_from;
+			done = head + tail - left;
+			base = PAGE_SIZE - head;
+			for (i = 0; i < done; i++)
+				if (kbuf_chk[i] != test_pattern(base + i))
+					goto fail_from;
+			for (; i < head + tail; i++)
+				if (kbuf_chk[i])
+					goto fail_from;
+
+			left = copy_to_user(uptr, kbuf_src, head + tail);
+			if (left < tail || left > head + tail)
+				goto fail_to;
+			done = head + tail - left;
+			ret = read_user(kbuf_chk, edge - head, done);
+			if (ret)
+				goto out;
+			if (memcmp(kbuf_chk, kbuf_src, done))
+				goto fail_to;
+
+			/* restore the pattern for the next round */
+			ret = fill_user(map, PAGE_SIZE, -1);
+			if (ret)
+				goto out;
+		}
+	}
+	goto out;
+
+fail_from:
+	pr_err("copy-test: copy_from_user fault, %u + %u bytes, %lu left\n",
+	       head, tail, left);
+	ret = -EINVAL;
+	goto out;
+fail_to:
+	pr_err("copy-test: copy_to_user fault, %u + %u bytes, %lu left\n",
+	       head, tail, left);
+	ret = -EINVAL;
+out:
+	vm_munmap(map, 2 * PAGE_SIZE);
+	return ret;
+}
+
+static int test_copy_page(void)
+{
+	void *from, *to;
+	unsigned int i;
+	int ret = 0;
+
+	from = (void *)__get_free_page(GFP_KERNEL);
+	to = (void *)__get_free_page(GFP_KERNEL);
+	if (!from || !to) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < PAGE_SIZE; i++)
+		((u8 *)from)[i] = test_pattern(i);
+	memset(to, TEST_GUARD, PAGE_SIZE);
+
+	copy_page(to, from);
+	if (memcmp(to, from, PAGE_SIZE)) {
+		pr_err("copy-test: copy_page failed\n");
+		ret = -EINVAL;
+	}
+
+out:
+	free_page((unsigned long)to);
+	free_page((unsigned long)from);
+	return ret;
+}
+
+/*
+ * Reference checksum, the way lib/checksum.c computes it: 16-bit words
+ * in memory order from the start of the buffer, whatever its alignment.
+ */
+static u64 ref_csum(const u8 *buf, unsigned int len, __wsum sum)
+{
+	u64 result = (__force u32)sum;
+	unsigned int i;
+	u16 word;
+
+	for (i = 0; i + 1 < len; i += 2) {
+		memcpy(&word, buf + i, 2);
+		result += word;
+	}
+	if (len & 1)
+#ifdef __ARMEB__
+		result += buf[len - 1] << 8;
+#else
+		result += buf[len - 1];
+#endif
+
+	return result;
+}
+
+/* Partial checksums are equivalent when they match modulo 0xffff */
+static bool csum_equal(u64 a, u64 b)
+{
+	while (a >> 16)
+		a = (a & 0xffff) + (a >> 16);
+	while (b >> 16)
+		b = (b & 0xffff) + (b >> 16);
+
+	return (a == 0xffff ? 0 : a) == (b == 0xffff ? 0 : b);
+}
+
+static int test_csum(void)
+{
+	unsigned int n, soff, doff, len;
+	const u8 *src;
+	__wsum sum, res;
+	u64 ref;
+	int err;
+
+	/* random data in kbuf_dst, which the copy tests are done with */
+	get_random_bytes(kbuf_dst, CSUM_MAX_LEN + 8);
+
+	for (n = 0; n < CSUM_TESTS; n++) {
+		soff = random32() & 7;
+		doff = random32() & 7;
+		len = random32() % CSUM_MAX_LEN;
+		sum = (__force __wsum)random32();
+		src = kbuf_dst + soff;
+		ref = ref_csum(src, len, sum);
+
+		res = csum_partial(src, len, sum);
+		if (!csum_equal(res, ref))
+			goto fail;
+
+		res = csum_partial_copy_nocheck(src, kbuf_chk + doff, len, sum);
+		if (!csum_equal(res, ref) || memcmp(kbuf_chk + doff, src, len))
+			goto fail;
+
+		err = 0;
+		res = csum_and_copy_to_user(src, (void __user *)ubuf + doff,
+					    len, sum, &err);
+		if (err || !csum_equal(res, ref))
+			goto fail;
+		err = read_user(kbuf_chk, ubuf + doff, len);
+		if (err || memcmp(kbuf_chk, src, len))
+			goto fail;
+
+		res = csum_and_copy_from_user((void __user *)ubuf + doff,
+					      kbuf_chk + soff, len, sum, &err);
+		if (err || !csum_equal(res, ref) ||
+		    memcmp(kbuf_chk + soff, src, len))
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	pr_err("copy-test: checksum failed, src+%u dst+%u len %u sum %08x\n",
+	       soff, doff, len, (__force u32)sum);
+	return -EINVAL;
+}
+
+/* What csum_and_copy_to_user() does without a fused implementation */
+static noinline __wsum csum_then_copy(void __user *to, const void *from,
+				      int len, int *err)
+{
+	__wsum sum = csum_partial(from, len, 0);
+
+	if (__copy_to_user(to, from, len))
+		*err = -EFAULT;
+
+	return sum;
+}
+
+/* Bandwidth in MB/s of a routine called in a loop for bench_ms */
+#define bench_loop(len, call)						\
+({									\
+	u64 __bytes = 0, __ns;						\
+	ktime_t __start = ktime_get();					\
+	unsigned int __i;						\
+									\
+	do {								\
+		for (__i = 0; __i < 16; __i++)				\
+			call;						\
+		__bytes += 16 * (len);					\
+		__ns = ktime_to_ns(ktime_sub(ktime_get(), __start));	\
+	} while (__ns < (u64)bench_ms * NSEC_PER_MSEC);		\
+									\
+	(unsigned int)div64_u64(__bytes * 1000, __ns);			\
+})
+
+static void bench_copy(enum copy_kind kind, u8 *kdst, const u8 *ksrc)
+{
+	unsigned int i, j, len, mbs;
+	unsigned long left = 0;
+	void __user *udst;
+	const void __user *usrc;
+	const u8 *src;
+	u8 *dst;
+
+	for (i = 0; i < ARRAY_SIZE(bench_lengths); i++) {
+		len = bench_lengths[i];
+		for (j = 0; j < ARRAY_SIZE(bench_offsets); j++) {
+			src = ksrc + bench_offsets[j].src;
+			dst = kdst + bench_offsets[j].dst;
+			usrc = (const void __user *)ubuf + bench_offsets[j].src;
+			udst = (void __user *)ubuf + bench_offsets[j].dst;
+
+			switch (kind) {
+			case COPY_MEMCPY:
+				mbs = bench_loop(len, memcpy(dst, src, len));
+				break;
+			case COPY_TO_USER:
+				mbs = bench_loop(len,
+					left |= __copy_to_user(udst, src, len));
+				break;
+			default:
+				mbs = bench_loop(len,
+					left |= __copy_from_user(dst, usrc,
+								 len));
+				break;
+			}
+
+			pr_info("copy-test: %-14s %6u bytes src+%u dst+%u: "
+				"%u MB/s\n", copy_names[kind], len,
+				bench_offsets[j].src, bench_offsets[j].dst,
+				mbs);
+		}
+	}
+
+	if (left)
+		pr_warn("copy-test: %s faulted during the benchmark\n",
+			copy_names[kind]);
+}
+
+static int run_bench(void)
+{
+	void __user *udst = (void __user *)ubuf;
+	u8 *ksrc, *kdst;
+	void *from, *to;
+	int ret = -ENOMEM;
+	int err = 0;
+
+	ksrc = vmalloc(BENCH_BUF_SIZE);
+	kdst = vmalloc(BENCH_BUF_SIZE);
+	from = (void *)__get_free_page(GFP_KERNEL);
+	to = (void *)__get_free_page(GFP_KERNEL);
+	if (!ksrc || !kdst || !from || !to)
+		goto out;
+
+	/* fault the whole user buffer in before timing anything */
+	memset(ksrc, TEST_GUARD, BENCH_BUF_SIZE);
+	memset(kdst, 0, BENCH_BUF_SIZE);
+	ret = fill_user(ubuf, BENCH_BUF_SIZE, TEST_GUARD);
+	if (ret)
+		goto out;
+
+	bench_copy(COPY_MEMCPY, kdst, ksrc);
+	bench_copy(COPY_TO_USER, kdst, ksrc);
+	bench_copy(COPY_FROM_USER, kdst, ksrc);
+
+	memset(from, TEST_GUARD, PAGE_SIZE);
+	pr_info("copy-test: %-14s %6lu bytes: %u MB/s\n", "copy_page",
+		PAGE_SIZE, bench_loop(PAGE_SIZE, copy_page(to, from)));
+
+	pr_info("copy-test: %-14s %6u bytes: %u MB/s\n", "csum+copy",
+		BENCH_PKT_LEN, bench_loop(BENCH_PKT_LEN,
+			csum_then_copy(udst, ksrc, BENCH_PKT_LEN, &err)));
+	pr_info("copy-test: %-14s %6u bytes: %u MB/s\n", "csum_copy",
+		BENCH_PKT_LEN, bench_loop(BENCH_PKT_LEN,
+			csum_partial_copy_to_user(ksrc, udst, BENCH_PKT_LEN,
+						  0, &err)));
+	if (err)
+		pr_warn("copy-test: checksum copy faulted\n");
+
+out:
+	free_page((unsigned long)to);
+	free_page((unsigned long)from);
+	vfree(kdst);
+	vfree(ksrc);
+	return ret;
+}
+
+static int __init copy_test_init(void)
+{
+	unsigned int i;
+	int ret = -ENOMEM;
+
+	kbuf_src = kmalloc(TEST_BUF_SIZE, GFP_KERNEL);
+	kbuf_dst = kmalloc(TEST_BUF_SIZE, GFP_KERNEL);
+	kbuf_chk = kmalloc(TEST_BUF_SIZE, GFP_KERNEL);
+	if (!kbuf_src || !kbuf_dst || !kbuf_chk)
+		goto out_free;
+
+	/* the user buffers live in the address space of insmod */
+	ubuf = vm_mmap(NULL, 0, PAGE_ALIGN(BENCH_BUF_SIZE),
+		       PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (IS_ERR_VALUE(ubuf)) {
+		ret = ubuf;
+		goto out_free;
+	}
+
+	for (i = 0; i < TEST_BUF_SIZE; i++)
+		kbuf_src[i] = test_pattern(i);
+
+	ret = test_copy(COPY_MEMCPY);
+	if (!ret)
+		ret = test_copy(COPY_TO_USER);
+	if (!ret)
+		ret = test_copy(COPY_FROM_USER);
+	if (!ret)
+		ret = test_fault();
+	if (!ret)
+		ret = test_copy_page();
+	if (!ret)
+		ret = test_csum();
+	if (ret) {
+		pr_err("copy-test: self test failed\n");
+		goto out_unmap;
+	}
+	pr_info("copy-test: self test passed\n");
+
+	if (bench_ms)
+		ret = run_bench();
+
+out_unmap:
+	vm_munmap(ubuf, PAGE_ALIGN(BENCH_BUF_SIZE));
+out_free:
+	kfree(kbuf_chk);
+	kfree(kbuf_dst);
+	kfree(kbuf_src);
+	return ret;
+}
+
+static void __exit copy_test_exit(void)
+{
+}
+
+module_init(copy_test_init);
+module_exit(copy_test_exit);
+MODULE_DESCRIPTION("ARM memory copy self test and benchmark");
+MODULE_LICENSE("GPL");
@@ -99,10 +99,31 @@ static cycle_t read_clk32k(struct clocksource *cs)
 	return read_CRTR();
 }
 
+/* Timekeeping runs from the slow clock while the counter is in use */
+static bool clk32k_in_use;
+
+static int clk32k_enable(struct clocksource *cs)
+{
+	clk32k_in_use = true;
+	return 0;
+}
+
+static void clk32k_disable(struct clocksource *cs)
+{
+	clk32k_in_use = false;
+}
+
+bool at91rm9200_clk32k_clocksource(void)
+{
+	return clk32k_in_use;
+}
+
 static struct clocksource clk32k = {
 	.name		= "32k_counter",
 	.rating		= 150,
 	.read		= read_clk32k,
+	.enable		= clk32k_enable,
+	.disable	= clk32k_disable,
 	.mask		= CLOCKSOURCE_MASK(20),
 	.flags		= CLOCK_SOURCE_IS_CONTINUOUS,
 };
@@ -1342,11 +1342,16 @@ static void __init at91_add_device_rtt(void)
 
 #if defined(CONFIG_HW_RANDOM_ATMEL) || defined(CONFIG_HW_RANDOM_ATMEL_MODULE)
 static struct resource trng_resources[] = {
-	{
+	[0] = {
 		.start	= AT91SAM9G45_BASE_TRNG,
 		.end	= AT91SAM9G45_BASE_TRNG + SZ_16K - 1,
 		.flags	= IORESOURCE_MEM,
 	},
+	[1] = {
+		.start	= NR_IRQS_LEGACY + AT91SAM9G45_ID_TRNG,
+		.end	= NR_IRQS_LEGACY + AT91SAM9G45_ID_TRNG,
+		.flags	= IORESOURCE_IRQ,
+	},
 };
 
 static struct platform_device at91sam9g45_trng_device = {
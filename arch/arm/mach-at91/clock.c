@@ -104,6 +104,10 @@ EXPORT_SYMBOL_GPL(at91_pmc_base);
 				|| cpu_is_at91sam9n12() \
 				|| cpu_is_sama5d3())
 
+/* PRES/MDIV trade-off at runtime, see cpu_clk_set_rate() */
+#define cpu_has_cpu_scaling()	(!(cpu_is_at91rm9200() \
+				|| cpu_is_at91sam9g20()))
+
 static LIST_HEAD(clocks);
 static DEFINE_SPINLOCK(clk_lock);
 
@@ -216,6 +220,14 @@ struct clk mck = {
 	.pmc_mask	= AT91_PMC_MCKRDY,	/* in PMC_SR */
 };
 
+/*
+ * The processor clock is the master clock source divided by the
+ * prescaler, MCK divides it further.  Only its rate is tracked here.
+ */
+static struct clk cpu_clk = {
+	.name		= "cpu",
+};
+
 static void pmc_periph_mode(struct clk *clk, int is_on)
 {
 	u32 regval = 0;
@@ -330,6 +342,154 @@ EXPORT_SYMBOL(clk_get_rate);
 
 /*------------------------------------------------------------------------*/
 
+/*
+ * CPU clock scaling.  The processor clock can be lowered by raising the
+ * prescaler (PRES) while lowering the master clock divider (MDIV) by the
+ * same factor: MCK, and so the timers, the SDRAM/DDR controller and every
+ * peripheral clock, keeps its rate.  The available rates thus depend on
+ * the MDIV the bootloader chose (e.g. 528/264/132 MHz with MDIV 4 on
+ * SAMA5D3, 198/99 MHz with MDIV 2 on SAM9260).
+ */
+
+static unsigned at91_mdiv_to_div(u32 mckr)
+{
+	switch (mckr & AT91_PMC_MDIV) {
+	case AT91SAM9_PMC_MDIV_1:
+		return 1;
+	case AT91SAM9_PMC_MDIV_2:
+		return 2;
+	case AT91SAM9_PMC_MDIV_4:
+		return 4;
+	default:
+		return cpu_has_mdiv3() ? 3 : 6;
+	}
+}
+
+/*
+ * Find the highest processor clock rate not above @rate (or the lowest
+ * one) keeping MCK unchanged, and the MCKR value giving it.
+ * Called with clk_lock held.
+ */
+static long __cpu_clk_round_rate(unsigned long rate, u32 *new_mckr)
+{
+	u32		mckr = at91_pmc_read(AT91_PMC_MCKR);
+	unsigned	total = pmc_prescaler_divider(mckr) * at91_mdiv_to_div(mckr);
+	unsigned	pres_offset, pres, mdiv;
+	u32		pres_mask;
+	long		actual = -ENOENT;
+
+	if (cpu_has_alt_prescaler()) {
+		pres_offset = PMC_ALT_PRES_OFFSET;
+		pres_mask = AT91_PMC_ALT_PRES;
+	} else {
+		pres_offset = PMC_PRES_OFFSET;
+		pres_mask = AT91_PMC_PRES;
+	}
+
+	/* PRES 1..64 and MDIV 1, 2 or 4: both are powers of two */
+	for (pres = 0; pres < 7; pres++) {
+		for (mdiv = 0; mdiv < 3; mdiv++) {
+			if ((1 << (pres + mdiv)) != total)
+				continue;
+
+			actual = mck.parent->rate_hz >> pres;
+			*new_mckr = (mckr & ~(pres_mask | AT91_PMC_MDIV))
+				| (pres << pres_offset) | (mdiv << 8);
+			if (actual <= rate)
+				return actual;
+		}
+	}
+
+	return actual;
+}
+
+static void at91_mck_wait_ready(void)
+{
+	while (!(at91_pmc_read(AT91_PMC_SR) & AT91_PMC_MCKRDY))
+		cpu_relax();
+}
+
+static long cpu_clk_round_rate(unsigned long rate)
+{
+	unsigned long	flags;
+	long		actual;
+	u32		mckr;
+
+	if (!cpu_has_cpu_scaling())
+		return -EINVAL;
+
+	spin_lock_irqsave(&clk_lock, flags);
+	actual = __cpu_clk_round_rate(rate, &mckr);
+	spin_unlock_irqrestore(&clk_lock, flags);
+
+	return actual;
+}
+
+static int cpu_clk_set_rate(unsigned long rate)
+{
+	unsigned long	flags;
+	long		actual;
+	u32		mckr, new_mckr;
+
+	if (!cpu_has_cpu_scaling())
+		return -EINVAL;
+
+	spin_lock_irqsave(&clk_lock, flags);
+
+	actual = __cpu_clk_round_rate(rate, &new_mckr);
+	if (actual < 0) {
+		spin_unlock_irqrestore(&clk_lock, flags);
+		return actual;
+	}
+
+	/*
+	 * Change one field at a time, waiting for MCKRDY in between, in the
+	 * order that keeps MCK at or below its rate and the CPU at or above
+	 * MCK: PRES first when slowing down, MDIV first when speeding up.
+	 */
+	mckr = at91_pmc_read(AT91_PMC_MCKR);
+	if (actual < cpu_clk.rate_hz)
+		mckr = (mckr & AT91_PMC_MDIV) | (new_mckr & ~AT91_PMC_MDIV);
+	else
+		mckr = (mckr & ~AT91_PMC_MDIV) | (new_mckr & AT91_PMC_MDIV);
+	at91_pmc_write(AT91_PMC_MCKR, mckr);
+	at91_mck_wait_ready();
+
+	at91_pmc_write(AT91_PMC_MCKR, new_mckr);
+	at91_mck_wait_ready();
+
+	cpu_clk.rate_hz = actual;
+
+	spin_unlock_irqrestore(&clk_lock, flags);
+	return 0;
+}
+
+long clk_round_rate(struct clk *clk, unsigned long rate)
+{
+	if (clk == &cpu_clk)
+		return cpu_clk_round_rate(rate);
+#ifdef CONFIG_AT91_PROGRAMMABLE_CLOCKS
+	if (clk_is_programmable(clk))
+		return pck_round_rate(clk, rate);
+#endif
+	return -EINVAL;
+}
+EXPORT_SYMBOL(clk_round_rate);
+
+int clk_set_rate(struct clk *clk, unsigned long rate)
+{
+	if (clk == &cpu_clk)
+		return cpu_clk_set_rate(rate);
+#ifdef CONFIG_AT91_PROGRAMMABLE_CLOCKS
+	if (clk_is_programmable(clk))
+		return pck_set_rate(clk, rate);
+#endif
+	return -EINVAL;
+}
+EXPORT_SYMBOL(clk_set_rate);
+
+/*------------------------------------------------------------------------*/
+
 #ifdef CONFIG_AT91_PROGRAMMABLE_CLOCKS
 
 /*
@@ -339,15 +499,13 @@ EXPORT_SYMBOL(clk_get_rate);
  * a better rate match; we don't.
  */
 
-long clk_round_rate(struct clk *clk, unsigned long rate)
+static long pck_round_rate(struct clk *clk, unsigned long rate)
 {
 	unsigned long	flags;
 	unsigned	prescale;
 	unsigned long	actual;
 	unsigned long	prev = ULONG_MAX;
 
-	if (!clk_is_programmable(clk))
-		return -EINVAL;
 	spin_lock_irqsave(&clk_lock, flags);
 
 	actual = clk->parent->rate_hz;
@@ -368,17 +526,14 @@ long clk_round_rate(struct clk *clk, unsigned long rate)
 	spin_unlock_irqrestore(&clk_lock, flags);
 	return (prescale < 7) ? actual : -ENOENT;
 }
-EXPORT_SYMBOL(clk_round_rate);
 
-int clk_set_rate(struct clk *clk, unsigned long rate)
+static int pck_set_rate(struct clk *clk, unsigned long rate)
 {
 	unsigned long	flags;
 	unsigned	prescale;
 	unsigned long	prescale_offset, css_mask;
 	unsigned long	actual;
 
-	if (!clk_is_programmable(clk))
-		return -EINVAL;
 	if (clk->users)
 		return -EBUSY;
 
@@ -410,7 +565,6 @@ int clk_set_rate(struct clk *clk, unsigned long rate)
 	spin_unlock_irqrestore(&clk_lock, flags);
 	return (prescale < 7) ? actual : -ENOENT;
 }
-EXPORT_SYMBOL(clk_set_rate);
 
 struct clk *clk_get_parent(struct clk *clk)
 {
@@ -830,6 +984,9 @@ static int __init at91_pmc_init(unsigned long main_clock)
 		mck.rate_hz = freq / (1 << ((mckr & AT91_PMC_MDIV) >> 8));		/* mdiv */
 	}
 
+	cpu_clk.parent = mck.parent;
+	cpu_clk.rate_hz = freq;
+
 	if (cpu_has_alt_prescaler()) {
 		/* Programmable clocks can use MCK */
 		mck.type |= CLK_TYPE_PRIMARY;
@@ -852,6 +1009,8 @@ static int __init at91_pmc_init(unsigned long main_clock)
 	if (cpu_has_utmi())
 		at91_clk_add(&utmi_clk);
 
+	at91_clk_add(&cpu_clk);
+
 	/* MCK and CPU clock are "always on" */
 	clk_enable(&mck);
 
@@ -7,32 +7,59 @@
  * License version 2.  This program is licensed "as is" without any
  * warranty of any kind, whether express or implied.
  *
- * The cpu idle uses wait-for-interrupt and RAM self refresh in order
- * to implement two idle states -
+ * The cpu idle uses wait-for-interrupt, RAM self refresh and slow clock
+ * mode in order to implement up to three idle states -
  * #1 wait-for-interrupt
  * #2 wait-for-interrupt and RAM self refresh
+ * #3 RAM self refresh with the master clock on clk32k, main oscillator
+ *    and PLLs off (CONFIG_AT91_CPUIDLE_SLOW_CLOCK)
  */
 
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/platform_device.h>
 #include <linux/cpuidle.h>
+#include <linux/clockchips.h>
+#include <linux/tick.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/io.h>
 #include <linux/export.h>
 #include <asm/proc-fns.h>
 #include <asm/cpuidle.h>
 #include <mach/cpu.h>
+#include <mach/at91_pmc.h>
 
+#include "generic.h"
 #include "pm.h"
 
+#define AT91_STATE_RAM_SR	1
+#define AT91_STATE_SLOW_CLK	2
+
+#ifdef CONFIG_AT91_CPUIDLE_SLOW_CLOCK
+#define AT91_MAX_STATES	3
+#else
 #define AT91_MAX_STATES	2
+#endif
 
 static DEFINE_PER_CPU(struct cpuidle_device, at91_cpuidle_device);
 
-/* Actual code that puts the SoC in different idle states */
-static int at91_enter_idle(struct cpuidle_device *dev,
-			struct cpuidle_driver *drv,
-			       int index)
+/*
+ * Wakeup statistics of the states handled here. A wakeup is accounted
+ * as a timer one when the tick device event was due, its latency is
+ * how late after that event the CPU got back from the idle state.
+ */
+struct at91_idle_stats {
+	unsigned long	timer_wakeups;
+	u64		latency_ns;		/* sum over timer wakeups */
+	u64		max_latency_ns;
+	unsigned long	demoted;		/* fell back to a lighter state */
+};
+
+static struct at91_idle_stats at91_idle_stats[AT91_MAX_STATES];
+
+static void at91_ram_standby(void)
 {
 	if (cpu_is_at91rm9200())
 		at91rm9200_standby();
@@ -44,6 +71,88 @@ static int at91_enter_idle(struct cpuidle_device *dev,
 		at91sam_ddr_standby(1);
 	else
 		at91sam9_standby();
+}
+
+#ifdef CONFIG_AT91_CPUIDLE_SLOW_CLOCK
+/*
+ * Slow clock mode stops everything clocked from the main oscillator,
+ * including the tick device and the clocksource unless they run from
+ * clk32k: only go there when both do and the next event is far enough.
+ * The peripheral clocks are checked by at91_pm_slow_clock_idle().
+ */
+static bool at91_slow_clock_allowed(struct cpuidle_driver *drv,
+				    struct clock_event_device *evt)
+{
+	u64 rate;
+	s64 sleep_us;
+
+	if (!evt || !at91rm9200_clk32k_clocksource())
+		return false;
+
+	rate = ((u64)evt->mult * NSEC_PER_SEC) >> evt->shift;
+	if (rate > 32768)
+		return false;
+
+	if (evt->mode != CLOCK_EVT_MODE_ONESHOT)
+		return true;
+
+	sleep_us = ktime_us_delta(evt->next_event, ktime_get());
+
+	return sleep_us >= drv->states[AT91_STATE_SLOW_CLK].target_residency;
+}
+
+static int at91_slow_clock_standby(struct cpuidle_driver *drv,
+				   struct clock_event_device *evt)
+{
+	if (at91_slow_clock_allowed(drv, evt) && !at91_pm_slow_clock_idle())
+		return AT91_STATE_SLOW_CLK;
+
+	at91_idle_stats[AT91_STATE_SLOW_CLK].demoted++;
+	at91_ram_standby();
+
+	return AT91_STATE_RAM_SR;
+}
+#else
+static inline int at91_slow_clock_standby(struct cpuidle_driver *drv,
+					  struct clock_event_device *evt)
+{
+	at91_ram_standby();
+
+	return AT91_STATE_RAM_SR;
+}
+#endif
+
+static void at91_idle_account(struct clock_event_device *evt, int index)
+{
+	struct at91_idle_stats *stats = &at91_idle_stats[index];
+	s64 late;
+
+	if (!evt || evt->mode != CLOCK_EVT_MODE_ONESHOT)
+		return;
+
+	late = ktime_to_ns(ktime_sub(ktime_get(), evt->next_event));
+	if (late < 0)
+		return;
+
+	stats->timer_wakeups++;
+	stats->latency_ns += late;
+	if (late > stats->max_latency_ns)
+		stats->max_latency_ns = late;
+}
+
+/* Actual code that puts the SoC in different idle states */
+static int at91_enter_idle(struct cpuidle_device *dev,
+			struct cpuidle_driver *drv,
+			       int index)
+{
+	struct clock_event_device *evt = tick_get_device(dev->cpu)->evtdev;
+
+	if (index == AT91_STATE_SLOW_CLK)
+		index = at91_slow_clock_standby(drv, evt);
+	else
+		at91_ram_standby();
+
+	at91_idle_account(evt, index);
 
 	return index;
 }
@@ -55,29 +164,150 @@ static struct cpuidle_driver at91_idle_driver = {
 	.states[0]		= ARM_CPUIDLE_WFI_STATE,
 	.states[1]		= {
 		.enter			= at91_enter_idle,
-		.exit_latency		= 10,
-		.target_residency	= 100000,
 		.flags			= CPUIDLE_FLAG_TIME_VALID,
 		.name			= "RAM_SR",
 		.desc			= "WFI and DDR Self Refresh",
 	},
+#ifdef CONFIG_AT91_CPUIDLE_SLOW_CLOCK
+	.states[2]		= {
+		.enter			= at91_enter_idle,
+		.flags			= CPUIDLE_FLAG_TIME_VALID,
+		.name			= "SLOW_CLK",
+		.desc			= "Slow clock mode and DDR Self Refresh",
+	},
+#endif
 	.state_count = AT91_MAX_STATES,
 };
 
+/*
+ * Wakeup latency of WFI with the RAM in self refresh, in usecs. It is
+ * dominated by the self refresh exit: a few clocks for the SDRAM
+ * controllers, 200 clocks (tXSRD) for DDR2 before the first access.
+ */
+static unsigned int __init at91_ram_sr_latency(void)
+{
+	if (cpu_is_at91rm9200())
+		return 2;
+	else if (cpu_is_at91sam9g45()
+		|| cpu_is_at91sam9x5()
+		|| cpu_is_at91sam9n12()
+		|| cpu_is_sama5d3())
+		return 5;
+	else
+		return 3;
+}
+
+/*
+ * Leaving slow clock mode waits for the main oscillator start-up time
+ * (OSCOUNT x 8 slow clock cycles) and the PLLA lock time (PLLCOUNT slow
+ * clock cycles) as programmed by the bootloader, then for the master
+ * clock to be ready again.
+ */
+static unsigned int __init at91_slow_clock_latency(void)
+{
+	u32 mor = at91_pmc_read(AT91_CKGR_MOR);
+	u32 pllar = at91_pmc_read(AT91_CKGR_PLLAR);
+	unsigned long cycles;
+
+	cycles = ((mor & AT91_PMC_OSCOUNT) >> 8) * 8
+		+ ((pllar & AT91_PMC_PLLCOUNT) >> 8);
+
+	return DIV_ROUND_UP(cycles * USEC_PER_SEC, 32768)
+		+ at91_ram_sr_latency() + 100;
+}
+
+static void __init at91_set_latencies(void)
+{
+	struct cpuidle_state *state;
+
+	state = &at91_idle_driver.states[AT91_STATE_RAM_SR];
+	state->exit_latency = at91_ram_sr_latency();
+	state->target_residency = 10 * state->exit_latency;
+
+#ifdef CONFIG_AT91_CPUIDLE_SLOW_CLOCK
+	state = &at91_idle_driver.states[AT91_STATE_SLOW_CLK];
+	state->exit_latency = at91_slow_clock_latency();
+	state->target_residency = 4 * state->exit_latency;
+#endif
+}
+
+#ifdef CONFIG_DEBUG_FS
+
+static int at91_cpuidle_show(struct seq_file *s, void *unused)
+{
+	struct cpuidle_device *device = &per_cpu(at91_cpuidle_device, 0);
+	int i;
+
+	seq_printf(s, "%-10s %8s %8s %12s %10s %10s %10s %8s\n",
+		   "state", "latency", "resid.", "usage", "time(ms)",
+		   "timer", "avg(us)", "max(us)");
+
+	for (i = 0; i < AT91_MAX_STATES; i++) {
+		struct cpuidle_state *state = &at91_idle_driver.states[i];
+		struct cpuidle_state_usage *usage = &device->states_usage[i];
+		struct at91_idle_stats *stats = &at91_idle_stats[i];
+		u64 avg = 0;
+
+		if (stats->timer_wakeups)
+			avg = div_u64(stats->latency_ns, stats->timer_wakeups);
+
+		seq_printf(s, "%-10s %8u %8u %12llu %10llu %10lu %10llu %8llu",
+			   state->name, state->exit_latency,
+			   state->target_residency, usage->usage,
+			   div_u64(usage->time, 1000), stats->timer_wakeups,
+			   div_u64(avg, NSEC_PER_USEC),
+			   div_u64(stats->max_latency_ns, NSEC_PER_USEC));
+		if (stats->demoted)
+			seq_printf(s, "  (demoted %lu)", stats->demoted);
+		seq_printf(s, "\n");
+	}
+
+	return 0;
+}
+
+static int at91_cpuidle_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, at91_cpuidle_show, NULL);
+}
+
+static const struct file_operations at91_cpuidle_operations = {
+	.open		= at91_cpuidle_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init at91_cpuidle_debugfs_init(void)
+{
+	/* /sys/kernel/debug/at91_cpuidle */
+	(void) debugfs_create_file("at91_cpuidle", S_IFREG | S_IRUGO,
+				   NULL, NULL, &at91_cpuidle_operations);
+}
+
+#else
+
+static inline void at91_cpuidle_debugfs_init(void) {}
+
+#endif
+
 /* Initialize CPU idle by registering the idle states */
-static int at91_init_cpuidle(void)
+static int __init at91_init_cpuidle(void)
 {
 	struct cpuidle_device *device;
 
 	device = &per_cpu(at91_cpuidle_device, smp_processor_id());
 	device->state_count = AT91_MAX_STATES;
 
+	at91_set_latencies();
 	cpuidle_register_driver(&at91_idle_driver);
 
 	if (cpuidle_register_device(device)) {
 		printk(KERN_ERR "at91_init_cpuidle: Failed registering\n");
 		return -EIO;
 	}
+
+	at91_cpuidle_debugfs_init();
+
 	return 0;
 }
 
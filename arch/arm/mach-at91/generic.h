@@ -41,6 +41,11 @@ extern struct sys_timer at91rm9200_timer;
 extern void at91sam926x_ioremap_pit(u32 addr);
 extern struct sys_timer at91sam926x_timer;
 extern struct sys_timer at91x40_timer;
+#ifdef CONFIG_SOC_AT91RM9200
+extern bool at91rm9200_clk32k_clocksource(void);
+#else
+static inline bool at91rm9200_clk32k_clocksource(void) { return false; }
+#endif
 
  /* Clocks */
 #ifdef CONFIG_AT91_PMC_UNIT
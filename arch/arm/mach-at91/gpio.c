@@ -42,6 +42,10 @@ struct at91_gpio_chip {
 	void __iomem		*regbase;	/* PIO bank virtual address */
 	struct clk		*clock;		/* associated clock */
 	struct irq_domain	*domain;	/* associated irq domain */
+	struct irq_desc		*pin_desc[MAX_NB_GPIO_PER_BANK]; /* pin irqs */
+	u32			bulk_mask;	/* pins delivered as a bitmap */
+	u32			bulk_pending;	/* bulk events not yet fetched */
+	unsigned int		bulk_irq;	/* pin irq raised for bulk events */
 };
 
 #define to_at91_gpio_chip(c) container_of(c, struct at91_gpio_chip, chip)
@@ -489,6 +493,19 @@ void at91_gpio_resume(void)
 #define gpio_irq_set_wake	NULL
 #endif
 
+/* Peripheral clocks of the PIO controllers, for PCSR */
+u32 at91_gpio_periph_mask(void)
+{
+	u32 mask = 0;
+	int i;
+
+	for (i = 0; i < gpio_banks; i++)
+		if (gpio_chip[i].pioc_hwirq < 32)
+			mask |= 1 << gpio_chip[i].pioc_hwirq;
+
+	return mask;
+}
+
 
 /* Several AIC controller irqs are dispatched through this GPIO handler.
  * To use any AT91_PIN_* as an externally triggered IRQ, first call
@@ -587,14 +604,42 @@ static struct irq_chip gpio_irqchip = {
 	.irq_set_wake	= gpio_irq_set_wake,
 };
 
+/*
+ * Dispatch all the pending pins of a bank latched by one ISR read,
+ * highest pin first. Pins in bulk mode don't get their own irq: they
+ * are accumulated into bulk_pending and the bulk irq is raised once
+ * for all of them, see at91_gpio_irq_set_bulk().
+ */
+static void gpio_irq_dispatch(struct at91_gpio_chip *at91_gpio, u32 isr)
+{
+	u32	bulk = isr & at91_gpio->bulk_mask;
+	int	n;
+
+	if (bulk) {
+		at91_gpio->bulk_pending |= bulk;
+		generic_handle_irq(at91_gpio->bulk_irq);
+		isr &= ~bulk;
+	}
+
+	while (isr) {
+		struct irq_desc *desc;
+
+		n = __fls(isr);
+		isr &= ~BIT(n);
+
+		desc = at91_gpio->pin_desc[n];
+		if (likely(desc))
+			generic_handle_irq_desc(desc->irq_data.irq, desc);
+	}
+}
+
 static void gpio_irq_handler(unsigned irq, struct irq_desc *desc)
 {
 	struct irq_chip *chip = irq_desc_get_chip(desc);
 	struct irq_data *idata = irq_desc_get_irq_data(desc);
 	struct at91_gpio_chip *at91_gpio = irq_data_get_irq_chip_data(idata);
 	void __iomem	*pio = at91_gpio->regbase;
-	unsigned long	isr;
-	int		n;
+	u32		isr;
 
 	chained_irq_enter(chip, desc);
 	for (;;) {
@@ -611,16 +656,71 @@ static void gpio_irq_handler(unsigned irq, struct irq_desc *desc)
 			continue;
 		}
 
-		n = find_first_bit(&isr, BITS_PER_LONG);
-		while (n < BITS_PER_LONG) {
-			generic_handle_irq(irq_find_mapping(at91_gpio->domain, n));
-			n = find_next_bit(&isr, BITS_PER_LONG, n + 1);
-		}
+		gpio_irq_dispatch(at91_gpio, isr);
 	}
 	chained_irq_exit(chip, desc);
 	/* now it may re-trigger */
 }
 
+/**
+ * at91_gpio_irq_set_bulk - deliver a set of pins as one bitmap
+ * @irq: irq of one pin of the bank, raised for all the pins of @mask
+ * @mask: pins of the bank in bulk mode, must include the @irq pin;
+ *	0 leaves bulk mode
+ *
+ * Meant for consumers watching many lines of a bank (encoders,
+ * counters): instead of one handler call per pin, the edges of the
+ * whole batch are latched and @irq is raised once. Its handler, usually
+ * a threaded one, fetches them with at91_gpio_irq_get_bulk(). The
+ * pins of @mask other than the @irq one are enabled here; their trigger
+ * type is the one already configured.
+ */
+int at91_gpio_irq_set_bulk(unsigned irq, u32 mask)
+{
+	struct irq_data		*d = irq_get_irq_data(irq);
+	struct at91_gpio_chip	*at91_gpio;
+	unsigned long		flags;
+	u32			pin;
+
+	/* pins of DT boards are handled by the pinctrl driver */
+	if (!d || d->chip != &gpio_irqchip)
+		return at91_pinctrl_gpio_irq_set_bulk(irq, mask);
+
+	at91_gpio = irq_data_get_irq_chip_data(d);
+	pin = BIT(d->hwirq);
+	if (mask && !(mask & pin))
+		return -EINVAL;
+
+	local_irq_save(flags);
+	__raw_writel(at91_gpio->bulk_mask & ~mask & ~pin,
+		     at91_gpio->regbase + PIO_IDR);
+	at91_gpio->bulk_mask = mask;
+	at91_gpio->bulk_irq = irq;
+	at91_gpio->bulk_pending = 0;
+	__raw_writel(mask & ~pin, at91_gpio->regbase + PIO_IER);
+	local_irq_restore(flags);
+
+	return 0;
+}
+EXPORT_SYMBOL(at91_gpio_irq_set_bulk);
+
+/**
+ * at91_gpio_irq_get_bulk - fetch and clear the latched bulk events
+ * @irq: the irq passed to at91_gpio_irq_set_bulk()
+ *
+ * Returns the bitmap of the pins that triggered since the last call.
+ */
+u32 at91_gpio_irq_get_bulk(unsigned irq)
+{
+	struct at91_gpio_chip *at91_gpio = irq_get_chip_data(irq);
+
+	if (irq_get_chip(irq) != &gpio_irqchip)
+		return at91_pinctrl_gpio_irq_get_bulk(irq);
+
+	return xchg(&at91_gpio->bulk_pending, 0);
+}
+EXPORT_SYMBOL(at91_gpio_irq_get_bulk);
+
 /*--------------------------------------------------------------------------*/
 
 #ifdef CONFIG_DEBUG_FS
@@ -771,6 +871,7 @@ void __init at91_gpio_irq_setup(void)
 						 handle_simple_irq);
 			set_irq_flags(virq, IRQF_VALID);
 			irq_set_chip_data(virq, this);
+			this->pin_desc[offset] = irq_to_desc(virq);
 
 			gpio_irqnbr++;
 		}
@@ -41,10 +41,44 @@ struct sam9_smc_config {
 	u8 tdf_cycles:4;
 };
 
+/*
+ * Device timings, in nanoseconds, from which sam9_smc_timings_to_config()
+ * computes the register values at a given MCK rate.  Each cycle is made
+ * long enough for the setup and pulse of both strobes.
+ */
+struct sam9_smc_timings {
+	/* Read access */
+	u16 ncs_read_setup;
+	u16 nrd_setup;
+	u16 ncs_read_pulse;
+	u16 nrd_pulse;
+	u16 read_cycle;
+
+	/* Write access */
+	u16 ncs_write_setup;
+	u16 nwe_setup;
+	u16 ncs_write_pulse;
+	u16 nwe_pulse;
+	u16 write_cycle;
+
+	/* Data float time */
+	u16 tdf;
+
+	/* Page mode reads: page size in bytes (4 to 32, 0 to disable) */
+	u8 page_size;
+	u16 page_access;
+};
+
 extern void sam9_smc_configure(int id, int cs, struct sam9_smc_config *config);
 extern void sam9_smc_read(int id, int cs, struct sam9_smc_config *config);
 extern void sam9_smc_read_mode(int id, int cs, struct sam9_smc_config *config);
 extern void sam9_smc_write_mode(int id, int cs, struct sam9_smc_config *config);
+extern int sam9_smc_timings_to_config(const struct sam9_smc_timings *timings,
+				      unsigned long mck_hz,
+				      struct sam9_smc_config *config);
+extern int sam9_smc_configure_timings(int id, int cs,
+				      const struct sam9_smc_timings *timings,
+				      u32 mode);
 #endif
 
 #define AT91_SMC_SETUP		0x00				/* Setup Register for CS n */
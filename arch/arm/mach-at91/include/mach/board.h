@@ -189,6 +189,9 @@ struct at91_tsadcc_data {
 	u8		pendet_debounce;
 	u8		pendet_sensitivity;
 	u8		ts_sample_hold_time;
+	u8		filtering_median;	/* samples per report */
+	unsigned int	report_rate;		/* reports per second */
+	unsigned int	pressure_threshold;	/* higher values are dropped */
 };
 extern void __init at91_add_device_tsadcc(struct at91_tsadcc_data *data);
 
@@ -14,6 +14,7 @@
 #define __ASM_ARCH_AT91RM9200_GPIO_H
 
 #include <linux/kernel.h>
+#include <linux/errno.h>
 #include <asm/irq.h>
 
 #define MAX_GPIO_BANKS		5
@@ -205,16 +206,37 @@ extern int __init_or_module at91_disable_schmitt_trig(unsigned pin);
 extern int at91_set_gpio_value(unsigned pin, int value);
 extern int at91_get_gpio_value(unsigned pin);
 
+/* bank level delivery of many pin interrupts as one bitmap */
+extern int at91_gpio_irq_set_bulk(unsigned irq, u32 mask);
+extern u32 at91_gpio_irq_get_bulk(unsigned irq);
+
 /* callable only from core power-management code */
 extern void at91_gpio_suspend(void);
 extern void at91_gpio_resume(void);
+extern u32 at91_gpio_periph_mask(void);
 
 #ifdef CONFIG_PINCTRL_AT91
 void at91_pinctrl_gpio_suspend(void);
 void at91_pinctrl_gpio_resume(void);
+u32 at91_pinctrl_gpio_periph_mask(void);
 #else
 static inline void at91_pinctrl_gpio_suspend(void) {}
 static inline void at91_pinctrl_gpio_resume(void) {}
+static inline u32 at91_pinctrl_gpio_periph_mask(void) { return 0; }
+#endif
+
+#ifdef CONFIG_PINCTRL_AT91
+int at91_pinctrl_gpio_irq_set_bulk(unsigned irq, u32 mask);
+u32 at91_pinctrl_gpio_irq_get_bulk(unsigned irq);
+#else
+static inline int at91_pinctrl_gpio_irq_set_bulk(unsigned irq, u32 mask)
+{
+	return -EINVAL;
+}
+static inline u32 at91_pinctrl_gpio_irq_get_bulk(unsigned irq)
+{
+	return 0;
+}
 #endif
 
 #endif	/* __ASSEMBLY__ */
@@ -32,6 +32,10 @@
 #include <linux/irqdomain.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hardirq.h>
+#include <linux/sched.h>
 
 #include <mach/hardware.h>
 #include <asm/irq.h>
@@ -54,6 +58,13 @@ static unsigned long at91_aic_caps = 0;
 #define AT91_AIC_CAP_AIC5	(1 << 0)
 #define has_aic5()		(at91_aic_caps & AT91_AIC_CAP_AIC5)
 
+/*
+ * The Source Vector Registers hold the hardware irq number, so the IVR
+ * value read on entry directly indexes this table. Any value >= n_irqs
+ * (the spurious vector is n_irqs) has no descriptor.
+ */
+static struct irq_desc *at91_aic_vectors[NR_AIC5_IRQS] __read_mostly;
+
 #ifdef CONFIG_PM
 
 static unsigned long *wakeups;
@@ -154,38 +165,177 @@ static inline int at91_aic_pm_init(void)
 
 #endif /* CONFIG_PM */
 
-asmlinkage void __exception_irq_entry
-at91_aic_handle_irq(struct pt_regs *regs)
+#ifdef CONFIG_AT91_AIC_LATENCY_HIST
+
+/*
+ * Per source histogram of the time spent from the IVR read to the
+ * return of the flow handler. Bucket 0 counts handlers shorter than
+ * 1 usec, bucket n those in [2^(n-1), 2^n) usec, the last one collects
+ * everything longer.
+ */
+#define AT91_AIC_HIST_BUCKETS	16
+
+static u32 (*at91_aic_hist)[AT91_AIC_HIST_BUCKETS];
+static u64 *at91_aic_hist_max;
+
+static inline u64 at91_aic_latency_start(void)
 {
-	u32 irqnr;
-	u32 irqstat;
+	return at91_aic_hist ? sched_clock() : 0;
+}
 
-	irqnr = at91_aic_read(AT91_AIC_IVR);
-	irqstat = at91_aic_read(AT91_AIC_ISR);
+static inline void at91_aic_latency_end(u32 hwirq, u64 start)
+{
+	u64 delta;
+	int bucket;
 
-	/*
-	 * ISR value is 0 when there is no current interrupt or when there is
-	 * a spurious interrupt
-	 */
-	if (!irqstat)
-		at91_aic_write(AT91_AIC_EOICR, 0);
-	else
-		handle_IRQ(irqnr, regs);
+	if (!at91_aic_hist)
+		return;
+
+	/* ~usec resolution is enough, avoid a 64-bit division */
+	delta = sched_clock() - start;
+	bucket = fls64(delta >> 10);
+	if (bucket >= AT91_AIC_HIST_BUCKETS)
+		bucket = AT91_AIC_HIST_BUCKETS - 1;
+
+	at91_aic_hist[hwirq][bucket]++;
+	if (delta > at91_aic_hist_max[hwirq])
+		at91_aic_hist_max[hwirq] = delta;
 }
 
-asmlinkage void __exception_irq_entry
-at91_aic5_handle_irq(struct pt_regs *regs)
+static int at91_aic_latency_show(struct seq_file *s, void *unused)
 {
-	u32 irqnr;
-	u32 irqstat;
+	unsigned int hwirq;
+	int i;
 
-	irqnr = at91_aic_read(AT91_AIC5_IVR);
-	irqstat = at91_aic_read(AT91_AIC5_ISR);
+	seq_printf(s, "%-5s %-5s %8s", "hwirq", "irq", "<1us");
+	for (i = 1; i < AT91_AIC_HIST_BUCKETS - 1; i++)
+		seq_printf(s, " %7u%s", 1 << (i - 1), "+");
+	seq_printf(s, " %7u%s %8s\n", 1 << (i - 1), "+", "max(ns)");
 
-	if (!irqstat)
-		at91_aic_write(AT91_AIC5_EOICR, 0);
-	else
-		handle_IRQ(irqnr, regs);
+	for (hwirq = 0; hwirq < n_irqs; hwirq++) {
+		struct irq_desc *desc = at91_aic_vectors[hwirq];
+
+		if (!desc || !at91_aic_hist_max[hwirq])
+			continue;
+
+		seq_printf(s, "%-5u %-5u", hwirq, desc->irq_data.irq);
+		for (i = 0; i < AT91_AIC_HIST_BUCKETS; i++)
+			seq_printf(s, " %8u", at91_aic_hist[hwirq][i]);
+		seq_printf(s, " %8llu\n", at91_aic_hist_max[hwirq]);
+	}
+
+	return 0;
+}
+
+static int at91_aic_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, at91_aic_latency_show, NULL);
+}
+
+/* any write clears the statistics */
+static ssize_t at91_aic_latency_write(struct file *file,
+				      const char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	memset(at91_aic_hist, 0, n_irqs * sizeof(*at91_aic_hist));
+	memset(at91_aic_hist_max, 0, n_irqs * sizeof(*at91_aic_hist_max));
+	local_irq_restore(flags);
+
+	return count;
+}
+
+static const struct file_operations at91_aic_latency_operations = {
+	.open		= at91_aic_latency_open,
+	.read		= seq_read,
+	.write		= at91_aic_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init at91_aic_latency_init(void)
+{
+	u32 (*hist)[AT91_AIC_HIST_BUCKETS];
+
+	if (!at91_aic_base)
+		return 0;
+
+	hist = kcalloc(n_irqs, sizeof(*hist), GFP_KERNEL);
+	at91_aic_hist_max = kcalloc(n_irqs, sizeof(*at91_aic_hist_max),
+				    GFP_KERNEL);
+	if (!hist || !at91_aic_hist_max) {
+		kfree(hist);
+		kfree(at91_aic_hist_max);
+		return -ENOMEM;
+	}
+
+	/* /sys/kernel/debug/at91_aic_latency */
+	(void) debugfs_create_file("at91_aic_latency", S_IFREG | S_IRUGO | S_IWUSR,
+				   NULL, NULL, &at91_aic_latency_operations);
+
+	/* publish last: the dispatcher starts sampling from now on */
+	smp_wmb();
+	at91_aic_hist = hist;
+
+	return 0;
+}
+late_initcall(at91_aic_latency_init);
+
+#else
+
+static inline u64 at91_aic_latency_start(void)
+{
+	return 0;
+}
+
+static inline void at91_aic_latency_end(u32 hwirq, u64 start)
+{
+}
+
+#endif /* CONFIG_AT91_AIC_LATENCY_HIST */
+
+/*
+ * Vectored dispatch: a single IVR read both acknowledges the interrupt
+ * and gives the table index of its descriptor, whose flow handler is
+ * called directly without the irq number to descriptor lookup.
+ */
+static inline void at91_aic_dispatch(u32 hwirq, struct pt_regs *regs,
+				     unsigned int eoicr)
+{
+	struct pt_regs *old_regs;
+	struct irq_desc *desc;
+	u64 start;
+
+	if (unlikely(hwirq >= n_irqs) || unlikely(!at91_aic_vectors[hwirq])) {
+		/* spurious interrupt: just acknowledge it */
+		at91_aic_write(eoicr, 0);
+		return;
+	}
+	desc = at91_aic_vectors[hwirq];
+
+	old_regs = set_irq_regs(regs);
+	irq_enter();
+
+	start = at91_aic_latency_start();
+	generic_handle_irq_desc(desc->irq_data.irq, desc);
+	at91_aic_latency_end(hwirq, start);
+
+	irq_exit();
+	set_irq_regs(old_regs);
+}
+
+asmlinkage void __exception_irq_entry
+at91_aic_handle_irq(struct pt_regs *regs)
+{
+	at91_aic_dispatch(at91_aic_read(AT91_AIC_IVR), regs, AT91_AIC_EOICR);
+}
+
+asmlinkage void __exception_irq_entry
+at91_aic5_handle_irq(struct pt_regs *regs)
+{
+	at91_aic_dispatch(at91_aic_read(AT91_AIC5_IVR), regs, AT91_AIC5_EOICR);
 }
 
 static void at91_aic_mask_irq(struct irq_data *d)
@@ -363,8 +513,9 @@ static unsigned int *at91_aic_irq_priorities;
 static int at91_aic_irq_map(struct irq_domain *h, unsigned int virq,
 							irq_hw_number_t hw)
 {
-	/* Put virq number in Source Vector Register */
-	at91_aic_write(AT91_AIC_SVR(hw), virq);
+	/* Put hardware irq number in Source Vector Register */
+	at91_aic_write(AT91_AIC_SVR(hw), hw);
+	at91_aic_vectors[hw] = irq_to_desc(virq);
 
 	/* Active Low interrupt, with priority */
 	at91_aic_write(AT91_AIC_SMR(hw),
@@ -381,8 +532,9 @@ static int at91_aic5_irq_map(struct irq_domain *h, unsigned int virq,
 {
 	at91_aic_write(AT91_AIC5_SSR, hw & AT91_AIC5_INTSEL_MSK);
 
-	/* Put virq number in Source Vector Register */
-	at91_aic_write(AT91_AIC5_SVR, virq);
+	/* Put hardware irq number in Source Vector Register */
+	at91_aic_write(AT91_AIC5_SVR, hw);
+	at91_aic_vectors[hw] = irq_to_desc(virq);
 
 	/* Active Low interrupt, with priority */
 	at91_aic_write(AT91_AIC5_SMR,
@@ -535,12 +687,13 @@ void __init at91_aic_init(unsigned int *priority, unsigned int ext_irq_mask)
 	irq_set_default_host(at91_aic_domain);
 
 	/*
-	 * The IVR is used by macro get_irqnr_and_base to read and verify.
-	 * The irq number is NR_AIC_IRQS when a spurious interrupt has occurred.
+	 * The IVR is used by at91_aic_handle_irq() to index at91_aic_vectors.
+	 * The vector is NR_AIC_IRQS when a spurious interrupt has occurred.
 	 */
 	for (i = 0; i < n_irqs; i++) {
 		/* Put hardware irq number in Source Vector Register: */
-		at91_aic_write(AT91_AIC_SVR(i), NR_IRQS_LEGACY + i);
+		at91_aic_write(AT91_AIC_SVR(i), i);
+		at91_aic_vectors[i] = irq_to_desc(NR_IRQS_LEGACY + i);
 		/* Active Low interrupt, with the specified priority */
 		at91_aic_write(AT91_AIC_SMR(i), AT91_AIC_SRCTYPE_LOW | priority[i]);
 		irq_set_chip_and_handler(NR_IRQS_LEGACY + i, &at91_aic_chip, handle_fasteoi_irq);
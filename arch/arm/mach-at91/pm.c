@@ -132,7 +132,7 @@ static int at91_pm_begin(suspend_state_t state)
  * Verify that all the clocks are correct before entering
  * slow-clock mode.
  */
-static int at91_pm_verify_clocks(void)
+static int at91_pm_verify_clocks(bool verbose)
 {
 	unsigned long scsr;
 	int i;
@@ -142,13 +142,15 @@ static int at91_pm_verify_clocks(void)
 	/* USB must not be using PLLB */
 	if (cpu_is_at91rm9200()) {
 		if ((scsr & (AT91RM9200_PMC_UHP | AT91RM9200_PMC_UDP)) != 0) {
-			pr_err("AT91: PM - Suspend-to-RAM with USB still active\n");
+			if (verbose)
+				pr_err("AT91: PM - Suspend-to-RAM with USB still active\n");
 			return 0;
 		}
 	} else if (cpu_is_at91sam9260() || cpu_is_at91sam9261() || cpu_is_at91sam9263()
 			|| cpu_is_at91sam9g20() || cpu_is_at91sam9g10()) {
 		if ((scsr & (AT91SAM926x_PMC_UHP | AT91SAM926x_PMC_UDP)) != 0) {
-			pr_err("AT91: PM - Suspend-to-RAM with USB still active\n");
+			if (verbose)
+				pr_err("AT91: PM - Suspend-to-RAM with USB still active\n");
 			return 0;
 		}
 	}
@@ -163,7 +165,8 @@ static int at91_pm_verify_clocks(void)
 
 		css = at91_pmc_read(AT91_PMC_PCKR(i)) & AT91_PMC_CSS;
 		if (css != AT91_PMC_CSS_SLOW) {
-			pr_err("AT91: PM - Suspend-to-RAM with PCK%d src %d\n", i, css);
+			if (verbose)
+				pr_err("AT91: PM - Suspend-to-RAM with PCK%d src %d\n", i, css);
 			return 0;
 		}
 	}
@@ -198,6 +201,61 @@ extern void at91_slow_clock(void __iomem *pmc, void __iomem *ramc0,
 extern u32 at91_slow_clock_sz;
 #endif
 
+static int at91_pm_memctrl(void)
+{
+	if (cpu_is_at91rm9200())
+		return AT91_MEMCTRL_MC;
+	else if (cpu_is_at91sam9g45()
+		|| cpu_is_at91sam9x5()
+		|| cpu_is_at91sam9n12()
+		|| cpu_is_sama5d3())
+		return AT91_MEMCTRL_DDRSDR;
+
+	return AT91_MEMCTRL_SDRAMC;
+}
+
+#ifdef CONFIG_AT91_SLOW_CLOCK
+/*
+ * With the master clock on clk32k, peripherals clocked from it would
+ * lose data or stall; only the PIO controllers, which provide wakeup
+ * interrupts, may have their clock enabled.
+ */
+static int at91_pm_periph_clocks_idle(void)
+{
+	u32 pcsr = at91_pmc_read(AT91_PMC_PCSR);
+
+	if (of_have_populated_dt())
+		pcsr &= ~at91_pinctrl_gpio_periph_mask();
+	else
+		pcsr &= ~at91_gpio_periph_mask();
+
+	if (pcsr)
+		return 0;
+	if (cpu_is_sama5d3() && at91_pmc_read(AT91_PMC_PCSR1))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Slow clock mode for cpuidle: unlike Suspend-to-RAM the drivers are
+ * still running, so it is refused whenever a clock that can't run from
+ * clk32k is in use. The handler was copied to SRAM at init time.
+ * Returns 0 after a slow clock mode sleep.
+ */
+int at91_pm_slow_clock_idle(void)
+{
+	if (!slow_clock || !at91_pm_verify_clocks(false)
+	    || !at91_pm_periph_clocks_idle())
+		return -EBUSY;
+
+	slow_clock(at91_pmc_base, at91_ramc_base[0],
+		   at91_ramc_base[1], at91_pm_memctrl());
+
+	return 0;
+}
+#endif
+
 static int at91_pm_enter(suspend_state_t state)
 {
 	if (of_have_populated_dt())
@@ -225,7 +283,7 @@ static int at91_pm_enter(suspend_state_t state)
 			/*
 			 * Ensure that clocks are in a valid state.
 			 */
-			if (!at91_pm_verify_clocks())
+			if (!at91_pm_verify_clocks(true))
 				goto error;
 
 			/*
@@ -233,15 +291,8 @@ static int at91_pm_enter(suspend_state_t state)
 			 * turning off the main oscillator; reverse on wakeup.
 			 */
 			if (slow_clock) {
-				int memctrl = AT91_MEMCTRL_SDRAMC;
-
-				if (cpu_is_at91rm9200())
-					memctrl = AT91_MEMCTRL_MC;
-				else if (cpu_is_at91sam9g45()
-					|| cpu_is_at91sam9x5()
-					|| cpu_is_at91sam9n12()
-					|| cpu_is_sama5d3())
-					memctrl = AT91_MEMCTRL_DDRSDR;
+				int memctrl = at91_pm_memctrl();
+
 #ifdef CONFIG_AT91_SLOW_CLOCK
 				/* copy slow_clock handler to SRAM, and call it */
 				memcpy(slow_clock, at91_slow_clock, at91_slow_clock_sz);
@@ -322,6 +373,8 @@ static int __init at91_pm_init(void)
 {
 #ifdef CONFIG_AT91_SLOW_CLOCK
 	slow_clock = (void *) (AT91_IO_VIRT_BASE - at91_slow_clock_sz);
+	/* the cpuidle slow clock state calls it without copying it again */
+	memcpy(slow_clock, at91_slow_clock, at91_slow_clock_sz);
 #endif
 
 	pr_info("AT91: Power Management%s\n", (slow_clock ? " (with slow clock mode)" : ""));
@@ -14,6 +14,15 @@
 #include <mach/at91_ramc.h>
 #include <mach/at91rm9200_sdramc.h>
 
+#ifdef CONFIG_AT91_SLOW_CLOCK
+extern int at91_pm_slow_clock_idle(void);
+#else
+static inline int at91_pm_slow_clock_idle(void)
+{
+	return -ENOSYS;
+}
+#endif
+
 /*
  * The AT91RM9200 goes into self-refresh mode with this command, and will
  * terminate self-refresh automatically on the next SDRAM access.
@@ -13,6 +13,8 @@
 #include <linux/io.h>
 #include <linux/of.h>
 #include <linux/of_address.h>
+#include <linux/clk.h>
+#include <linux/err.h>
 
 #include <mach/at91sam9_smc.h>
 
@@ -121,6 +123,217 @@ void sam9_smc_read(int id, int cs, struct sam9_smc_config *config)
 	sam9_smc_cs_read(AT91_SMC_CS(id, cs), config);
 }
 
+/*------------------------------------------------------------------------*/
+
+/*
+ * Timing calculator.  The SMC fields are not linear:
+ *	SETUP = 128 * setup[5] + setup[4:0]
+ *	PULSE = 256 * pulse[6] + pulse[5:0]
+ *	CYCLE = 256 * cycle[8:7] + cycle[6:0]
+ * each encoder rounds the number of cycles up to the next value that
+ * can be programmed and returns the field value, or -ERANGE.
+ */
+
+static int sam9_smc_encode_setup(unsigned int *cycles)
+{
+	unsigned int c = *cycles;
+
+	if (c < 32)
+		return c;
+	if (c < 128)
+		c = 128;
+	if (c > 128 + 31)
+		return -ERANGE;
+
+	*cycles = c;
+	return 0x20 | (c - 128);
+}
+
+static int sam9_smc_encode_pulse(unsigned int *cycles)
+{
+	unsigned int c = *cycles;
+
+	if (c < 64)
+		return c;
+	if (c < 256)
+		c = 256;
+	if (c > 256 + 63)
+		return -ERANGE;
+
+	*cycles = c;
+	return 0x40 | (c - 256);
+}
+
+static int sam9_smc_encode_cycle(unsigned int *cycles)
+{
+	unsigned int c = *cycles;
+
+	if (c % 256 > 127)
+		c = round_up(c, 256);
+	if (c > 3 * 256 + 127)
+		return -ERANGE;
+
+	*cycles = c;
+	return ((c / 256) << 7) | (c % 256);
+}
+
+static unsigned int sam9_smc_ns_to_cycles(unsigned int ns, unsigned long mck_hz)
+{
+	u64 cycles = (u64)ns * mck_hz + NSEC_PER_SEC - 1;
+
+	do_div(cycles, NSEC_PER_SEC);
+	return cycles;
+}
+
+/* One access direction, NCS and NRD or NWE strobes, in MCK cycles */
+struct sam9_smc_access {
+	unsigned int ncs_setup;
+	unsigned int setup;
+	unsigned int ncs_pulse;
+	unsigned int pulse;
+	unsigned int cycle;
+};
+
+static int sam9_smc_calc_access(struct sam9_smc_access *a,
+				u8 *ncs_setup, u8 *setup,
+				u8 *ncs_pulse, u8 *pulse, u16 *cycle)
+{
+	int ncs_setup_val, setup_val, ncs_pulse_val, pulse_val, cycle_val;
+
+	ncs_setup_val = sam9_smc_encode_setup(&a->ncs_setup);
+	setup_val = sam9_smc_encode_setup(&a->setup);
+	ncs_pulse_val = sam9_smc_encode_pulse(&a->ncs_pulse);
+	pulse_val = sam9_smc_encode_pulse(&a->pulse);
+	if (ncs_setup_val < 0 || setup_val < 0
+	    || ncs_pulse_val < 0 || pulse_val < 0)
+		return -ERANGE;
+
+	a->cycle = max3(a->cycle, a->ncs_setup + a->ncs_pulse,
+			a->setup + a->pulse);
+	cycle_val = sam9_smc_encode_cycle(&a->cycle);
+	if (cycle_val < 0)
+		return -ERANGE;
+
+	*ncs_setup = ncs_setup_val;
+	*setup = setup_val;
+	*ncs_pulse = ncs_pulse_val;
+	*pulse = pulse_val;
+	*cycle = cycle_val;
+
+	return 0;
+}
+
+/*
+ * Compute the register values for @timings at @mck_hz.  Only the page mode
+ * bits of config->mode are updated, the other ones are left to the caller.
+ */
+int sam9_smc_timings_to_config(const struct sam9_smc_timings *timings,
+			       unsigned long mck_hz,
+			       struct sam9_smc_config *config)
+{
+	struct sam9_smc_access rd, wr;
+	unsigned int tdf;
+	int ret;
+
+	rd.ncs_setup = sam9_smc_ns_to_cycles(timings->ncs_read_setup, mck_hz);
+	rd.setup = sam9_smc_ns_to_cycles(timings->nrd_setup, mck_hz);
+	rd.ncs_pulse = sam9_smc_ns_to_cycles(timings->ncs_read_pulse, mck_hz);
+	rd.pulse = sam9_smc_ns_to_cycles(timings->nrd_pulse, mck_hz);
+	rd.cycle = sam9_smc_ns_to_cycles(timings->read_cycle, mck_hz);
+
+	wr.ncs_setup = sam9_smc_ns_to_cycles(timings->ncs_write_setup, mck_hz);
+	wr.setup = sam9_smc_ns_to_cycles(timings->nwe_setup, mck_hz);
+	wr.ncs_pulse = sam9_smc_ns_to_cycles(timings->ncs_write_pulse, mck_hz);
+	wr.pulse = sam9_smc_ns_to_cycles(timings->nwe_pulse, mck_hz);
+	wr.cycle = sam9_smc_ns_to_cycles(timings->write_cycle, mck_hz);
+
+	config->mode &= ~(AT91_SMC_PMEN | AT91_SMC_PS);
+	if (timings->page_size) {
+		/*
+		 * Within a page, accesses after the first one only last
+		 * NRD_PULSE: it must cover the page access time.
+		 */
+		rd.pulse = max(rd.pulse,
+			       sam9_smc_ns_to_cycles(timings->page_access, mck_hz));
+		rd.ncs_pulse = max(rd.ncs_pulse, rd.pulse);
+
+		switch (timings->page_size) {
+		case 4:
+			config->mode |= AT91_SMC_PMEN | AT91_SMC_PS_4;
+			break;
+		case 8:
+			config->mode |= AT91_SMC_PMEN | AT91_SMC_PS_8;
+			break;
+		case 16:
+			config->mode |= AT91_SMC_PMEN | AT91_SMC_PS_16;
+			break;
+		case 32:
+			config->mode |= AT91_SMC_PMEN | AT91_SMC_PS_32;
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	ret = sam9_smc_calc_access(&rd, &config->ncs_read_setup,
+				   &config->nrd_setup, &config->ncs_read_pulse,
+				   &config->nrd_pulse, &config->read_cycle);
+	if (ret)
+		return ret;
+
+	ret = sam9_smc_calc_access(&wr, &config->ncs_write_setup,
+				   &config->nwe_setup, &config->ncs_write_pulse,
+				   &config->nwe_pulse, &config->write_cycle);
+	if (ret)
+		return ret;
+
+	tdf = sam9_smc_ns_to_cycles(timings->tdf, mck_hz);
+	if (tdf > 15)
+		return -ERANGE;
+	config->tdf_cycles = tdf;
+
+	return 0;
+}
+EXPORT_SYMBOL(sam9_smc_timings_to_config);
+
+/*
+ * Program chip select @cs of SMC @id for @timings at the current MCK rate.
+ * MCK is not changed at runtime (cpufreq only scales the processor clock),
+ * so the values stay valid.
+ */
+int sam9_smc_configure_timings(int id, int cs,
+			       const struct sam9_smc_timings *timings,
+			       u32 mode)
+{
+	struct sam9_smc_config config = { .mode = mode };
+	struct clk *mck;
+	unsigned long mck_hz;
+	int ret;
+
+	mck = clk_get(NULL, "mck");
+	if (IS_ERR(mck))
+		return PTR_ERR(mck);
+	mck_hz = clk_get_rate(mck);
+	clk_put(mck);
+
+	ret = sam9_smc_timings_to_config(timings, mck_hz, &config);
+	if (ret) {
+		pr_err("smc.%d: cs%d timings out of range at %lu Hz\n",
+		       id, cs, mck_hz);
+		return ret;
+	}
+
+	pr_debug("smc.%d: cs%d setup %#x/%#x pulse %#x/%#x cycle %#x/%#x\n",
+		 id, cs, config.nrd_setup, config.nwe_setup,
+		 config.nrd_pulse, config.nwe_pulse,
+		 config.read_cycle, config.write_cycle);
+
+	sam9_smc_configure(id, cs, &config);
+
+	return 0;
+}
+EXPORT_SYMBOL(sam9_smc_configure_timings);
+
 void __init at91sam9_ioremap_smc(int id, u32 addr)
 {
 	if (id > 1) {
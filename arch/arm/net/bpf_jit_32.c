@@ -14,8 +14,10 @@
 #include <linux/filter.h>
 #include <linux/moduleloader.h>
 #include <linux/netdevice.h>
+#include <linux/seccomp.h>
 #include <linux/string.h>
 #include <linux/slab.h>
+#include <net/netlink.h>
 #include <asm/cacheflush.h>
 #include <asm/hwcap.h>
 
@@ -54,7 +56,8 @@
 #define FLAG_NEED_X_RESET	(1 << 0)
 
 struct jit_ctx {
-	const struct sk_filter *skf;
+	const struct sock_filter *insns;
+	unsigned len;
 	unsigned idx;
 	unsigned prologue_bytes;
 	int ret0_fp_idx;
@@ -69,38 +72,117 @@ struct jit_ctx {
 #endif
 };
 
+#define PKT_TYPE_MAX		7
+
 int bpf_jit_enable __read_mostly;
 
-static u64 jit_get_skb_b(struct sk_buff *skb, unsigned offset)
+/*
+ * Negative offsets select the network or link layer header (SKF_NET_OFF,
+ * SKF_LL_OFF), resolve them the same way the interpreter does.
+ */
+static int jit_copy_bits(const struct sk_buff *skb, int offset, void *to,
+			 int len)
+{
+	void *ptr;
+
+	if (offset >= 0)
+		return skb_copy_bits(skb, offset, to, len);
+
+	ptr = bpf_internal_load_pointer_neg_helper(skb, offset, len);
+	if (ptr == NULL)
+		return -EFAULT;
+
+	memcpy(to, ptr, len);
+	return 0;
+}
+
+static u64 jit_get_skb_b(struct sk_buff *skb, int offset)
 {
 	u8 ret;
 	int err;
 
-	err = skb_copy_bits(skb, offset, &ret, 1);
+	err = jit_copy_bits(skb, offset, &ret, 1);
 
 	return (u64)err << 32 | ret;
 }
 
-static u64 jit_get_skb_h(struct sk_buff *skb, unsigned offset)
+static u64 jit_get_skb_h(struct sk_buff *skb, int offset)
 {
 	u16 ret;
 	int err;
 
-	err = skb_copy_bits(skb, offset, &ret, 2);
+	err = jit_copy_bits(skb, offset, &ret, 2);
 
 	return (u64)err << 32 | ntohs(ret);
 }
 
-static u64 jit_get_skb_w(struct sk_buff *skb, unsigned offset)
+static u64 jit_get_skb_w(struct sk_buff *skb, int offset)
 {
 	u32 ret;
 	int err;
 
-	err = skb_copy_bits(skb, offset, &ret, 4);
+	err = jit_copy_bits(skb, offset, &ret, 4);
 
 	return (u64)err << 32 | ntohl(ret);
 }
 
+/*
+ * The netlink attribute lookups follow sk_run_filter() exactly.  As for the
+ * loads above, a non zero upper word makes the filter return 0.
+ */
+static u64 jit_nlattr(struct sk_buff *skb, u32 A, u32 X)
+{
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return 1ULL << 32;
+	if (A > skb->len - sizeof(struct nlattr))
+		return 1ULL << 32;
+
+	nla = nla_find((struct nlattr *)&skb->data[A], skb->len - A, X);
+
+	return nla ? (void *)nla - (void *)skb->data : 0;
+}
+
+static u64 jit_nlattr_nest(struct sk_buff *skb, u32 A, u32 X)
+{
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return 1ULL << 32;
+	if (A > skb->len - sizeof(struct nlattr))
+		return 1ULL << 32;
+
+	nla = (struct nlattr *)&skb->data[A];
+	if (nla->nla_len > A - skb->len)
+		return 1ULL << 32;
+
+	nla = nla_find_nested(nla, X);
+
+	return nla ? (void *)nla - (void *)skb->data : 0;
+}
+
+/*
+ * skb->pkt_type is a bitfield, so find its byte and bit position by
+ * setting it in an otherwise empty skb.
+ */
+static int pkt_type_offset(unsigned *shift)
+{
+	struct sk_buff skb_probe = { .pkt_type = PKT_TYPE_MAX, };
+	u8 *ct = (u8 *)&skb_probe;
+	unsigned off;
+
+	for (off = 0; off < sizeof(struct sk_buff); off++) {
+		if (ct[off]) {
+			*shift = __ffs(ct[off]);
+			return off;
+		}
+	}
+
+	pr_err_once("BPF JIT: pkt_type not found in struct sk_buff\n");
+	return -1;
+}
+
 /*
  * Wrapper that handles both OABI and EABI and assures Thumb2 interworking
  * (where the assembly routines like __aeabi_uidiv could cause problems).
@@ -130,8 +212,7 @@ static u16 saved_regs(struct jit_ctx *ctx)
 {
 	u16 ret = 0;
 
-	if ((ctx->skf->len > 1) ||
-	    (ctx->skf->insns[0].code == BPF_S_RET_A))
+	if ((ctx->len > 1) || (ctx->insns[0].code == BPF_S_RET_A))
 		ret |= 1 << r_A;
 
 #ifdef CONFIG_FRAME_POINTER
@@ -167,8 +248,11 @@ static inline bool is_load_to_a(u16 inst)
 	case BPF_S_ANC_IFINDEX:
 	case BPF_S_ANC_MARK:
 	case BPF_S_ANC_PROTOCOL:
+	case BPF_S_ANC_PKTTYPE:
+	case BPF_S_ANC_HATYPE:
 	case BPF_S_ANC_RXHASH:
 	case BPF_S_ANC_QUEUE:
+	case BPF_S_ANC_SECCOMP_LD_W:
 		return true;
 	default:
 		return false;
@@ -178,7 +262,7 @@ static inline bool is_load_to_a(u16 inst)
 static void build_prologue(struct jit_ctx *ctx)
 {
 	u16 reg_set = saved_regs(ctx);
-	u16 first_inst = ctx->skf->insns[0].code;
+	u16 first_inst = ctx->insns[0].code;
 	u16 off;
 
 #ifdef CONFIG_FRAME_POINTER
@@ -276,7 +360,7 @@ static u16 imm_offset(u32 k, struct jit_ctx *ctx)
 		ctx->imms[i] = k;
 
 	/* constants go just after the epilogue */
-	offset =  ctx->offsets[ctx->skf->len];
+	offset =  ctx->offsets[ctx->len];
 	offset += ctx->prologue_bytes;
 	offset += ctx->epilogue_bytes;
 	offset += i * 4;
@@ -409,7 +493,7 @@ static inline void emit_err_ret(u8 cond, struct jit_ctx *ctx)
 		emit(ARM_MOV_R(ARM_R0, ARM_R0), ctx);
 	} else {
 		_emit(cond, ARM_MOV_I(ARM_R0, 0), ctx);
-		_emit(cond, ARM_B(b_imm(ctx->skf->len, ctx)), ctx);
+		_emit(cond, ARM_B(b_imm(ctx->len, ctx)), ctx);
 	}
 }
 
@@ -459,14 +543,13 @@ static inline void update_on_xread(struct jit_ctx *ctx)
 static int build_body(struct jit_ctx *ctx)
 {
 	void *load_func[] = {jit_get_skb_b, jit_get_skb_h, jit_get_skb_w};
-	const struct sk_filter *prog = ctx->skf;
 	const struct sock_filter *inst;
-	unsigned i, load_order, off, condt;
+	unsigned i, load_order, off, condt, shift;
 	int imm12;
 	u32 k;
 
-	for (i = 0; i < prog->len; i++) {
-		inst = &(prog->insns[i]);
+	for (i = 0; i < ctx->len; i++) {
+		inst = &(ctx->insns[i]);
 		/* K as an immediate value operand */
 		k = inst->k;
 
@@ -498,17 +581,17 @@ static int build_body(struct jit_ctx *ctx)
 		case BPF_S_LD_B_ABS:
 			load_order = 0;
 load:
-			/* the interpreter will deal with the negative K */
-			if ((int)k < 0)
-				return -ENOTSUPP;
+			/* a negative K always goes through the slowpath */
 			emit_mov_i(r_off, k, ctx);
 load_common:
 			ctx->seen |= SEEN_DATA | SEEN_CALL;
 
 			if (load_order > 0) {
-				emit(ARM_SUB_I(r_scratch, r_skb_hl,
-					       1 << load_order), ctx);
-				emit(ARM_CMP_R(r_scratch, r_off), ctx);
+				emit(ARM_SUBS_I(r_scratch, r_skb_hl,
+						1 << load_order), ctx);
+				/* headlen < size leaves C clear: slowpath */
+				_emit(ARM_COND_HS, ARM_CMP_R(r_scratch, r_off),
+				      ctx);
 				condt = ARM_COND_HS;
 			} else {
 				emit(ARM_CMP_R(r_skb_hl, r_off), ctx);
@@ -565,9 +648,6 @@ load_ind:
 		case BPF_S_LDX_B_MSH:
 			/* x = ((*(frame + k)) & 0xf) << 2; */
 			ctx->seen |= SEEN_X | SEEN_DATA | SEEN_CALL;
-			/* the interpreter should deal with the negative K */
-			if (k < 0)
-				return -1;
 			/* offset in r1: we might have to take the slow path */
 			emit_mov_i(r_off, k, ctx);
 			emit(ARM_CMP_R(r_skb_hl, r_off), ctx);
@@ -655,18 +735,29 @@ load_ind:
 			emit(ARM_AND_R(r_A, r_A, r_X), ctx);
 			break;
 		case BPF_S_ALU_LSH_K:
-			if (unlikely(k > 31))
-				return -1;
-			emit(ARM_LSL_I(r_A, r_A, k), ctx);
+			/*
+			 * A shift by 32 or more is undefined in C, the
+			 * interpreter ends up shifting by a register: do the
+			 * same so that both give the same result.
+			 */
+			if (unlikely(k > 31)) {
+				emit_mov_i(r_scratch, k, ctx);
+				emit(ARM_LSL_R(r_A, r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_LSL_I(r_A, r_A, k), ctx);
+			}
 			break;
 		case BPF_S_ALU_LSH_X:
 			update_on_xread(ctx);
 			emit(ARM_LSL_R(r_A, r_A, r_X), ctx);
 			break;
 		case BPF_S_ALU_RSH_K:
-			if (unlikely(k > 31))
-				return -1;
-			emit(ARM_LSR_I(r_A, r_A, k), ctx);
+			if (unlikely(k > 31)) {
+				emit_mov_i(r_scratch, k, ctx);
+				emit(ARM_LSR_R(r_A, r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_LSR_I(r_A, r_A, k), ctx);
+			}
 			break;
 		case BPF_S_ALU_RSH_X:
 			update_on_xread(ctx);
@@ -749,8 +840,8 @@ cmp_x:
 				ctx->ret0_fp_idx = i;
 			emit_mov_i(ARM_R0, k, ctx);
 b_epilogue:
-			if (i != ctx->skf->len - 1)
-				emit(ARM_B(b_imm(prog->len, ctx)), ctx);
+			if (i != ctx->len - 1)
+				emit(ARM_B(b_imm(ctx->len, ctx)), ctx);
 			break;
 		case BPF_S_MISC_TAX:
 			/* X = A */
@@ -776,6 +867,17 @@ b_epilogue:
 			emit(ARM_LDRH_I(r_scratch, r_skb, off), ctx);
 			emit_swap16(r_A, r_scratch, ctx);
 			break;
+		case BPF_S_ANC_PKTTYPE:
+			/* A = skb->pkt_type */
+			ctx->seen |= SEEN_SKB;
+			off = pkt_type_offset(&shift);
+			if ((int)off < 0)
+				return -1;
+			emit(ARM_LDRB_I(r_A, r_skb, off), ctx);
+			if (shift)
+				emit(ARM_LSR_I(r_A, r_A, shift), ctx);
+			emit(ARM_AND_I(r_A, r_A, PKT_TYPE_MAX), ctx);
+			break;
 		case BPF_S_ANC_CPU:
 			/* r_scratch = current_thread_info() */
 			OP_IMM3(ARM_BIC, r_scratch, ARM_SP, THREAD_SIZE - 1, ctx);
@@ -798,6 +900,26 @@ b_epilogue:
 			off = offsetof(struct net_device, ifindex);
 			emit(ARM_LDR_I(r_A, r_scratch, off), ctx);
 			break;
+		case BPF_S_ANC_HATYPE:
+			/* A = skb->dev->type */
+			ctx->seen |= SEEN_SKB;
+			off = offsetof(struct sk_buff, dev);
+			emit(ARM_LDR_I(r_scratch, r_skb, off), ctx);
+
+			emit(ARM_CMP_I(r_scratch, 0), ctx);
+			emit_err_ret(ARM_COND_EQ, ctx);
+
+			BUILD_BUG_ON(FIELD_SIZEOF(struct net_device,
+						  type) != 2);
+			off = offsetof(struct net_device, type);
+			/* LDRH only has an 8-bit immediate offset */
+			if (off > 0xff) {
+				emit_mov_i(r_off, off, ctx);
+				emit(ARM_LDRH_R(r_A, r_scratch, r_off), ctx);
+			} else {
+				emit(ARM_LDRH_I(r_A, r_scratch, off), ctx);
+			}
+			break;
 		case BPF_S_ANC_MARK:
 			ctx->seen |= SEEN_SKB;
 			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
@@ -819,6 +941,33 @@ b_epilogue:
 			off = offsetof(struct sk_buff, queue_mapping);
 			emit(ARM_LDRH_I(r_A, r_skb, off), ctx);
 			break;
+		case BPF_S_ANC_NLATTR:
+		case BPF_S_ANC_NLATTR_NEST:
+			/* A = offset of attribute X, searched from A */
+			ctx->seen |= SEEN_SKB | SEEN_CALL;
+			update_on_xread(ctx);
+			emit(ARM_MOV_R(ARM_R0, r_skb), ctx);
+			emit(ARM_MOV_R(ARM_R1, r_A), ctx);
+			emit(ARM_MOV_R(ARM_R2, r_X), ctx);
+			if (inst->code == BPF_S_ANC_NLATTR)
+				emit_mov_i(ARM_R3, (u32)jit_nlattr, ctx);
+			else
+				emit_mov_i(ARM_R3, (u32)jit_nlattr_nest, ctx);
+			emit_blx_r(ARM_R3, ctx);
+			emit(ARM_CMP_I(ARM_R1, 0), ctx);
+			emit_err_ret(ARM_COND_NE, ctx);
+			emit(ARM_MOV_R(r_A, ARM_R0), ctx);
+			break;
+#ifdef CONFIG_SECCOMP_FILTER
+		case BPF_S_ANC_SECCOMP_LD_W:
+			/* A = seccomp_data word at K, there's no skb */
+			ctx->seen |= SEEN_CALL;
+			emit_mov_i(ARM_R0, k, ctx);
+			emit_mov_i(ARM_R3, (u32)seccomp_bpf_load, ctx);
+			emit_blx_r(ARM_R3, ctx);
+			emit(ARM_MOV_R(r_A, ARM_R0), ctx);
+			break;
+#endif
 		default:
 			return -1;
 		}
@@ -832,22 +981,23 @@ b_epilogue:
 }
 
 
-void bpf_jit_compile(struct sk_filter *fp)
+static void *__bpf_jit_compile(const struct sock_filter *insns, unsigned len)
 {
 	struct jit_ctx ctx;
 	unsigned tmp_idx;
 	unsigned alloc_size;
 
 	if (!bpf_jit_enable)
-		return;
+		return NULL;
 
 	memset(&ctx, 0, sizeof(ctx));
-	ctx.skf		= fp;
+	ctx.insns	= insns;
+	ctx.len		= len;
 	ctx.ret0_fp_idx = -1;
 
-	ctx.offsets = kzalloc(GFP_KERNEL, 4 * (ctx.skf->len + 1));
+	ctx.offsets = kzalloc(4 * (ctx.len + 1), GFP_KERNEL);
 	if (ctx.offsets == NULL)
-		return;
+		return NULL;
 
 	/* fake pass to fill in the ctx->seen */
 	if (unlikely(build_body(&ctx)))
@@ -864,7 +1014,7 @@ void bpf_jit_compile(struct sk_filter *fp)
 
 	ctx.idx += ctx.imm_count;
 	if (ctx.imm_count) {
-		ctx.imms = kzalloc(GFP_KERNEL, 4 * ctx.imm_count);
+		ctx.imms = kzalloc(4 * ctx.imm_count, GFP_KERNEL);
 		if (ctx.imms == NULL)
 			goto out;
 	}
@@ -896,10 +1046,9 @@ void bpf_jit_compile(struct sk_filter *fp)
 			       DUMP_PREFIX_ADDRESS, 16, 4, ctx.target,
 			       alloc_size, false);
 
-	fp->bpf_func = (void *)ctx.target;
 out:
 	kfree(ctx.offsets);
-	return;
+	return ctx.target;
 }
 
 static void bpf_jit_free_worker(struct work_struct *work)
@@ -907,14 +1056,40 @@ static void bpf_jit_free_worker(struct work_struct *work)
 	module_free(NULL, work);
 }
 
+/*
+ * Filters can be released from softirq context, module_free() can't be
+ * called there: the code area is reused as the work_struct.
+ */
+static void __bpf_jit_free(void *func)
+{
+	struct work_struct *work = func;
+
+	INIT_WORK(work, bpf_jit_free_worker);
+	schedule_work(work);
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	void *func = __bpf_jit_compile(fp->insns, fp->len);
+
+	if (func)
+		fp->bpf_func = func;
+}
+
 void bpf_jit_free(struct sk_filter *fp)
 {
-	struct work_struct *work;
+	if (fp->bpf_func != sk_run_filter)
+		__bpf_jit_free(fp->bpf_func);
+}
 
-	if (fp->bpf_func != sk_run_filter) {
-		work = (struct work_struct *)fp->bpf_func;
+#ifdef CONFIG_SECCOMP_FILTER_JIT
+void *seccomp_jit_compile(const struct sock_filter *filter, unsigned int flen)
+{
+	return __bpf_jit_compile(filter, flen);
+}
 
-		INIT_WORK(work, bpf_jit_free_worker);
-		schedule_work(work);
-	}
+void seccomp_jit_free(void *bpf_func)
+{
+	__bpf_jit_free(bpf_func);
 }
+#endif
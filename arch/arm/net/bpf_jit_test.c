@@ -0,0 +1,555 @@
+/*
+ * linux/arch/arm/net/bpf_jit_test.c
+ *
+ * Self test for the BPF JIT compiler.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Small programs exercising every classic BPF instruction, ancillary
+ * load and the seccomp data load are compiled at boot and run on a set
+ * of packets through both the JIT code and sk_run_filter(), which is
+ * taken as the reference.  The packets cover the fast and slow paths of
+ * the loads: linear and paged data, data shorter than the load, negative
+ * offsets, with and without a device, and netlink attributes.  Every
+ * program that passes sk_chk_filter() must be compiled.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/netdevice.h>
+#include <linux/random.h>
+#include <linux/seccomp.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <net/net_namespace.h>
+#include <net/netlink.h>
+
+#define TEST_SKBS	8
+#define TEST_DATA_LEN	64
+#define TEST_MAX_INSNS	8
+
+static struct sk_buff *test_skbs[TEST_SKBS];
+static unsigned int tests_run, tests_failed;
+
+static const u32 test_values[] = {
+	0, 1, 2, 7, 31, 32, 33, 0xff, 0x100, 0xffff, 0x10000, 0x12345678,
+	0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff,
+};
+
+static const struct {
+	const char *name;
+	u16 code;
+} alu_ops[] = {
+	{ "add_k", BPF_ALU | BPF_ADD | BPF_K },
+	{ "add_x", BPF_ALU | BPF_ADD | BPF_X },
+	{ "sub_k", BPF_ALU | BPF_SUB | BPF_K },
+	{ "sub_x", BPF_ALU | BPF_SUB | BPF_X },
+	{ "mul_k", BPF_ALU | BPF_MUL | BPF_K },
+	{ "mul_x", BPF_ALU | BPF_MUL | BPF_X },
+	{ "div_k", BPF_ALU | BPF_DIV | BPF_K },
+	{ "div_x", BPF_ALU | BPF_DIV | BPF_X },
+	{ "and_k", BPF_ALU | BPF_AND | BPF_K },
+	{ "and_x", BPF_ALU | BPF_AND | BPF_X },
+	{ "or_k", BPF_ALU | BPF_OR | BPF_K },
+	{ "or_x", BPF_ALU | BPF_OR | BPF_X },
+	{ "lsh_k", BPF_ALU | BPF_LSH | BPF_K },
+	{ "lsh_x", BPF_ALU | BPF_LSH | BPF_X },
+	{ "rsh_k", BPF_ALU | BPF_RSH | BPF_K },
+	{ "rsh_x", BPF_ALU | BPF_RSH | BPF_X },
+	{ "neg", BPF_ALU | BPF_NEG },
+};
+
+static const struct {
+	const char *name;
+	u16 code;
+} jmp_ops[] = {
+	{ "jeq_k", BPF_JMP | BPF_JEQ | BPF_K },
+	{ "jeq_x", BPF_JMP | BPF_JEQ | BPF_X },
+	{ "jgt_k", BPF_JMP | BPF_JGT | BPF_K },
+	{ "jgt_x", BPF_JMP | BPF_JGT | BPF_X },
+	{ "jge_k", BPF_JMP | BPF_JGE | BPF_K },
+	{ "jge_x", BPF_JMP | BPF_JGE | BPF_X },
+	{ "jset_k", BPF_JMP | BPF_JSET | BPF_K },
+	{ "jset_x", BPF_JMP | BPF_JSET | BPF_X },
+};
+
+static const struct {
+	const char *name;
+	int off;
+} anc_loads[] = {
+	{ "protocol", SKF_AD_PROTOCOL },
+	{ "pkttype", SKF_AD_PKTTYPE },
+	{ "ifindex", SKF_AD_IFINDEX },
+	{ "mark", SKF_AD_MARK },
+	{ "queue", SKF_AD_QUEUE },
+	{ "hatype", SKF_AD_HATYPE },
+	{ "rxhash", SKF_AD_RXHASH },
+	{ "cpu", SKF_AD_CPU },
+};
+
+/* attribute starts in the netlink test packet, see alloc_nlattr_skb() */
+static const u32 nlattr_offsets[] = {
+	0, 8, 12, 20, 28, 36, 44, 48, 0xfffffff0,
+};
+
+static const struct {
+	const char *name;
+	u16 code;
+} ld_sizes[] = {
+	{ "b", BPF_B },
+	{ "h", BPF_H },
+	{ "w", BPF_W },
+};
+
+/*
+ * Check @insns (@len instructions) on each of the @nr_skbs packets.
+ * Programs rejected by sk_chk_filter(), such as a division by a constant
+ * zero, are skipped.  For @seccomp the absolute word loads are turned
+ * into seccomp data loads the way seccomp_check_filter() does.
+ */
+static void __init check_filter(const char *desc,
+				const struct sock_filter *insns,
+				unsigned int len, struct sk_buff **skbs,
+				unsigned int nr_skbs, bool seccomp)
+{
+	unsigned int i, ret, jit_ret;
+	struct sk_filter *fp;
+
+	fp = kzalloc(sizeof(*fp) + len * sizeof(*insns), GFP_KERNEL);
+	if (!fp) {
+		tests_failed++;
+		return;
+	}
+	memcpy(fp->insns, insns, len * sizeof(*insns));
+	fp->len = len;
+	fp->bpf_func = sk_run_filter;
+
+	if (sk_chk_filter(fp->insns, len))
+		goto out;
+
+	if (seccomp) {
+		for (i = 0; i < len; i++)
+			if (fp->insns[i].code == BPF_S_LD_W_ABS)
+				fp->insns[i].code = BPF_S_ANC_SECCOMP_LD_W;
+	}
+
+	tests_run++;
+	bpf_jit_compile(fp);
+	if (fp->bpf_func == sk_run_filter) {
+		pr_err("bpf_jit_test: %s: not compiled\n", desc);
+		tests_failed++;
+		goto out;
+	}
+
+	for (i = 0; i < nr_skbs; i++) {
+		local_bh_disable();
+		ret = sk_run_filter(skbs[i], fp->insns);
+		jit_ret = fp->bpf_func(skbs[i], fp->insns);
+		local_bh_enable();
+
+		if (ret != jit_ret) {
+			pr_err("bpf_jit_test: %s: skb %u: interpreter %#x, "
+			       "JIT %#x\n", desc, i, ret, jit_ret);
+			tests_failed++;
+			break;
+		}
+	}
+
+	bpf_jit_free(fp);
+out:
+	kfree(fp);
+}
+
+static void __init check_alu(unsigned int op, u32 a, u32 v)
+{
+	struct sock_filter prog[] = {
+		BPF_STMT(BPF_LD | BPF_IMM, a),
+		BPF_STMT(BPF_LDX | BPF_IMM, v),
+		BPF_STMT(alu_ops[op].code, v),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	char desc[64];
+
+	snprintf(desc, sizeof(desc), "%s A=%#x K=X=%#x",
+		 alu_ops[op].name, a, v);
+	check_filter(desc, prog, ARRAY_SIZE(prog), test_skbs, 1, false);
+}
+
+static void __init check_jump(unsigned int op, u32 a, u32 v, u8 jt)
+{
+	struct sock_filter prog[] = {
+		BPF_STMT(BPF_LD | BPF_IMM, a),
+		BPF_STMT(BPF_LDX | BPF_IMM, v),
+		BPF_JUMP(jmp_ops[op].code, v, jt, !jt),
+		BPF_STMT(BPF_RET | BPF_K, 1),
+		BPF_STMT(BPF_RET | BPF_K, 2),
+	};
+	char desc[64];
+
+	snprintf(desc, sizeof(desc), "%s A=%#x K=X=%#x jt=%u",
+		 jmp_ops[op].name, a, v, jt);
+	check_filter(desc, prog, ARRAY_SIZE(prog), test_skbs, 1, false);
+}
+
+static void __init test_alu(void)
+{
+	unsigned int op, i, j;
+
+	for (op = 0; op < ARRAY_SIZE(alu_ops); op++)
+		for (i = 0; i < ARRAY_SIZE(test_values); i++)
+			for (j = 0; j < ARRAY_SIZE(test_values); j++)
+				check_alu(op, test_values[i], test_values[j]);
+}
+
+static void __init test_jumps(void)
+{
+	struct sock_filter prog[TEST_MAX_INSNS];
+	unsigned int op, i, j;
+
+	/* both with jt = 0, jf = 1 and jt = 1, jf = 0 */
+	for (op = 0; op < ARRAY_SIZE(jmp_ops); op++) {
+		for (i = 0; i < ARRAY_SIZE(test_values); i++) {
+			for (j = 0; j < ARRAY_SIZE(test_values); j++) {
+				check_jump(op, test_values[i], test_values[j],
+					   0);
+				check_jump(op, test_values[i], test_values[j],
+					   1);
+			}
+		}
+	}
+
+	prog[0] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0);
+	prog[1] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 1);
+	prog[2] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 2);
+	check_filter("ja", prog, 3, test_skbs, 1, false);
+}
+
+static void __init test_mem(void)
+{
+	struct sock_filter prog[TEST_MAX_INSNS];
+	unsigned int k, next;
+	char desc[64];
+
+	for (k = 0; k < BPF_MEMWORDS; k++) {
+		next = (k + 1) % BPF_MEMWORDS;
+		/* mem[k] = A, X = mem[k], mem[next] = X, A = mem[next] */
+		prog[0] = (struct sock_filter)
+			BPF_STMT(BPF_LD | BPF_IMM, 0x1000 + k);
+		prog[1] = (struct sock_filter)BPF_STMT(BPF_ST, k);
+		prog[2] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_MEM, k);
+		prog[3] = (struct sock_filter)BPF_STMT(BPF_STX, next);
+		prog[4] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_IMM, 0);
+		prog[5] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_MEM, next);
+		prog[6] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TAX, 0);
+		prog[7] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+		snprintf(desc, sizeof(desc), "mem %u", k);
+		check_filter(desc, prog, 8, test_skbs, 1, false);
+	}
+
+	prog[0] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_IMM, 0x55);
+	prog[1] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TXA, 0);
+	prog[2] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+	check_filter("txa", prog, 3, test_skbs, 1, false);
+}
+
+static void __init test_loads(void)
+{
+	struct sock_filter prog[TEST_MAX_INSNS];
+	unsigned int size, base;
+	char desc[64];
+	int off;
+
+	for (size = 0; size < ARRAY_SIZE(ld_sizes); size++) {
+		for (off = -4; off < TEST_DATA_LEN + 4; off++) {
+			for (base = 0; base < 3; base++) {
+				int k = off;
+
+				if (base == 1)
+					k += SKF_NET_OFF;
+				else if (base == 2)
+					k += SKF_LL_OFF;
+
+				/* X must survive the slowpath call */
+				prog[0] = (struct sock_filter)
+					BPF_STMT(BPF_LDX | BPF_IMM, 0x55);
+				prog[1] = (struct sock_filter)
+					BPF_STMT(BPF_LD | BPF_ABS |
+						 ld_sizes[size].code, k);
+				prog[2] = (struct sock_filter)
+					BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0);
+				prog[3] = (struct sock_filter)
+					BPF_STMT(BPF_RET | BPF_A, 0);
+				snprintf(desc, sizeof(desc), "ld_%s_abs %d",
+					 ld_sizes[size].name, k);
+				check_filter(desc, prog, 4, test_skbs,
+					     TEST_SKBS, false);
+
+				/* X + K, split both ways */
+				prog[0] = (struct sock_filter)
+					BPF_STMT(BPF_LDX | BPF_IMM, k / 2);
+				prog[1] = (struct sock_filter)
+					BPF_STMT(BPF_LD | BPF_IND |
+						 ld_sizes[size].code,
+						 k - k / 2);
+				prog[2] = (struct sock_filter)
+					BPF_STMT(BPF_RET | BPF_A, 0);
+				snprintf(desc, sizeof(desc), "ld_%s_ind %d",
+					 ld_sizes[size].name, k);
+				check_filter(desc, prog, 3, test_skbs,
+					     TEST_SKBS, false);
+			}
+		}
+	}
+
+	for (off = -4; off < TEST_DATA_LEN + 4; off++) {
+		prog[0] = (struct sock_filter)
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, off);
+		prog[1] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TXA, 0);
+		prog[2] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+		snprintf(desc, sizeof(desc), "ldx_b_msh %d", off);
+		check_filter(desc, prog, 3, test_skbs, TEST_SKBS, false);
+	}
+
+	prog[0] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0);
+	prog[1] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+	check_filter("ld_len", prog, 2, test_skbs, TEST_SKBS, false);
+
+	prog[0] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_W | BPF_LEN, 0);
+	prog[1] = (struct sock_filter)BPF_STMT(BPF_MISC | BPF_TXA, 0);
+	prog[2] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+	check_filter("ldx_len", prog, 3, test_skbs, TEST_SKBS, false);
+}
+
+static void __init test_ancillary(void)
+{
+	struct sock_filter prog[TEST_MAX_INSNS];
+	unsigned int i, j;
+	char desc[64];
+	u32 a, v;
+
+	for (i = 0; i < ARRAY_SIZE(anc_loads); i++) {
+		/* as the first instruction, then with A and X live */
+		prog[0] = (struct sock_filter)
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + anc_loads[i].off);
+		prog[1] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+		check_filter(anc_loads[i].name, prog, 2, test_skbs, TEST_SKBS,
+			     false);
+
+		prog[0] = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_IMM, 1);
+		prog[1] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_IMM, 2);
+		prog[2] = (struct sock_filter)
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + anc_loads[i].off);
+		prog[3] = (struct sock_filter)
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0);
+		prog[4] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+		check_filter(anc_loads[i].name, prog, 5, test_skbs, TEST_SKBS,
+			     false);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(test_values); i++) {
+		for (j = 0; j < ARRAY_SIZE(test_values); j++) {
+			a = test_values[i];
+			v = test_values[j];
+			prog[0] = (struct sock_filter)
+				BPF_STMT(BPF_LD | BPF_IMM, a);
+			prog[1] = (struct sock_filter)
+				BPF_STMT(BPF_LDX | BPF_IMM, v);
+			prog[2] = (struct sock_filter)
+				BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+					 SKF_AD_OFF + SKF_AD_ALU_XOR_X);
+			prog[3] = (struct sock_filter)
+				BPF_STMT(BPF_RET | BPF_A, 0);
+			snprintf(desc, sizeof(desc), "xor_x A=%#x X=%#x",
+				 a, v);
+			check_filter(desc, prog, 4, test_skbs, 1, false);
+		}
+	}
+
+	/*
+	 * A = start offset, X = attribute type.  The nested lookup trusts
+	 * the length of the attribute at A, so it only runs on the netlink
+	 * packet at the start of an attribute.
+	 */
+	for (i = 0; i < ARRAY_SIZE(nlattr_offsets); i++) {
+		for (v = 0; v < 6; v++) {
+			a = nlattr_offsets[i];
+			prog[0] = (struct sock_filter)
+				BPF_STMT(BPF_LD | BPF_IMM, a);
+			prog[1] = (struct sock_filter)
+				BPF_STMT(BPF_LDX | BPF_IMM, v);
+			prog[2] = (struct sock_filter)
+				BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+					 SKF_AD_OFF + SKF_AD_NLATTR);
+			prog[3] = (struct sock_filter)
+				BPF_STMT(BPF_RET | BPF_A, 0);
+			snprintf(desc, sizeof(desc), "nlattr A=%#x X=%u",
+				 a, v);
+			check_filter(desc, prog, 4, test_skbs, TEST_SKBS,
+				     false);
+
+			prog[2].k = SKF_AD_OFF + SKF_AD_NLATTR_NEST;
+			snprintf(desc, sizeof(desc), "nlattr_nest A=%#x X=%u",
+				 a, v);
+			check_filter(desc, prog, 4, &test_skbs[TEST_SKBS - 1],
+				     1, false);
+		}
+	}
+}
+
+#ifdef CONFIG_SECCOMP_FILTER
+static void __init test_seccomp(void)
+{
+	struct sock_filter prog[TEST_MAX_INSNS];
+	struct sk_buff *no_skb = NULL;
+	unsigned int k;
+	char desc[64];
+
+	/* every word of struct seccomp_data, for the current task */
+	for (k = 0; k < sizeof(struct seccomp_data); k += 4) {
+		prog[0] = (struct sock_filter)
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, k);
+		prog[1] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+		snprintf(desc, sizeof(desc), "seccomp_ld_w %u", k);
+		check_filter(desc, prog, 2, &no_skb, 1, true);
+	}
+}
+#else
+static inline void test_seccomp(void)
+{
+}
+#endif
+
+/*
+ * Linear data of @hlen bytes followed by @len - @hlen bytes in a page.
+ */
+static struct sk_buff * __init alloc_test_skb(unsigned int len,
+					       unsigned int hlen)
+{
+	struct sk_buff *skb;
+	struct page *page;
+
+	skb = alloc_skb(hlen, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	get_random_bytes(skb_put(skb, hlen), hlen);
+
+	if (len > hlen) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		get_random_bytes(page_address(page), len - hlen);
+		skb_fill_page_desc(skb, 0, page, 0, len - hlen);
+		skb->len += len - hlen;
+		skb->data_len += len - hlen;
+		skb->truesize += PAGE_SIZE;
+	}
+
+	return skb;
+}
+
+static struct sk_buff * __init alloc_nlattr_skb(void)
+{
+	struct sk_buff *skb;
+	struct nlattr *nest;
+
+	skb = alloc_skb(TEST_DATA_LEN, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	if (nla_put_u32(skb, 1, 0x11111111))
+		goto fail;
+	nest = nla_nest_start(skb, 2);
+	if (!nest || nla_put_u32(skb, 1, 0x22222222) ||
+	    nla_put_u16(skb, 3, 0x3333) || nla_put_u8(skb, 4, 0x44))
+		goto fail;
+	nla_nest_end(skb, nest);
+	if (nla_put_u32(skb, 3, 0x55555555))
+		goto fail;
+
+	return skb;
+fail:
+	kfree_skb(skb);
+	return NULL;
+}
+
+static int __init alloc_test_skbs(void)
+{
+	struct net_device *dev = init_net.loopback_dev;
+	struct sk_buff *skb;
+	unsigned int i;
+
+	test_skbs[0] = alloc_test_skb(TEST_DATA_LEN, TEST_DATA_LEN);
+	test_skbs[1] = alloc_test_skb(TEST_DATA_LEN, TEST_DATA_LEN);
+	test_skbs[2] = alloc_test_skb(TEST_DATA_LEN, 16);
+	test_skbs[3] = alloc_test_skb(TEST_DATA_LEN, 1);
+	test_skbs[4] = alloc_test_skb(1, 1);
+	test_skbs[5] = alloc_test_skb(3, 3);
+	test_skbs[6] = alloc_test_skb(0, 0);
+	test_skbs[7] = alloc_nlattr_skb();
+
+	for (i = 0; i < TEST_SKBS; i++) {
+		skb = test_skbs[i];
+		if (!skb)
+			return -ENOMEM;
+
+		skb_reset_mac_header(skb);
+		skb_set_network_header(skb, ETH_HLEN);
+		skb->protocol = htons(ETH_P_IP);
+		skb->pkt_type = i;
+		skb->mark = random32();
+		skb->rxhash = random32();
+		skb->queue_mapping = random32() & 0xff;
+		if (i & 1)
+			skb->dev = dev;
+	}
+
+	return 0;
+}
+
+static void __init free_test_skbs(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < TEST_SKBS; i++)
+		kfree_skb(test_skbs[i]);
+}
+
+static int __init bpf_jit_test_init(void)
+{
+	int saved_enable = bpf_jit_enable;
+
+	if (alloc_test_skbs()) {
+		pr_err("bpf_jit_test: out of memory\n");
+		free_test_skbs();
+		return -ENOMEM;
+	}
+
+	bpf_jit_enable = 1;
+
+	test_alu();
+	test_jumps();
+	test_mem();
+	test_loads();
+	test_ancillary();
+	test_seccomp();
+
+	bpf_jit_enable = saved_enable;
+	free_test_skbs();
+
+	if (tests_failed)
+		pr_err("bpf_jit_test: %u of %u programs failed\n",
+		       tests_failed, tests_run);
+	else
+		pr_info("bpf_jit_test: %u programs passed\n", tests_run);
+
+	return 0;
+}
+late_initcall(bpf_jit_test_init);
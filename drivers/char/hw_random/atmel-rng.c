@@ -12,42 +12,168 @@
 #include <linux/err.h>
 #include <linux/clk.h>
 #include <linux/io.h>
+#include <linux/interrupt.h>
+#include <linux/kfifo.h>
+#include <linux/sched.h>
+#include <linux/jiffies.h>
 #include <linux/hw_random.h>
 #include <linux/platform_device.h>
 
 #define TRNG_CR		0x00
+#define TRNG_IER	0x10
+#define TRNG_IDR	0x14
 #define TRNG_ISR	0x1c
 #define TRNG_ODATA	0x50
 
 #define TRNG_KEY	0x524e4700 /* RNG */
+#define TRNG_DATRDY	(1 << 0)
+
+/* bytes buffered ahead of the readers, must be a power of 2 */
+#define TRNG_FIFO_SIZE	512
 
 struct atmel_trng {
 	struct clk *clk;
 	void __iomem *base;
+	int irq;
 	struct hwrng rng;
+
+	/* filled from the DATRDY interrupt, drained by atmel_trng_read() */
+	DECLARE_KFIFO(fifo, u8, TRNG_FIFO_SIZE);
+	wait_queue_head_t wait;
+
+	/* statistics */
+	unsigned long bytes_read;	/* handed to the hwrng core */
+	unsigned long start;		/* jiffies at probe */
 };
 
+static inline u32 atmel_trng_read_word(struct atmel_trng *trng)
+{
+	u32 data = readl(trng->base + TRNG_ODATA);
+
+	/*
+	  ensure data ready is only set again AFTER the next data
+	  word is ready in case it got set between checking ISR
+	  and reading ODATA, so we don't risk re-reading the
+	  same word
+	*/
+	readl(trng->base + TRNG_ISR);
+
+	return data;
+}
+
+static irqreturn_t atmel_trng_interrupt(int irq, void *dev_id)
+{
+	struct atmel_trng *trng = dev_id;
+	u32 data;
+
+	if (!(readl(trng->base + TRNG_ISR) & TRNG_DATRDY))
+		return IRQ_NONE;
+
+	do {
+		data = atmel_trng_read_word(trng);
+		kfifo_in(&trng->fifo, (u8 *)&data, sizeof(data));
+
+		/* stop generating interrupts until a reader makes room */
+		if (kfifo_avail(&trng->fifo) < sizeof(data)) {
+			writel(TRNG_DATRDY, trng->base + TRNG_IDR);
+			break;
+		}
+	} while (readl(trng->base + TRNG_ISR) & TRNG_DATRDY);
+
+	wake_up(&trng->wait);
+
+	return IRQ_HANDLED;
+}
+
+/* Without an interrupt, read the words directly from the device. */
+static int atmel_trng_read_polled(struct atmel_trng *trng, void *buf,
+				  size_t max, bool wait)
+{
+	u32 *data = buf;
+	int len = 0;
+
+	while (max >= sizeof(*data)) {
+		/* data ready? a new word comes every 84 clock cycles */
+		if (!(readl(trng->base + TRNG_ISR) & TRNG_DATRDY)) {
+			if (len || !wait)
+				break;
+			cpu_relax();
+			continue;
+		}
+
+		*data++ = atmel_trng_read_word(trng);
+		len += sizeof(*data);
+		max -= sizeof(*data);
+	}
+
+	return len;
+}
+
 static int atmel_trng_read(struct hwrng *rng, void *buf, size_t max,
 			   bool wait)
 {
 	struct atmel_trng *trng = container_of(rng, struct atmel_trng, rng);
-	u32 *data = buf;
+	int len, ret;
+
+	if (trng->irq < 0) {
+		len = atmel_trng_read_polled(trng, buf, max, wait);
+	} else {
+		if (wait) {
+			ret = wait_event_interruptible(trng->wait,
+					!kfifo_is_empty(&trng->fifo));
+			if (ret)
+				return ret;
+		}
+
+		/* the hwrng core serializes readers: single consumer */
+		len = kfifo_out(&trng->fifo, buf, max);
+
+		/* there is room again, refill */
+		if (len)
+			writel(TRNG_DATRDY, trng->base + TRNG_IER);
+	}
+
+	trng->bytes_read += len;
 
-	/* data ready? */
-	if (readl(trng->base + TRNG_ISR) & 1) {
-		*data = readl(trng->base + TRNG_ODATA);
-		/*
-		  ensure data ready is only set again AFTER the next data
-		  word is ready in case it got set between checking ISR
-		  and reading ODATA, so we don't risk re-reading the
-		  same word
-		*/
-		readl(trng->base + TRNG_ISR);
-		return 4;
-	} else
-		return 0;
+	return len;
 }
 
+static ssize_t atmel_trng_show_bytes_read(struct device *dev,
+					  struct device_attribute *attr,
+					  char *buf)
+{
+	struct atmel_trng *trng = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%lu\n", trng->bytes_read);
+}
+
+/* average rate at which entropy was fed to the hwrng core, in bytes/s */
+static ssize_t atmel_trng_show_rate(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct atmel_trng *trng = dev_get_drvdata(dev);
+	unsigned int msecs = jiffies_to_msecs(jiffies - trng->start);
+
+	if (!msecs)
+		msecs = 1;
+
+	return sprintf(buf, "%llu\n",
+		       div_u64((u64)trng->bytes_read * MSEC_PER_SEC, msecs));
+}
+
+static DEVICE_ATTR(bytes_read, S_IRUGO, atmel_trng_show_bytes_read, NULL);
+static DEVICE_ATTR(rate, S_IRUGO, atmel_trng_show_rate, NULL);
+
+static struct attribute *atmel_trng_attrs[] = {
+	&dev_attr_bytes_read.attr,
+	&dev_attr_rate.attr,
+	NULL,
+};
+
+static const struct attribute_group atmel_trng_attr_group = {
+	.attrs = atmel_trng_attrs,
+};
+
 static int atmel_trng_probe(struct platform_device *pdev)
 {
 	struct atmel_trng *trng;
@@ -78,6 +204,23 @@ static int atmel_trng_probe(struct platform_device *pdev)
 	if (ret)
 		goto err_enable;
 
+	INIT_KFIFO(trng->fifo);
+	init_waitqueue_head(&trng->wait);
+	trng->start = jiffies;
+	platform_set_drvdata(pdev, trng);
+
+	/* the interrupt is optional, fall back to polling without it */
+	writel(TRNG_DATRDY, trng->base + TRNG_IDR);
+	trng->irq = platform_get_irq(pdev, 0);
+	if (trng->irq >= 0) {
+		ret = devm_request_irq(&pdev->dev, trng->irq,
+				       atmel_trng_interrupt, 0,
+				       pdev->name, trng);
+		if (ret)
+			goto err_irq;
+		writel(TRNG_DATRDY, trng->base + TRNG_IER);
+	}
+
 	writel(TRNG_KEY | 1, trng->base + TRNG_CR);
 	trng->rng.name = pdev->name;
 	trng->rng.read = atmel_trng_read;
@@ -86,11 +229,19 @@ static int atmel_trng_probe(struct platform_device *pdev)
 	if (ret)
 		goto err_register;
 
-	platform_set_drvdata(pdev, trng);
+	ret = sysfs_create_group(&pdev->dev.kobj, &atmel_trng_attr_group);
+	if (ret)
+		goto err_sysfs;
 
 	return 0;
 
+err_sysfs:
+	hwrng_unregister(&trng->rng);
 err_register:
+	writel(TRNG_KEY, trng->base + TRNG_CR);
+	writel(TRNG_DATRDY, trng->base + TRNG_IDR);
+err_irq:
+	platform_set_drvdata(pdev, NULL);
 	clk_disable(trng->clk);
 err_enable:
 	clk_put(trng->clk);
@@ -102,9 +253,11 @@ static int __devexit atmel_trng_remove(struct platform_device *pdev)
 {
 	struct atmel_trng *trng = platform_get_drvdata(pdev);
 
+	sysfs_remove_group(&pdev->dev.kobj, &atmel_trng_attr_group);
 	hwrng_unregister(&trng->rng);
 
 	writel(TRNG_KEY, trng->base + TRNG_CR);
+	writel(TRNG_DATRDY, trng->base + TRNG_IDR);
 	clk_disable(trng->clk);
 	clk_put(trng->clk);
 
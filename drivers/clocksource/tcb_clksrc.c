@@ -11,6 +11,10 @@
 #include <linux/platform_device.h>
 #include <linux/atmel_tc.h>
 
+#ifdef CONFIG_ARM
+#include <asm/sched_clock.h>
+#endif
+
 
 /*
  * We're configured to use a specific TC block, one that's not hooked
@@ -21,10 +25,16 @@
  *     resolution better than 200 nsec).
  *   - Some chips support 32 bit counter. A single channel is used for
  *     this 32 bit free-running counter. the second channel is not used.
+ *     The counter width comes from the SoC data, or is probed.
  *
- *   - The third channel may be used to provide a 16-bit clockevent
- *     source, used in either periodic or oneshot mode.  This runs
- *     at 32 KiHZ, and can handle delays of up to two seconds.
+ *   - The third channel may be used to provide a clockevent source,
+ *     used in either periodic or oneshot mode.  With 16-bit counters
+ *     this runs at 32 KiHZ, and can handle delays of up to two seconds.
+ *     With 32-bit counters (or ATMEL_TCB_CLKEVT_HRES) it runs from the
+ *     same divided MCK as the clocksource, for sub-microsecond timers;
+ *     32 bits still allow several minutes between two ticks.
+ *
+ *   - On ARM the clocksource also backs sched_clock().
  *
  * A boot clocksource and clockevent source are also currently needed,
  * unless the relevant platforms (ARM/AT91, AVR32/AT32) are changed so
@@ -41,7 +51,9 @@
 
 static void __iomem *tcaddr;
 
-static cycle_t tc_get_cycles(struct clocksource *cs)
+static struct clocksource clksrc;
+
+static cycle_t notrace tc_get_cycles(struct clocksource *cs)
 {
 	unsigned long	flags;
 	u32		lower, upper;
@@ -61,6 +73,35 @@ static cycle_t tc_get_cycles32(struct clocksource *cs)
 	return __raw_readl(tcaddr + ATMEL_TC_REG(0, CV));
 }
 
+#ifdef CONFIG_ARM
+static u32 notrace tc_sched_clock_read(void)
+{
+	return tc_get_cycles(&clksrc);
+}
+
+/* a single load: the cheapest sched_clock() we can get */
+static u32 notrace tc_sched_clock_read32(void)
+{
+	return __raw_readl(tcaddr + ATMEL_TC_REG(0, CV));
+}
+
+static void __init tcb_setup_sched_clock(int counter_width, u32 rate)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	if (counter_width == 32)
+		setup_sched_clock(tc_sched_clock_read32, 32, rate);
+	else
+		setup_sched_clock(tc_sched_clock_read, 32, rate);
+	local_irq_restore(flags);
+}
+#else
+static void __init tcb_setup_sched_clock(int counter_width, u32 rate)
+{
+}
+#endif
+
 static struct clocksource clksrc = {
 	.name           = "tcb_clksrc",
 	.rating         = 200,
@@ -75,6 +116,7 @@ struct tc_clkevt_device {
 	struct clock_event_device	clkevt;
 	struct clk			*clk;
 	void __iomem			*regs;
+	u32				rate;
 };
 
 static struct tc_clkevt_device *to_tc_clkevt(struct clock_event_device *clkevt)
@@ -82,12 +124,13 @@ static struct tc_clkevt_device *to_tc_clkevt(struct clock_event_device *clkevt)
 	return container_of(clkevt, struct tc_clkevt_device, clkevt);
 }
 
-/* For now, we always use the 32K clock ... this optimizes for NO_HZ,
- * because using one of the divided clocks would usually mean the
- * tick rate can never be less than several dozen Hz (vs 0.5 Hz).
+/* With 16-bit counters we use the 32K clock by default ... this optimizes
+ * for NO_HZ, because using one of the divided clocks would usually mean
+ * the tick rate can never be less than several dozen Hz (vs 0.5 Hz).
  *
- * A divided clock could be good for high resolution timers, since
- * 30.5 usec resolution can seem "low".
+ * A divided clock is good for high resolution timers, since 30.5 usec
+ * resolution can seem "low"; 32-bit counters get it without the NO_HZ
+ * penalty.
  */
 static u32 timer_clock;
 
@@ -111,11 +154,11 @@ static void tc_mode(enum clock_event_mode m, struct clock_event_device *d)
 	case CLOCK_EVT_MODE_PERIODIC:
 		clk_enable(tcd->clk);
 
-		/* slow clock, count up to RC, then irq and restart */
+		/* count up to RC, then irq and restart */
 		__raw_writel(timer_clock
 				| ATMEL_TC_WAVE | ATMEL_TC_WAVESEL_UP_AUTO,
 				regs + ATMEL_TC_REG(2, CMR));
-		__raw_writel((32768 + HZ/2) / HZ, tcaddr + ATMEL_TC_REG(2, RC));
+		__raw_writel((tcd->rate + HZ/2) / HZ, tcaddr + ATMEL_TC_REG(2, RC));
 
 		/* Enable clock and interrupts on RC compare */
 		__raw_writel(ATMEL_TC_CPCS, regs + ATMEL_TC_REG(2, IER));
@@ -128,7 +171,7 @@ static void tc_mode(enum clock_event_mode m, struct clock_event_device *d)
 	case CLOCK_EVT_MODE_ONESHOT:
 		clk_enable(tcd->clk);
 
-		/* slow clock, count up to RC, then irq and stop */
+		/* count up to RC, then irq and stop */
 		__raw_writel(timer_clock | ATMEL_TC_CPCSTOP
 				| ATMEL_TC_WAVE | ATMEL_TC_WAVESEL_UP_AUTO,
 				regs + ATMEL_TC_REG(2, CMR));
@@ -157,7 +200,6 @@ static struct tc_clkevt_device clkevt = {
 		.name		= "tc_clkevt",
 		.features	= CLOCK_EVT_FEAT_PERIODIC
 					| CLOCK_EVT_FEAT_ONESHOT,
-		.shift		= 32,
 		/* Should be lower than at91rm9200's system timer */
 		.rating		= 125,
 		.set_next_event	= tc_next_event,
@@ -185,31 +227,35 @@ static struct irqaction tc_irqaction = {
 	.handler	= ch2_irq,
 };
 
-static void __init setup_clkevents(struct atmel_tc *tc, int clk32k_divisor_idx)
+static void __init setup_clkevents(struct atmel_tc *tc, int divisor_idx,
+				   u32 rate, int counter_width)
 {
 	struct clk *t2_clk = tc->clk[2];
 	int irq = tc->irq[2];
+	u32 max_count = counter_width == 32 ? 0xffffffff : 0xffff;
 
 	clkevt.regs = tc->regs;
 	clkevt.clk = t2_clk;
+	clkevt.rate = rate;
 	tc_irqaction.dev_id = &clkevt;
 
-	timer_clock = clk32k_divisor_idx;
+	timer_clock = divisor_idx;
+
+	/* a fast clock on a 16-bit counter can't hold a whole tick */
+	if ((rate + HZ/2) / HZ > max_count)
+		clkevt.clkevt.features &= ~CLOCK_EVT_FEAT_PERIODIC;
 
-	clkevt.clkevt.mult = div_sc(32768, NSEC_PER_SEC, clkevt.clkevt.shift);
-	clkevt.clkevt.max_delta_ns
-		= clockevent_delta2ns(0xffff, &clkevt.clkevt);
-	clkevt.clkevt.min_delta_ns = clockevent_delta2ns(1, &clkevt.clkevt) + 1;
 	clkevt.clkevt.cpumask = cpumask_of(0);
 
-	clockevents_register_device(&clkevt.clkevt);
+	clockevents_config_and_register(&clkevt.clkevt, rate, 1, max_count);
 
 	setup_irq(irq, &tc_irqaction);
 }
 
 #else /* !CONFIG_GENERIC_CLOCKEVENTS */
 
-static void __init setup_clkevents(struct atmel_tc *tc, int clk32k_divisor_idx)
+static void __init setup_clkevents(struct atmel_tc *tc, int divisor_idx,
+				   u32 rate, int counter_width)
 {
 	/* NOTHING */
 }
@@ -258,6 +304,24 @@ static void __init tcb_setup_single_chan(struct atmel_tc *tc, int mck_divisor_id
 	__raw_writel(ATMEL_TC_SYNC, tcaddr + ATMEL_TC_BCR);
 }
 
+/*
+ * RC is as wide as the counter: on 16-bit blocks the upper half of
+ * anything written to it reads back as zero.
+ */
+static int __init tcb_counter_width(struct atmel_tc *tc)
+{
+	u32 rc;
+
+	if (tc->tcb_config)
+		return tc->tcb_config->counter_width;
+
+	__raw_writel(0xffffffff, tcaddr + ATMEL_TC_REG(0, RC));
+	rc = __raw_readl(tcaddr + ATMEL_TC_REG(0, RC));
+	__raw_writel(0, tcaddr + ATMEL_TC_REG(0, RC));
+
+	return rc > 0xffff ? 32 : 16;
+}
+
 static int __init tcb_clksrc_init(void)
 {
 	static char bootinfo[] __initdata
@@ -269,6 +333,7 @@ static int __init tcb_clksrc_init(void)
 	u32 rate, divided_rate = 0;
 	int best_divisor_idx = -1;
 	int clk32k_divisor_idx = -1;
+	int counter_width;
 	int i;
 
 	tc = atmel_tc_alloc(CONFIG_ATMEL_TCB_CLKSRC_BLOCK, clksrc.name);
@@ -309,7 +374,8 @@ static int __init tcb_clksrc_init(void)
 			divided_rate / 1000000,
 			((divided_rate + 500000) % 1000000) / 1000);
 
-	if (tc->tcb_config && tc->tcb_config->counter_width == 32) {
+	counter_width = tcb_counter_width(tc);
+	if (counter_width == 32) {
 		/* use apropriate function to read 32 bit counter */
 		clksrc.read = tc_get_cycles32;
 		/* setup ony channel 0 */
@@ -325,9 +391,14 @@ static int __init tcb_clksrc_init(void)
 
 	/* and away we go! */
 	clocksource_register_hz(&clksrc, divided_rate);
+	tcb_setup_sched_clock(counter_width, divided_rate);
 
 	/* channel 2:  periodic and oneshot timer support */
-	setup_clkevents(tc, clk32k_divisor_idx);
+	if (counter_width == 32 || IS_ENABLED(CONFIG_ATMEL_TCB_CLKEVT_HRES))
+		setup_clkevents(tc, best_divisor_idx, divided_rate,
+				counter_width);
+	else
+		setup_clkevents(tc, clk32k_divisor_idx, 32768, counter_width);
 
 	return 0;
 }
@@ -0,0 +1,195 @@
+/*
+ * CPU frequency scaling for Atmel AT91SAM9 and SAMA5 SoCs
+ *
+ * Copyright (C) 2012 Atmel Corporation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The processor clock is scaled through the "cpu" clock, which trades
+ * the PMC prescaler against the master clock divider: the master clock
+ * (MCK) and all peripheral clocks keep their rate, so neither the
+ * timers nor the peripheral drivers need to know about a transition.
+ * The PLLs are left as configured by the bootloader.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/clk.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+
+/* at most PRES 1..64 */
+#define AT91_CPUFREQ_MAX_STEPS	7
+
+/* a couple of MCKRDY waits */
+#define AT91_CPUFREQ_LATENCY	10000	/* ns */
+
+static struct clk *cpu_clk;
+static struct cpufreq_frequency_table *at91_freq_table;
+
+static int at91_cpufreq_verify(struct cpufreq_policy *policy)
+{
+	if (policy->cpu != 0)
+		return -EINVAL;
+
+	return cpufreq_frequency_table_verify(policy, at91_freq_table);
+}
+
+static unsigned int at91_cpufreq_get(unsigned int cpu)
+{
+	if (cpu)
+		return 0;
+
+	return clk_get_rate(cpu_clk) / 1000;
+}
+
+static int at91_cpufreq_target(struct cpufreq_policy *policy,
+			       unsigned int target_freq, unsigned int relation)
+{
+	struct cpufreq_freqs freqs;
+	unsigned int index;
+	int ret;
+
+	ret = cpufreq_frequency_table_target(policy, at91_freq_table,
+					     target_freq, relation, &index);
+	if (ret)
+		return ret;
+
+	freqs.old = at91_cpufreq_get(0);
+	freqs.new = at91_freq_table[index].frequency;
+	freqs.cpu = 0;
+	freqs.flags = 0;
+
+	if (freqs.old == freqs.new)
+		return 0;
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+
+	ret = clk_set_rate(cpu_clk, freqs.new * 1000);
+	if (ret) {
+		pr_err("at91-cpufreq: cannot set CPU clock to %u kHz\n",
+		       freqs.new);
+		freqs.new = freqs.old;
+	}
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+
+	return ret;
+}
+
+/*
+ * Build the frequency table from what the clock code can actually reach
+ * from the maximum rate, this depends on the MCK divider set up by the
+ * bootloader.
+ */
+static int at91_cpufreq_table_init(unsigned long max)
+{
+	long rate, prev = 0;
+	int i, n = 0;
+
+	at91_freq_table = kcalloc(AT91_CPUFREQ_MAX_STEPS + 1,
+				  sizeof(*at91_freq_table), GFP_KERNEL);
+	if (!at91_freq_table)
+		return -ENOMEM;
+
+	for (i = 0; i < AT91_CPUFREQ_MAX_STEPS; i++) {
+		rate = clk_round_rate(cpu_clk, max >> i);
+		if (rate <= 0 || rate == prev)
+			continue;
+
+		at91_freq_table[n].index = n;
+		at91_freq_table[n].frequency = rate / 1000;
+		prev = rate;
+		n++;
+	}
+
+	at91_freq_table[n].index = n;
+	at91_freq_table[n].frequency = CPUFREQ_TABLE_END;
+
+	if (n < 2) {
+		kfree(at91_freq_table);
+		at91_freq_table = NULL;
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+static int at91_cpufreq_init(struct cpufreq_policy *policy)
+{
+	int ret;
+
+	if (policy->cpu != 0)
+		return -EINVAL;
+
+	cpu_clk = clk_get(NULL, "cpu");
+	if (IS_ERR(cpu_clk)) {
+		pr_err("at91-cpufreq: failed to get cpu clock\n");
+		return PTR_ERR(cpu_clk);
+	}
+
+	ret = at91_cpufreq_table_init(clk_get_rate(cpu_clk));
+	if (ret) {
+		if (ret == -ENODEV)
+			pr_info("at91-cpufreq: no frequency scaling possible\n");
+		goto err_put;
+	}
+
+	ret = cpufreq_frequency_table_cpuinfo(policy, at91_freq_table);
+	if (ret)
+		goto err_free;
+
+	policy->cur = at91_cpufreq_get(0);
+	policy->cpuinfo.transition_latency = AT91_CPUFREQ_LATENCY;
+
+	cpufreq_frequency_table_get_attr(at91_freq_table, policy->cpu);
+
+	pr_info("at91-cpufreq: %u - %u kHz\n",
+		policy->cpuinfo.min_freq, policy->cpuinfo.max_freq);
+
+	return 0;
+
+err_free:
+	kfree(at91_freq_table);
+	at91_freq_table = NULL;
+err_put:
+	clk_put(cpu_clk);
+	return ret;
+}
+
+static int at91_cpufreq_exit(struct cpufreq_policy *policy)
+{
+	cpufreq_frequency_table_put_attr(policy->cpu);
+
+	clk_set_rate(cpu_clk, policy->cpuinfo.max_freq * 1000);
+	clk_put(cpu_clk);
+	kfree(at91_freq_table);
+	at91_freq_table = NULL;
+
+	return 0;
+}
+
+static struct freq_attr *at91_cpufreq_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	NULL,
+};
+
+static struct cpufreq_driver at91_cpufreq_driver = {
+	.flags		= CPUFREQ_STICKY,
+	.verify		= at91_cpufreq_verify,
+	.target		= at91_cpufreq_target,
+	.get		= at91_cpufreq_get,
+	.init		= at91_cpufreq_init,
+	.exit		= at91_cpufreq_exit,
+	.name		= "at91",
+	.attr		= at91_cpufreq_attr,
+};
+
+static int __init at91_cpufreq_driver_init(void)
+{
+	return cpufreq_register_driver(&at91_cpufreq_driver);
+}
+late_initcall(at91_cpufreq_driver_init);
@@ -337,6 +337,41 @@ out:
 	return ret;
 }
 
+/*
+ * atc_get_cyclic_bytes_left -
+ * Get the number of bytes left before the end of a cyclic buffer.
+ * Unlike atc_get_bytes_left() this does not pause the channel nor depend
+ * on the BTC bookkeeping: the memory side address register directly gives
+ * the position inside the ring, which is what audio pointers need.
+ * Called with atchan->lock held.
+ * @chan: the cyclic channel
+ */
+static int atc_get_cyclic_bytes_left(struct dma_chan *chan)
+{
+	struct at_dma_chan	*atchan = to_at_dma_chan(chan);
+	struct at_desc		*first;
+	dma_addr_t		start, cur;
+
+	if (list_empty(&atchan->active_list))
+		return 0;
+
+	first = atc_first_active(atchan);
+	if ((first->lli.ctrlb & ATC_SRC_ADDR_MODE_MASK)
+			== ATC_SRC_ADDR_MODE_INCR) {
+		/* memory to peripheral: buffer is the source */
+		start = first->lli.saddr;
+		cur = channel_readl(atchan, SADDR);
+	} else {
+		start = first->lli.daddr;
+		cur = channel_readl(atchan, DADDR);
+	}
+
+	if (cur < start || cur - start > first->len)
+		return -EINVAL;
+
+	return first->len - (cur - start);
+}
+
 /**
  * atc_chain_complete - finish work for one transaction chain
  * @atchan: channel we work on
@@ -1160,7 +1195,10 @@ atc_tx_status(struct dma_chan *chan,
 	spin_lock_irqsave(&atchan->lock, flags);
 
 	/*  Get number of bytes left in the active transactions */
-	bytes = atc_get_bytes_left(chan);
+	if (atc_chan_is_cyclic(atchan))
+		bytes = atc_get_cyclic_bytes_left(chan);
+	else
+		bytes = atc_get_bytes_left(chan);
 
 	spin_unlock_irqrestore(&atchan->lock, flags);
 
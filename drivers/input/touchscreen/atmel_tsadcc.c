@@ -22,6 +22,8 @@
 #include <linux/clk.h>
 #include <linux/platform_device.h>
 #include <linux/io.h>
+#include <linux/dma-mapping.h>
+#include <linux/atmel_pdc.h>
 #include <mach/board.h>
 #include <mach/cpu.h>
 
@@ -32,6 +34,21 @@
 #define ADC_DEFAULT_CLOCK	100000
 #define ZTHRESHOLD		3200
 
+#define TS_DEFAULT_SAMPLES	5
+#define TS_MAX_SAMPLES		15
+#define TS_DEFAULT_RATE		100	/* reports per second */
+
+/*
+ * Minimum trigger period, in ADC clock cycles: see the comment about the
+ * internal resistor in the pen detection code.
+ */
+#define TS_MIN_TRGPER		0xff
+#define TS_MAX_TRGPER		0xffffU	/* width of the TRGPER field */
+
+/* The pre-9x5 controller converts X, Xref, Y and Yref (CDR0..3) */
+#define TS_PDC_CHANNELS		4
+#define TS_PDC_BUF_SIZE(n)	(2 * TS_PDC_CHANNELS * (n) * sizeof(u16))
+
 struct atmel_tsadcc {
 	struct input_dev	*input;
 	char			phys[32];
@@ -41,6 +58,28 @@ struct atmel_tsadcc {
 	unsigned int		prev_absy;
 	unsigned int		prev_absz;
 
+	/*
+	 * Each report is the median of nr_samples conversions, those with
+	 * a pressure above the threshold being dropped.  Conversions are
+	 * triggered every trgper ADC clocks so that reports come at the
+	 * configured rate.
+	 */
+	unsigned int		nr_samples;
+	unsigned int		trgper;
+	unsigned int		taken;
+	unsigned int		valid;
+	unsigned int		x[TS_MAX_SAMPLES];
+	unsigned int		y[TS_MAX_SAMPLES];
+	unsigned int		z[TS_MAX_SAMPLES];
+
+	/*
+	 * Pre-9x5 controllers: the PDC fills two halves of pdc_buf in turn,
+	 * each with nr_samples X/Y conversions, and interrupts once per half.
+	 */
+	u16			*pdc_buf;
+	dma_addr_t		pdc_dma;
+	unsigned int		pdc_half;
+
 	struct at91_tsadcc_data board;
 };
 
@@ -60,6 +99,117 @@ static void atmel_tsadcc_dump_conf(struct platform_device *pdev)
 	dev_info(&pdev->dev, "---------------------\n");
 }
 
+static unsigned int atmel_tsadcc_median(unsigned int *v, unsigned int n)
+{
+	unsigned int i, j, tmp;
+
+	/* insertion sort, n is small */
+	for (i = 1; i < n; i++) {
+		tmp = v[i];
+		for (j = i; j > 0 && v[j - 1] > tmp; j--)
+			v[j] = v[j - 1];
+		v[j] = tmp;
+	}
+
+	return v[(n - 1) / 2];
+}
+
+static void atmel_tsadcc_report(struct atmel_tsadcc *ts_dev)
+{
+	struct input_dev *input_dev = ts_dev->input;
+	unsigned int n = ts_dev->valid;
+
+	ts_dev->taken = 0;
+	ts_dev->valid = 0;
+
+	/* report only when most of the burst had enough pressure */
+	if (2 * n <= ts_dev->nr_samples) {
+		dev_dbg(&input_dev->dev, "pressure too low: not reporting\n");
+		return;
+	}
+
+	ts_dev->prev_absx = atmel_tsadcc_median(ts_dev->x, n);
+	ts_dev->prev_absy = atmel_tsadcc_median(ts_dev->y, n);
+	ts_dev->prev_absz = atmel_tsadcc_median(ts_dev->z, n);
+
+	dev_dbg(&input_dev->dev,
+			"x = %d, y = %d, pressure = %d\n",
+			ts_dev->prev_absx, ts_dev->prev_absy,
+			ts_dev->prev_absz);
+	input_report_abs(input_dev, ABS_X, ts_dev->prev_absx);
+	input_report_abs(input_dev, ABS_Y, ts_dev->prev_absy);
+	if (cpu_has_9x5_adc())
+		input_report_abs(input_dev, ABS_PRESSURE, ts_dev->prev_absz);
+	input_report_key(input_dev, BTN_TOUCH, 1);
+	input_sync(input_dev);
+}
+
+static void atmel_tsadcc_add_sample(struct atmel_tsadcc *ts_dev,
+				    unsigned int x, unsigned int y,
+				    unsigned int z)
+{
+	if (z < ts_dev->board.pressure_threshold) {
+		ts_dev->x[ts_dev->valid] = x;
+		ts_dev->y[ts_dev->valid] = y;
+		ts_dev->z[ts_dev->valid] = z;
+		ts_dev->valid++;
+	}
+
+	if (++ts_dev->taken == ts_dev->nr_samples)
+		atmel_tsadcc_report(ts_dev);
+}
+
+/* Start filling both PDC buffers, at pen contact */
+static void atmel_tsadcc_pdc_start(struct atmel_tsadcc *ts_dev)
+{
+	unsigned int count = ts_dev->nr_samples * TS_PDC_CHANNELS;
+
+	/* drop a stale conversion so that the buffers stay aligned */
+	atmel_tsadcc_read(ATMEL_TSADCC_LCDR);
+
+	atmel_tsadcc_write(ATMEL_PDC_RPR, ts_dev->pdc_dma);
+	atmel_tsadcc_write(ATMEL_PDC_RCR, count);
+	atmel_tsadcc_write(ATMEL_PDC_RNPR, ts_dev->pdc_dma + count * sizeof(u16));
+	atmel_tsadcc_write(ATMEL_PDC_RNCR, count);
+	atmel_tsadcc_write(ATMEL_PDC_PTCR, ATMEL_PDC_RXTEN);
+	ts_dev->pdc_half = 0;
+}
+
+static void atmel_tsadcc_pdc_stop(struct atmel_tsadcc *ts_dev)
+{
+	atmel_tsadcc_write(ATMEL_PDC_PTCR, ATMEL_PDC_RXTDIS);
+	atmel_tsadcc_write(ATMEL_PDC_RCR, 0);
+	atmel_tsadcc_write(ATMEL_PDC_RNCR, 0);
+}
+
+/* One half of the buffer is complete, the PDC went on with the other */
+static void atmel_tsadcc_pdc_rx(struct atmel_tsadcc *ts_dev)
+{
+	unsigned int count = ts_dev->nr_samples * TS_PDC_CHANNELS;
+	unsigned int offset = ts_dev->pdc_half * count;
+	u16 *buf = ts_dev->pdc_buf + offset;
+	unsigned int i, x, y;
+
+	for (i = 0; i < ts_dev->nr_samples; i++, buf += TS_PDC_CHANNELS) {
+		if (!buf[2] || !buf[0]) {
+			/* contact lost during this one */
+			ts_dev->taken++;
+			continue;
+		}
+		x = (buf[3] << 10) / buf[2];
+		y = (buf[1] << 10) / buf[0];
+		atmel_tsadcc_add_sample(ts_dev, x, y, 0);
+	}
+	if (ts_dev->taken == ts_dev->nr_samples)
+		atmel_tsadcc_report(ts_dev);
+
+	/* hand the half back as next buffer */
+	atmel_tsadcc_write(ATMEL_PDC_RNPR,
+			   ts_dev->pdc_dma + offset * sizeof(u16));
+	atmel_tsadcc_write(ATMEL_PDC_RNCR, count);
+	ts_dev->pdc_half ^= 1;
+}
+
 static irqreturn_t atmel_tsadcc_interrupt(int irq, void *dev)
 {
 	struct atmel_tsadcc	*ts_dev = (struct atmel_tsadcc *)dev;
@@ -68,6 +218,7 @@ static irqreturn_t atmel_tsadcc_interrupt(int irq, void *dev)
 
 	unsigned int status;
 	unsigned int reg;
+	unsigned int x, y, z;
 	unsigned int z1, z2;
 	unsigned int Rxp = 1;
 	unsigned int factor = 1000;
@@ -86,10 +237,20 @@ static irqreturn_t atmel_tsadcc_interrupt(int irq, void *dev)
 			atmel_tsadcc_write(ATMEL_TSADCC_MR, reg);
 		}
 		atmel_tsadcc_write(ATMEL_TSADCC_TRGR, ATMEL_TSADCC_TRGMOD_NONE);
-		atmel_tsadcc_write(ATMEL_TSADCC_IDR,
-				   ATMEL_TSADCC_CONVERSION_END | ATMEL_TSADCC_NOCNT);
+		if (cpu_has_9x5_adc()) {
+			atmel_tsadcc_write(ATMEL_TSADCC_IDR,
+					   ATMEL_TSADCC_CONVERSION_END | ATMEL_TSADCC_NOCNT);
+		} else {
+			atmel_tsadcc_write(ATMEL_TSADCC_IDR,
+					   ATMEL_TSADCC_ENDRX | ATMEL_TSADCC_NOCNT);
+			atmel_tsadcc_pdc_stop(ts_dev);
+		}
 		atmel_tsadcc_write(ATMEL_TSADCC_IER, ATMEL_TSADCC_PENCNT);
 
+		/* a partial burst is not reported */
+		ts_dev->taken = 0;
+		ts_dev->valid = 0;
+
 		input_report_key(input_dev, BTN_TOUCH, 0);
 		input_sync(input_dev);
 
@@ -106,8 +267,14 @@ static irqreturn_t atmel_tsadcc_interrupt(int irq, void *dev)
 		}
 
 		atmel_tsadcc_write(ATMEL_TSADCC_IDR, ATMEL_TSADCC_PENCNT);
-		atmel_tsadcc_write(ATMEL_TSADCC_IER,
-				   ATMEL_TSADCC_CONVERSION_END | ATMEL_TSADCC_NOCNT);
+		if (cpu_has_9x5_adc()) {
+			atmel_tsadcc_write(ATMEL_TSADCC_IER,
+					   ATMEL_TSADCC_CONVERSION_END | ATMEL_TSADCC_NOCNT);
+		} else {
+			atmel_tsadcc_pdc_start(ts_dev);
+			atmel_tsadcc_write(ATMEL_TSADCC_IER,
+					   ATMEL_TSADCC_ENDRX | ATMEL_TSADCC_NOCNT);
+		}
 		/* this value is related to the resistor bits value of
 		 * ACR register and R64. If internal resistor value is
 		 * increased then this value has to be increased. This
@@ -115,60 +282,38 @@ static irqreturn_t atmel_tsadcc_interrupt(int irq, void *dev)
 		 * values
 		 */
 		atmel_tsadcc_write(ATMEL_TSADCC_TRGR,
-				   ATMEL_TSADCC_TRGMOD_PERIOD | (0x0FF << 16));
+				   ATMEL_TSADCC_TRGMOD_PERIOD | (ts_dev->trgper << 16));
+
+	} else if (!cpu_has_9x5_adc() && (status & ATMEL_TSADCC_ENDRX)) {
+		/* A burst of conversions is in memory */
+		atmel_tsadcc_pdc_rx(ts_dev);
 
 	} else if ((status & ATMEL_TSADCC_CONVERSION_END) == ATMEL_TSADCC_CONVERSION_END) {
 		/* Conversion finished */
+		unsigned int xscale, yscale;
+
+		/* calculate position */
+		reg = atmel_tsadcc_read(ATMEL_TSADCC_XPOSR);
+		x = (reg & ATMEL_TSADCC_XPOS) << 10;
+		xscale = (reg & ATMEL_TSADCC_XSCALE) >> 16;
+		x /= xscale ? xscale: 1;
+
+		reg = atmel_tsadcc_read(ATMEL_TSADCC_YPOSR);
+		y = (reg & ATMEL_TSADCC_YPOS) << 10;
+		yscale = (reg & ATMEL_TSADCC_YSCALE) >> 16;
+		y /= yscale ? yscale: 1 << 10;
+
+		/* calculate the pressure */
+		reg = atmel_tsadcc_read(ATMEL_TSADCC_PRESSR);
+		z1 = reg & ATMEL_TSADCC_PRESSR_Z1;
+		z2 = (reg & ATMEL_TSADCC_PRESSR_Z2) >> 16;
+
+		if (z1 != 0)
+			z = Rxp * (x * factor / 1024) * (z2 * factor / z1 - factor) / factor;
+		else
+			z = 0;
 
-		/* make new measurement */
-		if (cpu_has_9x5_adc()) {
-			unsigned int xscale, yscale;
-
-			/* calculate position */
-			reg = atmel_tsadcc_read(ATMEL_TSADCC_XPOSR);
-			ts_dev->prev_absx = (reg & ATMEL_TSADCC_XPOS) << 10;
-			xscale = (reg & ATMEL_TSADCC_XSCALE) >> 16;
-			ts_dev->prev_absx /= xscale ? xscale: 1;
-
-			reg = atmel_tsadcc_read(ATMEL_TSADCC_YPOSR);
-			ts_dev->prev_absy = (reg & ATMEL_TSADCC_YPOS) << 10;
-			yscale = (reg & ATMEL_TSADCC_YSCALE) >> 16;
-			ts_dev->prev_absy /= yscale ? yscale: 1 << 10;
-
-			/* calculate the pressure */
-			reg = atmel_tsadcc_read(ATMEL_TSADCC_PRESSR);
-			z1 = reg & ATMEL_TSADCC_PRESSR_Z1;
-			z2 = (reg & ATMEL_TSADCC_PRESSR_Z2) >> 16;
-
-			if (z1 != 0)
-				ts_dev->prev_absz = Rxp * (ts_dev->prev_absx * factor / 1024) * (z2 * factor / z1 - factor) / factor;
-			else
-				ts_dev->prev_absz = 0;
-
-		} else {
-			ts_dev->prev_absx = atmel_tsadcc_read(ATMEL_TSADCC_CDR3) << 10;
-			ts_dev->prev_absx /= atmel_tsadcc_read(ATMEL_TSADCC_CDR2);
-
-			ts_dev->prev_absy = atmel_tsadcc_read(ATMEL_TSADCC_CDR1) << 10;
-			ts_dev->prev_absy /= atmel_tsadcc_read(ATMEL_TSADCC_CDR0);
-		}
-
-		/* report measurement to input layer */
-		if (ts_dev->prev_absz < ZTHRESHOLD) {
-			dev_dbg(&input_dev->dev,
-					"x = %d, y = %d, pressure = %d\n",
-					ts_dev->prev_absx, ts_dev->prev_absy,
-					ts_dev->prev_absz);
-			input_report_abs(input_dev, ABS_X, ts_dev->prev_absx);
-			input_report_abs(input_dev, ABS_Y, ts_dev->prev_absy);
-			if (cpu_has_9x5_adc())
-				input_report_abs(input_dev, ABS_PRESSURE, ts_dev->prev_absz);
-			input_report_key(input_dev, BTN_TOUCH, 1);
-			input_sync(input_dev);
-		} else {
-			dev_dbg(&input_dev->dev,
-					"pressure too low: not reporting\n");
-		}
+		atmel_tsadcc_add_sample(ts_dev, x, y, z);
 	}
 
 	return IRQ_HANDLED;
@@ -220,6 +365,21 @@ static int __devinit atmel_of_init_tsadcc(struct device_node *np,
 		pdata->ts_sample_hold_time = (u8)val;
 	}
 
+	if (of_property_read_u32(np, "atmel,filtering_median", &val) == 0) {
+		if (val > TS_MAX_SAMPLES) {
+			dev_err(&pdev->dev, "invalid median filter length, %u\n",
+				val);
+			return -EINVAL;
+		}
+		pdata->filtering_median = (u8)val;
+	}
+
+	if (of_property_read_u32(np, "atmel,report_rate", &val) == 0)
+		pdata->report_rate = val;
+
+	if (of_property_read_u32(np, "atmel,pressure_threshold", &val) == 0)
+		pdata->pressure_threshold = val;
+
 	return 0;
 }
 #else
@@ -351,6 +511,36 @@ static int __devinit atmel_tsadcc_probe(struct platform_device *pdev)
 
 	dev_info(&pdev->dev, "Prescaler is set at: %d\n", prsc);
 
+	if (!pdata->filtering_median)
+		pdata->filtering_median = TS_DEFAULT_SAMPLES;
+	if (pdata->filtering_median > TS_MAX_SAMPLES)
+		pdata->filtering_median = TS_MAX_SAMPLES;
+	if (!pdata->report_rate)
+		pdata->report_rate = TS_DEFAULT_RATE;
+	if (!pdata->pressure_threshold)
+		pdata->pressure_threshold = ZTHRESHOLD;
+	ts_dev->nr_samples = pdata->filtering_median;
+
+	/* trigger period = (TRGPER + 1) ADC clock cycles */
+	ts_dev->trgper = clk_get_rate(ts_dev->clk) / (2 * (prsc + 1));
+	ts_dev->trgper /= pdata->report_rate * ts_dev->nr_samples;
+	ts_dev->trgper = clamp_t(unsigned int, ts_dev->trgper,
+				 TS_MIN_TRGPER + 1, TS_MAX_TRGPER + 1) - 1;
+
+	dev_info(&pdev->dev, "Median of %u samples, trigger period %u\n",
+		 ts_dev->nr_samples, ts_dev->trgper);
+
+	if (!cpu_has_9x5_adc()) {
+		ts_dev->pdc_buf = dma_alloc_coherent(&pdev->dev,
+				TS_PDC_BUF_SIZE(ts_dev->nr_samples),
+				&ts_dev->pdc_dma, GFP_KERNEL);
+		if (!ts_dev->pdc_buf) {
+			dev_err(&pdev->dev, "failed to allocate PDC buffer.\n");
+			err = -ENOMEM;
+			goto err_fail;
+		}
+	}
+
 	if (cpu_has_9x5_adc()) {
 		reg = 	((0x00 << 5) & ATMEL_TSADCC_SLEEP)	|	/* no Sleep Mode */
 			((0x00 << 6) & ATMEL_TSADCC_FWUP)	|	/* no Fast Wake Up needed */
@@ -401,10 +591,15 @@ static int __devinit atmel_tsadcc_probe(struct platform_device *pdev)
 	/* All went ok, so register to the input system */
 	err = input_register_device(input_dev);
 	if (err)
-		goto err_fail;
+		goto err_free_pdc;
 
 	return 0;
 
+err_free_pdc:
+	if (ts_dev->pdc_buf)
+		dma_free_coherent(&pdev->dev,
+				TS_PDC_BUF_SIZE(ts_dev->nr_samples),
+				ts_dev->pdc_buf, ts_dev->pdc_dma);
 err_fail:
 	clk_disable(ts_dev->clk);
 	clk_put(ts_dev->clk);
@@ -430,6 +625,13 @@ static int __devexit atmel_tsadcc_remove(struct platform_device *pdev)
 
 	input_unregister_device(ts_dev->input);
 
+	if (ts_dev->pdc_buf) {
+		atmel_tsadcc_pdc_stop(ts_dev);
+		dma_free_coherent(&pdev->dev,
+				TS_PDC_BUF_SIZE(ts_dev->nr_samples),
+				ts_dev->pdc_buf, ts_dev->pdc_dma);
+	}
+
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	iounmap(tsc_base);
 	release_mem_region(res->start, resource_size(res));
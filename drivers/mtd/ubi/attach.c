@@ -806,7 +806,7 @@ out_unlock:
 }
 
 /**
- * scan_peb - scan and process UBI headers of a PEB.
+ * ubi_scan_peb - scan and process UBI headers of a PEB.
  * @ubi: UBI device description object
  * @ai: attaching information
  * @pnum: the physical eraseblock number
@@ -816,8 +816,7 @@ out_unlock:
  * "attaching info" structure. Returns zero if the physical eraseblock was
  * successfully handled and a negative error code in case of failure.
  */
-static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
-		    int pnum)
+int ubi_scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai, int pnum)
 {
 	long long uninitialized_var(ec);
 	int err, bitflips = 0, vol_id, ec_err = 0;
@@ -997,8 +996,12 @@ static int scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai,
 		/* Unsupported internal volume */
 		switch (vidh->compat) {
 		case UBI_COMPAT_DELETE:
-			ubi_msg("\"delete\" compatible internal volume %d:%d"
-				" found, will remove it", vol_id, lnum);
+			/* Stale fastmap PEBs are expected, do not shout */
+			if (vol_id != UBI_FM_SB_VOLUME_ID &&
+			    vol_id != UBI_FM_DATA_VOLUME_ID)
+				ubi_msg("\"delete\" compatible internal volume"
+					" %d:%d found, will remove it",
+					vol_id, lnum);
 			err = add_to_list(ai, pnum, vol_id, lnum,
 					  ec, 1, &ai->erase);
 			if (err)
@@ -1123,24 +1126,18 @@ static int late_analysis(struct ubi_device *ubi, struct ubi_attach_info *ai)
 }
 
 /**
- * scan_all - scan entire MTD device.
- * @ubi: UBI device description object
+ * alloc_ai - allocate attaching information.
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it in form of a "struct ubi_attach_info" object. In case
- * of failure, an error code is returned.
+ * This function returns a pointer to a new and empty attaching information
+ * object, or %NULL if there is no memory.
  */
-static struct ubi_attach_info *scan_all(struct ubi_device *ubi)
+static struct ubi_attach_info *alloc_ai(void)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_ainf_volume *av;
-	struct ubi_ainf_peb *aeb;
 	struct ubi_attach_info *ai;
 
 	ai = kzalloc(sizeof(struct ubi_attach_info), GFP_KERNEL);
 	if (!ai)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&ai->corr);
 	INIT_LIST_HEAD(&ai->free);
@@ -1148,44 +1145,64 @@ static struct ubi_attach_info *scan_all(struct ubi_device *ubi)
 	INIT_LIST_HEAD(&ai->alien);
 	ai->volumes = RB_ROOT;
 
-	err = -ENOMEM;
 	ai->aeb_slab_cache = kmem_cache_create("ubi_aeb_slab_cache",
 					       sizeof(struct ubi_ainf_peb),
 					       0, 0, NULL);
-	if (!ai->aeb_slab_cache)
-		goto out_ai;
+	if (!ai->aeb_slab_cache) {
+		kfree(ai);
+		return NULL;
+	}
 
-	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
-	if (!ech)
-		goto out_ai;
+	return ai;
+}
 
-	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
-	if (!vidh)
-		goto out_ech;
+/**
+ * erase_stale_fastmap - get rid of fastmap super blocks found by scanning.
+ * @ubi: UBI device description object
+ * @ai: attaching information
+ *
+ * When the device is attached by scanning, an old fastmap anchor must not
+ * survive until the next attach, because it does not describe the current
+ * state of the device anymore. So the anchors are erased right away, not in
+ * background, and the PEBs are moved to the free list.
+ */
+static int erase_stale_fastmap(struct ubi_device *ubi,
+			       struct ubi_attach_info *ai)
+{
+	struct ubi_ainf_peb *aeb, *tmp;
+	int err;
 
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
-		cond_resched();
+	if (ubi->ro_mode)
+		return 0;
 
-		dbg_gen("process PEB %d", pnum);
-		err = scan_peb(ubi, ai, pnum);
-		if (err < 0)
-			goto out_vidh;
-	}
+	list_for_each_entry_safe(aeb, tmp, &ai->erase, u.list) {
+		if (aeb->vol_id != UBI_FM_SB_VOLUME_ID)
+			continue;
 
-	dbg_msg("scanning is finished");
+		dbg_bld("erase stale fastmap anchor at PEB %d", aeb->pnum);
+		err = early_erase_peb(ubi, ai, aeb->pnum, aeb->ec + 1);
+		if (err)
+			return err;
+		aeb->ec += 1;
+		aeb->vol_id = aeb->lnum = UBI_UNKNOWN;
+		list_move_tail(&aeb->u.list, &ai->free);
+	}
 
-	/* Calculate mean erase counter */
-	if (ai->ec_count)
-		ai->mean_ec = div_u64(ai->ec_sum, ai->ec_count);
+	return 0;
+}
 
-	err = late_analysis(ubi, ai);
-	if (err)
-		goto out_vidh;
+/**
+ * set_unknown_ec - set unknown erase counters to the mean erase counter.
+ * @ai: attaching information
+ *
+ * In case of unknown erase counter we use the mean erase counter value.
+ */
+static void set_unknown_ec(struct ubi_attach_info *ai)
+{
+	struct rb_node *rb1, *rb2;
+	struct ubi_ainf_volume *av;
+	struct ubi_ainf_peb *aeb;
 
-	/*
-	 * In case of unknown erase counter we use the mean erase counter
-	 * value.
-	 */
 	ubi_rb_for_each_entry(rb1, av, &ai->volumes, rb) {
 		ubi_rb_for_each_entry(rb2, aeb, &av->root, u.rb)
 			if (aeb->ec == UBI_UNKNOWN)
@@ -1204,44 +1221,188 @@ static struct ubi_attach_info *scan_all(struct ubi_device *ubi)
 	list_for_each_entry(aeb, &ai->erase, u.list)
 		if (aeb->ec == UBI_UNKNOWN)
 			aeb->ec = ai->mean_ec;
+}
 
-	err = self_check_ai(ubi, ai);
+/**
+ * scan_all - scan entire MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function does full scanning of an MTD device and returns complete
+ * information about it in form of a "struct ubi_attach_info" object. In case
+ * of failure, an error code is returned.
+ */
+static struct ubi_attach_info *scan_all(struct ubi_device *ubi)
+{
+	int err, pnum;
+	struct ubi_attach_info *ai;
+
+	ai = alloc_ai();
+	if (!ai)
+		return ERR_PTR(-ENOMEM);
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		cond_resched();
+
+		dbg_gen("process PEB %d", pnum);
+		err = ubi_scan_peb(ubi, ai, pnum);
+		if (err < 0)
+			goto out_ai;
+	}
+
+	dbg_msg("scanning is finished");
+
+	/* Calculate mean erase counter */
+	if (ai->ec_count)
+		ai->mean_ec = div_u64(ai->ec_sum, ai->ec_count);
+
+	err = late_analysis(ubi, ai);
 	if (err)
-		goto out_vidh;
+		goto out_ai;
 
-	ubi_free_vid_hdr(ubi, vidh);
-	kfree(ech);
+	set_unknown_ec(ai);
+
+	err = erase_stale_fastmap(ubi, ai);
+	if (err)
+		goto out_ai;
+
+	err = self_check_ai(ubi, ai);
+	if (err)
+		goto out_ai;
 
 	return ai;
 
-out_vidh:
-	ubi_free_vid_hdr(ubi, vidh);
-out_ech:
-	kfree(ech);
 out_ai:
 	ubi_destroy_ai(ai);
 	return ERR_PTR(err);
 }
 
+/**
+ * find_fm_anchor - find the fastmap super block.
+ * @ubi: UBI device description object
+ *
+ * This function looks for the fastmap super block among the first
+ * %UBI_FM_MAX_START PEBs. If there are several of them (e.g., the old one was
+ * not erased yet), the one with the highest sequence number wins. Returns the
+ * PEB number of the super block, %-ENOENT if there is none, or a negative
+ * error code in case of failure.
+ */
+static int find_fm_anchor(struct ubi_device *ubi)
+{
+	int pnum, err, fm_anchor = -ENOENT;
+	unsigned long long sqnum, max_sqnum = 0;
+
+	for (pnum = 0; pnum < UBI_FM_MAX_START; pnum++) {
+		cond_resched();
+
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		else if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+		if (err < 0)
+			return err;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+
+		if (be32_to_cpu(vidh->vol_id) != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		sqnum = be64_to_cpu(vidh->sqnum);
+		dbg_bld("fastmap super block at PEB %d, sqnum %llu",
+			pnum, sqnum);
+		if (fm_anchor < 0 || sqnum > max_sqnum) {
+			fm_anchor = pnum;
+			max_sqnum = sqnum;
+		}
+	}
+
+	return fm_anchor;
+}
+
+/**
+ * scan_fast - attach an MTD device using its fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function returns the attaching information built from the fastmap,
+ * %NULL if the device has to be scanned because there is no usable fastmap,
+ * or an error code in case of failure.
+ */
+static struct ubi_attach_info *scan_fast(struct ubi_device *ubi)
+{
+	int err, fm_anchor;
+	struct ubi_attach_info *ai;
+
+	fm_anchor = find_fm_anchor(ubi);
+	if (fm_anchor == -ENOENT) {
+		ubi_msg("no fastmap found, scanning all PEBs");
+		return NULL;
+	}
+	if (fm_anchor < 0)
+		return ERR_PTR(fm_anchor);
+
+	ai = alloc_ai();
+	if (!ai)
+		return ERR_PTR(-ENOMEM);
+
+	err = ubi_scan_fastmap(ubi, ai, fm_anchor);
+	if (err) {
+		ubi_destroy_ai(ai);
+		if (err < 0)
+			return ERR_PTR(err);
+
+		/* The device was using fastmap, write a new one */
+		ubi_warn("fastmap is unusable, scanning all PEBs");
+		ubi->fm_disabled = 0;
+		return NULL;
+	}
+
+	if (ai->ec_count)
+		ai->mean_ec = div_u64(ai->ec_sum, ai->ec_count);
+	set_unknown_ec(ai);
+
+	ubi->fm_disabled = 0;
+	return ai;
+}
+
 /**
  * ubi_attach - attach an MTD device.
  * @ubi: UBI device descriptor
  *
- * This function returns zero in case of success and a negative error code in
- * case of failure.
+ * The device is attached using its fastmap if there is one, and by scanning
+ * all PEBs otherwise. This function returns zero in case of success and a
+ * negative error code in case of failure.
  */
 int ubi_attach(struct ubi_device *ubi)
 {
 	int err;
-	struct ubi_attach_info *ai;
+	struct ubi_attach_info *ai = NULL;
+
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ech)
+		return -ENOMEM;
+
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh) {
+		kfree(ech);
+		return -ENOMEM;
+	}
+
+	if (ubi->fm_size)
+		ai = scan_fast(ubi);
+	if (!ai)
+		ai = scan_all(ubi);
 
-	ai = scan_all(ubi);
+	ubi_free_vid_hdr(ubi, vidh);
+	kfree(ech);
 	if (IS_ERR(ai))
 		return PTR_ERR(ai);
 
 	ubi->bad_peb_count = ai->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
 	ubi->corr_peb_count = ai->corr_peb_count;
+	ubi->alien_peb_count = ai->alien_peb_count;
 	ubi->max_ec = ai->max_ec;
 	ubi->mean_ec = ai->mean_ec;
 	ubi_msg("max. sequence number:       %llu", ai->max_sqnum);
@@ -1267,6 +1428,7 @@ out_vtbl:
 	ubi_free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 out_ai:
+	ubi_fastmap_close(ubi);
 	ubi_destroy_ai(ai);
 	return err;
 }
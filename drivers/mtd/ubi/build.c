@@ -56,10 +56,12 @@
  * @name: MTD character device node path, MTD device name, or MTD device number
  *        string
  * @vid_hdr_offs: VID header offset
+ * @chips: number of independent chips the MTD device consists of
  */
 struct mtd_dev_param {
 	char name[MTD_PARAM_LEN_MAX];
 	int vid_hdr_offs;
+	int chips;
 };
 
 /* Numbers of elements set in the @mtd_dev_param array */
@@ -103,6 +105,9 @@ static struct class_attribute ubi_version =
 
 static ssize_t dev_attribute_show(struct device *dev,
 				  struct device_attribute *attr, char *buf);
+static ssize_t dev_attribute_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count);
 
 /* UBI device attributes (correspond to files in '/<sysfs>/class/ubi/ubiX') */
 static struct device_attribute dev_eraseblock_size =
@@ -127,6 +132,18 @@ static struct device_attribute dev_bgt_enabled =
 	__ATTR(bgt_enabled, S_IRUGO, dev_attribute_show, NULL);
 static struct device_attribute dev_mtd_num =
 	__ATTR(mtd_num, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_bg_scrub_interval =
+	__ATTR(bg_scrub_interval, S_IRUGO | S_IWUSR, dev_attribute_show,
+	       dev_attribute_store);
+static struct device_attribute dev_bg_scrub_checked =
+	__ATTR(bg_scrub_checked, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_bg_scrub_bitflips =
+	__ATTR(bg_scrub_bitflips, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_read_disturb_threshold =
+	__ATTR(read_disturb_threshold, S_IRUGO | S_IWUSR, dev_attribute_show,
+	       dev_attribute_store);
+static struct device_attribute dev_read_disturb_scrubs =
+	__ATTR(read_disturb_scrubs, S_IRUGO, dev_attribute_show, NULL);
 
 /**
  * ubi_volume_notify - send a volume change notification.
@@ -351,6 +368,53 @@ static ssize_t dev_attribute_show(struct device *dev,
 		ret = sprintf(buf, "%d\n", ubi->thread_enabled);
 	else if (attr == &dev_mtd_num)
 		ret = sprintf(buf, "%d\n", ubi->mtd->index);
+	else if (attr == &dev_bg_scrub_interval)
+		ret = sprintf(buf, "%u\n", ubi->bg_scrub_interval);
+	else if (attr == &dev_bg_scrub_checked)
+		ret = sprintf(buf, "%lu\n", ubi->bg_scrub_checked);
+	else if (attr == &dev_bg_scrub_bitflips)
+		ret = sprintf(buf, "%lu\n", ubi->bg_scrub_bitflips);
+	else if (attr == &dev_read_disturb_threshold)
+		ret = sprintf(buf, "%u\n", ubi->read_disturb_threshold);
+	else if (attr == &dev_read_disturb_scrubs)
+		ret = sprintf(buf, "%lu\n", ubi->read_disturb_scrubs);
+	else
+		ret = -EINVAL;
+
+	ubi_put_device(ubi);
+	return ret;
+}
+
+/* "Store" method for files in '/<sysfs>/class/ubi/ubiX/' */
+static ssize_t dev_attribute_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	ssize_t ret;
+	unsigned int val;
+	struct ubi_device *ubi;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	/* See 'dev_attribute_show()' */
+	ubi = container_of(dev, struct ubi_device, dev);
+	ubi = ubi_get_device(ubi->ubi_num);
+	if (!ubi)
+		return -ENODEV;
+
+	ret = count;
+	if (attr == &dev_bg_scrub_interval) {
+		/* Let the background thread pick up the new interval */
+		spin_lock(&ubi->wl_lock);
+		ubi->bg_scrub_interval = val;
+		ubi->bg_scrub_next = jiffies + msecs_to_jiffies(val);
+		if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi))
+			wake_up_process(ubi->bgt_thread);
+		spin_unlock(&ubi->wl_lock);
+	} else if (attr == &dev_read_disturb_threshold)
+		ubi->read_disturb_threshold = val;
 	else
 		ret = -EINVAL;
 
@@ -418,6 +482,21 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
 	if (err)
 		return err;
 	err = device_create_file(&ubi->dev, &dev_mtd_num);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_bg_scrub_interval);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_bg_scrub_checked);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_bg_scrub_bitflips);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_read_disturb_threshold);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_read_disturb_scrubs);
 	return err;
 }
 
@@ -427,6 +506,11 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
  */
 static void ubi_sysfs_close(struct ubi_device *ubi)
 {
+	device_remove_file(&ubi->dev, &dev_read_disturb_scrubs);
+	device_remove_file(&ubi->dev, &dev_read_disturb_threshold);
+	device_remove_file(&ubi->dev, &dev_bg_scrub_bitflips);
+	device_remove_file(&ubi->dev, &dev_bg_scrub_checked);
+	device_remove_file(&ubi->dev, &dev_bg_scrub_interval);
 	device_remove_file(&ubi->dev, &dev_mtd_num);
 	device_remove_file(&ubi->dev, &dev_bgt_enabled);
 	device_remove_file(&ubi->dev, &dev_min_io_size);
@@ -805,6 +889,7 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
  * @mtd: MTD device description object
  * @ubi_num: number to assign to the new UBI device
  * @vid_hdr_offset: VID header offset
+ * @chips: number of equally sized independent chips the MTD device consists of
  *
  * This function attaches MTD device @mtd_dev to UBI and assign @ubi_num number
  * to the newly created UBI device, unless @ubi_num is %UBI_DEV_NUM_AUTO, in
@@ -815,7 +900,8 @@ static int autoresize(struct ubi_device *ubi, int vol_id)
  * Note, the invocations of this function has to be serialized by the
  * @ubi_devices_mutex.
  */
-int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
+int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset,
+		       int chips)
 {
 	struct ubi_device *ubi;
 	int i, err, ref = 0;
@@ -849,6 +935,13 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		return -EINVAL;
 	}
 
+	if (chips < 1 || chips > UBI_MAX_CHIPS ||
+	    mtd_div_by_eb(mtd->size, mtd) % chips) {
+		ubi_err("mtd%d cannot be split into %d equally sized chips",
+			mtd->index, chips);
+		return -EINVAL;
+	}
+
 	if (ubi_num == UBI_DEV_NUM_AUTO) {
 		/* Search for an empty slot in the @ubi_devices array */
 		for (ubi_num = 0; ubi_num < UBI_MAX_DEVICES; ubi_num++)
@@ -877,6 +970,7 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	ubi->mtd = mtd;
 	ubi->ubi_num = ubi_num;
 	ubi->vid_hdr_offset = vid_hdr_offset;
+	ubi->chips = chips;
 	ubi->autoresize_vol_id = -1;
 
 	mutex_init(&ubi->buf_mutex);
@@ -892,6 +986,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	if (err)
 		goto out_free;
 
+	ubi_fastmap_init(ubi);
+
 	err = -ENOMEM;
 	ubi->peb_buf = vmalloc(ubi->peb_size);
 	if (!ubi->peb_buf)
@@ -929,6 +1025,12 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		goto out_debugfs;
 	}
 
+	err = ubi_wl_start_erasers(ubi);
+	if (err) {
+		kthread_stop(ubi->bgt_thread);
+		goto out_debugfs;
+	}
+
 	ubi_msg("attached mtd%d to ubi%d", mtd->index, ubi_num);
 	ubi_msg("MTD device name:            \"%s\"", mtd->name);
 	ubi_msg("MTD device size:            %llu MiB", ubi->flash_size >> 20);
@@ -953,7 +1055,7 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	 */
 	spin_lock(&ubi->wl_lock);
 	ubi->thread_enabled = 1;
-	wake_up_process(ubi->bgt_thread);
+	ubi_wl_wake_threads(ubi);
 	spin_unlock(&ubi->wl_lock);
 
 	ubi_devices[ubi_num] = ubi;
@@ -968,6 +1070,7 @@ out_uif:
 	uif_close(ubi);
 out_detach:
 	ubi_wl_close(ubi);
+	ubi_fastmap_close(ubi);
 	ubi_free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 out_debugging:
@@ -996,6 +1099,7 @@ out_free:
  */
 int ubi_detach_mtd_dev(int ubi_num, int anyway)
 {
+	int err;
 	struct ubi_device *ubi;
 
 	if (ubi_num < 0 || ubi_num >= UBI_MAX_DEVICES)
@@ -1027,10 +1131,24 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	/*
 	 * Before freeing anything, we have to stop the background thread to
 	 * prevent it from doing anything on this device while we are freeing.
+	 * Nobody must wake it up once it is stopped, so disable the threads
+	 * and stop the erase threads, which wake it up, first.
 	 */
+	spin_lock(&ubi->wl_lock);
+	ubi->thread_enabled = 0;
+	spin_unlock(&ubi->wl_lock);
+	ubi_wl_stop_erasers(ubi);
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
+	/*
+	 * Write the final fastmap, so that the next attach does not have to
+	 * scan the PEBs which were handed out since the last one.
+	 */
+	err = ubi_update_fastmap(ubi);
+	if (err && err != -EROFS)
+		ubi_warn("cannot write fastmap, error %d", err);
+
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
 	 * from freeing the @ubi object.
@@ -1040,6 +1158,7 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	ubi_debugfs_exit_dev(ubi);
 	uif_close(ubi);
 	ubi_wl_close(ubi);
+	ubi_fastmap_close(ubi);
 	ubi_free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
 	put_mtd_device(ubi->mtd);
@@ -1177,7 +1296,7 @@ static int __init ubi_init(void)
 
 		mutex_lock(&ubi_devices_mutex);
 		err = ubi_attach_mtd_dev(mtd, UBI_DEV_NUM_AUTO,
-					 p->vid_hdr_offs);
+					 p->vid_hdr_offs, p->chips);
 		mutex_unlock(&ubi_devices_mutex);
 		if (err < 0) {
 			ubi_err("cannot attach mtd%d", mtd->index);
@@ -1296,7 +1415,7 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	struct mtd_dev_param *p;
 	char buf[MTD_PARAM_LEN_MAX];
 	char *pbuf = &buf[0];
-	char *tokens[2] = {NULL, NULL};
+	char *tokens[3] = {NULL, NULL, NULL};
 
 	if (!val)
 		return -EINVAL;
@@ -1326,7 +1445,7 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	if (buf[len - 1] == '\n')
 		buf[len - 1] = '\0';
 
-	for (i = 0; i < 2; i++)
+	for (i = 0; i < 3; i++)
 		tokens[i] = strsep(&pbuf, ",");
 
 	if (pbuf) {
@@ -1344,18 +1463,32 @@ static int __init ubi_mtd_param_parse(const char *val, struct kernel_param *kp)
 	if (p->vid_hdr_offs < 0)
 		return p->vid_hdr_offs;
 
+	p->chips = 1;
+	if (tokens[2]) {
+		int err = kstrtoint(tokens[2], 0, &p->chips);
+
+		if (err || p->chips < 1 || p->chips > UBI_MAX_CHIPS) {
+			printk(KERN_ERR "UBI error: bad chips count: \"%s\", "
+			       "max. is %d\n", tokens[2], UBI_MAX_CHIPS);
+			return -EINVAL;
+		}
+	}
+
 	mtd_devs += 1;
 	return 0;
 }
 
 module_param_call(mtd, ubi_mtd_param_parse, NULL, NULL, 000);
 MODULE_PARM_DESC(mtd, "MTD devices to attach. Parameter format: "
-		      "mtd=<name|num|path>[,<vid_hdr_offs>].\n"
+		      "mtd=<name|num|path>[,<vid_hdr_offs>[,<chips>]].\n"
 		      "Multiple \"mtd\" parameters may be specified.\n"
 		      "MTD devices may be specified by their number, name, or "
 		      "path to the MTD character device node.\n"
 		      "Optional \"vid_hdr_offs\" parameter specifies UBI VID "
 		      "header position to be used by UBI.\n"
+		      "Optional \"chips\" parameter specifies how many equally "
+		      "sized independent chips the MTD device consists of, "
+		      "erasures on different chips are done in parallel.\n"
 		      "Example 1: mtd=/dev/mtd0 - attach MTD device "
 		      "/dev/mtd0.\n"
 		      "Example 2: mtd=content,1984 mtd=4 - attach MTD device "
@@ -0,0 +1,1087 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap sub-system.
+ *
+ * Attaching an MTD device requires reading the headers of every physical
+ * eraseblock, which takes time proportional to the size of the flash. The
+ * fastmap is a snapshot of the attaching information - the state of every PEB
+ * and the EBA table of every volume - stored in a few PEBs, which makes it
+ * possible to attach the device by reading only a small, bounded amount of
+ * data.
+ *
+ * The fastmap consists of a super block, stored at the beginning of the
+ * "anchor" PEB, and the fastmap data, which starts right after the super block
+ * and may span up to %UBI_FM_MAX_BLOCKS PEBs. The anchor is always one of the
+ * first %UBI_FM_MAX_START PEBs, so it is found by reading only their VID
+ * headers.
+ *
+ * The fastmap is not updated on every change. Instead, free PEBs are handed
+ * out from pools (@ubi->fm_pool for the EBA sub-system and @ubi->fm_wl_pool
+ * for wear-leveling), and all pool PEBs are recorded in the "scan" list of the
+ * fastmap, together with the PEBs in the protection queue. On attach, these
+ * PEBs are scanned as usual, and their VID headers take precedence over the
+ * fastmap. A new fastmap is written when a pool runs empty.
+ *
+ * A PEB which the on-flash fastmap considers used must not be erased before a
+ * new fastmap is written, otherwise the EBA table in the fastmap would refer
+ * to an empty PEB after an unclean reboot. The wear-leveling sub-system defers
+ * such erasures (see @ubi->fm_erase).
+ *
+ * If the fastmap is missing, corrupted or inconsistent, the device is attached
+ * by scanning all PEBs, and the old fastmap is erased.
+ */
+
+#include <linux/module.h>
+#include <linux/crc32.h>
+#include "ubi.h"
+
+/*
+ * Whether to write a fastmap to devices which do not have one yet. Devices
+ * which already have a fastmap keep it regardless of this parameter.
+ */
+static bool fm_autoconvert;
+module_param(fm_autoconvert, bool, 0644);
+MODULE_PARM_DESC(fm_autoconvert, "Set this parameter to enable fastmap "
+		 "automatically on images without a fastmap.");
+
+/**
+ * update_fastmap_work_fn - write a fastmap from process context.
+ * @wrk: the work object
+ */
+static void update_fastmap_work_fn(struct work_struct *wrk)
+{
+	struct ubi_device *ubi = container_of(wrk, struct ubi_device, fm_work);
+
+	/* The device is being attached or detached */
+	if (!ubi->thread_enabled)
+		return;
+
+	ubi_update_fastmap(ubi);
+}
+
+/**
+ * ubi_fastmap_init - initialize the fastmap sub-system.
+ * @ubi: UBI device description object
+ *
+ * This function is called before the device is attached. It calculates the
+ * size of the fastmap and of the pools, and disables fastmap for devices which
+ * are too small or too large for it.
+ */
+void ubi_fastmap_init(struct ubi_device *ubi)
+{
+	int size;
+
+	mutex_init(&ubi->fm_mutex);
+	init_rwsem(&ubi->fm_sem);
+	INIT_WORK(&ubi->fm_work, update_fastmap_work_fn);
+	INIT_LIST_HEAD(&ubi->fm_erase);
+
+	ubi->fm_pool.max_size = ubi->peb_count / 20;
+	if (ubi->fm_pool.max_size < UBI_FM_MIN_POOL_SIZE)
+		ubi->fm_pool.max_size = UBI_FM_MIN_POOL_SIZE;
+	if (ubi->fm_pool.max_size > UBI_FM_MAX_POOL_SIZE)
+		ubi->fm_pool.max_size = UBI_FM_MAX_POOL_SIZE;
+	ubi->fm_wl_pool.max_size = ubi->fm_pool.max_size / 2;
+
+	ubi->fm_disabled = !fm_autoconvert;
+
+	size = sizeof(struct ubi_fm_sb) + sizeof(struct ubi_fm_hdr) +
+	       ubi->peb_count * sizeof(struct ubi_fm_ec) +
+	       (UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) *
+	       (sizeof(struct ubi_fm_volhdr) + sizeof(struct ubi_fm_eba)) +
+	       ubi->peb_count * sizeof(__be32);
+	ubi->fm_size = roundup(size, ubi->leb_size);
+
+	if (ubi->peb_count <= UBI_FM_MAX_START) {
+		ubi->fm_size = 0;
+		ubi->fm_disabled = 1;
+	} else if (ubi->fm_size / ubi->leb_size > UBI_FM_MAX_BLOCKS) {
+		ubi_warn("device is too large for fastmap (%d PEBs)",
+			 ubi->peb_count);
+		ubi->fm_size = 0;
+		ubi->fm_disabled = 1;
+	}
+}
+
+/**
+ * free_fm - free an in-memory fastmap layout.
+ * @fm: the fastmap layout to free
+ */
+static void free_fm(struct ubi_fastmap_layout *fm)
+{
+	int i;
+
+	if (!fm)
+		return;
+
+	for (i = 0; i < fm->used_blocks; i++)
+		kmem_cache_free(ubi_wl_entry_slab, fm->e[i]);
+	kfree(fm);
+}
+
+/**
+ * ubi_fastmap_close - close the fastmap sub-system.
+ * @ubi: UBI device description object
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	cancel_work_sync(&ubi->fm_work);
+	free_fm(ubi->fm);
+	ubi->fm = NULL;
+	kfree(ubi->fm_used);
+	ubi->fm_used = NULL;
+}
+
+/**
+ * add_aeb - create a PEB object for the attaching information.
+ * @ai: attaching information
+ * @list: the list to add the object to
+ * @pnum: physical eraseblock number
+ * @ec: erase counter
+ * @scrub: if the physical eraseblock has to be scrubbed
+ *
+ * Returns the new object or %NULL if there is no memory.
+ */
+static struct ubi_ainf_peb *add_aeb(struct ubi_attach_info *ai,
+				    struct list_head *list, int pnum, int ec,
+				    int scrub)
+{
+	struct ubi_ainf_peb *aeb;
+
+	aeb = kmem_cache_alloc(ai->aeb_slab_cache, GFP_KERNEL);
+	if (!aeb)
+		return NULL;
+
+	aeb->ec = ec;
+	aeb->pnum = pnum;
+	aeb->vol_id = UBI_UNKNOWN;
+	aeb->lnum = UBI_UNKNOWN;
+	aeb->scrub = scrub;
+	aeb->copy_flag = 0;
+	aeb->sqnum = 0;
+	list_add_tail(&aeb->u.list, list);
+
+	ai->ec_sum += ec;
+	ai->ec_count += 1;
+	if (ec > ai->max_ec)
+		ai->max_ec = ec;
+	if (ec < ai->min_ec)
+		ai->min_ec = ec;
+
+	return aeb;
+}
+
+/**
+ * add_fm_volume - add a volume described by the fastmap.
+ * @ai: attaching information
+ * @fmvh: the fastmap volume header
+ *
+ * Returns the new volume object, %NULL if the volume already exists, or an
+ * error code if there is no memory.
+ */
+static struct ubi_ainf_volume *add_fm_volume(struct ubi_attach_info *ai,
+					     const struct ubi_fm_volhdr *fmvh)
+{
+	struct ubi_ainf_volume *av;
+	struct rb_node **p = &ai->volumes.rb_node, *parent = NULL;
+	int vol_id = be32_to_cpu(fmvh->vol_id);
+
+	/* Same ordering as in 'add_volume()' */
+	while (*p) {
+		parent = *p;
+		av = rb_entry(parent, struct ubi_ainf_volume, rb);
+
+		if (vol_id == av->vol_id)
+			return NULL;
+
+		if (vol_id > av->vol_id)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	av = kmalloc(sizeof(struct ubi_ainf_volume), GFP_KERNEL);
+	if (!av)
+		return ERR_PTR(-ENOMEM);
+
+	av->highest_lnum = av->leb_count = 0;
+	av->vol_id = vol_id;
+	av->root = RB_ROOT;
+	av->used_ebs = be32_to_cpu(fmvh->used_ebs);
+	av->data_pad = be32_to_cpu(fmvh->data_pad);
+	if (vol_id == UBI_LAYOUT_VOLUME_ID)
+		av->compat = UBI_LAYOUT_VOLUME_COMPAT;
+	else
+		av->compat = 0;
+	if (fmvh->vol_type == UBI_VID_DYNAMIC) {
+		av->vol_type = UBI_DYNAMIC_VOLUME;
+		av->last_data_size = 0;
+	} else {
+		av->vol_type = UBI_STATIC_VOLUME;
+		av->last_data_size = be32_to_cpu(fmvh->last_eb_bytes);
+	}
+	if (vol_id > ai->highest_vol_id)
+		ai->highest_vol_id = vol_id;
+
+	rb_link_node(&av->rb, parent, p);
+	rb_insert_color(&av->rb, &ai->volumes);
+	ai->vols_found += 1;
+	dbg_bld("added volume %d from fastmap", vol_id);
+	return av;
+}
+
+/**
+ * add_fm_leb - add a logical eraseblock to a volume described by the fastmap.
+ * @av: volume attaching information
+ * @aeb: the physical eraseblock the logical eraseblock is mapped to
+ * @lnum: logical eraseblock number
+ */
+static void add_fm_leb(struct ubi_ainf_volume *av, struct ubi_ainf_peb *aeb,
+		       int lnum)
+{
+	struct rb_node **p = &av->root.rb_node, *parent = NULL;
+	struct ubi_ainf_peb *tmp;
+
+	while (*p) {
+		parent = *p;
+		tmp = rb_entry(parent, struct ubi_ainf_peb, u.rb);
+		if (lnum < tmp->lnum)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	list_del(&aeb->u.list);
+	aeb->vol_id = av->vol_id;
+	aeb->lnum = lnum;
+	if (av->highest_lnum <= lnum)
+		av->highest_lnum = lnum;
+	av->leb_count += 1;
+	rb_link_node(&aeb->u.rb, parent, p);
+	rb_insert_color(&aeb->u.rb, &av->root);
+}
+
+/**
+ * attach_fastmap - build attaching information from fastmap data.
+ * @ubi: UBI device description object
+ * @ai: attaching information to fill
+ * @fm: the fastmap layout, its PEBs are already known
+ * @buf: the fastmap data, starting with the super block
+ * @size: size of @buf
+ *
+ * This function returns zero in case of success, %UBI_BAD_FASTMAP if the
+ * fastmap is inconsistent, and a negative error code in case of failure.
+ */
+static int attach_fastmap(struct ubi_device *ubi, struct ubi_attach_info *ai,
+			  struct ubi_fastmap_layout *fm, void *buf, int size)
+{
+	struct ubi_fm_hdr *fmhdr;
+	struct ubi_fm_ec *fmec;
+	struct ubi_fm_volhdr *fmvh;
+	struct ubi_fm_eba *fmeba;
+	struct ubi_ainf_volume *av;
+	struct ubi_ainf_peb *aeb, *tmp, **used = NULL;
+	unsigned long *seen, *skip;
+	long long total;
+	int i, j, n, pnum, ec, err, ret, off, vol_id;
+	int free_cnt, used_cnt, scrub_cnt, erase_cnt, scan_cnt, scan_off;
+	LIST_HEAD(used_list);
+
+	seen = kcalloc(BITS_TO_LONGS(ubi->peb_count), sizeof(unsigned long),
+		       GFP_KERNEL);
+	skip = kcalloc(BITS_TO_LONGS(ubi->peb_count), sizeof(unsigned long),
+		       GFP_KERNEL);
+	used = vzalloc(ubi->peb_count * sizeof(struct ubi_ainf_peb *));
+	if (!ubi->fm_used)
+		ubi->fm_used = kcalloc(BITS_TO_LONGS(ubi->peb_count),
+				       sizeof(unsigned long), GFP_KERNEL);
+	err = -ENOMEM;
+	if (!seen || !skip || !used || !ubi->fm_used)
+		goto out;
+
+	err = UBI_BAD_FASTMAP;
+	off = sizeof(struct ubi_fm_sb);
+	if (off + sizeof(struct ubi_fm_hdr) > size)
+		goto out;
+	fmhdr = buf + off;
+	off += sizeof(struct ubi_fm_hdr);
+
+	if (be32_to_cpu(fmhdr->magic) != UBI_FM_HDR_MAGIC) {
+		ubi_err("bad fastmap header magic: 0x%x, expected: 0x%x",
+			be32_to_cpu(fmhdr->magic), UBI_FM_HDR_MAGIC);
+		goto out;
+	}
+
+	total = (long long)be32_to_cpu(fmhdr->free_peb_count) +
+		be32_to_cpu(fmhdr->used_peb_count) +
+		be32_to_cpu(fmhdr->scrub_peb_count) +
+		be32_to_cpu(fmhdr->erase_peb_count) +
+		be32_to_cpu(fmhdr->scan_peb_count) +
+		be32_to_cpu(fmhdr->bad_peb_count) +
+		be32_to_cpu(fmhdr->corr_peb_count) +
+		be32_to_cpu(fmhdr->alien_peb_count) + fm->used_blocks;
+	if (total != ubi->peb_count) {
+		ubi_err("fastmap describes %lld PEBs, but there are %d",
+			total, ubi->peb_count);
+		goto out;
+	}
+
+	free_cnt = be32_to_cpu(fmhdr->free_peb_count);
+	used_cnt = be32_to_cpu(fmhdr->used_peb_count);
+	scrub_cnt = be32_to_cpu(fmhdr->scrub_peb_count);
+	erase_cnt = be32_to_cpu(fmhdr->erase_peb_count);
+	scan_cnt = be32_to_cpu(fmhdr->scan_peb_count);
+	n = free_cnt + used_cnt + scrub_cnt + erase_cnt + scan_cnt;
+	if (off + n * sizeof(struct ubi_fm_ec) > size)
+		goto out;
+	fmec = buf + off;
+	off += n * sizeof(struct ubi_fm_ec);
+
+	for (i = 0; i < fm->used_blocks; i++)
+		__set_bit(fm->e[i]->pnum, seen);
+
+	bitmap_zero(ubi->fm_used, ubi->peb_count);
+	scan_off = free_cnt + used_cnt + scrub_cnt + erase_cnt;
+	for (i = 0; i < n; i++) {
+		pnum = be32_to_cpu(fmec[i].pnum);
+		ec = be32_to_cpu(fmec[i].ec);
+		if (pnum < 0 || pnum >= ubi->peb_count ||
+		    ec < 0 || ec > UBI_MAX_ERASECOUNTER) {
+			ubi_err("bad fastmap PEB %d, EC %d", pnum, ec);
+			goto out;
+		}
+		if (__test_and_set_bit(pnum, seen)) {
+			ubi_err("PEB %d is listed twice in fastmap", pnum);
+			goto out;
+		}
+
+		if (i >= scan_off) {
+			/* PEBs to be scanned are handled later */
+			__set_bit(pnum, skip);
+			continue;
+		}
+
+		aeb = NULL;
+		if (i < free_cnt)
+			aeb = add_aeb(ai, &ai->free, pnum, ec, 0);
+		else if (i < free_cnt + used_cnt + scrub_cnt) {
+			aeb = add_aeb(ai, &used_list, pnum, ec,
+				      i >= free_cnt + used_cnt);
+			used[pnum] = aeb;
+			__set_bit(pnum, ubi->fm_used);
+		} else {
+			/* It may have gone bad since the fastmap was written */
+			__set_bit(pnum, skip);
+			ret = ubi_io_is_bad(ubi, pnum);
+			if (ret < 0) {
+				err = ret;
+				goto out;
+			}
+			if (ret) {
+				ai->bad_peb_count += 1;
+				continue;
+			}
+			aeb = add_aeb(ai, &ai->erase, pnum, ec, 0);
+		}
+		if (!aeb) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < be32_to_cpu(fmhdr->vol_count); i++) {
+		if (off + sizeof(struct ubi_fm_volhdr) +
+		    sizeof(struct ubi_fm_eba) > size)
+			goto out;
+		fmvh = buf + off;
+		off += sizeof(struct ubi_fm_volhdr);
+		fmeba = buf + off;
+		off += sizeof(struct ubi_fm_eba);
+
+		if (be32_to_cpu(fmvh->magic) != UBI_FM_VHDR_MAGIC ||
+		    be32_to_cpu(fmeba->magic) != UBI_FM_EBA_MAGIC) {
+			ubi_err("bad fastmap volume %d magic", i);
+			goto out;
+		}
+
+		vol_id = be32_to_cpu(fmvh->vol_id);
+		n = be32_to_cpu(fmeba->reserved_pebs);
+		if ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+		    vol_id != UBI_LAYOUT_VOLUME_ID) {
+			ubi_err("bad fastmap volume ID %d", vol_id);
+			goto out;
+		}
+		if (fmvh->vol_type != UBI_VID_DYNAMIC &&
+		    fmvh->vol_type != UBI_VID_STATIC) {
+			ubi_err("bad type of fastmap volume %d", vol_id);
+			goto out;
+		}
+		if (n < 0 || n > ubi->peb_count ||
+		    off + n * sizeof(__be32) > size) {
+			ubi_err("bad size of fastmap volume %d", vol_id);
+			goto out;
+		}
+		off += n * sizeof(__be32);
+
+		av = NULL;
+		for (j = 0; j < n; j++) {
+			pnum = be32_to_cpu(fmeba->pnum[j]);
+			if (pnum == UBI_LEB_UNMAPPED)
+				continue;
+			if (pnum < 0 || pnum >= ubi->peb_count) {
+				ubi_err("bad PEB %d of LEB %d:%d in fastmap",
+					pnum, vol_id, j);
+				goto out;
+			}
+
+			/*
+			 * The LEB was mapped to a PEB after the fastmap was
+			 * taken, it is found by scanning.
+			 */
+			if (test_bit(pnum, skip))
+				continue;
+
+			aeb = used[pnum];
+			if (!aeb || aeb->vol_id != UBI_UNKNOWN) {
+				ubi_err("PEB %d of LEB %d:%d is not used",
+					pnum, vol_id, j);
+				goto out;
+			}
+
+			if (!av) {
+				av = add_fm_volume(ai, fmvh);
+				if (IS_ERR(av)) {
+					err = PTR_ERR(av);
+					goto out;
+				}
+				if (!av) {
+					ubi_err("volume %d is in fastmap twice",
+						vol_id);
+					goto out;
+				}
+			}
+
+			add_fm_leb(av, aeb, j);
+		}
+	}
+
+	/* Used PEBs which are not mapped anymore */
+	list_for_each_entry_safe(aeb, tmp, &used_list, u.list)
+		list_move_tail(&aeb->u.list, &ai->erase);
+
+	ai->bad_peb_count += be32_to_cpu(fmhdr->bad_peb_count);
+	ai->corr_peb_count += be32_to_cpu(fmhdr->corr_peb_count);
+	/*
+	 * PEBs of incompatible volumes with the "preserve" compatibility flag
+	 * are not listed, they are never touched anyway
+	 */
+	ai->alien_peb_count += be32_to_cpu(fmhdr->alien_peb_count);
+
+	for (i = scan_off; i < scan_off + scan_cnt; i++) {
+		cond_resched();
+
+		pnum = be32_to_cpu(fmec[i].pnum);
+		dbg_bld("scan PEB %d", pnum);
+		err = ubi_scan_peb(ubi, ai, pnum);
+		if (err == -ENOMEM)
+			goto out;
+		if (err) {
+			ubi_err("cannot scan PEB %d listed in fastmap", pnum);
+			err = UBI_BAD_FASTMAP;
+			goto out;
+		}
+	}
+
+	err = 0;
+
+out:
+	/* Objects on other lists are freed together with @ai */
+	list_for_each_entry_safe(aeb, tmp, &used_list, u.list) {
+		list_del(&aeb->u.list);
+		kmem_cache_free(ai->aeb_slab_cache, aeb);
+	}
+	vfree(used);
+	kfree(skip);
+	kfree(seen);
+	return err;
+}
+
+/**
+ * ubi_scan_fastmap - attach an MTD device using its fastmap.
+ * @ubi: UBI device description object
+ * @ai: attaching information to fill
+ * @fm_anchor: the PEB containing the fastmap super block
+ *
+ * This function reads the fastmap and builds the attaching information from
+ * it. Returns zero in case of success, %UBI_BAD_FASTMAP if the fastmap cannot
+ * be used, and a negative error code in case of failure.
+ */
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		     int fm_anchor)
+{
+	struct ubi_fastmap_layout *fm;
+	struct ubi_fm_sb *fmsb;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_hdr *vh;
+	struct ubi_wl_entry *e;
+	void *buf = NULL;
+	int i, err, pnum, image_seq, used_blocks;
+	uint32_t crc;
+
+	fm = kzalloc(sizeof(struct ubi_fastmap_layout), GFP_KERNEL);
+	fmsb = kmalloc(sizeof(struct ubi_fm_sb), GFP_KERNEL);
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	vh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	err = -ENOMEM;
+	if (!fm || !fmsb || !ech || !vh)
+		goto out;
+
+	err = ubi_io_read_ec_hdr(ubi, fm_anchor, ech, 0);
+	if (err < 0)
+		goto out;
+	if (err && err != UBI_IO_BITFLIPS) {
+		ubi_err("bad EC header in fastmap anchor PEB %d", fm_anchor);
+		err = UBI_BAD_FASTMAP;
+		goto out;
+	}
+
+	image_seq = be32_to_cpu(ech->image_seq);
+	if (!ubi->image_seq)
+		ubi->image_seq = image_seq;
+
+	err = ubi_io_read_data(ubi, fmsb, fm_anchor, 0,
+			       sizeof(struct ubi_fm_sb));
+	if (err && err != UBI_IO_BITFLIPS) {
+		if (err == -EBADMSG)
+			err = UBI_BAD_FASTMAP;
+		goto out;
+	}
+
+	err = UBI_BAD_FASTMAP;
+	if (be32_to_cpu(fmsb->magic) != UBI_FM_SB_MAGIC) {
+		ubi_err("bad fastmap super block magic: 0x%x, expected: 0x%x",
+			be32_to_cpu(fmsb->magic), UBI_FM_SB_MAGIC);
+		goto out;
+	}
+	if (fmsb->version != UBI_FM_FMT_VERSION) {
+		ubi_err("unsupported fastmap version %d", fmsb->version);
+		goto out;
+	}
+
+	used_blocks = be32_to_cpu(fmsb->used_blocks);
+	if (used_blocks < 1 || used_blocks > UBI_FM_MAX_BLOCKS ||
+	    be32_to_cpu(fmsb->block_loc[0]) != fm_anchor) {
+		ubi_err("bad fastmap super block at PEB %d", fm_anchor);
+		goto out;
+	}
+
+	buf = vmalloc(used_blocks * ubi->leb_size);
+	if (!buf) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < used_blocks; i++) {
+		pnum = be32_to_cpu(fmsb->block_loc[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count) {
+			ubi_err("bad fastmap PEB %d", pnum);
+			err = UBI_BAD_FASTMAP;
+			goto out;
+		}
+
+		if (i > 0) {
+			err = ubi_io_read_vid_hdr(ubi, pnum, vh, 0);
+			if (err < 0)
+				goto out;
+			if ((err && err != UBI_IO_BITFLIPS) ||
+			    be32_to_cpu(vh->vol_id) != UBI_FM_DATA_VOLUME_ID ||
+			    be32_to_cpu(vh->lnum) != i) {
+				ubi_err("PEB %d is not fastmap block %d",
+					pnum, i);
+				err = UBI_BAD_FASTMAP;
+				goto out;
+			}
+		}
+
+		err = ubi_io_read_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+				       ubi->leb_size);
+		if (err && err != UBI_IO_BITFLIPS) {
+			ubi_err("cannot read fastmap PEB %d", pnum);
+			if (err == -EBADMSG)
+				err = UBI_BAD_FASTMAP;
+			goto out;
+		}
+
+		e = kmem_cache_alloc(ubi_wl_entry_slab, GFP_KERNEL);
+		if (!e) {
+			err = -ENOMEM;
+			goto out;
+		}
+		e->pnum = pnum;
+		e->ec = be32_to_cpu(fmsb->block_ec[i]);
+		fm->e[i] = e;
+		fm->used_blocks += 1;
+	}
+
+	crc = crc32(UBI_CRC32_INIT, buf + sizeof(struct ubi_fm_sb),
+		    used_blocks * ubi->leb_size - sizeof(struct ubi_fm_sb));
+	if (crc != be32_to_cpu(fmsb->data_crc)) {
+		ubi_err("fastmap data CRC is invalid: 0x%08x, expected: 0x%08x",
+			crc, be32_to_cpu(fmsb->data_crc));
+		err = UBI_BAD_FASTMAP;
+		goto out;
+	}
+
+	ai->max_sqnum = be64_to_cpu(fmsb->sqnum);
+
+	err = attach_fastmap(ubi, ai, fm, buf, used_blocks * ubi->leb_size);
+	if (err)
+		goto out;
+
+	ubi->fm = fm;
+	fm = NULL;
+	ubi_msg("attached by fastmap from PEB %d", fm_anchor);
+
+out:
+	if (err) {
+		kfree(ubi->fm_used);
+		ubi->fm_used = NULL;
+	}
+	free_fm(fm);
+	vfree(buf);
+	ubi_free_vid_hdr(ubi, vh);
+	kfree(ech);
+	kfree(fmsb);
+	return err;
+}
+
+/**
+ * reuse_old_peb - pick a PEB of the old fastmap for the new one.
+ * @old: the old fastmap layout
+ * @reused: which PEBs of @old are already re-used
+ * @anchor: non-zero if the PEB has to be suitable for the anchor
+ *
+ * The old anchor is re-used only as the new anchor, because it is the only
+ * old PEB which is guaranteed to be within the first %UBI_FM_MAX_START PEBs.
+ * Returns the index of the PEB in @old or %-1 if there is none.
+ */
+static int reuse_old_peb(struct ubi_fastmap_layout *old, int *reused,
+			 int anchor)
+{
+	int i;
+
+	if (!old)
+		return -1;
+
+	if (anchor)
+		return reused[0] ? -1 : 0;
+
+	for (i = 1; i < old->used_blocks; i++)
+		if (!reused[i])
+			return i;
+
+	return -1;
+}
+
+/**
+ * put_fm_pebs - return the PEBs of a fastmap to the wear-leveling sub-system.
+ * @ubi: UBI device description object
+ * @fm: the fastmap layout
+ * @reused: the PEBs to skip, may be %NULL
+ */
+static void put_fm_pebs(struct ubi_device *ubi, struct ubi_fastmap_layout *fm,
+			int *reused)
+{
+	int i, err;
+
+	for (i = 0; i < fm->used_blocks; i++) {
+		if (!fm->e[i] || (reused && reused[i]))
+			continue;
+		err = ubi_wl_put_fm_peb(ubi, fm->e[i], i, 0);
+		if (err)
+			ubi_err("cannot return fastmap PEB %d, error %d",
+				fm->e[i]->pnum, err);
+	}
+}
+
+/**
+ * add_fm_ec - add a PEB to a list of the fastmap.
+ * @ubi: UBI device description object
+ * @buf: the fastmap buffer
+ * @off: current offset in @buf, updated by this function
+ * @e: the wear-leveling entry of the PEB
+ */
+static void add_fm_ec(struct ubi_device *ubi, void *buf, int *off,
+		      struct ubi_wl_entry *e)
+{
+	struct ubi_fm_ec *fmec = buf + *off;
+
+	ubi_assert(*off + sizeof(struct ubi_fm_ec) <= ubi->fm_size);
+	fmec->pnum = cpu_to_be32(e->pnum);
+	fmec->ec = cpu_to_be32(e->ec);
+	*off += sizeof(struct ubi_fm_ec);
+}
+
+/**
+ * encode_fastmap - put the current state of the device into a buffer.
+ * @ubi: UBI device description object
+ * @buf: the buffer of @ubi->fm_size bytes to fill
+ * @old: the old fastmap layout, may be %NULL
+ * @reused: which PEBs of @old are re-used by the new fastmap
+ *
+ * The super block at the beginning of @buf is filled by the caller. Has to be
+ * called with @ubi->fm_sem and @ubi->work_sem locked for writing. Returns zero
+ * in case of success and %-ENOSPC if the fastmap does not fit.
+ */
+static int encode_fastmap(struct ubi_device *ubi, void *buf,
+			  struct ubi_fastmap_layout *old, int *reused)
+{
+	struct ubi_fm_hdr *fmhdr = buf + sizeof(struct ubi_fm_sb);
+	struct ubi_fm_volhdr *fmvh;
+	struct ubi_fm_eba *fmeba;
+	struct ubi_fm_pool *pool;
+	struct ubi_volume *vol;
+	struct ubi_wl_entry *e;
+	struct ubi_work *wrk;
+	struct rb_node *rb;
+	int i, j, off, start, vol_count = 0;
+
+	off = sizeof(struct ubi_fm_sb) + sizeof(struct ubi_fm_hdr);
+	fmhdr->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+
+	spin_lock(&ubi->wl_lock);
+	bitmap_zero(ubi->fm_used, ubi->peb_count);
+
+	start = off;
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		add_fm_ec(ubi, buf, &off, e);
+	fmhdr->free_peb_count = cpu_to_be32((off - start) /
+					    sizeof(struct ubi_fm_ec));
+
+	start = off;
+	ubi_rb_for_each_entry(rb, e, &ubi->used, u.rb) {
+		add_fm_ec(ubi, buf, &off, e);
+		__set_bit(e->pnum, ubi->fm_used);
+	}
+	ubi_rb_for_each_entry(rb, e, &ubi->erroneous, u.rb) {
+		add_fm_ec(ubi, buf, &off, e);
+		__set_bit(e->pnum, ubi->fm_used);
+	}
+	fmhdr->used_peb_count = cpu_to_be32((off - start) /
+					    sizeof(struct ubi_fm_ec));
+
+	start = off;
+	ubi_rb_for_each_entry(rb, e, &ubi->scrub, u.rb) {
+		add_fm_ec(ubi, buf, &off, e);
+		__set_bit(e->pnum, ubi->fm_used);
+	}
+	fmhdr->scrub_peb_count = cpu_to_be32((off - start) /
+					     sizeof(struct ubi_fm_ec));
+
+	start = off;
+	list_for_each_entry(wrk, &ubi->works, list)
+		if (ubi_is_erase_work(wrk))
+			add_fm_ec(ubi, buf, &off, wrk->e);
+	list_for_each_entry(wrk, &ubi->fm_erase, list)
+		add_fm_ec(ubi, buf, &off, wrk->e);
+	/* The old fastmap PEBs are erased once the new fastmap is written */
+	for (i = 0; old && i < old->used_blocks; i++)
+		if (!reused[i])
+			add_fm_ec(ubi, buf, &off, old->e[i]);
+	fmhdr->erase_peb_count = cpu_to_be32((off - start) /
+					     sizeof(struct ubi_fm_ec));
+
+	start = off;
+	pool = &ubi->fm_pool;
+	for (i = 0; i < pool->size; i++)
+		add_fm_ec(ubi, buf, &off, ubi->lookuptbl[pool->pebs[i]]);
+	pool = &ubi->fm_wl_pool;
+	for (i = 0; i < pool->size; i++)
+		add_fm_ec(ubi, buf, &off, ubi->lookuptbl[pool->pebs[i]]);
+	for (i = 0; i < UBI_PROT_QUEUE_LEN; i++)
+		list_for_each_entry(e, &ubi->pq[i], u.list)
+			add_fm_ec(ubi, buf, &off, e);
+	fmhdr->scan_peb_count = cpu_to_be32((off - start) /
+					    sizeof(struct ubi_fm_ec));
+
+	fmhdr->bad_peb_count = cpu_to_be32(ubi->bad_peb_count);
+	fmhdr->corr_peb_count = cpu_to_be32(ubi->corr_peb_count);
+	fmhdr->alien_peb_count = cpu_to_be32(ubi->alien_peb_count);
+	spin_unlock(&ubi->wl_lock);
+
+	/*
+	 * The EBA tables are taken after the PEB lists. LEBs which are mapped
+	 * meanwhile can only be mapped to PEBs from the scan list, and those
+	 * are ignored on attach. LEBs which are unmapped meanwhile leave their
+	 * PEBs in the used list, where they are erased on attach.
+	 */
+	spin_lock(&ubi->volumes_lock);
+	for (i = 0; i < UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		if (off + sizeof(struct ubi_fm_volhdr) +
+		    sizeof(struct ubi_fm_eba) +
+		    vol->reserved_pebs * sizeof(__be32) > ubi->fm_size) {
+			spin_unlock(&ubi->volumes_lock);
+			ubi_err("fastmap is too small for volume %d",
+				vol->vol_id);
+			return -ENOSPC;
+		}
+
+		fmvh = buf + off;
+		off += sizeof(struct ubi_fm_volhdr);
+		fmvh->magic = cpu_to_be32(UBI_FM_VHDR_MAGIC);
+		fmvh->vol_id = cpu_to_be32(vol->vol_id);
+		fmvh->data_pad = cpu_to_be32(vol->data_pad);
+		fmvh->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME) {
+			/* VID headers of dynamic volumes have zero used_ebs */
+			fmvh->vol_type = UBI_VID_DYNAMIC;
+			fmvh->used_ebs = 0;
+		} else {
+			fmvh->vol_type = UBI_VID_STATIC;
+			fmvh->used_ebs = cpu_to_be32(vol->used_ebs);
+		}
+
+		fmeba = buf + off;
+		off += sizeof(struct ubi_fm_eba);
+		fmeba->magic = cpu_to_be32(UBI_FM_EBA_MAGIC);
+		fmeba->reserved_pebs = cpu_to_be32(vol->reserved_pebs);
+		for (j = 0; j < vol->reserved_pebs; j++)
+			fmeba->pnum[j] = cpu_to_be32(vol->eba_tbl[j]);
+		off += vol->reserved_pebs * sizeof(__be32);
+		vol_count += 1;
+	}
+	spin_unlock(&ubi->volumes_lock);
+
+	fmhdr->vol_count = cpu_to_be32(vol_count);
+	return 0;
+}
+
+/**
+ * write_fm_peb - write one PEB of the fastmap.
+ * @ubi: UBI device description object
+ * @vh: VID header buffer to use
+ * @e: the physical eraseblock to write to
+ * @lnum: position of the PEB within the fastmap
+ * @buf: the data to write, @ubi->leb_size bytes
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int write_fm_peb(struct ubi_device *ubi, struct ubi_vid_hdr *vh,
+			struct ubi_wl_entry *e, int lnum, const void *buf)
+{
+	int err;
+
+	vh->vol_type = UBI_VID_DYNAMIC;
+	vh->compat = UBI_FM_VOLUME_COMPAT;
+	vh->vol_id = cpu_to_be32(lnum ? UBI_FM_DATA_VOLUME_ID :
+					UBI_FM_SB_VOLUME_ID);
+	vh->lnum = cpu_to_be32(lnum);
+
+	err = ubi_io_write_vid_hdr(ubi, e->pnum, vh);
+	if (err) {
+		ubi_err("cannot write VID header of fastmap PEB %d", e->pnum);
+		return err;
+	}
+
+	err = ubi_io_write_data(ubi, buf, e->pnum, 0, ubi->leb_size);
+	if (err)
+		ubi_err("cannot write fastmap PEB %d", e->pnum);
+	return err;
+}
+
+/**
+ * ubi_update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function refills the fastmap pools and writes a new fastmap describing
+ * the current state of the device. The old fastmap is invalidated before
+ * anything is written, so if the update is interrupted or the new fastmap
+ * cannot be written, the device is attached by scanning next time. Returns
+ * zero in case of success and a negative error code if even that failed.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	struct ubi_fastmap_layout *new_fm, *old_fm;
+	struct ubi_fm_sb *fmsb;
+	struct ubi_vid_hdr *vh = NULL;
+	struct ubi_wl_entry *e;
+	void *buf = NULL;
+	int reused[UBI_FM_MAX_BLOCKS] = {0};
+	int i, j, err, anchor_written = 0;
+
+	if (ubi->ro_mode)
+		return -EROFS;
+	if (ubi->fm_disabled)
+		return 0;
+
+	new_fm = kzalloc(sizeof(struct ubi_fastmap_layout), GFP_KERNEL);
+	if (!new_fm)
+		return -ENOMEM;
+
+	buf = vzalloc(ubi->fm_size);
+	vh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!buf || !vh) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	mutex_lock(&ubi->fm_mutex);
+	if (!ubi->fm_used) {
+		ubi->fm_used = kcalloc(BITS_TO_LONGS(ubi->peb_count),
+				       sizeof(unsigned long), GFP_KERNEL);
+		if (!ubi->fm_used) {
+			mutex_unlock(&ubi->fm_mutex);
+			err = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	/* Stop the users of the pools and the wear-leveling worker */
+	down_write(&ubi->fm_sem);
+	down_write(&ubi->work_sem);
+	old_fm = ubi->fm;
+	ubi->fm = NULL;
+
+	/*
+	 * The new fastmap is written to PEBs which the old one lists as free,
+	 * and attaching by the old fastmap after a power cut in the middle of
+	 * the update would hand them out without erasing them. So erase the
+	 * old anchor first.
+	 */
+	if (old_fm) {
+		err = ubi_wl_erase_fm_peb(ubi, old_fm->e[0]);
+		if (err) {
+			ubi_err("cannot erase fastmap anchor, error %d", err);
+			put_fm_pebs(ubi, old_fm, NULL);
+			kfree(old_fm);
+			ubi_ro_mode(ubi);
+			goto out_unlock;
+		}
+	}
+
+	err = 0;
+	new_fm->used_blocks = ubi->fm_size / ubi->leb_size;
+	for (i = 0; i < new_fm->used_blocks; i++) {
+		e = ubi_wl_get_fm_peb(ubi, i == 0);
+		if (!e) {
+			j = reuse_old_peb(old_fm, reused, i == 0);
+			if (j < 0) {
+				ubi_err("no free PEBs for fastmap");
+				err = -ENOSPC;
+				break;
+			}
+
+			/* Re-use an old fastmap PEB, the anchor is erased */
+			e = old_fm->e[j];
+			reused[j] = 1;
+			if (j)
+				err = ubi_wl_erase_fm_peb(ubi, e);
+		}
+
+		new_fm->e[i] = e;
+		if (err)
+			break;
+	}
+
+	/* The pools are refilled even if there is no fastmap */
+	ubi_refill_pools(ubi);
+	if (err)
+		goto out_invalidate;
+
+	err = encode_fastmap(ubi, buf, old_fm, reused);
+	if (err)
+		goto out_invalidate;
+
+	/* Write the data first, the super block makes it valid */
+	fmsb = buf;
+	fmsb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	fmsb->version = UBI_FM_FMT_VERSION;
+	fmsb->used_blocks = cpu_to_be32(new_fm->used_blocks);
+	for (i = 0; i < new_fm->used_blocks; i++) {
+		fmsb->block_loc[i] = cpu_to_be32(new_fm->e[i]->pnum);
+		fmsb->block_ec[i] = cpu_to_be32(new_fm->e[i]->ec);
+	}
+	fmsb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT,
+					   buf + sizeof(struct ubi_fm_sb),
+					   ubi->fm_size -
+					   sizeof(struct ubi_fm_sb)));
+
+	for (i = 1; i < new_fm->used_blocks; i++) {
+		vh->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+		err = write_fm_peb(ubi, vh, new_fm->e[i], i,
+				   buf + i * ubi->leb_size);
+		if (err)
+			goto out_invalidate;
+	}
+
+	/* The data CRC does not cover the super block itself */
+	vh->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+	fmsb->sqnum = vh->sqnum;
+	anchor_written = 1;
+	err = write_fm_peb(ubi, vh, new_fm->e[0], 0, buf);
+	if (err)
+		goto out_invalidate;
+
+	ubi->fm = new_fm;
+	new_fm = NULL;
+	if (old_fm) {
+		put_fm_pebs(ubi, old_fm, reused);
+		kfree(old_fm);
+	}
+	dbg_bld("fastmap written to PEB %d", ubi->fm->e[0]->pnum);
+	goto out_unlock;
+
+out_invalidate:
+	/*
+	 * Make sure no fastmap super block describes a state of the device
+	 * which is not going to be maintained anymore. The old one is already
+	 * erased.
+	 */
+	err = 0;
+	if (anchor_written)
+		err = ubi_wl_erase_fm_peb(ubi, new_fm->e[0]);
+
+	if (old_fm) {
+		put_fm_pebs(ubi, old_fm, reused);
+		kfree(old_fm);
+	}
+	put_fm_pebs(ubi, new_fm, NULL);
+
+	if (err) {
+		ubi_err("cannot erase fastmap anchor, error %d", err);
+		ubi_ro_mode(ubi);
+	} else
+		ubi_warn("cannot write fastmap, the next attach will scan "
+			 "all PEBs");
+
+out_unlock:
+	ubi_wl_requeue_deferred(ubi);
+	up_write(&ubi->work_sem);
+	up_write(&ubi->fm_sem);
+	mutex_unlock(&ubi->fm_mutex);
+out_free:
+	ubi_free_vid_hdr(ubi, vh);
+	vfree(buf);
+	kfree(new_fm);
+	return err;
+}
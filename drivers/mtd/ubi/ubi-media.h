@@ -312,6 +312,16 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The fastmap volumes: the super block volume (one "anchor" PEB within the
+ * first %UBI_FM_MAX_START PEBs) and the fastmap data volume. Neither of them
+ * is registered in the volume table, and implementations without fastmap
+ * support simply delete them.
+ */
+#define UBI_FM_SB_VOLUME_ID	(UBI_INTERNAL_VOL_START + 1)
+#define UBI_FM_DATA_VOLUME_ID	(UBI_INTERNAL_VOL_START + 2)
+#define UBI_FM_VOLUME_COMPAT	UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +385,134 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __packed;
 
+/* UBI fastmap on-flash data structures */
+
+/* Version of the fastmap on-flash format */
+#define UBI_FM_FMT_VERSION	1
+
+/* The fastmap super block has to live in one of the first 64 PEBs */
+#define UBI_FM_MAX_START	64
+
+/* The maximum number of PEBs the fastmap data may occupy */
+#define UBI_FM_MAX_BLOCKS	32
+
+/* Limits of the fastmap pool size (PEBs handed out between fastmap writes) */
+#define UBI_FM_MIN_POOL_SIZE	8
+#define UBI_FM_MAX_POOL_SIZE	256
+
+/* Fastmap magic numbers */
+#define UBI_FM_SB_MAGIC		0x7B11D69F
+#define UBI_FM_HDR_MAGIC	0xD4B82EF7
+#define UBI_FM_VHDR_MAGIC	0xFA370ED1
+#define UBI_FM_EBA_MAGIC	0xF0C040A8
+
+/**
+ * struct ubi_fm_sb - UBI fastmap super block.
+ * @magic: fastmap super block magic number (%UBI_FM_SB_MAGIC)
+ * @version: format version of this fastmap (%UBI_FM_FMT_VERSION)
+ * @padding1: reserved, zeroes
+ * @data_crc: CRC checksum of the fastmap data following the super block
+ * @used_blocks: number of PEBs used by this fastmap
+ * @block_loc: an array containing the location of all PEBs of the fastmap
+ * @block_ec: the erase counter of each used PEB
+ * @sqnum: highest sequence number value at the time the fastmap was taken
+ * @padding2: reserved, zeroes
+ *
+ * The super block is stored at the beginning of the first fastmap PEB (the
+ * "anchor"), which is always one of the first %UBI_FM_MAX_START PEBs, so it
+ * can be found by scanning only them. @block_loc[0] is the anchor itself.
+ */
+struct ubi_fm_sb {
+	__be32 magic;
+	__u8 version;
+	__u8 padding1[3];
+	__be32 data_crc;
+	__be32 used_blocks;
+	__be32 block_loc[UBI_FM_MAX_BLOCKS];
+	__be32 block_ec[UBI_FM_MAX_BLOCKS];
+	__be64 sqnum;
+	__u8 padding2[32];
+} __packed;
+
+/**
+ * struct ubi_fm_hdr - header of the fastmap data set.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @free_peb_count: number of free PEBs known by this fastmap
+ * @used_peb_count: number of used PEBs known by this fastmap
+ * @scrub_peb_count: number of to be scrubbed PEBs known by this fastmap
+ * @erase_peb_count: number of PEBs which have to be erased
+ * @scan_peb_count: number of PEBs which have to be scanned on attach
+ * @bad_peb_count: number of bad PEBs
+ * @corr_peb_count: number of corrupted PEBs
+ * @vol_count: number of volume records following the PEB lists
+ * @alien_peb_count: number of PEBs of preserved incompatible volumes
+ * @padding: reserved, zeroes
+ *
+ * The header is followed by the free, used, scrub, erase and scan lists, in
+ * this order, each of them an array of &struct ubi_fm_ec. The scan list
+ * contains the PEBs which were handed out to the EBA and wear-leveling
+ * sub-systems after the fastmap was taken, or were not yet protected against
+ * moves: their VID headers are authoritative and they are scanned on attach.
+ */
+struct ubi_fm_hdr {
+	__be32 magic;
+	__be32 free_peb_count;
+	__be32 used_peb_count;
+	__be32 scrub_peb_count;
+	__be32 erase_peb_count;
+	__be32 scan_peb_count;
+	__be32 bad_peb_count;
+	__be32 corr_peb_count;
+	__be32 vol_count;
+	__be32 alien_peb_count;
+	__u8 padding[24];
+} __packed;
+
+/**
+ * struct ubi_fm_ec - stores the erase counter of a PEB.
+ * @pnum: PEB number
+ * @ec: erase counter
+ */
+struct ubi_fm_ec {
+	__be32 pnum;
+	__be32 ec;
+} __packed;
+
+/**
+ * struct ubi_fm_volhdr - fastmap volume header.
+ * @magic: fastmap volume header magic number (%UBI_FM_VHDR_MAGIC)
+ * @vol_id: volume ID
+ * @vol_type: type of the volume (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @padding1: reserved, zeroes
+ * @data_pad: data_pad value of the volume
+ * @used_ebs: number of used LEBs within this volume
+ * @last_eb_bytes: number of bytes used in the last LEB
+ * @padding2: reserved, zeroes
+ *
+ * Every volume header is followed by a &struct ubi_fm_eba record holding the
+ * EBA table of the volume.
+ */
+struct ubi_fm_volhdr {
+	__be32 magic;
+	__be32 vol_id;
+	__u8 vol_type;
+	__u8 padding1[3];
+	__be32 data_pad;
+	__be32 used_ebs;
+	__be32 last_eb_bytes;
+	__u8 padding2[8];
+} __packed;
+
+/**
+ * struct ubi_fm_eba - denotes an association between a LEB and a PEB.
+ * @magic: EBA table magic number (%UBI_FM_EBA_MAGIC)
+ * @reserved_pebs: number of entries in @pnum
+ * @pnum: PEB number of LEB (LEB is the index), %-1 if the LEB is unmapped
+ */
+struct ubi_fm_eba {
+	__be32 magic;
+	__be32 reserved_pebs;
+	__be32 pnum[0];
+} __packed;
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -38,6 +38,7 @@
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/notifier.h>
+#include <linux/workqueue.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/ubi.h>
 #include <asm/pgtable.h>
@@ -65,6 +66,12 @@
 /* Background thread name pattern */
 #define UBI_BGT_NAME_PATTERN "ubi_bgt%dd"
 
+/* Per-chip erase thread name pattern */
+#define UBI_ERASE_NAME_PATTERN "ubi_erase%d_%d"
+
+/* Maximum number of independent chips an MTD device may be split into */
+#define UBI_MAX_CHIPS 16
+
 /*
  * This marker in the EBA table means that the LEB is um-mapped.
  * NOTE! It has to have the same value as %UBI_ALL.
@@ -136,6 +143,19 @@ enum {
 	MOVE_RETRY,
 };
 
+/*
+ * Return codes of the fastmap sub-system.
+ *
+ * UBI_NO_FASTMAP: no fastmap super block was found
+ * UBI_BAD_FASTMAP: a fastmap was found but it is corrupted or inconsistent
+ *
+ * In both cases the device has to be attached by scanning all PEBs.
+ */
+enum {
+	UBI_NO_FASTMAP = 1,
+	UBI_BAD_FASTMAP,
+};
+
 /**
  * struct ubi_wl_entry - wear-leveling entry.
  * @u.rb: link in the corresponding (free/used) RB-tree
@@ -156,6 +176,34 @@ struct ubi_wl_entry {
 	int pnum;
 };
 
+/**
+ * struct ubi_fm_pool - in-memory fastmap pool.
+ * @pebs: PEBs in this pool
+ * @used: number of PEBs already handed out from this pool
+ * @size: total number of PEBs in this pool
+ * @max_size: maximum size of the pool
+ *
+ * A pool is a set of free PEBs which are handed out without writing a new
+ * fastmap. All of them are recorded in the scan list of the fastmap, so
+ * whatever is written to them after the fastmap was taken is found on attach.
+ */
+struct ubi_fm_pool {
+	int pebs[UBI_FM_MAX_POOL_SIZE];
+	int used;
+	int size;
+	int max_size;
+};
+
+/**
+ * struct ubi_fastmap_layout - in-memory fastmap data structure.
+ * @e: PEBs used by the current fastmap, @e[0] is the anchor
+ * @used_blocks: number of used PEBs
+ */
+struct ubi_fastmap_layout {
+	struct ubi_wl_entry *e[UBI_FM_MAX_BLOCKS];
+	int used_blocks;
+};
+
 /**
  * struct ubi_ltree_entry - an entry in the lock tree.
  * @rb: links RB-tree nodes
@@ -297,6 +345,25 @@ struct ubi_volume_desc {
 };
 
 struct ubi_wl_entry;
+struct ubi_device;
+
+/**
+ * struct ubi_erase_thread - per-chip erase thread description object.
+ * @ubi: the UBI device this thread works for
+ * @task: the thread task object
+ * @chip: index of the chip this thread erases PEBs on
+ * @name: thread name
+ *
+ * When the MTD device consists of several independent chips, every chip has
+ * its own erase thread. This way an erasure on one chip does not stall the
+ * erasures queued for the other chips, nor the other background works.
+ */
+struct ubi_erase_thread {
+	struct ubi_device *ubi;
+	struct task_struct *task;
+	int chip;
+	char name[sizeof(UBI_ERASE_NAME_PATTERN)+4];
+};
 
 /**
  * struct ubi_device - UBI device description structure
@@ -345,7 +412,8 @@ struct ubi_wl_entry;
  * @pq_head: protection queue head
  * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
  *	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- *	     @erroneous, and @erroneous_peb_count fields
+ *	     @erroneous, @erroneous_peb_count, @fm_pool, @fm_wl_pool, @fm_used,
+ *	     @fm_erase and @fm_erase_count fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -359,6 +427,35 @@ struct ubi_wl_entry;
  * @bgt_thread: background thread description object
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
+ * @chips: number of equally sized independent chips the MTD device consists
+ *         of
+ * @erase_threads: per-chip erase threads, only used if @chips is greater
+ *                 than %1
+ * @erases_running: erasures of LEB copies which are being done right now
+ *
+ * @fm: in-memory description of the on-flash fastmap, %NULL if there is none
+ * @fm_pool: pool of PEBs handed out to the EBA sub-system
+ * @fm_wl_pool: pool of PEBs used as wear-leveling targets
+ * @fm_used: bitmap of PEBs recorded as used in the on-flash fastmap
+ * @fm_erase: erase works deferred until the next fastmap is written
+ * @fm_erase_count: number of works in @fm_erase
+ * @fm_disabled: non-zero if fastmap is not maintained on this device
+ * @fm_size: fastmap size in bytes (a multiple of @leb_size)
+ * @fm_mutex: serializes fastmap writers
+ * @fm_sem: blocks taking and returning PEBs while a fastmap is written
+ * @fm_work: work to write a fastmap from process context
+ *
+ * @read_counts: per-PEB count of reads since the last erasure
+ * @read_disturb_threshold: number of reads after which a PEB is scrubbed to
+ *                          preempt read disturb, %0 if disabled
+ * @bg_scrub_interval: interval in milliseconds between two PEBs checked by
+ *                     the background scrubber, %0 if disabled
+ * @bg_scrub_pnum: the next PEB the background scrubber checks
+ * @bg_scrub_next: time (in jiffies) when the next PEB is checked
+ * @bg_scrub_checked: number of PEBs checked by the background scrubber
+ * @bg_scrub_bitflips: number of PEBs in which the background scrubber found
+ *                     bit-flips
+ * @read_disturb_scrubs: number of PEBs scrubbed because of read counts
  *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
@@ -367,6 +464,8 @@ struct ubi_wl_entry;
  * @good_peb_count: count of good physical eraseblocks
  * @corr_peb_count: count of corrupted physical eraseblocks (preserved and not
  *                  used by UBI)
+ * @alien_peb_count: count of physical eraseblocks of incompatible internal
+ *                   volumes (preserved and not used by UBI)
  * @erroneous_peb_count: count of erroneous physical eraseblocks in @erroneous
  * @max_erroneous: maximum allowed amount of erroneous physical eraseblocks
  * @min_io_size: minimal input/output unit size of the underlying MTD device
@@ -447,6 +546,32 @@ struct ubi_device {
 	struct task_struct *bgt_thread;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
+	int chips;
+	struct ubi_erase_thread erase_threads[UBI_MAX_CHIPS];
+	struct list_head erases_running;
+
+	/* Fastmap stuff */
+	struct ubi_fastmap_layout *fm;
+	struct ubi_fm_pool fm_pool;
+	struct ubi_fm_pool fm_wl_pool;
+	unsigned long *fm_used;
+	struct list_head fm_erase;
+	int fm_erase_count;
+	int fm_disabled;
+	int fm_size;
+	struct mutex fm_mutex;
+	struct rw_semaphore fm_sem;
+	struct work_struct fm_work;
+
+	/* Background scrubbing stuff */
+	unsigned int *read_counts;
+	unsigned int read_disturb_threshold;
+	unsigned int bg_scrub_interval;
+	int bg_scrub_pnum;
+	unsigned long bg_scrub_next;
+	unsigned long bg_scrub_checked;
+	unsigned long bg_scrub_bitflips;
+	unsigned long read_disturb_scrubs;
 
 	/* I/O sub-system's stuff */
 	long long flash_size;
@@ -455,6 +580,7 @@ struct ubi_device {
 	int bad_peb_count;
 	int good_peb_count;
 	int corr_peb_count;
+	int alien_peb_count;
 	int erroneous_peb_count;
 	int max_erroneous;
 	int min_io_size;
@@ -479,6 +605,30 @@ struct ubi_device {
 	struct ubi_debug_info *dbg;
 };
 
+/**
+ * struct ubi_work - UBI work description data structure.
+ * @list: a link in the list of pending works
+ * @func: worker function
+ * @e: physical eraseblock to erase
+ * @vol_id: the volume ID on which this erasure is being performed
+ * @lnum: the logical eraseblock number
+ * @torture: if the physical eraseblock has to be tortured
+ *
+ * The @func pointer points to the worker function. If the @cancel argument is
+ * not zero, the worker has to free the resources and exit immediately. The
+ * worker has to return zero in case of success and a negative error code in
+ * case of failure.
+ */
+struct ubi_work {
+	struct list_head list;
+	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
+	/* The below fields are only relevant to erasure works */
+	struct ubi_wl_entry *e;
+	int vol_id;
+	int lnum;
+	int torture;
+};
+
 /**
  * struct ubi_ainf_peb - attach information about a physical eraseblock.
  * @ec: erase counter (%UBI_UNKNOWN if it is unknown)
@@ -615,6 +765,7 @@ struct ubi_ainf_volume *ubi_find_av(const struct ubi_attach_info *ai,
 void ubi_remove_av(struct ubi_attach_info *ai, struct ubi_ainf_volume *av);
 struct ubi_ainf_peb *ubi_early_get_peb(struct ubi_device *ubi,
 				       struct ubi_attach_info *ai);
+int ubi_scan_peb(struct ubi_device *ubi, struct ubi_attach_info *ai, int pnum);
 int ubi_attach(struct ubi_device *ubi);
 void ubi_destroy_ai(struct ubi_attach_info *ai);
 
@@ -665,6 +816,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		     struct ubi_vid_hdr *vid_hdr);
 int ubi_eba_init(struct ubi_device *ubi, struct ubi_attach_info *ai);
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 
 /* wl.c */
 int ubi_wl_get_peb(struct ubi_device *ubi);
@@ -675,6 +827,40 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+int ubi_wl_start_erasers(struct ubi_device *ubi);
+void ubi_wl_stop_erasers(struct ubi_device *ubi);
+void ubi_wl_wake_threads(struct ubi_device *ubi);
+int ubi_wl_read_disturbed(struct ubi_device *ubi, int pnum);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor);
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int lnum, int torture);
+void ubi_refill_pools(struct ubi_device *ubi);
+void ubi_wl_requeue_deferred(struct ubi_device *ubi);
+int ubi_is_erase_work(struct ubi_work *wrk);
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e);
+#endif
+
+/* fastmap.c */
+#ifdef CONFIG_MTD_UBI_FASTMAP
+void ubi_fastmap_init(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_attach_info *ai,
+		     int fm_anchor);
+int ubi_update_fastmap(struct ubi_device *ubi);
+#else
+static inline void ubi_fastmap_init(struct ubi_device *ubi)
+{
+	ubi->fm_disabled = 1;
+}
+static inline void ubi_fastmap_close(struct ubi_device *ubi) {}
+static inline int ubi_scan_fastmap(struct ubi_device *ubi,
+				   struct ubi_attach_info *ai, int fm_anchor)
+{
+	return UBI_NO_FASTMAP;
+}
+static inline int ubi_update_fastmap(struct ubi_device *ubi) { return 0; }
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -694,7 +880,8 @@ int ubi_io_write_vid_hdr(struct ubi_device *ubi, int pnum,
 			 struct ubi_vid_hdr *vid_hdr);
 
 /* build.c */
-int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset);
+int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset,
+		       int chips);
 int ubi_detach_mtd_dev(int ubi_num, int anyway);
 struct ubi_device *ubi_get_device(int ubi_num);
 void ubi_put_device(struct ubi_device *ubi);
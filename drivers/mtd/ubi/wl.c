@@ -135,29 +135,11 @@
  */
 #define WL_MAX_FAILURES 32
 
-/**
- * struct ubi_work - UBI work description data structure.
- * @list: a link in the list of pending works
- * @func: worker function
- * @e: physical eraseblock to erase
- * @vol_id: the volume ID on which this erasure is being performed
- * @lnum: the logical eraseblock number
- * @torture: if the physical eraseblock has to be tortured
- *
- * The @func pointer points to the worker function. If the @cancel argument is
- * not zero, the worker has to free the resources and exit immediately. The
- * worker has to return zero in case of success and a negative error code in
- * case of failure.
+/*
+ * Maximum number of PEBs the background scrubber looks at to find the next
+ * used PEB to check. The search is done under @ubi->wl_lock, so it is bounded.
  */
-struct ubi_work {
-	struct list_head list;
-	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
-	/* The below fields are only relevant to erasure works */
-	struct ubi_wl_entry *e;
-	int vol_id;
-	int lnum;
-	int torture;
-};
+#define BG_SCRUB_MAX_SKIP 64
 
 static int self_check_ec(struct ubi_device *ubi, int pnum, int ec);
 static int self_check_in_wl_tree(const struct ubi_device *ubi,
@@ -201,17 +183,204 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 	rb_insert_color(&e->u.rb, root);
 }
 
+static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
+			int cancel);
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
 /**
- * do_work - do one pending work.
+ * defer_erase - postpone an erase work until the next fastmap is written.
+ * @ubi: UBI device description object
+ * @wrk: the work which was just taken off the list of pending works
+ *
+ * As long as the on-flash fastmap says that a PEB is used, the PEB must not be
+ * erased, because the fastmap would refer to an empty PEB after an unclean
+ * reboot. Likewise, a PEB which was unmapped after the fastmap was taken must
+ * not be erased while an older copy of the same LEB is still waiting to be
+ * erased, because that older copy would come back. Such works are parked on
+ * @ubi->fm_erase and returned to the list of pending works once a new fastmap
+ * has been written. Has to be called with @ubi->wl_lock locked. Returns %1 if
+ * @wrk was parked and %0 if it can be done right away.
+ */
+static int defer_erase(struct ubi_device *ubi, struct ubi_work *wrk)
+{
+	struct ubi_work *w;
+
+	if (!ubi->fm || wrk->func != &erase_worker)
+		return 0;
+
+	if (!test_bit(wrk->e->pnum, ubi->fm_used)) {
+		if (wrk->vol_id == UBI_UNKNOWN)
+			return 0;
+		list_for_each_entry(w, &ubi->fm_erase, list)
+			if (w->vol_id == wrk->vol_id && w->lnum == wrk->lnum)
+				break;
+		if (&w->list == &ubi->fm_erase)
+			return 0;
+	}
+
+	dbg_wl("defer erasure of PEB %d until the next fastmap", wrk->e->pnum);
+	list_add_tail(&wrk->list, &ubi->fm_erase);
+	ubi->fm_erase_count += 1;
+	if (ubi->fm_erase_count >= ubi->fm_pool.max_size)
+		schedule_work(&ubi->fm_work);
+	return 1;
+}
+
+/**
+ * erase_deferred - check if erasure of a LEB is deferred.
+ * @ubi: UBI device description object
+ * @vol_id: the volume ID to check for, may be %UBI_ALL
+ * @lnum: the logical eraseblock number to check for, may be %UBI_ALL
+ */
+static int erase_deferred(struct ubi_device *ubi, int vol_id, int lnum)
+{
+	struct ubi_work *wrk;
+	int found = 0;
+
+	spin_lock(&ubi->wl_lock);
+	list_for_each_entry(wrk, &ubi->fm_erase, list)
+		if ((vol_id == UBI_ALL || wrk->vol_id == vol_id) &&
+		    (lnum == UBI_ALL || wrk->lnum == lnum)) {
+			found = 1;
+			break;
+		}
+	spin_unlock(&ubi->wl_lock);
+
+	return found;
+}
+#else
+static inline int defer_erase(struct ubi_device *ubi, struct ubi_work *wrk)
+{
+	return 0;
+}
+
+static inline int erase_deferred(struct ubi_device *ubi, int vol_id, int lnum)
+{
+	return 0;
+}
+#endif
+
+/* Work selectors for 'next_work()', non-negative values select a chip */
+#define WORK_ANY      -1
+#define WORK_NO_ERASE -2
+
+/**
+ * struct erase_running - an erasure of a LEB copy which is being done.
+ * @list: link in @ubi->erases_running
+ * @vol_id: the volume ID that last used the PEB
+ * @lnum: the logical eraseblock number the PEB was last used for
+ */
+struct erase_running {
+	struct list_head list;
+	int vol_id;
+	int lnum;
+};
+
+/**
+ * peb_chip - find out which chip a physical eraseblock belongs to.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock number
+ */
+static inline int peb_chip(const struct ubi_device *ubi, int pnum)
+{
+	return pnum * ubi->chips / ubi->peb_count;
+}
+
+/**
+ * older_erase_pending - check if an older copy of a LEB waits for erasure.
  * @ubi: UBI device description object
+ * @wrk: the erase work to check
+ *
+ * Erasures of PEBs on different chips are done in parallel, but the PEBs which
+ * belonged to the same LEB still have to be erased in the order they were
+ * put. Otherwise, if the newer PEB was erased first, the older one would come
+ * back after an unclean reboot. An older copy is pending as long as it is
+ * queued or being erased. Has to be called with @ubi->wl_lock locked.
+ */
+static int older_erase_pending(struct ubi_device *ubi, struct ubi_work *wrk)
+{
+	struct ubi_work *w;
+	struct erase_running *r;
+
+	if (wrk->vol_id == UBI_UNKNOWN)
+		return 0;
+
+	list_for_each_entry(r, &ubi->erases_running, list)
+		if (r->vol_id == wrk->vol_id && r->lnum == wrk->lnum)
+			return 1;
+
+	list_for_each_entry(w, &ubi->works, list) {
+		if (w == wrk)
+			break;
+		if (w->func == &erase_worker && w->vol_id == wrk->vol_id &&
+		    w->lnum == wrk->lnum)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * next_work - find the next pending work matching a selector.
+ * @ubi: UBI device description object
+ * @sel: %WORK_ANY, %WORK_NO_ERASE, or the chip number
+ *
+ * %WORK_ANY matches any work, %WORK_NO_ERASE matches any work except
+ * erasures, and a chip number matches erasures of PEBs on this chip only.
+ * Erasures which have to wait for an older copy of the same LEB to be erased
+ * are skipped if erasures are done in parallel. This function has to be
+ * called with @ubi->wl_lock locked. Returns the oldest matching work or %NULL
+ * if there is none.
+ */
+static struct ubi_work *next_work(struct ubi_device *ubi, int sel)
+{
+	struct ubi_work *wrk;
+
+	if (sel == WORK_ANY && ubi->chips < 2) {
+		if (list_empty(&ubi->works))
+			return NULL;
+		return list_entry(ubi->works.next, struct ubi_work, list);
+	}
+
+	list_for_each_entry(wrk, &ubi->works, list) {
+		if (wrk->func != &erase_worker) {
+			if (sel < 0)
+				return wrk;
+		} else if (sel == WORK_NO_ERASE)
+			continue;
+		else if ((sel == WORK_ANY || peb_chip(ubi, wrk->e->pnum) == sel)
+			 && !older_erase_pending(ubi, wrk))
+			return wrk;
+	}
+
+	return NULL;
+}
+
+/**
+ * bgt_work_sel - get the work selector of the background thread.
+ * @ubi: UBI device description object
+ *
+ * If there are per-chip erase threads, they take care of the erasures and the
+ * background thread does all the other works.
+ */
+static inline int bgt_work_sel(const struct ubi_device *ubi)
+{
+	return ubi->chips > 1 ? WORK_NO_ERASE : WORK_ANY;
+}
+
+/**
+ * __do_work - do one pending work matching a selector.
+ * @ubi: UBI device description object
+ * @sel: work selector (see 'next_work()')
  *
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  */
-static int do_work(struct ubi_device *ubi)
+static int __do_work(struct ubi_device *ubi, int sel)
 {
-	int err;
+	int err, running = 0;
 	struct ubi_work *wrk;
+	struct erase_running r;
 
 	cond_resched();
 
@@ -223,16 +392,29 @@ static int do_work(struct ubi_device *ubi)
 	 */
 	down_read(&ubi->work_sem);
 	spin_lock(&ubi->wl_lock);
-	if (list_empty(&ubi->works)) {
+	wrk = next_work(ubi, sel);
+	if (!wrk) {
 		spin_unlock(&ubi->wl_lock);
 		up_read(&ubi->work_sem);
 		return 0;
 	}
 
-	wrk = list_entry(ubi->works.next, struct ubi_work, list);
 	list_del(&wrk->list);
 	ubi->works_count -= 1;
 	ubi_assert(ubi->works_count >= 0);
+	if (defer_erase(ubi, wrk)) {
+		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->work_sem);
+		return 0;
+	}
+	if (ubi->chips > 1 && wrk->func == &erase_worker &&
+	    wrk->vol_id != UBI_UNKNOWN) {
+		/* Newer copies of the LEB have to wait for this erasure */
+		r.vol_id = wrk->vol_id;
+		r.lnum = wrk->lnum;
+		list_add_tail(&r.list, &ubi->erases_running);
+		running = 1;
+	}
 	spin_unlock(&ubi->wl_lock);
 
 	/*
@@ -243,26 +425,48 @@ static int do_work(struct ubi_device *ubi)
 	err = wrk->func(ubi, wrk, 0);
 	if (err)
 		ubi_err("work failed with error code %d", err);
+
+	if (running) {
+		spin_lock(&ubi->wl_lock);
+		list_del(&r.list);
+		if (ubi->works_count && ubi->thread_enabled &&
+		    !ubi_dbg_is_bgt_disabled(ubi))
+			ubi_wl_wake_threads(ubi);
+		spin_unlock(&ubi->wl_lock);
+	}
 	up_read(&ubi->work_sem);
 
 	return err;
 }
 
+/**
+ * do_work - do one pending work.
+ * @ubi: UBI device description object
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int do_work(struct ubi_device *ubi)
+{
+	return __do_work(ubi, WORK_ANY);
+}
+
 /**
  * produce_free_peb - produce a free physical eraseblock.
  * @ubi: UBI device description object
  *
  * This function tries to make a free PEB by means of synchronous execution of
  * pending works. This may be needed if, for example the background thread is
- * disabled. Returns zero in case of success and a negative error code in case
- * of failure.
+ * disabled. Note, no free PEB may be produced if all pending works were
+ * deferred until the next fastmap. Returns zero in case of success and a
+ * negative error code in case of failure.
  */
 static int produce_free_peb(struct ubi_device *ubi)
 {
 	int err;
 
 	spin_lock(&ubi->wl_lock);
-	while (!ubi->free.rb_node) {
+	while (!ubi->free.rb_node && ubi->works_count) {
 		spin_unlock(&ubi->wl_lock);
 
 		dbg_wl("do one work synchronously");
@@ -371,13 +575,32 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int diff)
 }
 
 /**
- * ubi_wl_get_peb - get a physical eraseblock.
+ * find_anchor_wl_entry - find a wear-leveling entry for the fastmap anchor.
+ * @root: the RB-tree where to look for
+ *
+ * This function returns the least worn out entry among the ones with PEB
+ * number lower than %UBI_FM_MAX_START, or %NULL if there is none.
+ */
+static struct ubi_wl_entry *find_anchor_wl_entry(struct rb_root *root)
+{
+	struct rb_node *p;
+	struct ubi_wl_entry *e;
+
+	ubi_rb_for_each_entry(p, e, root, u.rb)
+		if (e->pnum < UBI_FM_MAX_START)
+			return e;
+
+	return NULL;
+}
+
+/**
+ * __wl_get_peb - get a physical eraseblock from the free tree.
  * @ubi: UBI device description object
  *
  * This function returns a physical eraseblock in case of success and a
  * negative error code in case of failure. Might sleep.
  */
-int ubi_wl_get_peb(struct ubi_device *ubi)
+static int __wl_get_peb(struct ubi_device *ubi)
 {
 	int err;
 	struct ubi_wl_entry *e, *first, *last;
@@ -428,6 +651,193 @@ retry:
 	return e->pnum;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_wl_get_peb - get a physical eraseblock.
+ * @ubi: UBI device description object
+ *
+ * When fastmap is in use, PEBs are handed out from @ubi->fm_pool, and a new
+ * fastmap is written to refill the pool when it runs empty. This function
+ * returns a physical eraseblock in case of success and a negative error code
+ * in case of failure. Might sleep.
+ */
+int ubi_wl_get_peb(struct ubi_device *ubi)
+{
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+	struct ubi_wl_entry *e = NULL;
+	int err, refilled = 0;
+
+	if (ubi->fm_disabled)
+		return __wl_get_peb(ubi);
+
+	for (;;) {
+		down_read(&ubi->fm_sem);
+		spin_lock(&ubi->wl_lock);
+		if (pool->used < pool->size) {
+			e = ubi->lookuptbl[pool->pebs[pool->used++]];
+			dbg_wl("PEB %d EC %d", e->pnum, e->ec);
+			prot_queue_add(ubi, e);
+		}
+		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->fm_sem);
+		if (e)
+			break;
+
+		if (refilled) {
+			/*
+			 * The pool was refilled but there was not a single
+			 * free PEB. Run the pending works to get some.
+			 */
+			if (!ubi->works_count && !ubi->fm_erase_count) {
+				ubi_err("no free eraseblocks");
+				return -ENOSPC;
+			}
+
+			err = produce_free_peb(ubi);
+			if (err < 0)
+				return err;
+		}
+
+		err = ubi_update_fastmap(ubi);
+		if (err)
+			return err;
+		refilled = 1;
+	}
+
+	err = ubi_self_check_all_ff(ubi, e->pnum, ubi->vid_hdr_aloffset,
+				    ubi->peb_size - ubi->vid_hdr_aloffset);
+	if (err) {
+		ubi_err("new PEB %d does not contain all 0xFF bytes", e->pnum);
+		return err;
+	}
+
+	return e->pnum;
+}
+
+/**
+ * ubi_wl_get_fm_peb - get a physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @anchor: non-zero if the PEB has to be suitable for the fastmap anchor
+ *
+ * This function takes a free PEB for the fastmap itself. Fastmap PEBs are not
+ * kept in any tree, they are referred to by @ubi->fm. Returns %NULL if there
+ * is no suitable free PEB.
+ */
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor)
+{
+	struct ubi_wl_entry *e = NULL;
+
+	spin_lock(&ubi->wl_lock);
+	if (!ubi->free.rb_node)
+		goto out;
+
+	if (anchor)
+		e = find_anchor_wl_entry(&ubi->free);
+	else
+		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF/2);
+	if (!e)
+		goto out;
+
+	self_check_in_wl_tree(ubi, e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+	dbg_wl("PEB %d EC %d for the fastmap", e->pnum, e->ec);
+out:
+	spin_unlock(&ubi->wl_lock);
+	return e;
+}
+
+/**
+ * ubi_refill_pools - refill the fastmap pools.
+ * @ubi: UBI device description object
+ *
+ * This function returns the unused PEBs of both pools to the free tree and
+ * fills the pools up again. It is called by the fastmap writer with
+ * @ubi->fm_sem and @ubi->work_sem held in write mode, so nobody can take PEBs
+ * from the pools meanwhile.
+ */
+void ubi_refill_pools(struct ubi_device *ubi)
+{
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+	struct ubi_fm_pool *wl_pool = &ubi->fm_wl_pool;
+	struct ubi_wl_entry *e;
+	int i;
+
+	spin_lock(&ubi->wl_lock);
+	for (i = pool->used; i < pool->size; i++)
+		wl_tree_add(ubi->lookuptbl[pool->pebs[i]], &ubi->free);
+	for (i = wl_pool->used; i < wl_pool->size; i++)
+		wl_tree_add(ubi->lookuptbl[wl_pool->pebs[i]], &ubi->free);
+
+	/* Wear-leveling targets are picked the same way as without fastmap */
+	wl_pool->used = wl_pool->size = 0;
+	while (wl_pool->size < wl_pool->max_size && ubi->free.rb_node) {
+		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+		self_check_in_wl_tree(ubi, e, &ubi->free);
+		rb_erase(&e->u.rb, &ubi->free);
+		wl_pool->pebs[wl_pool->size++] = e->pnum;
+	}
+
+	pool->used = pool->size = 0;
+	while (pool->size < pool->max_size && ubi->free.rb_node) {
+		e = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF/2);
+		self_check_in_wl_tree(ubi, e, &ubi->free);
+		rb_erase(&e->u.rb, &ubi->free);
+		pool->pebs[pool->size++] = e->pnum;
+	}
+	spin_unlock(&ubi->wl_lock);
+}
+#else
+int ubi_wl_get_peb(struct ubi_device *ubi)
+{
+	return __wl_get_peb(ubi);
+}
+#endif
+
+/**
+ * peek_wl_target - find the target PEB for the next wear-leveling move.
+ * @ubi: UBI device description object
+ *
+ * With fastmap the target is taken from @ubi->fm_wl_pool, because PEBs from
+ * the free tree would not be scanned on attach. If that pool is empty, a new
+ * fastmap is scheduled to refill it. Returns %NULL if there is no target. Has
+ * to be called with @ubi->wl_lock locked; the target is taken by
+ * 'take_wl_target()'.
+ */
+static struct ubi_wl_entry *peek_wl_target(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	struct ubi_fm_pool *pool = &ubi->fm_wl_pool;
+
+	if (!ubi->fm_disabled) {
+		if (pool->used < pool->size)
+			return ubi->lookuptbl[pool->pebs[pool->used]];
+		if (ubi->free.rb_node)
+			schedule_work(&ubi->fm_work);
+		return NULL;
+	}
+#endif
+	if (!ubi->free.rb_node)
+		return NULL;
+	return find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+}
+
+/**
+ * take_wl_target - take the PEB returned by 'peek_wl_target()'.
+ * @ubi: UBI device description object
+ * @e: the target physical eraseblock
+ */
+static void take_wl_target(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (!ubi->fm_disabled) {
+		ubi->fm_wl_pool.used += 1;
+		return;
+	}
+#endif
+	self_check_in_wl_tree(ubi, e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
+}
+
 /**
  * prot_queue_del - remove a physical eraseblock from the protection queue.
  * @ubi: UBI device description object
@@ -503,6 +913,7 @@ static int sync_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 		goto out_free;
 
 	e->ec = ec;
+	ubi->read_counts[e->pnum] = 0;
 	spin_lock(&ubi->wl_lock);
 	if (e->ec > ubi->max_ec)
 		ubi->max_ec = e->ec;
@@ -571,14 +982,16 @@ static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 	list_add_tail(&wrk->list, &ubi->works);
 	ubi_assert(ubi->works_count >= 0);
 	ubi->works_count += 1;
-	if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi))
-		wake_up_process(ubi->bgt_thread);
+	if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi)) {
+		if (ubi->chips > 1 && wrk->func == &erase_worker)
+			wake_up_process(ubi->erase_threads[
+					peb_chip(ubi, wrk->e->pnum)].task);
+		else
+			wake_up_process(ubi->bgt_thread);
+	}
 	spin_unlock(&ubi->wl_lock);
 }
 
-static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
-			int cancel);
-
 /**
  * schedule_erase - schedule an erase work.
  * @ubi: UBI device description object
@@ -643,8 +1056,8 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	ubi_assert(!ubi->move_from && !ubi->move_to);
 	ubi_assert(!ubi->move_to_put);
 
-	if (!ubi->free.rb_node ||
-	    (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
+	e2 = peek_wl_target(ubi);
+	if (!e2 || (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
 		/*
 		 * No free physical eraseblocks? Well, they must be waiting in
 		 * the queue to be erased. Cancel movement - it will be
@@ -656,7 +1069,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * triggered again.
 		 */
 		dbg_wl("cancel WL, a list is empty: free %d, used %d",
-		       !ubi->free.rb_node, !ubi->used.rb_node);
+		       !e2, !ubi->used.rb_node);
 		goto out_cancel;
 	}
 
@@ -667,7 +1080,6 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -682,14 +1094,12 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 		self_check_in_wl_tree(ubi, e1, &ubi->scrub);
 		rb_erase(&e1->u.rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	self_check_in_wl_tree(ubi, e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	take_wl_target(ubi, e2);
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -923,9 +1333,12 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	 * the WL worker has to be scheduled anyway.
 	 */
 	if (!ubi->scrub.rb_node) {
-		if (!ubi->used.rb_node || !ubi->free.rb_node)
+		if (!ubi->used.rb_node)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
+		e2 = peek_wl_target(ubi);
+		if (!e2)
+			goto out_unlock;
 
 		/*
 		 * We schedule wear-leveling only if the difference between the
@@ -934,7 +1347,6 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		 * %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -1086,20 +1498,17 @@ out_ro:
 }
 
 /**
- * ubi_wl_put_peb - return a PEB to the wear-leveling sub-system.
+ * __wl_put_peb - return a PEB to the wear-leveling sub-system.
  * @ubi: UBI device description object
  * @vol_id: the volume ID that last used this PEB
  * @lnum: the last used logical eraseblock number for the PEB
  * @pnum: physical eraseblock to return
  * @torture: if this physical eraseblock has to be tortured
  *
- * This function is called to return physical eraseblock @pnum to the pool of
- * free physical eraseblocks. The @torture flag has to be set if an I/O error
- * occurred to this @pnum and it has to be tested. This function returns zero
- * in case of success, and a negative error code in case of failure.
+ * See 'ubi_wl_put_peb()'.
  */
-int ubi_wl_put_peb(struct ubi_device *ubi, int vol_id, int lnum,
-		   int pnum, int torture)
+static int __wl_put_peb(struct ubi_device *ubi, int vol_id, int lnum,
+			int pnum, int torture)
 {
 	int err;
 	struct ubi_wl_entry *e;
@@ -1175,6 +1584,101 @@ retry:
 	return err;
 }
 
+/**
+ * ubi_wl_put_peb - return a PEB to the wear-leveling sub-system.
+ * @ubi: UBI device description object
+ * @vol_id: the volume ID that last used this PEB
+ * @lnum: the last used logical eraseblock number for the PEB
+ * @pnum: physical eraseblock to return
+ * @torture: if this physical eraseblock has to be tortured
+ *
+ * This function is called to return physical eraseblock @pnum to the pool of
+ * free physical eraseblocks. The @torture flag has to be set if an I/O error
+ * occurred to this @pnum and it has to be tested. This function returns zero
+ * in case of success, and a negative error code in case of failure.
+ */
+int ubi_wl_put_peb(struct ubi_device *ubi, int vol_id, int lnum,
+		   int pnum, int torture)
+{
+	int err;
+
+	if (ubi->fm_disabled)
+		return __wl_put_peb(ubi, vol_id, lnum, pnum, torture);
+
+	/*
+	 * The PEB is neither in a tree nor in the work queue for a moment,
+	 * the fastmap writer must not see it in this state.
+	 */
+	down_read(&ubi->fm_sem);
+	err = __wl_put_peb(ubi, vol_id, lnum, pnum, torture);
+	up_read(&ubi->fm_sem);
+	return err;
+}
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_wl_put_fm_peb - return a fastmap PEB to the wear-leveling sub-system.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock to return
+ * @lnum: the position of the PEB within the fastmap
+ * @torture: if this physical eraseblock has to be tortured
+ *
+ * This function schedules a PEB which was used by a fastmap for erasure.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int lnum, int torture)
+{
+	int vol_id = lnum ? UBI_FM_DATA_VOLUME_ID : UBI_FM_SB_VOLUME_ID;
+
+	ubi_assert(ubi->lookuptbl[e->pnum] == e);
+	return schedule_erase(ubi, e, vol_id, lnum, torture);
+}
+
+/**
+ * ubi_wl_requeue_deferred - return deferred erase works to the work queue.
+ * @ubi: UBI device description object
+ *
+ * This function is called by the fastmap writer once the deferred works may
+ * be done, i.e. when a new fastmap was written or the old one was invalidated.
+ */
+void ubi_wl_requeue_deferred(struct ubi_device *ubi)
+{
+	spin_lock(&ubi->wl_lock);
+	if (ubi->fm_erase_count) {
+		list_splice_tail_init(&ubi->fm_erase, &ubi->works);
+		ubi->works_count += ubi->fm_erase_count;
+		ubi->fm_erase_count = 0;
+		if (ubi->thread_enabled && !ubi_dbg_is_bgt_disabled(ubi))
+			ubi_wl_wake_threads(ubi);
+	}
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_is_erase_work - check if a work is an erase work.
+ * @wrk: the work object
+ */
+int ubi_is_erase_work(struct ubi_work *wrk)
+{
+	return wrk->func == &erase_worker;
+}
+
+/**
+ * ubi_wl_erase_fm_peb - synchronously erase a fastmap PEB for re-use.
+ * @ubi: UBI device description object
+ * @e: the physical eraseblock to erase
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	return sync_erase(ubi, e, 0);
+}
+#endif
+
 /**
  * ubi_wl_scrub_peb - schedule a physical eraseblock for scrubbing.
  * @ubi: UBI device description object
@@ -1255,6 +1759,7 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 	int err = 0;
 	int found = 1;
 
+again:
 	/*
 	 * Erase while the pending works queue is not empty, but not more than
 	 * the number of currently pending works.
@@ -1274,6 +1779,9 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 				list_del(&wrk->list);
 				ubi->works_count -= 1;
 				ubi_assert(ubi->works_count >= 0);
+				found = 1;
+				if (defer_erase(ubi, wrk))
+					break;
 				spin_unlock(&ubi->wl_lock);
 
 				err = wrk->func(ubi, wrk, 0);
@@ -1283,7 +1791,6 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 				}
 
 				spin_lock(&ubi->wl_lock);
-				found = 1;
 				break;
 			}
 		}
@@ -1291,6 +1798,18 @@ int ubi_wl_flush(struct ubi_device *ubi, int vol_id, int lnum)
 		up_read(&ubi->work_sem);
 	}
 
+	/*
+	 * Erasures which are deferred until the next fastmap have not been
+	 * done yet, write the fastmap to get them done.
+	 */
+	if (erase_deferred(ubi, vol_id, lnum)) {
+		err = ubi_update_fastmap(ubi);
+		if (err)
+			return err;
+		found = 1;
+		goto again;
+	}
+
 	/*
 	 * Make sure all the works which have been done in parallel are
 	 * finished.
@@ -1332,6 +1851,120 @@ static void tree_destroy(struct rb_root *root)
 	}
 }
 
+/**
+ * ubi_wl_read_disturbed - account a read from a physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock which was read
+ *
+ * Every read slightly disturbs the other pages of the eraseblock, so data
+ * which is read very often may go bad even though it is never written. This
+ * function returns %1 once @pnum was read at least
+ * @ubi->read_disturb_threshold times since it was erased, so that the caller
+ * schedules it for scrubbing, and %0 otherwise. "At least" because the
+ * threshold may have been lowered below the count via sysfs; the count
+ * restarts once the scrub is requested. The counters are not protected by any
+ * lock, because an approximate count is good enough.
+ */
+int ubi_wl_read_disturbed(struct ubi_device *ubi, int pnum)
+{
+	unsigned int threshold = ubi->read_disturb_threshold;
+	unsigned int count;
+
+	if (!threshold)
+		return 0;
+
+	count = ++ubi->read_counts[pnum];
+	if (count < threshold)
+		return 0;
+
+	dbg_wl("PEB %d was read %u times, scrub it", pnum, count);
+	ubi->read_counts[pnum] = 0;
+	ubi->read_disturb_scrubs += 1;
+	return 1;
+}
+
+/**
+ * bg_scrub_timeout - get the time until the background scrubber runs.
+ * @ubi: UBI device description object
+ *
+ * Returns the number of jiffies until the next PEB has to be checked, or
+ * %MAX_SCHEDULE_TIMEOUT if background scrubbing is disabled.
+ */
+static long bg_scrub_timeout(struct ubi_device *ubi)
+{
+	if (!ubi->bg_scrub_interval)
+		return MAX_SCHEDULE_TIMEOUT;
+	if (time_after_eq(jiffies, ubi->bg_scrub_next))
+		return 0;
+	return ubi->bg_scrub_next - jiffies;
+}
+
+/**
+ * bg_scrub_peb - check the next used physical eraseblock for bit-flips.
+ * @ubi: UBI device description object
+ *
+ * Data which is rarely read may degrade unnoticed until it cannot be corrected
+ * anymore. The background thread reads one used PEB every
+ * @ubi->bg_scrub_interval milliseconds while it has nothing else to do, and
+ * schedules it for scrubbing if the MTD layer reports bit-flips, i.e., if the
+ * number of corrected bits reached the bit-flip threshold of the MTD device.
+ */
+static void bg_scrub_peb(struct ubi_device *ubi)
+{
+	struct ubi_wl_entry *e = NULL;
+	int i, pnum, err;
+
+	ubi->bg_scrub_next = jiffies + msecs_to_jiffies(ubi->bg_scrub_interval);
+
+	spin_lock(&ubi->wl_lock);
+	for (i = 0; i < BG_SCRUB_MAX_SKIP; i++) {
+		pnum = ubi->bg_scrub_pnum;
+		if (++ubi->bg_scrub_pnum >= ubi->peb_count)
+			ubi->bg_scrub_pnum = 0;
+
+		e = ubi->lookuptbl[pnum];
+		if (e && in_wl_tree(e, &ubi->used))
+			break;
+		e = NULL;
+	}
+	spin_unlock(&ubi->wl_lock);
+	if (!e)
+		return;
+
+	/*
+	 * The PEB is not protected against being put and erased meanwhile,
+	 * but then it is not in the @ubi->used tree anymore and the result of
+	 * the check does not matter.
+	 */
+	mutex_lock(&ubi->buf_mutex);
+	err = ubi_io_read(ubi, ubi->peb_buf, pnum, 0, ubi->peb_size);
+	mutex_unlock(&ubi->buf_mutex);
+	ubi->bg_scrub_checked += 1;
+
+	if (err == UBI_IO_BITFLIPS) {
+		spin_lock(&ubi->wl_lock);
+		e = ubi->lookuptbl[pnum];
+		if (e && in_wl_tree(e, &ubi->used)) {
+			dbg_wl("bit-flips in PEB %d, scrub it", pnum);
+			rb_erase(&e->u.rb, &ubi->used);
+			wl_tree_add(e, &ubi->scrub);
+			ubi->bg_scrub_bitflips += 1;
+		} else
+			e = NULL;
+		spin_unlock(&ubi->wl_lock);
+
+		if (e) {
+			err = ensure_wear_leveling(ubi);
+			if (err)
+				ubi_err("cannot schedule scrubbing of PEB %d, "
+					"error %d", pnum, err);
+		}
+	} else if (mtd_is_eccerr(err))
+		ubi_warn("uncorrectable ECC error in PEB %d", pnum);
+	else if (err)
+		ubi_warn("error %d while checking PEB %d", err, pnum);
+}
+
 /**
  * ubi_thread - UBI background thread.
  * @u: the UBI device description object pointer
@@ -1355,16 +1988,29 @@ int ubi_thread(void *u)
 			continue;
 
 		spin_lock(&ubi->wl_lock);
-		if (list_empty(&ubi->works) || ubi->ro_mode ||
+		if (!next_work(ubi, bgt_work_sel(ubi)) || ubi->ro_mode ||
 		    !ubi->thread_enabled || ubi_dbg_is_bgt_disabled(ubi)) {
+			long timeout = MAX_SCHEDULE_TIMEOUT;
+
+			/* Nothing to do, check a PEB if it is time to */
+			if (!ubi->ro_mode && ubi->thread_enabled &&
+			    !ubi_dbg_is_bgt_disabled(ubi))
+				timeout = bg_scrub_timeout(ubi);
+			if (!timeout) {
+				spin_unlock(&ubi->wl_lock);
+				bg_scrub_peb(ubi);
+				cond_resched();
+				continue;
+			}
+
 			set_current_state(TASK_INTERRUPTIBLE);
 			spin_unlock(&ubi->wl_lock);
-			schedule();
+			schedule_timeout(timeout);
 			continue;
 		}
 		spin_unlock(&ubi->wl_lock);
 
-		err = do_work(ubi);
+		err = __do_work(ubi, bgt_work_sel(ubi));
 		if (err) {
 			ubi_err("%s: work failed with error code %d",
 				ubi->bgt_name, err);
@@ -1389,6 +2035,131 @@ int ubi_thread(void *u)
 	return 0;
 }
 
+/**
+ * erase_thread - per-chip erase thread.
+ * @u: the &struct ubi_erase_thread object pointer
+ */
+static int erase_thread(void *u)
+{
+	int failures = 0;
+	struct ubi_erase_thread *et = u;
+	struct ubi_device *ubi = et->ubi;
+
+	dbg_wl("erase thread \"%s\" started, PID %d", et->name,
+	       task_pid_nr(current));
+
+	set_freezable();
+	for (;;) {
+		int err;
+
+		if (kthread_should_stop())
+			break;
+
+		if (try_to_freeze())
+			continue;
+
+		spin_lock(&ubi->wl_lock);
+		if (!next_work(ubi, et->chip) || ubi->ro_mode ||
+		    !ubi->thread_enabled || ubi_dbg_is_bgt_disabled(ubi)) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			spin_unlock(&ubi->wl_lock);
+			schedule();
+			continue;
+		}
+		spin_unlock(&ubi->wl_lock);
+
+		err = __do_work(ubi, et->chip);
+		if (err) {
+			ubi_err("%s: work failed with error code %d",
+				et->name, err);
+			if (failures++ > WL_MAX_FAILURES) {
+				ubi_msg("%s: %d consecutive failures",
+					et->name, WL_MAX_FAILURES);
+				ubi_ro_mode(ubi);
+				ubi->thread_enabled = 0;
+				continue;
+			}
+		} else
+			failures = 0;
+
+		cond_resched();
+	}
+
+	dbg_wl("erase thread \"%s\" is killed", et->name);
+	return 0;
+}
+
+/**
+ * ubi_wl_wake_threads - wake up the background and the erase threads.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called with @ubi->wl_lock locked.
+ */
+void ubi_wl_wake_threads(struct ubi_device *ubi)
+{
+	int i;
+
+	wake_up_process(ubi->bgt_thread);
+	if (ubi->chips > 1)
+		for (i = 0; i < ubi->chips; i++)
+			wake_up_process(ubi->erase_threads[i].task);
+}
+
+/**
+ * ubi_wl_start_erasers - start the per-chip erase threads.
+ * @ubi: UBI device description object
+ *
+ * Nothing is done if the MTD device consists of a single chip, the background
+ * thread does the erasures then. The threads sleep until
+ * @ubi->thread_enabled is set. This function returns zero in case of success
+ * and a negative error code in case of failure.
+ */
+int ubi_wl_start_erasers(struct ubi_device *ubi)
+{
+	int i;
+
+	if (ubi->chips < 2)
+		return 0;
+
+	for (i = 0; i < ubi->chips; i++) {
+		struct ubi_erase_thread *et = &ubi->erase_threads[i];
+
+		et->ubi = ubi;
+		et->chip = i;
+		sprintf(et->name, UBI_ERASE_NAME_PATTERN, ubi->ubi_num, i);
+		et->task = kthread_run(erase_thread, et, et->name);
+		if (IS_ERR(et->task)) {
+			int err = PTR_ERR(et->task);
+
+			ubi_err("cannot spawn \"%s\", error %d", et->name, err);
+			et->task = NULL;
+			ubi_wl_stop_erasers(ubi);
+			return err;
+		}
+	}
+
+	ubi_msg("erasures are done in parallel on %d chips", ubi->chips);
+	return 0;
+}
+
+/**
+ * ubi_wl_stop_erasers - stop the per-chip erase threads.
+ * @ubi: UBI device description object
+ */
+void ubi_wl_stop_erasers(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < ubi->chips; i++) {
+		struct ubi_erase_thread *et = &ubi->erase_threads[i];
+
+		if (et->task) {
+			kthread_stop(et->task);
+			et->task = NULL;
+		}
+	}
+}
+
 /**
  * cancel_pending - cancel all pending works.
  * @ubi: UBI device description object
@@ -1428,6 +2199,7 @@ int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = ai->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
+	INIT_LIST_HEAD(&ubi->erases_running);
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
 
@@ -1436,6 +2208,15 @@ int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	if (!ubi->lookuptbl)
 		return err;
 
+	ubi->read_counts = vzalloc(ubi->peb_count * sizeof(unsigned int));
+	if (!ubi->read_counts) {
+		kfree(ubi->lookuptbl);
+		return err;
+	}
+	ubi->read_disturb_threshold = CONFIG_MTD_UBI_READ_DISTURB_THRESHOLD;
+	ubi->bg_scrub_interval = CONFIG_MTD_UBI_BG_SCRUB_INTERVAL;
+	ubi->bg_scrub_next = jiffies + msecs_to_jiffies(ubi->bg_scrub_interval);
+
 	for (i = 0; i < UBI_PROT_QUEUE_LEN; i++)
 		INIT_LIST_HEAD(&ubi->pq[i]);
 	ubi->pq_head = 0;
@@ -1456,6 +2237,11 @@ int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai)
 		}
 	}
 
+	/* The fastmap PEBs are owned by @ubi->fm and are in no tree */
+	if (ubi->fm)
+		for (i = 0; i < ubi->fm->used_blocks; i++)
+			ubi->lookuptbl[ubi->fm->e[i]->pnum] = ubi->fm->e[i];
+
 	list_for_each_entry(aeb, &ai->free, u.list) {
 		cond_resched();
 
@@ -1504,6 +2290,21 @@ int ubi_wl_init(struct ubi_device *ubi, struct ubi_attach_info *ai)
 	ubi->avail_pebs -= WL_RESERVED_PEBS;
 	ubi->rsvd_pebs += WL_RESERVED_PEBS;
 
+	if (!ubi->fm_disabled) {
+		/*
+		 * The PEBs of the old fastmap are only returned once the new
+		 * one is written, so reserve room for two of them. If the
+		 * PEBs are not there, old fastmap PEBs are re-used.
+		 */
+		i = 2 * (ubi->fm_size / ubi->leb_size);
+		if (ubi->avail_pebs >= i) {
+			ubi->avail_pebs -= i;
+			ubi->rsvd_pebs += i;
+		} else
+			ubi_warn("no PEBs reserved for fastmap (%d, need %d)",
+				 ubi->avail_pebs, i);
+	}
+
 	/* Schedule wear-leveling if needed */
 	err = ensure_wear_leveling(ubi);
 	if (err)
@@ -1516,6 +2317,7 @@ out_free:
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	vfree(ubi->read_counts);
 	kfree(ubi->lookuptbl);
 	return err;
 }
@@ -1537,6 +2339,33 @@ static void protection_queue_destroy(struct ubi_device *ubi)
 	}
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * fastmap_pools_destroy - free the fastmap pools and deferred works.
+ * @ubi: UBI device description object
+ */
+static void fastmap_pools_destroy(struct ubi_device *ubi)
+{
+	struct ubi_fm_pool *pool = &ubi->fm_pool;
+	struct ubi_fm_pool *wl_pool = &ubi->fm_wl_pool;
+	int i;
+
+	for (i = pool->used; i < pool->size; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->lookuptbl[pool->pebs[i]]);
+	for (i = wl_pool->used; i < wl_pool->size; i++)
+		kmem_cache_free(ubi_wl_entry_slab,
+				ubi->lookuptbl[wl_pool->pebs[i]]);
+	pool->used = pool->size = wl_pool->used = wl_pool->size = 0;
+
+	/* Deferred works are cancelled together with the pending ones */
+	list_splice_tail_init(&ubi->fm_erase, &ubi->works);
+	ubi->works_count += ubi->fm_erase_count;
+	ubi->fm_erase_count = 0;
+}
+#else
+static inline void fastmap_pools_destroy(struct ubi_device *ubi) {}
+#endif
+
 /**
  * ubi_wl_close - close the wear-leveling sub-system.
  * @ubi: UBI device description object
@@ -1544,12 +2373,14 @@ static void protection_queue_destroy(struct ubi_device *ubi)
 void ubi_wl_close(struct ubi_device *ubi)
 {
 	dbg_wl("close the WL sub-system");
+	fastmap_pools_destroy(ubi);
 	cancel_pending(ubi);
 	protection_queue_destroy(ubi);
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->erroneous);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	vfree(ubi->read_counts);
 	kfree(ubi->lookuptbl);
 }
 
@@ -37,6 +37,8 @@
 #define MAX_RBUFF_SZ	0x600
 /* max number of receive buffers */
 #define MAX_RX_DESCR	9
+/* max number of frames owned by the EMAC: the active and the queued one */
+#define MAX_TX_FRAMES	ARRAY_SIZE(((struct macb *)0)->rm9200_txq)
 
 /* Initialize and start the Receiver and Transmit subsystems */
 static int at91ether_start(struct net_device *dev)
@@ -77,8 +79,10 @@ static int at91ether_start(struct net_device *dev)
 	/* Set the Wrap bit on the last descriptor */
 	lp->rx_ring[MAX_RX_DESCR - 1].addr |= MACB_BIT(RX_WRAP);
 
-	/* Reset buffer index */
+	/* Reset buffer indexes */
 	lp->rx_tail = 0;
+	lp->rm9200_tx_tail = 0;
+	lp->rm9200_tx_len = 0;
 
 	/* Program address of descriptor list in Rx Buffer Queue register */
 	macb_writel(lp, RBQP, lp->rx_ring_dma);
@@ -107,6 +111,8 @@ static int at91ether_open(struct net_device *dev)
 	if (ret)
 		return ret;
 
+	napi_enable(&lp->napi);
+
 	/* Enable MAC interrupts */
 	macb_writel(lp, IER, MACB_BIT(RCOMP)	|
 			     MACB_BIT(RXUBR)	|
@@ -144,6 +150,19 @@ static int at91ether_close(struct net_device *dev)
 			     MACB_BIT(HRESP));
 
 	netif_stop_queue(dev);
+	napi_disable(&lp->napi);
+
+	/* Drop the frames the transmitter was holding */
+	while (lp->rm9200_tx_len) {
+		struct macb_tx_skb *tx = &lp->rm9200_txq[lp->rm9200_tx_tail];
+
+		dma_unmap_single(&lp->pdev->dev, tx->mapping, tx->skb->len,
+				 DMA_TO_DEVICE);
+		dev_kfree_skb(tx->skb);
+		tx->skb = NULL;
+		lp->rm9200_tx_tail = (lp->rm9200_tx_tail + 1) % MAX_TX_FRAMES;
+		lp->rm9200_tx_len--;
+	}
 
 	dma_free_coherent(&lp->pdev->dev,
 				MAX_RX_DESCR * sizeof(struct macb_dma_desc),
@@ -158,44 +177,114 @@ static int at91ether_close(struct net_device *dev)
 	return 0;
 }
 
-/* Transmit packet */
+/* Transmit packet
+ *
+ * The EMAC holds two frames: the one being sent and one queued behind it
+ * (BNQ is set while the queue slot is free). BNQ also reads 0 for a moment
+ * after a frame is queued, until the EMAC takes it over, so the stack is
+ * stopped when it is still clear after queuing, and woken again by the
+ * next transmit complete interrupt.
+ */
 static int at91ether_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct macb *lp = netdev_priv(dev);
+	struct macb_tx_skb *tx;
+	unsigned long flags;
+	unsigned int entry;
 
-	if (macb_readl(lp, TSR) & MACB_BIT(RM9200_BNQ)) {
-		netif_stop_queue(dev);
-
-		/* Store packet information (to free when Tx completed) */
-		lp->skb = skb;
-		lp->skb_length = skb->len;
-		lp->skb_physaddr = dma_map_single(NULL, skb->data, skb->len,
-							DMA_TO_DEVICE);
+	spin_lock_irqsave(&lp->lock, flags);
 
-		/* Set address of the data in the Transmit Address register */
-		macb_writel(lp, TAR, lp->skb_physaddr);
-		/* Set length of the packet in the Transmit Control register */
-		macb_writel(lp, TCR, skb->len);
+	if (lp->rm9200_tx_len >= MAX_TX_FRAMES) {
+		netif_stop_queue(dev);
+		spin_unlock_irqrestore(&lp->lock, flags);
 
-	} else {
 		netdev_err(dev, "%s called, but device is busy!\n", __func__);
 		return NETDEV_TX_BUSY;
 	}
 
+	entry = (lp->rm9200_tx_tail + lp->rm9200_tx_len) % MAX_TX_FRAMES;
+	tx = &lp->rm9200_txq[entry];
+
+	/* Store packet information (to free when Tx completed) */
+	tx->skb = skb;
+	tx->mapping = dma_map_single(&lp->pdev->dev, skb->data, skb->len,
+				     DMA_TO_DEVICE);
+
+	/* Set address of the data in the Transmit Address register */
+	macb_writel(lp, TAR, tx->mapping);
+	/* Set length of the packet in the Transmit Control register */
+	macb_writel(lp, TCR, skb->len);
+
+	if (++lp->rm9200_tx_len == MAX_TX_FRAMES ||
+	    !(macb_readl(lp, TSR) & MACB_BIT(RM9200_BNQ)))
+		netif_stop_queue(dev);
+
+	spin_unlock_irqrestore(&lp->lock, flags);
+
 	return NETDEV_TX_OK;
 }
 
-/* Extract received frame from buffer descriptors and sent to upper layers.
- * (Called from interrupt context)
+/* Free the frames the transmitter is done with.
+ * (Called from interrupt context with lp->lock held)
  */
-static void at91ether_rx(struct net_device *dev)
+static void at91ether_tx_complete(struct net_device *dev, u32 intstatus)
+{
+	struct macb *lp = netdev_priv(dev);
+	unsigned int busy;
+	bool failed;
+	u32 tsr;
+
+	/* TCOM is only raised once for back to back frames, so deduce
+	 * from the transmit status how many the EMAC still owns.
+	 */
+	tsr = macb_readl(lp, TSR);
+	if (!(tsr & MACB_BIT(RM9200_BNQ)))
+		busy = 2;
+	else if (tsr & MACB_BIT(TGO))
+		busy = 1;
+	else
+		busy = 0;
+
+	/* The TCOM bit is set even if the transmission failed. The error
+	 * belongs to the last frame the EMAC finished with.
+	 */
+	failed = intstatus & (MACB_BIT(ISR_TUND) | MACB_BIT(ISR_RLE));
+	if (failed)
+		lp->stats.tx_errors++;
+
+	while (lp->rm9200_tx_len > busy) {
+		struct macb_tx_skb *tx = &lp->rm9200_txq[lp->rm9200_tx_tail];
+
+		dma_unmap_single(&lp->pdev->dev, tx->mapping, tx->skb->len,
+				 DMA_TO_DEVICE);
+		if (!failed || lp->rm9200_tx_len > busy + 1) {
+			lp->stats.tx_packets++;
+			lp->stats.tx_bytes += tx->skb->len;
+		}
+		dev_kfree_skb_irq(tx->skb);
+		tx->skb = NULL;
+
+		lp->rm9200_tx_tail = (lp->rm9200_tx_tail + 1) % MAX_TX_FRAMES;
+		lp->rm9200_tx_len--;
+	}
+
+	if (lp->rm9200_tx_len < MAX_TX_FRAMES)
+		netif_wake_queue(dev);
+}
+
+/* Extract received frames from buffer descriptors and send them to upper
+ * layers, at most @budget of them. (Called from NAPI poll context)
+ */
+static int at91ether_rx(struct net_device *dev, int budget)
 {
 	struct macb *lp = netdev_priv(dev);
 	unsigned char *p_recv;
 	struct sk_buff *skb;
 	unsigned int pktlen;
+	int received = 0;
 
-	while (lp->rx_ring[lp->rx_tail].addr & MACB_BIT(RX_USED)) {
+	while (received < budget &&
+	       (lp->rx_ring[lp->rx_tail].addr & MACB_BIT(RX_USED))) {
 		p_recv = lp->rx_buffers + lp->rx_tail * MAX_RBUFF_SZ;
 		pktlen = MACB_BF(RX_FRMLEN, lp->rx_ring[lp->rx_tail].ctrl);
 		skb = netdev_alloc_skb(dev, pktlen + 2);
@@ -206,7 +295,7 @@ static void at91ether_rx(struct net_device *dev)
 			skb->protocol = eth_type_trans(skb, dev);
 			lp->stats.rx_packets++;
 			lp->stats.rx_bytes += pktlen;
-			netif_rx(skb);
+			netif_receive_skb(skb);
 		} else {
 			lp->stats.rx_dropped++;
 			netdev_notice(dev, "Memory squeeze, dropping packet.\n");
@@ -223,7 +312,34 @@ static void at91ether_rx(struct net_device *dev)
 			lp->rx_tail = 0;
 		else
 			lp->rx_tail++;
+
+		received++;
 	}
+
+	return received;
+}
+
+static int at91ether_poll(struct napi_struct *napi, int budget)
+{
+	struct macb *lp = container_of(napi, struct macb, napi);
+	int work_done;
+
+	work_done = at91ether_rx(lp->dev, budget);
+	if (work_done < budget) {
+		napi_complete(napi);
+
+		/* We've done what we can to clean the buffers. Make sure we
+		 * get notified when new packets arrive.
+		 */
+		macb_writel(lp, IER, MACB_BIT(RCOMP));
+
+		/* Packets received while interrupts were disabled */
+		if ((lp->rx_ring[lp->rx_tail].addr & MACB_BIT(RX_USED)) &&
+		    napi_reschedule(napi))
+			macb_writel(lp, IDR, MACB_BIT(RCOMP));
+	}
+
+	return work_done;
 }
 
 /* MAC interrupt handler */
@@ -238,24 +354,19 @@ static irqreturn_t at91ether_interrupt(int irq, void *dev_id)
 	 */
 	intstatus = macb_readl(lp, ISR);
 
-	/* Receive complete */
-	if (intstatus & MACB_BIT(RCOMP))
-		at91ether_rx(dev);
+	/* Receive complete: there's no point taking any more RX interrupts
+	 * until the poll routine has processed the buffers.
+	 */
+	if (intstatus & MACB_BIT(RCOMP)) {
+		macb_writel(lp, IDR, MACB_BIT(RCOMP));
+		napi_schedule(&lp->napi);
+	}
 
 	/* Transmit complete */
 	if (intstatus & MACB_BIT(TCOMP)) {
-		/* The TCOM bit is set even if the transmission failed */
-		if (intstatus & (MACB_BIT(ISR_TUND) | MACB_BIT(ISR_RLE)))
-			lp->stats.tx_errors++;
-
-		if (lp->skb) {
-			dev_kfree_skb_irq(lp->skb);
-			lp->skb = NULL;
-			dma_unmap_single(NULL, lp->skb_physaddr, lp->skb_length, DMA_TO_DEVICE);
-			lp->stats.tx_packets++;
-			lp->stats.tx_bytes += lp->skb_length;
-		}
-		netif_wake_queue(dev);
+		spin_lock(&lp->lock);
+		at91ether_tx_complete(dev, intstatus);
+		spin_unlock(&lp->lock);
 	}
 
 	/* Work-around for EMAC Errata section 41.3.1 */
@@ -400,6 +511,7 @@ static int __init at91ether_probe(struct platform_device *pdev)
 	ether_setup(dev);
 	dev->netdev_ops = &at91ether_netdev_ops;
 	dev->ethtool_ops = &macb_ethtool_ops;
+	netif_napi_add(dev, &lp->napi, at91ether_poll, 64);
 	platform_set_drvdata(pdev, dev);
 	SET_NETDEV_DEV(dev, &pdev->dev);
 
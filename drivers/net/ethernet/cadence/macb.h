@@ -590,9 +590,9 @@ struct macb {
 	phy_interface_t		phy_interface;
 
 	/* AT91RM9200 transmit */
-	struct sk_buff *skb;			/* holds skb until xmit interrupt completes */
-	dma_addr_t skb_physaddr;		/* phys addr from pci_map_single */
-	int skb_length;				/* saved skb length for pci_unmap_single */
+	struct macb_tx_skb rm9200_txq[2];	/* frame being sent and queued one */
+	unsigned int rm9200_tx_tail;		/* oldest frame of rm9200_txq */
+	unsigned int rm9200_tx_len;		/* frames handed to the EMAC */
 };
 
 extern const struct ethtool_ops macb_ethtool_ops;
@@ -13,6 +13,7 @@
 #include <linux/platform_device.h>
 #include <linux/pinctrl/consumer.h>
 #include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
 #include <linux/interrupt.h>
 #include <linux/clk.h>
 #include <linux/fb.h>
@@ -31,6 +32,15 @@
 /* configurable parameters */
 #define ATMEL_LCDC_CVAL_DEFAULT		0xc8
 
+/*
+ * When set, regions drawn through the fb_ops are copied into the new back
+ * buffer on every page flip, so double-buffered clients only have to
+ * redraw what changed since their previous frame.
+ */
+static bool flipsync;
+module_param(flipsync, bool, 0644);
+MODULE_PARM_DESC(flipsync, "Keep both pages of a double-buffered display in sync on pan (default: off)");
+
 #ifdef CONFIG_BACKLIGHT_ATMEL_LCDC
 
 static void init_backlight(struct atmel_lcdfb_info *sinfo)
@@ -450,6 +460,371 @@ static int atmel_lcdfb_setcolreg(unsigned int regno, unsigned int red,
 	return ret;
 }
 
+static void atmel_lcdfb_mark_dirty(struct atmel_lcdfb_info *sinfo,
+				   u32 x, u32 y, u32 width, u32 height)
+{
+	struct atmel_lcdfb_dirty *dirty = &sinfo->dirty;
+	unsigned long flags;
+
+	if (!flipsync || !width || !height)
+		return;
+
+	spin_lock_irqsave(&sinfo->lock, flags);
+	if (dirty->x2 <= dirty->x1 || dirty->y2 <= dirty->y1) {
+		dirty->x1 = x;
+		dirty->y1 = y;
+		dirty->x2 = x + width;
+		dirty->y2 = y + height;
+	} else {
+		dirty->x1 = min(dirty->x1, x);
+		dirty->y1 = min(dirty->y1, y);
+		dirty->x2 = max(dirty->x2, x + width);
+		dirty->y2 = max(dirty->y2, y + height);
+	}
+	spin_unlock_irqrestore(&sinfo->lock, flags);
+}
+
+#ifdef CONFIG_FB_ATMEL_DMA_ACCEL
+
+/* Below these sizes the CPU is faster than programming the DMA */
+#define ATMEL_LCDFB_DMA_MIN_BYTES	4096
+#define ATMEL_LCDFB_DMA_MIN_LINE	32
+
+/*
+ * Check whether a width x height rectangle is worth handing to the DMA.
+ * Completion is reported by the DMA tasklet, so we also need interrupts
+ * to be enabled (printk() calls fbcon with them disabled).
+ */
+static bool atmel_lcdfb_dma_usable(struct fb_info *info, u32 width, u32 height)
+{
+	struct atmel_lcdfb_info *sinfo = info->par;
+	u32 bpp = info->var.bits_per_pixel;
+	u32 line_bytes = width * bpp / 8;
+
+	if (!sinfo->dma_chan || info->state != FBINFO_STATE_RUNNING)
+		return false;
+	if (bpp < 8 || (bpp & 7))
+		return false;
+	if (line_bytes < ATMEL_LCDFB_DMA_MIN_LINE
+	    || line_bytes * height < ATMEL_LCDFB_DMA_MIN_BYTES)
+		return false;
+
+	return !irqs_disabled() && !in_interrupt() && !oops_in_progress;
+}
+
+static inline dma_addr_t atmel_lcdfb_dma_addr(struct fb_info *info,
+					      u32 x, u32 y)
+{
+	return info->fix.smem_start + y * info->fix.line_length
+		+ x * (info->var.bits_per_pixel / 8);
+}
+
+/*
+ * Queue one memory to memory copy. Descriptors on a channel complete in
+ * submission order, so a sequence of line copies behaves exactly like the
+ * same sequence of memmove() calls would.
+ */
+static int atmel_lcdfb_dma_queue(struct atmel_lcdfb_info *sinfo,
+				 dma_addr_t dst, dma_addr_t src, size_t len)
+{
+	struct dma_chan *chan = sinfo->dma_chan;
+	struct dma_async_tx_descriptor *tx;
+	dma_cookie_t cookie;
+
+	tx = chan->device->device_prep_dma_memcpy(chan, dst, src, len,
+			DMA_CTRL_ACK | DMA_COMPL_SKIP_SRC_UNMAP
+			| DMA_COMPL_SKIP_DEST_UNMAP);
+	if (!tx)
+		return -ENOMEM;
+
+	cookie = dmaengine_submit(tx);
+	if (dma_submit_error(cookie))
+		return -EIO;
+
+	sinfo->dma_cookie = cookie;
+	return 0;
+}
+
+/*
+ * Wait for everything queued so far. The operation is synchronous from the
+ * caller's point of view (fbcon may draw over the area right after), but the
+ * CPU only polls the channel while the bus runs in DMA bursts instead of
+ * single uncached accesses.
+ */
+static int atmel_lcdfb_dma_flush(struct atmel_lcdfb_info *sinfo)
+{
+	struct dma_chan *chan = sinfo->dma_chan;
+
+	if (dma_sync_wait(chan, sinfo->dma_cookie) != DMA_SUCCESS) {
+		dev_err(sinfo->info->device, "DMA fill/copy failed\n");
+		dmaengine_terminate_all(chan);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * Copy an area in chunks of lines which do not overlap their own source,
+ * one DMA descriptor per line, or one per chunk when the area covers whole
+ * lines. Each chunk is waited for before the next one is queued, so if the
+ * DMA fails, the lines of that chunk still hold their source and can be
+ * redone. Returns the number of lines moved, counted from the top for
+ * upward moves and from the bottom otherwise; the caller finishes the rest
+ * with the CPU.
+ */
+static u32 atmel_lcdfb_dma_copy_lines(struct fb_info *info,
+				      const struct fb_copyarea *area)
+{
+	struct atmel_lcdfb_info *sinfo = info->par;
+	u32 line_bytes = area->width * info->var.bits_per_pixel / 8;
+	u32 pitch = info->fix.line_length;
+	bool upward = area->dy < area->sy;
+	bool whole = area->dx == 0 && area->sx == 0 && line_bytes == pitch;
+	u32 step = upward ? area->sy - area->dy : area->dy - area->sy;
+	dma_addr_t dst, src;
+	u32 done = 0;
+	u32 first, queued, n, y;
+
+	if (step > area->height)
+		step = area->height;
+
+	while (done < area->height) {
+		n = min(step, area->height - done);
+		first = upward ? done : area->height - done - n;
+		queued = 0;
+
+		if (whole) {
+			dst = atmel_lcdfb_dma_addr(info, 0, area->dy + first);
+			src = atmel_lcdfb_dma_addr(info, 0, area->sy + first);
+			if (!atmel_lcdfb_dma_queue(sinfo, dst, src, pitch * n))
+				queued = n;
+		} else {
+			for (; queued < n; queued++) {
+				y = upward ? first + queued
+					   : first + n - 1 - queued;
+				dst = atmel_lcdfb_dma_addr(info, area->dx,
+							   area->dy + y);
+				src = atmel_lcdfb_dma_addr(info, area->sx,
+							   area->sy + y);
+				if (atmel_lcdfb_dma_queue(sinfo, dst, src,
+							  line_bytes))
+					break;
+			}
+		}
+
+		if (!queued || atmel_lcdfb_dma_flush(sinfo))
+			break;
+		done += queued;
+		if (queued < n)
+			break;
+	}
+
+	return done;
+}
+
+static void atmel_lcdfb_copyarea(struct fb_info *info,
+				 const struct fb_copyarea *area)
+{
+	struct atmel_lcdfb_info *sinfo = info->par;
+	struct fb_copyarea rest = *area;
+	u32 done;
+
+	atmel_lcdfb_mark_dirty(sinfo, area->dx, area->dy,
+			       area->width, area->height);
+
+	/*
+	 * Moves within the same lines overlap their source on every line, so
+	 * a failed DMA could not be redone. They are rare, leave them to the
+	 * CPU.
+	 */
+	if (area->dy == area->sy
+	    || !atmel_lcdfb_dma_usable(info, area->width, area->height)) {
+		cfb_copyarea(info, area);
+		return;
+	}
+
+	/* make sure posted CPU writes reach memory before the DMA reads it */
+	wmb();
+
+	done = atmel_lcdfb_dma_copy_lines(info, area);
+	if (done == area->height)
+		return;
+
+	rest.height = area->height - done;
+	if (area->dy < area->sy) {
+		rest.dy += done;
+		rest.sy += done;
+	}
+	cfb_copyarea(info, &rest);
+}
+
+/*
+ * The DMA controller has no fill operation: draw the first line with the
+ * CPU, then replicate it. Whole-line fills double the filled block on each
+ * step, partial ones copy the first line once per remaining line.
+ */
+static void atmel_lcdfb_fillrect(struct fb_info *info,
+				 const struct fb_fillrect *rect)
+{
+	struct atmel_lcdfb_info *sinfo = info->par;
+	struct fb_fillrect rest = *rect;
+	u32 line_bytes = rect->width * info->var.bits_per_pixel / 8;
+	u32 pitch = info->fix.line_length;
+	dma_addr_t first;
+	u32 done, chunk;
+
+	atmel_lcdfb_mark_dirty(sinfo, rect->dx, rect->dy,
+			       rect->width, rect->height);
+
+	if (rect->rop != ROP_COPY
+	    || !atmel_lcdfb_dma_usable(info, rect->width, rect->height)) {
+		cfb_fillrect(info, rect);
+		return;
+	}
+
+	rest.height = 1;
+	cfb_fillrect(info, &rest);
+	wmb();
+
+	first = atmel_lcdfb_dma_addr(info, rect->dx, rect->dy);
+	done = 1;
+	if (rect->dx == 0 && line_bytes == pitch) {
+		while (done < rect->height) {
+			chunk = min(done, rect->height - done);
+			if (atmel_lcdfb_dma_queue(sinfo, first + done * pitch,
+						  first, chunk * pitch))
+				break;
+			done += chunk;
+		}
+	} else {
+		while (done < rect->height) {
+			if (atmel_lcdfb_dma_queue(sinfo, first + done * pitch,
+						  first, line_bytes))
+				break;
+			done++;
+		}
+	}
+
+	if (done > 1 && atmel_lcdfb_dma_flush(sinfo))
+		done = 1;
+	if (done == rect->height)
+		return;
+
+	rest = *rect;
+	rest.dy += done;
+	rest.height -= done;
+	cfb_fillrect(info, &rest);
+}
+
+static void atmel_lcdfb_init_dma(struct atmel_lcdfb_info *sinfo)
+{
+	dma_cap_mask_t mask;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	sinfo->dma_chan = dma_request_channel(mask, NULL, NULL);
+	if (!sinfo->dma_chan) {
+		dev_info(&sinfo->pdev->dev,
+			 "no DMA channel, using CPU fill/copy\n");
+		return;
+	}
+
+	dev_info(&sinfo->pdev->dev, "using %s for fill/copy\n",
+		 dma_chan_name(sinfo->dma_chan));
+}
+
+static void atmel_lcdfb_release_dma(struct atmel_lcdfb_info *sinfo)
+{
+	if (sinfo->dma_chan) {
+		dma_release_channel(sinfo->dma_chan);
+		sinfo->dma_chan = NULL;
+	}
+}
+
+#else
+
+static void atmel_lcdfb_copyarea(struct fb_info *info,
+				 const struct fb_copyarea *area)
+{
+	atmel_lcdfb_mark_dirty(info->par, area->dx, area->dy,
+			       area->width, area->height);
+	cfb_copyarea(info, area);
+}
+
+static void atmel_lcdfb_fillrect(struct fb_info *info,
+				 const struct fb_fillrect *rect)
+{
+	atmel_lcdfb_mark_dirty(info->par, rect->dx, rect->dy,
+			       rect->width, rect->height);
+	cfb_fillrect(info, rect);
+}
+
+static void atmel_lcdfb_init_dma(struct atmel_lcdfb_info *sinfo)
+{
+}
+
+static void atmel_lcdfb_release_dma(struct atmel_lcdfb_info *sinfo)
+{
+}
+
+#endif /* CONFIG_FB_ATMEL_DMA_ACCEL */
+
+static void atmel_lcdfb_imageblit(struct fb_info *info,
+				  const struct fb_image *image)
+{
+	atmel_lcdfb_mark_dirty(info->par, image->dx, image->dy,
+			       image->width, image->height);
+	cfb_imageblit(info, image);
+}
+
+/*
+ * Page flip of a double-buffered display: the page we just left is the
+ * client's next back buffer and is one frame behind. Bring it up to date by
+ * copying only the region drawn since the previous flip.
+ */
+static void atmel_lcdfb_sync_flip(struct fb_info *info,
+				  struct fb_var_screeninfo *var)
+{
+	struct atmel_lcdfb_info *sinfo = info->par;
+	struct atmel_lcdfb_dirty dirty;
+	struct fb_copyarea area;
+	unsigned long flags;
+	u32 old = sinfo->front_yoffset;
+	u32 yres = info->var.yres;
+
+	sinfo->front_yoffset = var->yoffset;
+
+	spin_lock_irqsave(&sinfo->lock, flags);
+	dirty = sinfo->dirty;
+	memset(&sinfo->dirty, 0, sizeof(sinfo->dirty));
+	spin_unlock_irqrestore(&sinfo->lock, flags);
+
+	if (!flipsync || old == var->yoffset
+	    || info->var.yres_virtual < 2 * yres
+	    || var->yoffset % yres || old % yres)
+		return;
+
+	/* clip the drawn region to the page now being displayed */
+	dirty.y1 = max(dirty.y1, var->yoffset);
+	dirty.y2 = min(dirty.y2, var->yoffset + yres);
+	dirty.x2 = min(dirty.x2, info->var.xres_virtual);
+	if (dirty.x2 <= dirty.x1 || dirty.y2 <= dirty.y1)
+		return;
+
+	area.sx = area.dx = dirty.x1;
+	area.sy = dirty.y1;
+	area.dy = dirty.y1 - var->yoffset + old;
+	area.width = dirty.x2 - dirty.x1;
+	area.height = dirty.y2 - dirty.y1;
+
+	/* this copy is bookkeeping, keep it out of the next frame's region */
+	atmel_lcdfb_copyarea(info, &area);
+	spin_lock_irqsave(&sinfo->lock, flags);
+	memset(&sinfo->dirty, 0, sizeof(sinfo->dirty));
+	spin_unlock_irqrestore(&sinfo->lock, flags);
+}
+
 static int atmel_lcdfb_pan_display(struct fb_var_screeninfo *var,
 			       struct fb_info *info)
 {
@@ -458,6 +833,7 @@ static int atmel_lcdfb_pan_display(struct fb_var_screeninfo *var,
 	dev_dbg(info->device, "%s\n", __func__);
 
 	sinfo->dev_data->update_dma(info, var);
+	atmel_lcdfb_sync_flip(info, var);
 
 	return 0;
 }
@@ -494,9 +870,9 @@ static struct fb_ops atmel_lcdfb_ops = {
 	.fb_setcolreg	= atmel_lcdfb_setcolreg,
 	.fb_blank	= atmel_lcdfb_blank,
 	.fb_pan_display	= atmel_lcdfb_pan_display,
-	.fb_fillrect	= cfb_fillrect,
-	.fb_copyarea	= cfb_copyarea,
-	.fb_imageblit	= cfb_imageblit,
+	.fb_fillrect	= atmel_lcdfb_fillrect,
+	.fb_copyarea	= atmel_lcdfb_copyarea,
+	.fb_imageblit	= atmel_lcdfb_imageblit,
 };
 
 /*
@@ -590,6 +966,7 @@ int __atmel_lcdfb_probe(struct platform_device *pdev,
 	}
 	sinfo->info = info;
 	sinfo->pdev = pdev;
+	spin_lock_init(&sinfo->lock);
 
 	strcpy(info->fix.id, sinfo->pdev->name);
 	info->flags = dev_data->fbinfo_flags;
@@ -724,6 +1101,8 @@ int __atmel_lcdfb_probe(struct platform_device *pdev,
 		goto unregister_irqs;
 	}
 
+	atmel_lcdfb_init_dma(sinfo);
+
 	/*
 	 * This makes sure that our colour bitfield
 	 * descriptors are correctly initialised.
@@ -763,6 +1142,7 @@ int __atmel_lcdfb_probe(struct platform_device *pdev,
 reset_drvdata:
 	dev_set_drvdata(dev, NULL);
 free_cmap:
+	atmel_lcdfb_release_dma(sinfo);
 	fb_dealloc_cmap(&info->cmap);
 unregister_irqs:
 	cancel_work_sync(&sinfo->task);
@@ -812,6 +1192,7 @@ int __atmel_lcdfb_remove(struct platform_device *pdev)
 	if (sinfo->atmel_lcdfb_power_control)
 		sinfo->atmel_lcdfb_power_control(0);
 	unregister_framebuffer(info);
+	atmel_lcdfb_release_dma(sinfo);
 	atmel_lcdfb_stop_clock(sinfo);
 	clk_put(sinfo->lcdc_clk);
 	if (sinfo->bus_clk)
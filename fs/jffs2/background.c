@@ -19,8 +19,15 @@
 #include <linux/sched.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
 #include "nodelist.h"
 
+/* Delay between passes of the GC thread, in ms, when nobody is writing
+   and when there are writers. There is no delay when the writers are
+   about to run out of free blocks and do GC themselves. */
+#define JFFS2_GC_IDLE_DELAY	50
+#define JFFS2_GC_BUSY_DELAY	10
 
 static int jffs2_garbage_collect_thread(void *);
 
@@ -58,6 +65,55 @@ int jffs2_start_garbage_collect_thread(struct jffs2_sb_info *c)
 	return ret;
 }
 
+void jffs2_gc_account_pass(struct jffs2_sb_info *c, ktime_t start, int bg)
+{
+	struct jffs2_gc_stats *st = &c->gc_stats;
+	unsigned int us = min_t(s64, ktime_us_delta(ktime_get(), start), UINT_MAX);
+
+	spin_lock(&c->erase_completion_lock);
+	if (bg) {
+		st->bg_passes++;
+		st->bg_time += us;
+		st->bg_max = max(st->bg_max, us);
+	} else {
+		st->fg_passes++;
+		st->fg_time += us;
+		st->fg_max = max(st->fg_max, us);
+	}
+	spin_unlock(&c->erase_completion_lock);
+}
+
+void jffs2_gc_account_stall(struct jffs2_sb_info *c, ktime_t start)
+{
+	struct jffs2_gc_stats *st = &c->gc_stats;
+	unsigned int us = min_t(s64, ktime_us_delta(ktime_get(), start), UINT_MAX);
+	unsigned int slot = us < 1000 ? 0 : ilog2(us / 1000) + 1;
+
+	spin_lock(&c->erase_completion_lock);
+	st->stalls++;
+	st->stall_time += us;
+	st->stall_max = max(st->stall_max, us);
+	st->stall_hist[min_t(unsigned int, slot, JFFS2_STALL_HIST - 1)]++;
+	spin_unlock(&c->erase_completion_lock);
+}
+
+/* How long to wait before the next GC pass. 'wr_size' is the amount of
+   space reserved by writers at the previous pass. */
+static long jffs2_gc_delay(struct jffs2_sb_info *c, uint32_t *wr_size)
+{
+	long delay = msecs_to_jiffies(JFFS2_GC_IDLE_DELAY);
+
+	spin_lock(&c->erase_completion_lock);
+	if (c->nr_free_blocks + c->nr_erasing_blocks < c->resv_blocks_gctrigger)
+		delay = 0;
+	else if (c->wr_size != *wr_size)
+		delay = msecs_to_jiffies(JFFS2_GC_BUSY_DELAY);
+	*wr_size = c->wr_size;
+	spin_unlock(&c->erase_completion_lock);
+
+	return delay;
+}
+
 void jffs2_stop_garbage_collect_thread(struct jffs2_sb_info *c)
 {
 	int wait = 0;
@@ -75,6 +131,9 @@ void jffs2_stop_garbage_collect_thread(struct jffs2_sb_info *c)
 static int jffs2_garbage_collect_thread(void *_c)
 {
 	struct jffs2_sb_info *c = _c;
+	uint32_t wr_size = c->wr_size;
+	ktime_t start;
+	int ret;
 
 	allow_signal(SIGKILL);
 	allow_signal(SIGSTOP);
@@ -108,8 +167,11 @@ static int jffs2_garbage_collect_thread(void *_c)
 		 * disk).
 		 * This forces the GCD to slow the hell down.   Pulling an
 		 * inode in with read_inode() is much preferable to having
-		 * the GC thread get there first. */
-		schedule_timeout_interruptible(msecs_to_jiffies(50));
+		 * the GC thread get there first.
+		 * Writers which have run out of free blocks have to wait for
+		 * GC passes though, so go faster when there are writers and
+		 * don't wait at all when they are about to block on us. */
+		schedule_timeout_interruptible(jffs2_gc_delay(c, &wr_size));
 
 		if (kthread_should_stop()) {
 			jffs2_dbg(1, "%s(): kthread_stop() called\n", __func__);
@@ -153,7 +215,10 @@ static int jffs2_garbage_collect_thread(void *_c)
 		disallow_signal(SIGHUP);
 
 		jffs2_dbg(1, "%s(): pass\n", __func__);
-		if (jffs2_garbage_collect_pass(c) == -ENOSPC) {
+		start = ktime_get();
+		ret = jffs2_garbage_collect_pass(c);
+		jffs2_gc_account_pass(c, start, 1);
+		if (ret == -ENOSPC) {
 			pr_notice("No space for garbage collection. Aborting GC thread\n");
 			goto die;
 		}
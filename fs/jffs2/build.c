@@ -289,6 +289,12 @@ static void jffs2_calc_trigger_levels(struct jffs2_sb_info *c)
 
 	c->resv_blocks_gctrigger = c->resv_blocks_write + 1;
 
+	/* Up to when does the GC thread keep reclaiming very dirty blocks
+	   in the background, so that writers don't have to do it themselves
+	   once they run out of free blocks */
+	c->resv_blocks_gcpace = min(255, c->resv_blocks_gctrigger +
+				    max(2, c->resv_blocks_write - c->resv_blocks_deletion));
+
 	/* When do we allow garbage collection to merge nodes to make
 	   long-term progress at the expense of short-term space exhaustion? */
 	c->resv_blocks_gcmerge = c->resv_blocks_deletion + 1;
@@ -317,6 +323,8 @@ static void jffs2_calc_trigger_levels(struct jffs2_sb_info *c)
 		  c->resv_blocks_write, c->resv_blocks_write*c->sector_size/1024);
 	dbg_fsbuild("Blocks required to quiesce GC thread: %d (%d KiB)\n",
 		  c->resv_blocks_gctrigger, c->resv_blocks_gctrigger*c->sector_size/1024);
+	dbg_fsbuild("Blocks required to stop GC pacing:    %d (%d KiB)\n",
+		  c->resv_blocks_gcpace, c->resv_blocks_gcpace*c->sector_size/1024);
 	dbg_fsbuild("Blocks required to allow GC merges:   %d (%d KiB)\n",
 		  c->resv_blocks_gcmerge, c->resv_blocks_gcmerge*c->sector_size/1024);
 	dbg_fsbuild("Blocks required to GC bad blocks:     %d (%d KiB)\n",
@@ -0,0 +1,858 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ */
+
+/*
+ * Mount checkpoint.
+ *
+ * Even with summaries, mounting has to look at every eraseblock and build
+ * the inode caches from the nodes found there. When the 'checkpoint=N'
+ * mount option is given, the first N eraseblocks of the flash are kept out
+ * of the file system and used to store a checkpoint of the node references
+ * and inode caches, written when the file system is unmounted or remounted
+ * read-only. The next mount restores that state from the checkpoint area
+ * alone instead of scanning the medium.
+ *
+ * The checkpoint is invalidated before anything is written to the file
+ * system, so after an unclean shutdown the full scan is done as usual.
+ * This is done by every read-write mount which finds one, with or without
+ * the option. Kernels without checkpoint support cannot do it, so the
+ * end of the used area and the last node of every eraseblock are recorded
+ * too, and the checkpoint is only used if the flash still matches them.
+ * Restored nodes are marked unchecked and have their CRCs checked later,
+ * exactly like nodes found through summaries.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mtd/mtd.h>
+#include <linux/crc32.h>
+#include <linux/sort.h>
+#include <linux/bsearch.h>
+#include <linux/completion.h>
+#include "nodelist.h"
+#include "summary.h"
+#include "checkpoint.h"
+#include "debug.h"
+
+/* Node of an inode, used to match the block node lists against the
+   inode node lists when writing a checkpoint */
+struct ckpt_owned {
+	uint32_t ofs;
+	uint32_t ino;
+};
+
+static inline uint32_t ckpt_piece_size(struct jffs2_sb_info *c)
+{
+	return c->sector_size - sizeof(struct jffs2_raw_checkpoint);
+}
+
+static void ckpt_erase_callback(struct erase_info *instr)
+{
+	complete((struct completion *)instr->priv);
+}
+
+static int ckpt_erase(struct jffs2_sb_info *c, uint32_t ofs, uint32_t len)
+{
+	struct erase_info instr;
+	struct completion done;
+	int ret;
+
+	init_completion(&done);
+	memset(&instr, 0, sizeof(instr));
+	instr.mtd = c->mtd;
+	instr.addr = ofs;
+	instr.len = len;
+	instr.callback = ckpt_erase_callback;
+	instr.priv = (unsigned long)&done;
+
+	ret = mtd_erase(c->mtd, &instr);
+	if (ret)
+		return ret;
+
+	wait_for_completion(&done);
+	if (instr.state != MTD_ERASE_DONE)
+		return -EIO;
+	return 0;
+}
+
+/* Write piece 'piece' of 'pieces' to the start of its area block. 'buf'
+   must have room for the node padded to the flash write size. */
+static int ckpt_write_piece(struct jffs2_sb_info *c, void *buf, int piece,
+			    int pieces, uint32_t blocks, const void *data,
+			    uint32_t len)
+{
+	struct jffs2_raw_checkpoint *rc = buf;
+	uint32_t totlen = sizeof(*rc) + len;
+	uint32_t wlen = roundup(totlen, c->mtd->writesize);
+	size_t retlen;
+	int ret;
+
+	rc->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
+	rc->nodetype = cpu_to_je16(JFFS2_NODETYPE_CHECKPOINT);
+	rc->totlen = cpu_to_je32(totlen);
+	rc->hdr_crc = cpu_to_je32(crc32(0, rc, sizeof(struct jffs2_unknown_node)-4));
+	rc->version = cpu_to_je32(c->ckpt_version);
+	rc->blocks = cpu_to_je32(blocks);
+	rc->piece = cpu_to_je16(piece);
+	rc->pieces = cpu_to_je16(pieces);
+	rc->data_crc = cpu_to_je32(crc32(0, data, len));
+	rc->node_crc = cpu_to_je32(crc32(0, rc, sizeof(*rc)-8));
+	memcpy(rc->data, data, len);
+	memset(buf + totlen, 0xff, wlen - totlen);
+
+	ret = mtd_write(c->mtd, c->blocks[piece].offset, wlen, &retlen, buf);
+	if (!ret && retlen != wlen)
+		ret = -EIO;
+	if (ret)
+		pr_warn("Write of checkpoint piece at 0x%08x failed: %d\n",
+			c->blocks[piece].offset, ret);
+	return ret;
+}
+
+static int ckpt_read_header(struct jffs2_sb_info *c, int piece,
+			    struct jffs2_raw_checkpoint *rc)
+{
+	size_t retlen;
+	int ret;
+
+	ret = jffs2_flash_read(c, c->blocks[piece].offset, sizeof(*rc), &retlen,
+			       (void *)rc);
+	if (ret || retlen != sizeof(*rc))
+		return -EIO;
+
+	if (je16_to_cpu(rc->magic) != JFFS2_MAGIC_BITMASK ||
+	    je16_to_cpu(rc->nodetype) != JFFS2_NODETYPE_CHECKPOINT ||
+	    je32_to_cpu(rc->hdr_crc) != crc32(0, rc, sizeof(struct jffs2_unknown_node)-4) ||
+	    je32_to_cpu(rc->node_crc) != crc32(0, rc, sizeof(*rc)-8))
+		return -EINVAL;
+
+	if (je16_to_cpu(rc->piece) != piece ||
+	    je32_to_cpu(rc->totlen) < sizeof(*rc) ||
+	    je32_to_cpu(rc->totlen) > c->sector_size)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Nothing may have been written at 'ofs' */
+static int ckpt_erased_at(struct jffs2_sb_info *c, uint32_t ofs)
+{
+	uint32_t word;
+	size_t retlen;
+	int ret;
+
+	ret = jffs2_flash_read(c, ofs, sizeof(word), &retlen, (void *)&word);
+	return !ret && retlen == sizeof(word) && word == 0xFFFFFFFF;
+}
+
+/* Nothing may follow the checkpoint node at the start of area block 'i' */
+static int ckpt_tail_erased(struct jffs2_sb_info *c, int i,
+			    struct jffs2_raw_checkpoint *rc)
+{
+	uint32_t ofs = roundup(je32_to_cpu(rc->totlen), c->mtd->writesize);
+
+	return ofs >= c->sector_size ||
+		ckpt_erased_at(c, c->blocks[i].offset + ofs);
+}
+
+/* The area blocks after the first may only hold checkpoint nodes, maybe
+   of an older checkpoint, or nothing at all. Anything else was written
+   by a kernel which did not reserve the area. */
+static int ckpt_area_intact(struct jffs2_sb_info *c)
+{
+	struct jffs2_raw_checkpoint rc;
+	uint32_t i;
+
+	for (i = 1; i < c->mount_opts.ckpt_blocks; i++) {
+		if (ckpt_read_header(c, i, &rc)) {
+			if (!ckpt_erased_at(c, c->blocks[i].offset))
+				return 0;
+		} else if (!ckpt_tail_erased(c, i, &rc)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Checksum the start of the node at 'ofs' of the eraseblock, to find out
+   later whether the eraseblock was rewritten. The node header alone is
+   the same for all nodes of a type and length, so take in the inode
+   number, version and node CRC too. */
+static int ckpt_node_crc(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+			 uint32_t ofs, uint32_t *crc)
+{
+	union jffs2_node_union node;
+	uint32_t len = min_t(uint32_t, sizeof(node), c->sector_size - ofs);
+	size_t retlen;
+	int ret;
+
+	ret = jffs2_flash_read(c, jeb->offset + ofs, len, &retlen,
+			       (void *)&node);
+	if (!ret && retlen != len)
+		ret = -EIO;
+	if (ret)
+		return ret;
+
+	/* Leave out whatever follows a short node */
+	if (len >= sizeof(struct jffs2_unknown_node) &&
+	    je16_to_cpu(node.u.magic) == JFFS2_MAGIC_BITMASK &&
+	    je32_to_cpu(node.u.totlen) >= sizeof(struct jffs2_unknown_node))
+		len = min(len, je32_to_cpu(node.u.totlen));
+
+	*crc = crc32(0, &node, len);
+	return 0;
+}
+
+static int ckpt_cmp_ino(const void *a, const void *b)
+{
+	uint32_t ia = je32_to_cpu(((struct jffs2_ckpt_ino *)a)->ino);
+	uint32_t ib = je32_to_cpu(((struct jffs2_ckpt_ino *)b)->ino);
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+static int ckpt_cmp_owned(const void *a, const void *b)
+{
+	uint32_t oa = ((struct ckpt_owned *)a)->ofs;
+	uint32_t ob = ((struct ckpt_owned *)b)->ofs;
+
+	return oa < ob ? -1 : oa > ob;
+}
+
+/* Check the loaded checkpoint data for consistency with the flash and
+   with itself, so that restoring it cannot fail half-way. Returns
+   -ESTALE if the flash was written to after the checkpoint. */
+static int ckpt_check(struct jffs2_sb_info *c, struct jffs2_checkpoint *ckpt)
+{
+	struct jffs2_ckpt_info *info = ckpt->buf;
+	struct jffs2_ckpt_ino key;
+	uint32_t nr_inos, nr_refs, highest_ino, refs = 0, i, j;
+	uint64_t len;
+	void *p, *end = ckpt->buf + ckpt->len;
+
+	if (ckpt->len < sizeof(*info))
+		return -EINVAL;
+
+	if (je32_to_cpu(info->flash_size) != c->flash_size ||
+	    je32_to_cpu(info->sector_size) != c->sector_size ||
+	    je32_to_cpu(info->cleanmarker_size) != c->cleanmarker_size)
+		return -EINVAL;
+
+	nr_inos = je32_to_cpu(info->nr_inos);
+	nr_refs = je32_to_cpu(info->nr_refs);
+	highest_ino = je32_to_cpu(info->highest_ino);
+
+	len = sizeof(*info);
+	len += (uint64_t)nr_inos * sizeof(struct jffs2_ckpt_ino);
+	len += (uint64_t)(c->nr_blocks - c->mount_opts.ckpt_blocks) *
+		sizeof(struct jffs2_ckpt_block);
+	len += (uint64_t)nr_refs * sizeof(struct jffs2_ckpt_ref);
+	if (len != ckpt->len)
+		return -EINVAL;
+
+	ckpt->inos = (void *)(info + 1);
+	for (i = 0; i < nr_inos; i++) {
+		uint32_t ino = je32_to_cpu(ckpt->inos[i].ino);
+
+		if (!ino || ino > highest_ino || !ckpt->inos[i].pino_nlink.v32)
+			return -EINVAL;
+		if (i && ino <= je32_to_cpu(ckpt->inos[i-1].ino))
+			return -EINVAL;
+	}
+
+	p = ckpt->inos + nr_inos;
+	ckpt->next = p;
+	for (i = c->mount_opts.ckpt_blocks; i < c->nr_blocks; i++) {
+		struct jffs2_ckpt_block *b = p;
+		struct jffs2_ckpt_ref *r = (void *)(b + 1);
+		uint32_t state = je32_to_cpu(b->state);
+		uint32_t n = je32_to_cpu(b->nr_refs);
+		uint32_t used_end = c->sector_size - je32_to_cpu(b->free_size);
+		uint32_t check_ofs = je32_to_cpu(b->check_ofs), crc;
+		uint32_t ref_end = 0;
+
+		if ((void *)r > end || n > (end - (void *)r) / sizeof(*r))
+			return -EINVAL;
+		if (state > CKPT_BLOCK_BAD ||
+		    je32_to_cpu(b->free_size) > c->sector_size ||
+		    used_end & 3)
+			return -EINVAL;
+		if ((state == CKPT_BLOCK_ERASE || state == CKPT_BLOCK_BAD) && n)
+			return -EINVAL;
+		if (check_ofs != CKPT_NO_CHECK && check_ofs >= c->sector_size)
+			return -EINVAL;
+
+		if (state != CKPT_BLOCK_BAD) {
+			if (used_end < c->sector_size &&
+			    !ckpt_erased_at(c, c->blocks[i].offset + used_end))
+				return -ESTALE;
+			if (check_ofs != CKPT_NO_CHECK &&
+			    (ckpt_node_crc(c, &c->blocks[i], check_ofs, &crc) ||
+			     crc != je32_to_cpu(b->check_crc)))
+				return -ESTALE;
+		}
+
+		for (j = 0; j < n; j++, r++) {
+			uint32_t ofs = je32_to_cpu(r->offset);
+			uint32_t totlen = je32_to_cpu(r->totlen);
+
+			if ((ofs & ~3) < ref_end || (ofs & ~3) > used_end ||
+			    totlen & 3 ||
+			    totlen < sizeof(struct jffs2_unknown_node) ||
+			    totlen > used_end - (ofs & ~3))
+				return -EINVAL;
+			ref_end = (ofs & ~3) + totlen;
+
+			if (!r->ino.v32) {
+				if ((ofs & 3) == REF_OBSOLETE ||
+				    (ofs & 3) == REF_UNCHECKED)
+					return -EINVAL;
+				continue;
+			}
+			key.ino = r->ino;
+			if (!bsearch(&key, ckpt->inos, nr_inos, sizeof(key),
+				     ckpt_cmp_ino))
+				return -EINVAL;
+		}
+		refs += n;
+		p = r;
+	}
+
+	if (refs != nr_refs)
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * jffs2_ckpt_load - load and validate the checkpoint from the flash.
+ * @c: file system to mount
+ *
+ * Also works out whether the checkpoint area is reserved; it is if its
+ * first eraseblock starts with a checkpoint node of the configured size,
+ * even if that holds no checkpoint, and the other area eraseblocks hold
+ * nothing but checkpoint nodes. A checkpoint found without the option
+ * still has to be invalidated. Returns the checkpoint, with all the
+ * inode caches it records created, NULL if there is no usable checkpoint
+ * and an error pointer if the mount has to fail.
+ */
+struct jffs2_checkpoint *jffs2_ckpt_load(struct jffs2_sb_info *c)
+{
+	struct jffs2_raw_checkpoint rc;
+	struct jffs2_checkpoint *ckpt;
+	struct jffs2_ckpt_info *info;
+	uint32_t i, pieces, len;
+	size_t retlen;
+	int ret;
+
+	c->ckpt_area = 0;
+	c->ckpt_present = 0;
+	c->ckpt_version = 0;
+
+	if (mtd_block_isbad(c->mtd, c->blocks[0].offset) > 0 ||
+	    ckpt_read_header(c, 0, &rc)) {
+		jffs2_dbg(1, "No checkpoint area found\n");
+		return NULL;
+	}
+
+	/* If the file system was written to the first eraseblock, it is
+	   neither a checkpoint area nor ours to erase */
+	if (!ckpt_tail_erased(c, 0, &rc)) {
+		jffs2_dbg(1, "Checkpoint node is followed by data, ignoring it\n");
+		return NULL;
+	}
+
+	c->ckpt_version = je32_to_cpu(rc.version);
+	pieces = je16_to_cpu(rc.pieces);
+	c->ckpt_present = pieces != 0;
+
+	if (!jffs2_ckpt_active(c) ||
+	    je32_to_cpu(rc.blocks) != c->mount_opts.ckpt_blocks) {
+		jffs2_dbg(1, "No checkpoint area found\n");
+		return NULL;
+	}
+
+	for (i = 0; i < c->mount_opts.ckpt_blocks; i++) {
+		if (mtd_block_isbad(c->mtd, c->blocks[i].offset) > 0) {
+			pr_notice("Bad block at 0x%08x in checkpoint area, not using checkpoint\n",
+				  c->blocks[i].offset);
+			return NULL;
+		}
+	}
+
+	if (!ckpt_area_intact(c)) {
+		pr_notice("Checkpoint area is in use, scanning medium\n");
+		return NULL;
+	}
+
+	c->ckpt_area = 1;
+	if (!pieces) {
+		jffs2_dbg(1, "No checkpoint, scanning medium\n");
+		return NULL;
+	}
+
+	if (pieces > c->mount_opts.ckpt_blocks) {
+		pr_notice("Invalid checkpoint, scanning medium\n");
+		return NULL;
+	}
+
+	ckpt = kzalloc(sizeof(*ckpt), GFP_KERNEL);
+	if (!ckpt)
+		return NULL;
+	ckpt->buf = vmalloc(pieces * ckpt_piece_size(c));
+	if (!ckpt->buf) {
+		kfree(ckpt);
+		return NULL;
+	}
+
+	for (i = 0; i < pieces; i++) {
+		if (i && ckpt_read_header(c, i, &rc))
+			goto bad;
+		if (je32_to_cpu(rc.version) != c->ckpt_version ||
+		    je32_to_cpu(rc.blocks) != c->mount_opts.ckpt_blocks ||
+		    je16_to_cpu(rc.pieces) != pieces)
+			goto bad;
+
+		len = je32_to_cpu(rc.totlen) - sizeof(rc);
+		if (i < pieces - 1 && len != ckpt_piece_size(c))
+			goto bad;
+
+		ret = jffs2_flash_read(c, c->blocks[i].offset + sizeof(rc), len,
+				       &retlen, ckpt->buf + ckpt->len);
+		if (ret || retlen != len)
+			goto bad;
+		if (crc32(0, ckpt->buf + ckpt->len, len) != je32_to_cpu(rc.data_crc))
+			goto bad;
+		ckpt->len += len;
+	}
+
+	ret = ckpt_check(c, ckpt);
+	if (ret == -ESTALE) {
+		pr_notice("Flash was written to after the checkpoint, scanning medium\n");
+		jffs2_ckpt_free(ckpt);
+		return NULL;
+	}
+	if (ret)
+		goto bad;
+
+	info = ckpt->buf;
+	c->highest_ino = je32_to_cpu(info->highest_ino);
+	for (i = 0; i < je32_to_cpu(info->nr_inos); i++) {
+		struct jffs2_inode_cache *ic;
+
+		ic = jffs2_scan_make_ino_cache(c, je32_to_cpu(ckpt->inos[i].ino));
+		if (!ic) {
+			jffs2_ckpt_free(ckpt);
+			return ERR_PTR(-ENOMEM);
+		}
+		ic->pino_nlink = je32_to_cpu(ckpt->inos[i].pino_nlink);
+	}
+
+	jffs2_dbg(1, "Mounting from checkpoint version %u, %u inodes, %u nodes\n",
+		  c->ckpt_version, je32_to_cpu(info->nr_inos),
+		  je32_to_cpu(info->nr_refs));
+	return ckpt;
+
+ bad:
+	pr_notice("Invalid checkpoint, scanning medium\n");
+	jffs2_ckpt_free(ckpt);
+	return NULL;
+}
+
+void jffs2_ckpt_free(struct jffs2_checkpoint *ckpt)
+{
+	if (!ckpt)
+		return;
+	vfree(ckpt->buf);
+	kfree(ckpt);
+}
+
+/**
+ * jffs2_ckpt_scan_eraseblock - restore an eraseblock from the checkpoint.
+ *
+ * Used instead of jffs2_scan_eraseblock() for every eraseblock outside
+ * the checkpoint area, in order. Returns the BLK_STATE_xxx of the block.
+ */
+int jffs2_ckpt_scan_eraseblock(struct jffs2_sb_info *c,
+			       struct jffs2_checkpoint *ckpt,
+			       struct jffs2_eraseblock *jeb,
+			       struct jffs2_summary *s)
+{
+	struct jffs2_ckpt_block *b = ckpt->next;
+	struct jffs2_ckpt_ref *r = (void *)(b + 1);
+	uint32_t i, nr_refs = je32_to_cpu(b->nr_refs);
+	uint32_t used_end = c->sector_size - je32_to_cpu(b->free_size);
+	int ret;
+
+	ckpt->next = r + nr_refs;
+
+	/* We have no summary information for this block. Make sure it's
+	   not written out if the block becomes the nextblock. */
+	jffs2_sum_disable_collecting(s);
+
+	switch (je32_to_cpu(b->state)) {
+	case CKPT_BLOCK_BAD:
+		return BLK_STATE_BADBLOCK;
+	case CKPT_BLOCK_ERASE:
+		return BLK_STATE_ALLFF;
+	}
+
+	/* One for each node, one for each gap between them */
+	ret = jffs2_prealloc_raw_node_refs(c, jeb, 2 * nr_refs + 1);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nr_refs; i++, r++) {
+		struct jffs2_inode_cache *ic = NULL;
+		uint32_t ofs = je32_to_cpu(r->offset);
+
+		/* If there was a gap, mark it dirty */
+		if ((ofs & ~3) > c->sector_size - jeb->free_size)
+			jffs2_scan_dirty_space(c, jeb, (ofs & ~3) -
+					       (c->sector_size - jeb->free_size));
+
+		if (r->ino.v32) {
+			ic = jffs2_get_ino_cache(c, je32_to_cpu(r->ino));
+			ofs = (ofs & ~3) | REF_UNCHECKED;
+		}
+		jffs2_link_node_ref(c, jeb, jeb->offset + ofs,
+				    je32_to_cpu(r->totlen), ic);
+	}
+
+	if (used_end > c->sector_size - jeb->free_size)
+		jffs2_scan_dirty_space(c, jeb, used_end -
+				       (c->sector_size - jeb->free_size));
+
+	if (je32_to_cpu(b->state) == CKPT_BLOCK_FREE)
+		return BLK_STATE_CLEANMARKER;
+
+	return jffs2_scan_classify_jeb(c, jeb);
+}
+
+/* Leave a checkpoint node without a checkpoint behind. It keeps the area
+   reserved if it is, and is a plain obsolete node otherwise. */
+static int ckpt_write_stub(struct jffs2_sb_info *c)
+{
+	uint32_t blocks = c->ckpt_area ? c->mount_opts.ckpt_blocks : 0;
+	void *buf;
+	int ret;
+
+	buf = kmalloc(roundup(sizeof(struct jffs2_raw_checkpoint),
+			      c->mtd->writesize), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = ckpt_erase(c, c->blocks[0].offset, c->sector_size);
+	if (!ret) {
+		c->ckpt_present = 0;
+		ret = ckpt_write_piece(c, buf, 0, 0, blocks, NULL, 0);
+	}
+	kfree(buf);
+	return ret;
+}
+
+/**
+ * jffs2_ckpt_invalidate - make sure the checkpoint is not used again.
+ * @c: file system about to be written to
+ *
+ * Must be called before the file system is written to, whether the area
+ * is reserved or not. A stub checkpoint node is left behind so that the
+ * area stays reserved. Without a reserved area the first eraseblock holds
+ * nothing but the checkpoint node, so erasing it loses no data.
+ */
+int jffs2_ckpt_invalidate(struct jffs2_sb_info *c)
+{
+	int ret;
+
+	if (!c->ckpt_present)
+		return 0;
+
+	ret = ckpt_write_stub(c);
+	if (ret)
+		pr_warn("Failed to invalidate checkpoint: %d\n", ret);
+	return ret;
+}
+
+/* The checkpoint area may be taken over if it holds no nodes other than
+   cleanmarkers and none of its eraseblocks is bad */
+static int ckpt_area_claimable(struct jffs2_sb_info *c)
+{
+	struct jffs2_eraseblock *jeb;
+	uint32_t i;
+
+	for (i = 0; i < c->mount_opts.ckpt_blocks; i++) {
+		jeb = &c->blocks[i];
+		if (jeb->used_size + jeb->unchecked_size > PAD(c->cleanmarker_size))
+			return 0;
+	}
+	list_for_each_entry(jeb, &c->bad_list, list)
+		if (jeb - c->blocks < c->mount_opts.ckpt_blocks)
+			return 0;
+	list_for_each_entry(jeb, &c->bad_used_list, list)
+		if (jeb - c->blocks < c->mount_opts.ckpt_blocks)
+			return 0;
+	return 1;
+}
+
+static void ckpt_mark_list(struct jffs2_sb_info *c, uint8_t *states,
+			   struct list_head *head, uint8_t state)
+{
+	struct jffs2_eraseblock *jeb;
+
+	list_for_each_entry(jeb, head, list)
+		states[jeb - c->blocks] = state;
+}
+
+/* Emit the eraseblock records to 'p', or just count the node records if
+   'p' is NULL. Fails if the nodes of the eraseblocks do not match the
+   nodes of the inodes, or if the last node of an eraseblock cannot be
+   read back. */
+static int ckpt_emit_blocks(struct jffs2_sb_info *c, const uint8_t *states,
+			    const struct ckpt_owned *owned, uint32_t nr_owned,
+			    void *p, uint32_t *nr_refs)
+{
+	uint32_t i, k = 0, refs = 0;
+
+	for (i = c->mount_opts.ckpt_blocks; i < c->nr_blocks; i++) {
+		struct jffs2_eraseblock *jeb = &c->blocks[i];
+		struct jffs2_ckpt_block *b = p;
+		struct jffs2_ckpt_ref *r = (void *)(b + 1);
+		struct jffs2_raw_node_ref *ref;
+		uint32_t n = 0;
+
+		for (ref = jeb->first_node; ref; ref = ref_next(ref)) {
+			uint32_t ofs = ref_offset(ref), ino = 0;
+
+			if (ref_obsolete(ref))
+				continue;
+
+			if (ref->next_in_ino) {
+				/* Xattr nodes and nodes of inodes without
+				   links end up here */
+				if (k >= nr_owned || owned[k].ofs != ofs)
+					return -EINVAL;
+				ino = owned[k++].ino;
+			}
+
+			if (states[i] == CKPT_BLOCK_ERASE ||
+			    states[i] == CKPT_BLOCK_BAD) {
+				if (ino)
+					return -EINVAL;
+				continue;
+			}
+
+			if (p) {
+				r->offset = cpu_to_je32((ofs - jeb->offset) |
+						(ino ? REF_UNCHECKED : ref_flags(ref)));
+				r->totlen = cpu_to_je32(ref_totlen(c, jeb, ref));
+				r->ino = cpu_to_je32(ino);
+				r++;
+			}
+			n++;
+		}
+
+		if (p) {
+			uint32_t check_ofs = CKPT_NO_CHECK, crc = 0;
+
+			if (states[i] != CKPT_BLOCK_BAD && jeb->last_node) {
+				check_ofs = ref_offset(jeb->last_node) -
+					jeb->offset;
+				if (ckpt_node_crc(c, jeb, check_ofs, &crc))
+					return -EIO;
+			}
+			b->state = cpu_to_je32(states[i]);
+			b->free_size = cpu_to_je32(jeb->free_size);
+			b->nr_refs = cpu_to_je32(n);
+			b->check_ofs = cpu_to_je32(check_ofs);
+			b->check_crc = cpu_to_je32(crc);
+			p = r;
+		}
+		refs += n;
+	}
+
+	if (k != nr_owned)
+		return -EINVAL;
+
+	*nr_refs = refs;
+	return 0;
+}
+
+/* Collect the valid nodes of all inodes, sorted by flash offset, and
+   emit the inode records to 'inos' if it is not NULL */
+static int ckpt_collect_inodes(struct jffs2_sb_info *c,
+			       struct jffs2_ckpt_ino *inos, uint32_t *nr_inos,
+			       struct ckpt_owned *owned, uint32_t *nr_owned)
+{
+	struct jffs2_inode_cache *ic;
+	struct jffs2_raw_node_ref *raw;
+	uint32_t ni = 0, no = 0;
+	int i;
+
+	for (i = 0; i < c->inocache_hashsize; i++) {
+		for (ic = c->inocache_list[i]; ic; ic = ic->next) {
+			uint32_t n = 0;
+
+			for (raw = ic->nodes; raw != (void *)ic; raw = raw->next_in_ino) {
+				if (ref_obsolete(raw))
+					continue;
+				if (owned) {
+					owned[no + n].ofs = ref_offset(raw);
+					owned[no + n].ino = ic->ino;
+				}
+				n++;
+			}
+			if (!n)
+				continue;
+
+			if (!ic->pino_nlink) {
+				jffs2_dbg(1, "Inode #%u has no links\n", ic->ino);
+				return -EINVAL;
+			}
+			if (inos) {
+				inos[ni].ino = cpu_to_je32(ic->ino);
+				inos[ni].pino_nlink = cpu_to_je32(ic->pino_nlink);
+			}
+			ni++;
+			no += n;
+		}
+	}
+
+	if (inos)
+		sort(inos, ni, sizeof(*inos), ckpt_cmp_ino, NULL);
+	if (owned)
+		sort(owned, no, sizeof(*owned), ckpt_cmp_owned, NULL);
+
+	*nr_inos = ni;
+	*nr_owned = no;
+	return 0;
+}
+
+/**
+ * jffs2_ckpt_write - write a checkpoint of the file system state.
+ * @c: file system which will not be written to any more
+ * @claim: the checkpoint area may be taken over from the file system
+ *
+ * Called with alloc_sem held after the write buffer has been flushed,
+ * when the file system is unmounted or remounted read-only. The area can
+ * only be claimed at unmount, as its eraseblocks stay in use otherwise.
+ * Failing to write a checkpoint is not an error, the next mount just
+ * scans the medium.
+ */
+void jffs2_ckpt_write(struct jffs2_sb_info *c, int claim)
+{
+	struct jffs2_ckpt_info *info;
+	struct ckpt_owned *owned = NULL;
+	uint8_t *states = NULL;
+	void *data = NULL, *buf = NULL;
+	uint32_t nr_inos, nr_owned, nr_refs, len, pieces, i;
+	int ret;
+
+	if (!jffs2_ckpt_active(c) || (c->flags & JFFS2_SB_FLAG_RO))
+		return;
+
+	if (!c->ckpt_area) {
+		if (!claim)
+			return;
+		if (!ckpt_area_claimable(c)) {
+			pr_notice("Checkpoint area is in use, not writing checkpoint\n");
+			return;
+		}
+	}
+
+	ret = ckpt_collect_inodes(c, NULL, &nr_inos, NULL, &nr_owned);
+	if (ret)
+		goto out;
+
+	ret = -ENOMEM;
+	states = kzalloc(c->nr_blocks, GFP_KERNEL);
+	owned = vmalloc(max(nr_owned, 1U) * sizeof(*owned));
+	if (!states || !owned)
+		goto out;
+
+	ckpt_mark_list(c, states, &c->free_list, CKPT_BLOCK_FREE);
+	ckpt_mark_list(c, states, &c->erasable_list, CKPT_BLOCK_ERASE);
+	ckpt_mark_list(c, states, &c->erasable_pending_wbuf_list, CKPT_BLOCK_ERASE);
+	ckpt_mark_list(c, states, &c->erasing_list, CKPT_BLOCK_ERASE);
+	ckpt_mark_list(c, states, &c->erase_checking_list, CKPT_BLOCK_ERASE);
+	ckpt_mark_list(c, states, &c->erase_pending_list, CKPT_BLOCK_ERASE);
+	ckpt_mark_list(c, states, &c->erase_complete_list, CKPT_BLOCK_ERASE);
+	ckpt_mark_list(c, states, &c->bad_list, CKPT_BLOCK_BAD);
+
+	ret = ckpt_collect_inodes(c, NULL, &nr_inos, owned, &nr_owned);
+	if (ret)
+		goto out;
+	ret = ckpt_emit_blocks(c, states, owned, nr_owned, NULL, &nr_refs);
+	if (ret)
+		goto out;
+
+	len = sizeof(*info) + nr_inos * sizeof(struct jffs2_ckpt_ino) +
+		(c->nr_blocks - c->mount_opts.ckpt_blocks) *
+		sizeof(struct jffs2_ckpt_block) +
+		nr_refs * sizeof(struct jffs2_ckpt_ref);
+	pieces = DIV_ROUND_UP(len, ckpt_piece_size(c));
+	if (pieces > c->mount_opts.ckpt_blocks) {
+		pr_notice("Checkpoint needs %u eraseblocks, not writing checkpoint\n",
+			  pieces);
+		goto out;
+	}
+
+	ret = -ENOMEM;
+	data = vmalloc(len);
+	buf = vmalloc(c->sector_size);
+	if (!data || !buf)
+		goto out;
+
+	info = data;
+	info->flash_size = cpu_to_je32(c->flash_size);
+	info->sector_size = cpu_to_je32(c->sector_size);
+	info->cleanmarker_size = cpu_to_je32(c->cleanmarker_size);
+	info->highest_ino = cpu_to_je32(c->highest_ino);
+	info->nr_inos = cpu_to_je32(nr_inos);
+	info->nr_refs = cpu_to_je32(nr_refs);
+
+	ckpt_collect_inodes(c, (void *)(info + 1), &nr_inos, NULL, &nr_owned);
+	ret = ckpt_emit_blocks(c, states, owned, nr_owned,
+			       (struct jffs2_ckpt_ino *)(info + 1) + nr_inos,
+			       &nr_refs);
+	if (ret)
+		goto out;
+
+	ret = ckpt_erase(c, c->blocks[0].offset,
+			 c->mount_opts.ckpt_blocks * c->sector_size);
+	if (ret) {
+		pr_warn("Erase of checkpoint area failed: %d\n", ret);
+		goto out;
+	}
+	c->ckpt_present = 0;
+	c->ckpt_version++;
+
+	/* Piece 0 goes last, so it only validates a complete checkpoint */
+	for (i = pieces; i-- > 0; ) {
+		uint32_t ofs = i * ckpt_piece_size(c);
+
+		ret = ckpt_write_piece(c, buf, i, pieces,
+				       c->mount_opts.ckpt_blocks, data + ofs,
+				       min(len - ofs, ckpt_piece_size(c)));
+		if (ret)
+			goto out;
+	}
+	c->ckpt_area = 1;
+	c->ckpt_present = 1;
+
+	jffs2_dbg(1, "Wrote checkpoint version %u, %u inodes, %u nodes\n",
+		  c->ckpt_version, nr_inos, nr_refs);
+ out:
+	if (ret == -EINVAL)
+		pr_notice("File system state cannot be checkpointed\n");
+	vfree(buf);
+	vfree(data);
+	vfree(owned);
+	kfree(states);
+}
@@ -0,0 +1,99 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ */
+
+#ifndef JFFS2_CHECKPOINT_H
+#define JFFS2_CHECKPOINT_H
+
+#include <linux/jffs2.h>
+
+/* States of the eraseblocks recorded in the checkpoint */
+#define CKPT_BLOCK_DATA		0	/* restore the nodes and classify */
+#define CKPT_BLOCK_FREE		1	/* erased, maybe with a cleanmarker */
+#define CKPT_BLOCK_ERASE	2	/* to be (re-)erased */
+#define CKPT_BLOCK_BAD		3
+
+/* Checkpoint data as stored on flash, split into pieces of
+   jffs2_raw_checkpoint nodes. It consists of:
+	struct jffs2_ckpt_info
+	struct jffs2_ckpt_ino [nr_inos], sorted by inode number
+	for every eraseblock outside the checkpoint area:
+		struct jffs2_ckpt_block
+		struct jffs2_ckpt_ref [nr_refs of the block], sorted by offset
+*/
+
+struct jffs2_ckpt_info
+{
+	jint32_t flash_size;
+	jint32_t sector_size;
+	jint32_t cleanmarker_size;
+	jint32_t highest_ino;
+	jint32_t nr_inos;
+	jint32_t nr_refs;	/* total number of node records */
+};
+
+struct jffs2_ckpt_ino
+{
+	jint32_t ino;
+	jint32_t pino_nlink;
+};
+
+/* No node to check the eraseblock against */
+#define CKPT_NO_CHECK		0xFFFFFFFF
+
+struct jffs2_ckpt_block
+{
+	jint32_t state;		/* CKPT_BLOCK_xxx */
+	jint32_t free_size;
+	jint32_t nr_refs;
+	jint32_t check_ofs;	/* offset of the last node, or CKPT_NO_CHECK */
+	jint32_t check_crc;	/* crc of the flash at check_ofs */
+};
+
+struct jffs2_ckpt_ref
+{
+	jint32_t offset;	/* offset in eraseblock | REF_xxx flags */
+	jint32_t totlen;
+	jint32_t ino;		/* 0 for nodes not belonging to an inode */
+};
+
+/* Checkpoint loaded at mount time */
+
+struct jffs2_checkpoint
+{
+	void *buf;		/* checkpoint data */
+	uint32_t len;
+	struct jffs2_ckpt_ino *inos;
+	void *next;		/* record of the next eraseblock to restore */
+};
+
+#ifdef CONFIG_JFFS2_CHECKPOINT	/* CHECKPOINT SUPPORT ENABLED */
+
+#define jffs2_ckpt_active(c) ((c)->mount_opts.ckpt_blocks != 0)
+#define jffs2_ckpt_area_block(c, jeb) \
+	((c)->ckpt_area && (jeb) - (c)->blocks < (c)->mount_opts.ckpt_blocks)
+struct jffs2_checkpoint *jffs2_ckpt_load(struct jffs2_sb_info *c);
+void jffs2_ckpt_free(struct jffs2_checkpoint *ckpt);
+int jffs2_ckpt_scan_eraseblock(struct jffs2_sb_info *c,
+			       struct jffs2_checkpoint *ckpt,
+			       struct jffs2_eraseblock *jeb,
+			       struct jffs2_summary *s);
+int jffs2_ckpt_invalidate(struct jffs2_sb_info *c);
+void jffs2_ckpt_write(struct jffs2_sb_info *c, int claim);
+
+#else				/* CHECKPOINT DISABLED */
+
+#define jffs2_ckpt_active(c) (0)
+#define jffs2_ckpt_area_block(c, jeb) (0)
+#define jffs2_ckpt_load(c) (NULL)
+#define jffs2_ckpt_free(a)
+#define jffs2_ckpt_scan_eraseblock(a,b,c,d) (0)
+#define jffs2_ckpt_invalidate(c) (0)
+#define jffs2_ckpt_write(c, claim)
+
+#endif /* CONFIG_JFFS2_CHECKPOINT */
+
+#endif /* JFFS2_CHECKPOINT_H */
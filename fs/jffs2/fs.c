@@ -24,6 +24,7 @@
 #include <linux/vfs.h>
 #include <linux/crc32.h>
 #include "nodelist.h"
+#include "checkpoint.h"
 
 static int jffs2_flash_setup(struct jffs2_sb_info *c);
 
@@ -392,6 +393,7 @@ void jffs2_dirty_inode(struct inode *inode, int flags)
 int jffs2_do_remount_fs(struct super_block *sb, int *flags, char *data)
 {
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
+	int ret;
 
 	if (c->flags & JFFS2_SB_FLAG_RO && !(sb->s_flags & MS_RDONLY))
 		return -EROFS;
@@ -404,11 +406,23 @@ int jffs2_do_remount_fs(struct super_block *sb, int *flags, char *data)
 		jffs2_stop_garbage_collect_thread(c);
 		mutex_lock(&c->alloc_sem);
 		jffs2_flush_wbuf_pad(c);
+		if (*flags & MS_RDONLY)
+			jffs2_ckpt_write(c, 0);
 		mutex_unlock(&c->alloc_sem);
 	}
 
-	if (!(*flags & MS_RDONLY))
+	if (!(*flags & MS_RDONLY)) {
+		/* A checkpoint of this file system becomes stale with
+		   the first write, kill it now */
+		if (sb->s_flags & MS_RDONLY) {
+			mutex_lock(&c->alloc_sem);
+			ret = jffs2_ckpt_invalidate(c);
+			mutex_unlock(&c->alloc_sem);
+			if (ret)
+				return ret;
+		}
 		jffs2_start_garbage_collect_thread(c);
+	}
 
 	*flags |= MS_NOATIME;
 	return 0;
@@ -562,6 +576,12 @@ int jffs2_do_fill_super(struct super_block *sb, void *data, int silent)
 	if ((ret = jffs2_do_mount_fs(c)))
 		goto out_inohash;
 
+	if (!(sb->s_flags & MS_RDONLY)) {
+		ret = jffs2_ckpt_invalidate(c);
+		if (ret)
+			goto out_root;
+	}
+
 	jffs2_dbg(1, "%s(): Getting root inode\n", __func__);
 	root_i = jffs2_iget(sb, 1);
 	if (IS_ERR(root_i)) {
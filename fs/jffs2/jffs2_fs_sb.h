@@ -22,6 +22,7 @@
 #include <linux/wait.h>
 #include <linux/list.h>
 #include <linux/rwsem.h>
+#include <linux/kobject.h>
 
 #define JFFS2_SB_FLAG_RO 1
 #define JFFS2_SB_FLAG_SCANNING 2 /* Flash scanning is in progress */
@@ -29,6 +30,24 @@
 
 struct jffs2_inodirty;
 
+/* Number of write stall histogram buckets, by log2 of the stall in ms */
+#define JFFS2_STALL_HIST 16
+
+/* Garbage collection statistics, protected by erase_completion_lock.
+   Times are in microseconds. */
+struct jffs2_gc_stats {
+	unsigned long bg_passes;	/* GC passes done by the GC thread */
+	u64 bg_time;
+	unsigned int bg_max;
+	unsigned long fg_passes;	/* GC passes done by writers */
+	u64 fg_time;
+	unsigned int fg_max;
+	unsigned long stalls;		/* writes which had to wait for GC */
+	u64 stall_time;
+	unsigned int stall_max;
+	unsigned long stall_hist[JFFS2_STALL_HIST];
+};
+
 struct jffs2_mount_opts {
 	bool override_compr;
 	unsigned int compr;
@@ -39,6 +58,10 @@ struct jffs2_mount_opts {
 	 * latter users to write to the file system if the amount if the
 	 * available space is less then 'rp_size'. */
 	unsigned int rp_size;
+
+	/* The number of eraseblocks at the start of the flash reserved for
+	 * the mount checkpoint, 0 if checkpointing is disabled. */
+	unsigned int ckpt_blocks;
 };
 
 /* A struct for the overall file system control.  Pointers to
@@ -80,6 +103,7 @@ struct jffs2_sb_info {
 	uint8_t resv_blocks_write;	/* ... allow a normal filesystem write */
 	uint8_t resv_blocks_deletion;	/* ... allow a normal filesystem deletion */
 	uint8_t resv_blocks_gctrigger;	/* ... wake up the GC thread */
+	uint8_t resv_blocks_gcpace;	/* ... let the GC thread get ahead of writers */
 	uint8_t resv_blocks_gcbad;	/* ... pick a block from the bad_list to GC */
 	uint8_t resv_blocks_gcmerge;	/* ... merge pages when garbage collecting */
 	/* Number of 'very dirty' blocks before we trigger immediate GC */
@@ -87,6 +111,9 @@ struct jffs2_sb_info {
 
 	uint32_t nospc_dirty_size;
 
+	uint32_t wr_size;		/* Space reserved by writers, wraps. For GC pacing */
+	struct jffs2_gc_stats gc_stats;
+
 	uint32_t nr_blocks;
 	struct jffs2_eraseblock *blocks;	/* The whole array of blocks. Used for getting blocks
 						 * from the offset (blocks[ofs / sector_size]) */
@@ -144,6 +171,12 @@ struct jffs2_sb_info {
 	struct jffs2_summary *summary;		/* Summary information */
 	struct jffs2_mount_opts mount_opts;
 
+#ifdef CONFIG_JFFS2_CHECKPOINT
+	int ckpt_area;		/* checkpoint area is reserved */
+	int ckpt_present;	/* checkpoint area holds a checkpoint */
+	uint32_t ckpt_version;
+#endif
+
 #ifdef CONFIG_JFFS2_FS_XATTR
 #define XATTRINDEX_HASHSIZE	(57)
 	uint32_t highest_xid;
@@ -159,6 +192,9 @@ struct jffs2_sb_info {
 #endif
 	/* OS-private pointer for getting back to master superblock info */
 	void *os_priv;
+
+	struct kobject kobj;		/* /sys/fs/jffs2/mtdN */
+	struct completion kobj_unregister;
 };
 
 #endif /* _JFFS2_FS_SB */
@@ -15,6 +15,7 @@
 #include <linux/mtd/mtd.h>
 #include <linux/compiler.h>
 #include <linux/sched.h> /* For cond_resched() */
+#include <linux/ktime.h>
 #include "nodelist.h"
 #include "debug.h"
 
@@ -71,8 +72,9 @@ static int jffs2_rp_can_write(struct jffs2_sb_info *c)
 static int jffs2_do_reserve_space(struct jffs2_sb_info *c,  uint32_t minsize,
 				  uint32_t *len, uint32_t sumsize);
 
-int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
-			uint32_t *len, int prio, uint32_t sumsize)
+static int __jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
+				 uint32_t *len, int prio, uint32_t sumsize,
+				 ktime_t *stall)
 {
 	int ret = -EAGAIN;
 	int blocksneeded = c->resv_blocks_write;
@@ -99,6 +101,7 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 	while(ret == -EAGAIN) {
 		while(c->nr_free_blocks + c->nr_erasing_blocks < blocksneeded) {
 			uint32_t dirty, avail;
+			ktime_t pass;
 
 			/* calculate real dirty size
 			 * dirty_size contains blocks on erase_pending_list
@@ -154,6 +157,9 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 
 			mutex_unlock(&c->alloc_sem);
 
+			if (!stall->tv64)
+				*stall = ktime_get();
+
 			jffs2_dbg(1, "Triggering GC pass. nr_free_blocks %d, nr_erasing_blocks %d, free_size 0x%08x, dirty_size 0x%08x, wasted_size 0x%08x, used_size 0x%08x, erasing_size 0x%08x, bad_size 0x%08x (total 0x%08x of 0x%08x)\n",
 				  c->nr_free_blocks, c->nr_erasing_blocks,
 				  c->free_size, c->dirty_size, c->wasted_size,
@@ -164,7 +170,9 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 				  c->flash_size);
 			spin_unlock(&c->erase_completion_lock);
 
+			pass = ktime_get();
 			ret = jffs2_garbage_collect_pass(c);
+			jffs2_gc_account_pass(c, pass, 0);
 
 			if (ret == -EAGAIN) {
 				spin_lock(&c->erase_completion_lock);
@@ -200,6 +208,8 @@ int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
 	}
 
 out:
+	if (!ret)
+		c->wr_size += minsize;
 	spin_unlock(&c->erase_completion_lock);
 	if (!ret)
 		ret = jffs2_prealloc_raw_node_refs(c, c->nextblock, 1);
@@ -208,6 +218,18 @@ out:
 	return ret;
 }
 
+int jffs2_reserve_space(struct jffs2_sb_info *c, uint32_t minsize,
+			uint32_t *len, int prio, uint32_t sumsize)
+{
+	ktime_t stall = ktime_set(0, 0);
+	int ret;
+
+	ret = __jffs2_reserve_space(c, minsize, len, prio, sumsize, &stall);
+	if (stall.tv64)
+		jffs2_gc_account_stall(c, stall);
+	return ret;
+}
+
 int jffs2_reserve_space_gc(struct jffs2_sb_info *c, uint32_t minsize,
 			   uint32_t *len, uint32_t sumsize)
 {
@@ -857,6 +879,21 @@ int jffs2_thread_should_wake(struct jffs2_sb_info *c)
 			(dirty > c->nospc_dirty_size))
 		ret = 1;
 
+	/* Get ahead of the writers while there are very dirty blocks which
+	   are cheap to reclaim. Blocks waiting for the wbuf to be flushed
+	   will be erasable soon without our help. */
+	if (!ret && dirty > c->nospc_dirty_size &&
+	    !list_empty(&c->very_dirty_list) &&
+	    c->nr_free_blocks + c->nr_erasing_blocks < c->resv_blocks_gcpace) {
+		int nr_pending_wbuf = 0;
+
+		list_for_each_entry(jeb, &c->erasable_pending_wbuf_list, list)
+			nr_pending_wbuf++;
+		if (c->nr_free_blocks + c->nr_erasing_blocks + nr_pending_wbuf <
+		    c->resv_blocks_gcpace)
+			ret = 1;
+	}
+
 	list_for_each_entry(jeb, &c->very_dirty_list, list) {
 		nr_very_dirty++;
 		if (nr_very_dirty == c->vdirty_blocks_gctrigger) {
@@ -144,6 +144,8 @@ void jffs2_dirty_trigger(struct jffs2_sb_info *c);
 int jffs2_start_garbage_collect_thread(struct jffs2_sb_info *c);
 void jffs2_stop_garbage_collect_thread(struct jffs2_sb_info *c);
 void jffs2_garbage_collect_trigger(struct jffs2_sb_info *c);
+void jffs2_gc_account_pass(struct jffs2_sb_info *c, ktime_t start, int bg);
+void jffs2_gc_account_stall(struct jffs2_sb_info *c, ktime_t start);
 
 /* dir.c */
 extern const struct file_operations jffs2_dir_operations;
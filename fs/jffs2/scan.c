@@ -20,6 +20,7 @@
 #include <linux/compiler.h>
 #include "nodelist.h"
 #include "summary.h"
+#include "checkpoint.h"
 #include "debug.h"
 
 #define DEFAULT_EMPTY_SCAN_SIZE 256
@@ -95,6 +96,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	unsigned char *flashbuf = NULL;
 	uint32_t buf_size = 0;
 	struct jffs2_summary *s = NULL; /* summary info collected by the scan process */
+	struct jffs2_checkpoint *ckpt = NULL;
 #ifndef __ECOS
 	size_t pointlen, try_size;
 
@@ -140,16 +142,35 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		}
 	}
 
+	ckpt = jffs2_ckpt_load(c);
+	if (IS_ERR(ckpt)) {
+		ret = PTR_ERR(ckpt);
+		ckpt = NULL;
+		goto out;
+	}
+
 	for (i=0; i<c->nr_blocks; i++) {
 		struct jffs2_eraseblock *jeb = &c->blocks[i];
 
 		cond_resched();
 
+		if (jffs2_ckpt_area_block(c, jeb)) {
+			/* Not part of the file system; account it as bad */
+			list_add(&jeb->list, &c->bad_list);
+			c->bad_size += c->sector_size;
+			c->free_size -= c->sector_size;
+			bad_blocks++;
+			continue;
+		}
+
 		/* reset summary info for next eraseblock scan */
 		jffs2_sum_reset_collected(s);
 
-		ret = jffs2_scan_eraseblock(c, jeb, buf_size?flashbuf:(flashbuf+jeb->offset),
-						buf_size, s);
+		if (ckpt)
+			ret = jffs2_ckpt_scan_eraseblock(c, ckpt, jeb, s);
+		else
+			ret = jffs2_scan_eraseblock(c, jeb, buf_size?flashbuf:(flashbuf+jeb->offset),
+						    buf_size, s);
 
 		if (ret < 0)
 			goto out;
@@ -281,6 +302,7 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 		mtd_unpoint(c->mtd, 0, c->mtd->size);
 #endif
 	kfree(s);
+	jffs2_ckpt_free(ckpt);
 	return ret;
 }
 
@@ -29,6 +29,7 @@
 #include <linux/exportfs.h>
 #include "compr.h"
 #include "nodelist.h"
+#include "checkpoint.h"
 
 static void jffs2_put_super(struct super_block *);
 
@@ -92,10 +93,116 @@ static int jffs2_show_options(struct seq_file *s, struct dentry *root)
 		seq_printf(s, ",compr=%s", jffs2_compr_name(opts->compr));
 	if (opts->rp_size)
 		seq_printf(s, ",rp_size=%u", opts->rp_size / 1024);
+	if (opts->ckpt_blocks)
+		seq_printf(s, ",checkpoint=%u", opts->ckpt_blocks);
 
 	return 0;
 }
 
+/*
+ * Garbage collection statistics in /sys/fs/jffs2/mtdN/
+ */
+static struct kset *jffs2_kset;
+
+struct jffs2_attr {
+	struct attribute attr;
+	ssize_t (*show)(struct jffs2_sb_info *c, char *buf);
+};
+
+#define JFFS2_GC_STAT_ATTR(_name, _field, _fmt, _type)			\
+static ssize_t _name##_show(struct jffs2_sb_info *c, char *buf)	\
+{									\
+	_type val;							\
+									\
+	spin_lock(&c->erase_completion_lock);				\
+	val = c->gc_stats._field;					\
+	spin_unlock(&c->erase_completion_lock);				\
+	return sprintf(buf, _fmt "\n", val);				\
+}									\
+static struct jffs2_attr jffs2_attr_##_name = __ATTR_RO(_name)
+
+JFFS2_GC_STAT_ATTR(gc_bg_passes, bg_passes, "%lu", unsigned long);
+JFFS2_GC_STAT_ATTR(gc_bg_time_us, bg_time, "%llu", unsigned long long);
+JFFS2_GC_STAT_ATTR(gc_bg_max_us, bg_max, "%u", unsigned int);
+JFFS2_GC_STAT_ATTR(gc_fg_passes, fg_passes, "%lu", unsigned long);
+JFFS2_GC_STAT_ATTR(gc_fg_time_us, fg_time, "%llu", unsigned long long);
+JFFS2_GC_STAT_ATTR(gc_fg_max_us, fg_max, "%u", unsigned int);
+JFFS2_GC_STAT_ATTR(write_stalls, stalls, "%lu", unsigned long);
+JFFS2_GC_STAT_ATTR(write_stall_time_us, stall_time, "%llu", unsigned long long);
+JFFS2_GC_STAT_ATTR(write_stall_max_us, stall_max, "%u", unsigned int);
+
+/* Number of write stalls of <1ms, 1ms, 2-3ms, 4-7ms, ... */
+static ssize_t write_stall_hist_show(struct jffs2_sb_info *c, char *buf)
+{
+	unsigned long hist[JFFS2_STALL_HIST];
+	ssize_t len = 0;
+	int i;
+
+	spin_lock(&c->erase_completion_lock);
+	memcpy(hist, c->gc_stats.stall_hist, sizeof(hist));
+	spin_unlock(&c->erase_completion_lock);
+
+	for (i = 0; i < JFFS2_STALL_HIST; i++)
+		len += sprintf(buf + len, "%lu%c", hist[i],
+			       i == JFFS2_STALL_HIST - 1 ? '\n' : ' ');
+	return len;
+}
+static struct jffs2_attr jffs2_attr_write_stall_hist = __ATTR_RO(write_stall_hist);
+
+static struct attribute *jffs2_attrs[] = {
+	&jffs2_attr_gc_bg_passes.attr,
+	&jffs2_attr_gc_bg_time_us.attr,
+	&jffs2_attr_gc_bg_max_us.attr,
+	&jffs2_attr_gc_fg_passes.attr,
+	&jffs2_attr_gc_fg_time_us.attr,
+	&jffs2_attr_gc_fg_max_us.attr,
+	&jffs2_attr_write_stalls.attr,
+	&jffs2_attr_write_stall_time_us.attr,
+	&jffs2_attr_write_stall_max_us.attr,
+	&jffs2_attr_write_stall_hist.attr,
+	NULL,
+};
+
+static ssize_t jffs2_attr_show(struct kobject *kobj, struct attribute *attr,
+			       char *buf)
+{
+	struct jffs2_sb_info *c = container_of(kobj, struct jffs2_sb_info, kobj);
+	struct jffs2_attr *a = container_of(attr, struct jffs2_attr, attr);
+
+	return a->show(c, buf);
+}
+
+static void jffs2_sb_release(struct kobject *kobj)
+{
+	struct jffs2_sb_info *c = container_of(kobj, struct jffs2_sb_info, kobj);
+
+	complete(&c->kobj_unregister);
+}
+
+static const struct sysfs_ops jffs2_attr_ops = {
+	.show	= jffs2_attr_show,
+};
+
+static struct kobj_type jffs2_ktype = {
+	.default_attrs	= jffs2_attrs,
+	.sysfs_ops	= &jffs2_attr_ops,
+	.release	= jffs2_sb_release,
+};
+
+static int jffs2_sysfs_register(struct jffs2_sb_info *c)
+{
+	c->kobj.kset = jffs2_kset;
+	init_completion(&c->kobj_unregister);
+	return kobject_init_and_add(&c->kobj, &jffs2_ktype, NULL, "mtd%d",
+				    c->mtd->index);
+}
+
+static void jffs2_sysfs_unregister(struct jffs2_sb_info *c)
+{
+	kobject_put(&c->kobj);
+	wait_for_completion(&c->kobj_unregister);
+}
+
 static int jffs2_sync_fs(struct super_block *sb, int wait)
 {
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
@@ -161,17 +268,22 @@ static const struct export_operations jffs2_export_ops = {
  *
  * Opt_override_compr: override default compressor
  * Opt_rp_size: size of reserved pool in KiB
+ * Opt_checkpoint: number of eraseblocks reserved for the mount checkpoint
  * Opt_err: just end of array marker
  */
 enum {
 	Opt_override_compr,
 	Opt_rp_size,
+	Opt_checkpoint,
 	Opt_err,
 };
 
 static const match_table_t tokens = {
 	{Opt_override_compr, "compr=%s"},
 	{Opt_rp_size, "rp_size=%u"},
+#ifdef CONFIG_JFFS2_CHECKPOINT
+	{Opt_checkpoint, "checkpoint=%u"},
+#endif
 	{Opt_err, NULL},
 };
 
@@ -228,6 +340,17 @@ static int jffs2_parse_options(struct jffs2_sb_info *c, char *data)
 			}
 			c->mount_opts.rp_size = opt;
 			break;
+		case Opt_checkpoint:
+			if (match_int(&args[0], &opt))
+				return -EINVAL;
+			if (opt > 0xffff ||
+			    opt > div_u64(c->mtd->size, c->mtd->erasesize) / 4) {
+				pr_warn("Too large checkpoint area specified, max "
+					"is a quarter of the eraseblocks\n");
+				return -EINVAL;
+			}
+			c->mount_opts.ckpt_blocks = opt;
+			break;
 		default:
 			pr_err("Error: unrecognized mount option '%s' or missing value\n",
 			       p);
@@ -241,12 +364,19 @@ static int jffs2_parse_options(struct jffs2_sb_info *c, char *data)
 static int jffs2_remount_fs(struct super_block *sb, int *flags, char *data)
 {
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
+	unsigned int ckpt_blocks = c->mount_opts.ckpt_blocks;
 	int err;
 
 	err = jffs2_parse_options(c, data);
 	if (err)
 		return -EINVAL;
 
+	if (c->mount_opts.ckpt_blocks != ckpt_blocks) {
+		pr_err("Error: the checkpoint area cannot be changed on remount\n");
+		c->mount_opts.ckpt_blocks = ckpt_blocks;
+		return -EINVAL;
+	}
+
 	return jffs2_do_remount_fs(sb, flags, data);
 }
 
@@ -305,7 +435,15 @@ static int jffs2_fill_super(struct super_block *sb, void *data, int silent)
 #ifdef CONFIG_JFFS2_FS_POSIX_ACL
 	sb->s_flags |= MS_POSIXACL;
 #endif
+	ret = jffs2_sysfs_register(c);
+	if (ret) {
+		jffs2_sysfs_unregister(c);
+		return ret;
+	}
+
 	ret = jffs2_do_fill_super(sb, data, silent);
+	if (ret)
+		jffs2_sysfs_unregister(c);
 	return ret;
 }
 
@@ -324,6 +462,8 @@ static void jffs2_put_super (struct super_block *sb)
 
 	mutex_lock(&c->alloc_sem);
 	jffs2_flush_wbuf_pad(c);
+	if (!(sb->s_flags & MS_RDONLY))
+		jffs2_ckpt_write(c, 1);
 	mutex_unlock(&c->alloc_sem);
 
 	jffs2_sum_exit(c);
@@ -338,6 +478,7 @@ static void jffs2_put_super (struct super_block *sb)
 	kfree(c->inocache_list);
 	jffs2_clear_xattr_subsystem(c);
 	mtd_sync(c->mtd);
+	jffs2_sysfs_unregister(c);
 	jffs2_dbg(1, "%s(): returning\n", __func__);
 }
 
@@ -372,6 +513,7 @@ static int __init init_jffs2_fs(void)
 	BUILD_BUG_ON(sizeof(struct jffs2_raw_dirent) != 40);
 	BUILD_BUG_ON(sizeof(struct jffs2_raw_inode) != 68);
 	BUILD_BUG_ON(sizeof(struct jffs2_raw_summary) != 32);
+	BUILD_BUG_ON(sizeof(struct jffs2_raw_checkpoint) != 32);
 
 	pr_info("version 2.2."
 #ifdef CONFIG_JFFS2_FS_WRITEBUFFER
@@ -379,6 +521,9 @@ static int __init init_jffs2_fs(void)
 #endif
 #ifdef CONFIG_JFFS2_SUMMARY
 	       " (SUMMARY) "
+#endif
+#ifdef CONFIG_JFFS2_CHECKPOINT
+	       " (CHECKPOINT) "
 #endif
 	       " © 2001-2006 Red Hat, Inc.\n");
 
@@ -401,13 +546,21 @@ static int __init init_jffs2_fs(void)
 		pr_err("error: Failed to initialise slab caches\n");
 		goto out_compressors;
 	}
+	jffs2_kset = kset_create_and_add("jffs2", NULL, fs_kobj);
+	if (!jffs2_kset) {
+		pr_err("error: Failed to create sysfs directory\n");
+		ret = -ENOMEM;
+		goto out_slab;
+	}
 	ret = register_filesystem(&jffs2_fs_type);
 	if (ret) {
 		pr_err("error: Failed to register filesystem\n");
-		goto out_slab;
+		goto out_kset;
 	}
 	return 0;
 
+ out_kset:
+	kset_unregister(jffs2_kset);
  out_slab:
 	jffs2_destroy_slab_caches();
  out_compressors:
@@ -420,6 +573,7 @@ static int __init init_jffs2_fs(void)
 static void __exit exit_jffs2_fs(void)
 {
 	unregister_filesystem(&jffs2_fs_type);
+	kset_unregister(jffs2_kset);
 	jffs2_destroy_slab_caches();
 	jffs2_compressors_exit();
 	kmem_cache_destroy(jffs2_inode_cachep);
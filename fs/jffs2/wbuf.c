@@ -703,6 +703,7 @@ int jffs2_flush_wbuf_gc(struct jffs2_sb_info *c, uint32_t ino)
 {
 	uint32_t old_wbuf_ofs;
 	uint32_t old_wbuf_len;
+	ktime_t pass;
 	int ret = 0;
 
 	jffs2_dbg(1, "jffs2_flush_wbuf_gc() called for ino #%u...\n", ino);
@@ -738,7 +739,9 @@ int jffs2_flush_wbuf_gc(struct jffs2_sb_info *c, uint32_t ino)
 
 		jffs2_dbg(1, "%s(): calls gc pass\n", __func__);
 
+		pass = ktime_get();
 		ret = jffs2_garbage_collect_pass(c);
+		jffs2_gc_account_pass(c, pass, 0);
 		if (ret) {
 			/* GC failed. Flush it with padding instead */
 			mutex_lock(&c->alloc_sem);
@@ -38,7 +38,9 @@
  * longer held and the journal is again in operation, allowing users to continue
  * to use the file system while the bulk of the commit I/O is performed. The
  * purpose of this two-step approach is to prevent the commit from causing any
- * latency blips. Note that in any case, the commit does not prevent lookups
+ * latency blips. For the same reason the write-buffers are synchronized before
+ * the commit semaphore is taken, which leaves only little to flush in commit
+ * start. Note that in any case, the commit does not prevent lookups
  * (as permitted by the TNC mutex), or access to VFS data structures e.g. page
  * cache.
  */
@@ -98,6 +100,24 @@ static int nothing_to_commit(struct ubifs_info *c)
 	return 1;
 }
 
+/**
+ * presync_wbufs - synchronize write-buffers before commit start.
+ * @c: UBIFS file-system description object
+ *
+ * Commit start synchronizes all write-buffers while holding @c->commit_sem
+ * for writing, which blocks all journal writers. This function is called
+ * before taking @c->commit_sem to do the bulk of this I/O in advance, so that
+ * commit start only has to flush what was written in between. Errors are
+ * ignored here, they are hit again and handled in 'do_commit()'.
+ */
+static void presync_wbufs(struct ubifs_info *c)
+{
+	int i;
+
+	for (i = 0; i < c->jhead_cnt; i++)
+		ubifs_wbuf_sync(&c->jheads[i].wbuf);
+}
+
 /**
  * do_commit - commit the journal.
  * @c: UBIFS file-system description object
@@ -257,6 +277,7 @@ static int run_bg_commit(struct ubifs_info *c)
 		goto out;
 	spin_unlock(&c->cs_lock);
 
+	presync_wbufs(c);
 	down_write(&c->commit_sem);
 	spin_lock(&c->cs_lock);
 	if (c->cmt_state == COMMIT_REQUIRED)
@@ -437,6 +458,7 @@ int ubifs_run_commit(struct ubifs_info *c)
 
 	/* Ok, the commit is indeed needed */
 
+	presync_wbufs(c);
 	down_write(&c->commit_sem);
 	spin_lock(&c->cs_lock);
 	/*
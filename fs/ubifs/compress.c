@@ -25,11 +25,24 @@
 /*
  * This file provides a single place to access to compression and
  * decompression.
+ *
+ * Compressors keep their working state in the cryptoapi handle, so a handle
+ * may only be used by one task at a time. To let compression and
+ * decompression scale with the number of CPUs, every compressor has a pool of
+ * handles, one per possible CPU. Tasks take a handle from the pool and wait
+ * only if all of them are in use.
  */
 
 #include <linux/crypto.h>
+#include <linux/slab.h>
 #include "ubifs.h"
 
+/*
+ * Maximum number of handles per compressor. Deflate handles carry big
+ * workspaces, so do not allocate one per CPU on machines with many CPUs.
+ */
+#define MAX_COMPR_HANDLES 16
+
 /* Fake description object for the "none" compressor */
 static struct ubifs_compressor none_compr = {
 	.compr_type = UBIFS_COMPR_NONE,
@@ -38,11 +51,9 @@ static struct ubifs_compressor none_compr = {
 };
 
 #ifdef CONFIG_UBIFS_FS_LZO
-static DEFINE_MUTEX(lzo_mutex);
-
 static struct ubifs_compressor lzo_compr = {
 	.compr_type = UBIFS_COMPR_LZO,
-	.comp_mutex = &lzo_mutex,
+	.comp_excl = 1,
 	.name = "lzo",
 	.capi_name = "lzo",
 };
@@ -54,13 +65,10 @@ static struct ubifs_compressor lzo_compr = {
 #endif
 
 #ifdef CONFIG_UBIFS_FS_ZLIB
-static DEFINE_MUTEX(deflate_mutex);
-static DEFINE_MUTEX(inflate_mutex);
-
 static struct ubifs_compressor zlib_compr = {
 	.compr_type = UBIFS_COMPR_ZLIB,
-	.comp_mutex = &deflate_mutex,
-	.decomp_mutex = &inflate_mutex,
+	.comp_excl = 1,
+	.decomp_excl = 1,
 	.name = "zlib",
 	.capi_name = "deflate",
 };
@@ -71,9 +79,89 @@ static struct ubifs_compressor zlib_compr = {
 };
 #endif
 
+#ifdef CONFIG_UBIFS_FS_LZ4
+static struct ubifs_compressor lz4_compr = {
+	.compr_type = UBIFS_COMPR_LZ4,
+	.comp_excl = 1,
+	.name = "lz4",
+	.capi_name = "lz4",
+};
+#else
+static struct ubifs_compressor lz4_compr = {
+	.compr_type = UBIFS_COMPR_LZ4,
+	.name = "lz4",
+};
+#endif
+
+/*
+ * Incompressible data heuristic. Once %COMPR_MISSES data blocks of an inode in
+ * a row did not compress, the next %COMPR_SKIP_MIN blocks are written without
+ * trying to compress them. Then one block is sampled: if it does not compress
+ * either, the number of blocks to skip is doubled, up to %COMPR_SKIP_MAX
+ * blocks. A block which compresses resets the heuristic.
+ */
+#define COMPR_MISSES   4
+#define COMPR_SKIP_MIN 16
+#define COMPR_SKIP_MAX 1024
+
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
+/**
+ * try_get_cc - try to take a free compressor handle from the pool.
+ * @compr: compressor description object
+ *
+ * Returns the handle or %NULL if all of them are in use.
+ */
+static struct crypto_comp *try_get_cc(struct ubifs_compressor *compr)
+{
+	struct crypto_comp *cc = NULL;
+
+	spin_lock(&compr->lock);
+	if (compr->free_cnt)
+		cc = compr->free_cc[--compr->free_cnt];
+	spin_unlock(&compr->lock);
+	return cc;
+}
+
+/**
+ * get_cc - get a compressor handle.
+ * @compr: compressor description object
+ * @excl: non-zero if the handle is needed for exclusive use
+ *
+ * Handles which are not needed for exclusive use may be shared, so the first
+ * one is returned right away. Otherwise this function takes a free handle from
+ * the pool, waiting for one if all of them are in use.
+ */
+static struct crypto_comp *get_cc(struct ubifs_compressor *compr, int excl)
+{
+	struct crypto_comp *cc;
+
+	if (!excl)
+		return compr->cc[0];
+
+	wait_event(compr->wait, (cc = try_get_cc(compr)));
+	return cc;
+}
+
+/**
+ * put_cc - return a compressor handle.
+ * @compr: compressor description object
+ * @cc: the handle obtained with 'get_cc()'
+ * @excl: the same value as was passed to 'get_cc()'
+ */
+static void put_cc(struct ubifs_compressor *compr, struct crypto_comp *cc,
+		   int excl)
+{
+	if (!excl)
+		return;
+
+	spin_lock(&compr->lock);
+	compr->free_cc[compr->free_cnt++] = cc;
+	spin_unlock(&compr->lock);
+	wake_up(&compr->wait);
+}
+
 /**
  * ubifs_compress - compress data.
  * @in_buf: data to compress
@@ -97,6 +185,7 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 {
 	int err;
 	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
+	struct crypto_comp *cc;
 
 	if (*compr_type == UBIFS_COMPR_NONE)
 		goto no_compr;
@@ -105,12 +194,10 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 	if (in_len < UBIFS_MIN_COMPR_LEN)
 		goto no_compr;
 
-	if (compr->comp_mutex)
-		mutex_lock(compr->comp_mutex);
-	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
+	cc = get_cc(compr, compr->comp_excl);
+	err = crypto_comp_compress(cc, in_buf, in_len, out_buf,
 				   (unsigned int *)out_len);
-	if (compr->comp_mutex)
-		mutex_unlock(compr->comp_mutex);
+	put_cc(compr, cc, compr->comp_excl);
 	if (unlikely(err)) {
 		ubifs_warn("cannot compress %d bytes, compressor %s, "
 			   "error %d, leave data uncompressed",
@@ -150,6 +237,7 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 {
 	int err;
 	struct ubifs_compressor *compr;
+	struct crypto_comp *cc;
 
 	if (unlikely(compr_type < 0 || compr_type >= UBIFS_COMPR_TYPES_CNT)) {
 		ubifs_err("invalid compression type %d", compr_type);
@@ -169,12 +257,10 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 		return 0;
 	}
 
-	if (compr->decomp_mutex)
-		mutex_lock(compr->decomp_mutex);
-	err = crypto_comp_decompress(compr->cc, in_buf, in_len, out_buf,
+	cc = get_cc(compr, compr->decomp_excl);
+	err = crypto_comp_decompress(cc, in_buf, in_len, out_buf,
 				     (unsigned int *)out_len);
-	if (compr->decomp_mutex)
-		mutex_unlock(compr->decomp_mutex);
+	put_cc(compr, cc, compr->decomp_excl);
 	if (err)
 		ubifs_err("cannot decompress %d bytes, compressor %s, "
 			  "error %d", in_len, compr->name, err);
@@ -182,6 +268,70 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 	return err;
 }
 
+/**
+ * ubifs_compr_skip - check if a data block should be written uncompressed.
+ * @ui: UBIFS inode the data block belongs to
+ *
+ * This function returns %1 if the recent data blocks of @ui did not compress,
+ * so compression should not even be tried for the next one, and %0 otherwise.
+ */
+int ubifs_compr_skip(struct ubifs_inode *ui)
+{
+	if (ui->compr_skip <= 0)
+		return 0;
+
+	ui->compr_skip -= 1;
+	return 1;
+}
+
+/**
+ * ubifs_compr_account - account the result of compressing a data block.
+ * @ui: UBIFS inode the data block belongs to
+ * @compressed: non-zero if the data block compressed
+ */
+void ubifs_compr_account(struct ubifs_inode *ui, int compressed)
+{
+	if (compressed) {
+		ui->compr_misses = 0;
+		ui->compr_window = 0;
+		return;
+	}
+
+	if (ui->compr_misses < COMPR_MISSES)
+		ui->compr_misses += 1;
+	if (ui->compr_misses < COMPR_MISSES)
+		return;
+
+	if (!ui->compr_window)
+		ui->compr_window = COMPR_SKIP_MIN;
+	else
+		ui->compr_window = min(ui->compr_window * 2, COMPR_SKIP_MAX);
+	ui->compr_skip = ui->compr_window;
+}
+
+/**
+ * compr_exit - de-initialize a compressor.
+ * @compr: compressor description object
+ *
+ * This function frees the handles of a compressor, including partially
+ * initialized ones.
+ */
+static void compr_exit(struct ubifs_compressor *compr)
+{
+	int i;
+
+	if (!compr->capi_name)
+		return;
+
+	if (compr->cc)
+		for (i = 0; i < compr->cc_cnt; i++)
+			if (compr->cc[i])
+				crypto_free_comp(compr->cc[i]);
+	kfree(compr->cc);
+	kfree(compr->free_cc);
+	compr->cc = compr->free_cc = NULL;
+}
+
 /**
  * compr_init - initialize a compressor.
  * @compr: compressor description object
@@ -191,28 +341,45 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
  */
 static int __init compr_init(struct ubifs_compressor *compr)
 {
+	int i, err;
+
 	if (compr->capi_name) {
-		compr->cc = crypto_alloc_comp(compr->capi_name, 0, 0);
-		if (IS_ERR(compr->cc)) {
-			ubifs_err("cannot initialize compressor %s, error %ld",
-				  compr->name, PTR_ERR(compr->cc));
-			return PTR_ERR(compr->cc);
+		spin_lock_init(&compr->lock);
+		init_waitqueue_head(&compr->wait);
+
+		compr->cc_cnt = min_t(int, num_possible_cpus(),
+				      MAX_COMPR_HANDLES);
+		compr->cc = kcalloc(compr->cc_cnt, sizeof(struct crypto_comp *),
+				    GFP_KERNEL);
+		compr->free_cc = kcalloc(compr->cc_cnt,
+					 sizeof(struct crypto_comp *),
+					 GFP_KERNEL);
+		if (!compr->cc || !compr->free_cc) {
+			err = -ENOMEM;
+			goto out_free;
 		}
+
+		for (i = 0; i < compr->cc_cnt; i++) {
+			struct crypto_comp *cc;
+
+			cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+			if (IS_ERR(cc)) {
+				err = PTR_ERR(cc);
+				ubifs_err("cannot initialize compressor %s, "
+					  "error %d", compr->name, err);
+				goto out_free;
+			}
+			compr->cc[i] = compr->free_cc[i] = cc;
+		}
+		compr->free_cnt = compr->cc_cnt;
 	}
 
 	ubifs_compressors[compr->compr_type] = compr;
 	return 0;
-}
 
-/**
- * compr_exit - de-initialize a compressor.
- * @compr: compressor description object
- */
-static void compr_exit(struct ubifs_compressor *compr)
-{
-	if (compr->capi_name)
-		crypto_free_comp(compr->cc);
-	return;
+out_free:
+	compr_exit(compr);
+	return err;
 }
 
 /**
@@ -233,9 +400,15 @@ int __init ubifs_compressors_init(void)
 	if (err)
 		goto out_lzo;
 
+	err = compr_init(&lz4_compr);
+	if (err)
+		goto out_zlib;
+
 	ubifs_compressors[UBIFS_COMPR_NONE] = &none_compr;
 	return 0;
 
+out_zlib:
+	compr_exit(&zlib_compr);
 out_lzo:
 	compr_exit(&lzo_compr);
 	return err;
@@ -248,4 +421,5 @@ void ubifs_compressors_exit(void)
 {
 	compr_exit(&lzo_compr);
 	compr_exit(&zlib_compr);
+	compr_exit(&lz4_compr);
 }
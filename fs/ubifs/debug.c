@@ -212,6 +212,8 @@ const char *dbg_jhead(int jhead)
 		return "1 (base)";
 	case DATAHD:
 		return "2 (data)";
+	case COLDHD:
+		return "3 (cold data)";
 	default:
 		return "unknown journal head";
 	}
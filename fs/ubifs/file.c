@@ -53,6 +53,7 @@
 #include <linux/mount.h>
 #include <linux/namei.h>
 #include <linux/slab.h>
+#include <linux/workqueue.h>
 
 static int read_block(struct inode *inode, void *addr, unsigned int block,
 		      struct ubifs_data_node *dn)
@@ -701,6 +702,68 @@ out_err:
 	return -EINVAL;
 }
 
+/*
+ * Bulk-read decompresses the second half of the pages in a worker if there are
+ * at least this many pages to populate besides the first one, and there is
+ * more than one CPU.
+ */
+#define BULK_READ_PARALLEL_MIN 4
+
+/**
+ * struct bu_populate - a range of pages to populate from a bulk-read.
+ * @work: work object used to populate the range in parallel
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @mapping: address space the pages belong to
+ * @start: index of the first page of the range
+ * @end: index of the page after the last page of the range
+ * @done: index of the page after the last page populated
+ */
+struct bu_populate {
+	struct work_struct work;
+	struct ubifs_info *c;
+	struct bu_info *bu;
+	struct address_space *mapping;
+	pgoff_t start;
+	pgoff_t end;
+	pgoff_t done;
+};
+
+/**
+ * populate_range - populate a range of pages from bulk-read information.
+ * @bp: the range to populate
+ *
+ * This function stops at the first page which cannot be created or populated
+ * and stores its index in @bp->done.
+ */
+static void populate_range(struct bu_populate *bp)
+{
+	pgoff_t index;
+	int err = 0, n = 0;
+
+	for (index = bp->start; index < bp->end; index++) {
+		struct page *page;
+
+		page = find_or_create_page(bp->mapping, index,
+					   GFP_NOFS | __GFP_COLD);
+		if (!page)
+			break;
+		if (!PageUptodate(page))
+			err = populate_page(bp->c, page, bp->bu, &n);
+		unlock_page(page);
+		page_cache_release(page);
+		if (err)
+			break;
+	}
+
+	bp->done = index;
+}
+
+static void populate_range_work(struct work_struct *work)
+{
+	populate_range(container_of(work, struct bu_populate, work));
+}
+
 /**
  * ubifs_do_bulk_read - do bulk-read.
  * @c: UBIFS file-system description object
@@ -716,8 +779,9 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 	struct address_space *mapping = page1->mapping;
 	struct inode *inode = mapping->host;
 	struct ubifs_inode *ui = ubifs_inode(inode);
-	int err, page_idx, page_cnt, ret = 0, n = 0;
+	int err, page_cnt, ret = 0, n = 0;
 	int allocate = bu->buf ? 0 : 1;
+	struct bu_populate bp1, bp2;
 	loff_t isize;
 
 	err = ubifs_tnc_get_bu_keys(c, bu);
@@ -774,25 +838,41 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 		goto out_free;
 	end_index = ((isize - 1) >> PAGE_CACHE_SHIFT);
 
-	for (page_idx = 1; page_idx < page_cnt; page_idx++) {
-		pgoff_t page_offset = offset + page_idx;
-		struct page *page;
+	bp1.c = c;
+	bp1.bu = bu;
+	bp1.mapping = mapping;
+	bp1.start = offset + 1;
+	bp1.end = min_t(pgoff_t, offset + page_cnt, end_index + 1);
+	if (bp1.start >= bp1.end) {
+		ui->last_page_read = offset;
+		goto out_free;
+	}
 
-		if (page_offset > end_index)
-			break;
-		page = find_or_create_page(mapping, page_offset,
-					   GFP_NOFS | __GFP_COLD);
-		if (!page)
-			break;
-		if (!PageUptodate(page))
-			err = populate_page(c, page, bu, &n);
-		unlock_page(page);
-		page_cache_release(page);
-		if (err)
-			break;
+	if (bp1.end - bp1.start < BULK_READ_PARALLEL_MIN ||
+	    num_online_cpus() < 2) {
+		populate_range(&bp1);
+		ui->last_page_read = bp1.done - 1;
+		goto out_free;
 	}
 
-	ui->last_page_read = offset + page_idx - 1;
+	/*
+	 * Decompress the second half of the pages in a worker while this task
+	 * does the first half. The worker has to be finished before the
+	 * bulk-read buffer is released.
+	 */
+	bp2 = bp1;
+	bp2.start = bp1.start + (bp1.end - bp1.start) / 2;
+	bp1.end = bp2.start;
+	INIT_WORK_ONSTACK(&bp2.work, populate_range_work);
+	queue_work(system_unbound_wq, &bp2.work);
+	populate_range(&bp1);
+	flush_work(&bp2.work);
+	destroy_work_on_stack(&bp2.work);
+
+	if (bp1.done < bp1.end)
+		ui->last_page_read = bp1.done - 1;
+	else
+		ui->last_page_read = bp2.done - 1;
 
 out_free:
 	if (allocate)
@@ -1319,6 +1399,9 @@ int ubifs_fsync(struct file *file, loff_t start, loff_t end, int datasync)
 		 */
 		return 0;
 
+	/* Data written back from now on goes to the hot data journal head */
+	ubifs_inode(inode)->sync_time = get_seconds();
+
 	err = filemap_write_and_wait_range(inode->i_mapping, start, end);
 	if (err)
 		return err;
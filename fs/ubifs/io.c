@@ -142,6 +142,7 @@ int ubifs_leb_change(struct ubifs_info *c, int lnum, const void *buf, int len)
 	ubifs_assert(!c->ro_media && !c->ro_mount);
 	if (c->ro_error)
 		return -EROFS;
+	ubifs_lc_invalidate(c, lnum);
 	if (!dbg_is_tst_rcvry(c))
 		err = ubi_leb_change(c->ubi, lnum, buf, len);
 	else
@@ -162,6 +163,7 @@ int ubifs_leb_unmap(struct ubifs_info *c, int lnum)
 	ubifs_assert(!c->ro_media && !c->ro_mount);
 	if (c->ro_error)
 		return -EROFS;
+	ubifs_lc_invalidate(c, lnum);
 	if (!dbg_is_tst_rcvry(c))
 		err = ubi_leb_unmap(c->ubi, lnum);
 	else
@@ -1015,6 +1017,40 @@ out:
 	return -EINVAL;
 }
 
+/**
+ * ubifs_check_read_node - quietly check a node which has already been read.
+ * @c: UBIFS file-system description object
+ * @buf: the node
+ * @type: expected node type
+ * @len: expected node length
+ * @lnum: logical eraseblock number the node was read from
+ * @offs: offset within the logical eraseblock
+ *
+ * This function is used for nodes which were read speculatively together with
+ * other nodes. It does the same checks as 'ubifs_read_node()' but does not
+ * print anything. Returns zero if the node is OK and %-EINVAL or %-EUCLEAN if
+ * it is not, in which case the caller should read it with 'ubifs_read_node()'
+ * if it really needs it.
+ */
+int ubifs_check_read_node(const struct ubifs_info *c, const void *buf,
+			  int type, int len, int lnum, int offs)
+{
+	const struct ubifs_ch *ch = buf;
+	int err;
+
+	if (ch->node_type != type)
+		return -EINVAL;
+
+	err = ubifs_check_node(c, buf, lnum, offs, 1, 0);
+	if (err)
+		return err;
+
+	if (le32_to_cpu(ch->len) != len)
+		return -EINVAL;
+
+	return 0;
+}
+
 /**
  * ubifs_wbuf_init - initialize write-buffer.
  * @c: UBIFS file-system description object
@@ -678,6 +678,30 @@ out_ro:
 	return err;
 }
 
+/**
+ * data_jhead - select the journal head for data nodes of an inode.
+ * @c: UBIFS file-system description object
+ * @ui: UBIFS inode the data belongs to
+ *
+ * Data which is synchronized often (e.g., by databases) is frequently
+ * overwritten, while data which is just written back (e.g., big files being
+ * copied) usually stays on the flash for long. Keeping them in separate LEBs
+ * makes the LEBs with hot data become dirty as a whole, so the garbage
+ * collector has to move less live data. If the file-system has a cold data
+ * journal head, this function returns it for the inodes which were not
+ * synchronized by 'fsync()' during the last %UBIFS_HOT_DATA_AGE seconds.
+ */
+static int data_jhead(const struct ubifs_info *c, const struct ubifs_inode *ui)
+{
+	unsigned long sync_time = ui->sync_time;
+
+	if (c->jhead_cnt <= COLDHD || IS_SYNC(&ui->vfs_inode))
+		return DATAHD;
+	if (sync_time && get_seconds() - sync_time < UBIFS_HOT_DATA_AGE)
+		return DATAHD;
+	return COLDHD;
+}
+
 /**
  * ubifs_jnl_write_data - write a data node to the journal.
  * @c: UBIFS file-system description object
@@ -693,9 +717,10 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len)
 {
 	struct ubifs_data_node *data;
-	int err, lnum, offs, compr_type, out_len;
+	int err, lnum, offs, compr_type, out_len, sample = 0;
 	int dlen = COMPRESSED_DATA_NODE_BUF_SZ, allocated = 1;
 	struct ubifs_inode *ui = ubifs_inode(inode);
+	int jhead = data_jhead(c, ui);
 
 	dbg_jnlk(key, "ino %lu, blk %u, len %d, key ",
 		(unsigned long)key_inum(c, key), key_block(c, key), len);
@@ -723,26 +748,34 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 	if (!(ui->flags & UBIFS_COMPR_FL))
 		/* Compression is disabled for this inode */
 		compr_type = UBIFS_COMPR_NONE;
-	else
+	else if (ubifs_compr_skip(ui))
+		/* The recent data of this inode did not compress */
+		compr_type = UBIFS_COMPR_NONE;
+	else {
 		compr_type = ui->compr_type;
+		sample = compr_type != UBIFS_COMPR_NONE &&
+			 len >= UBIFS_MIN_COMPR_LEN;
+	}
 
 	out_len = dlen - UBIFS_DATA_NODE_SZ;
 	ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
 	ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
+	if (sample)
+		ubifs_compr_account(ui, compr_type != UBIFS_COMPR_NONE);
 
 	dlen = UBIFS_DATA_NODE_SZ + out_len;
 	data->compr_type = cpu_to_le16(compr_type);
 
 	/* Make reservation before allocating sequence numbers */
-	err = make_reservation(c, DATAHD, dlen);
+	err = make_reservation(c, jhead, dlen);
 	if (err)
 		goto out_free;
 
-	err = write_node(c, DATAHD, data, dlen, &lnum, &offs);
+	err = write_node(c, jhead, data, dlen, &lnum, &offs);
 	if (err)
 		goto out_release;
-	ubifs_wbuf_add_ino_nolock(&c->jheads[DATAHD].wbuf, key_inum(c, key));
-	release_head(c, DATAHD);
+	ubifs_wbuf_add_ino_nolock(&c->jheads[jhead].wbuf, key_inum(c, key));
+	release_head(c, jhead);
 
 	err = ubifs_tnc_add(c, key, lnum, offs, dlen);
 	if (err)
@@ -756,7 +789,7 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 	return 0;
 
 out_release:
-	release_head(c, DATAHD);
+	release_head(c, jhead);
 out_ro:
 	ubifs_ro_mode(c, err);
 	finish_reservation(c);
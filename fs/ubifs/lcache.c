@@ -0,0 +1,313 @@
+/*
+ * This file is part of UBIFS.
+ *
+ * Copyright (C) 2006-2008 Nokia Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This file implements the leaf node cache (LC), which keeps copies of
+ * recently read inode and directory entry nodes.
+ *
+ * Unlike the per-zbranch cache of directory entries in tnc.c, the LC is
+ * indexed by the flash address of the nodes, so it survives znodes being
+ * evicted from the TNC and zbranches being replaced. This is correct because
+ * UBIFS never overwrites a node in place: the contents of a LEB do not change
+ * until the LEB is unmapped or atomically changed, and at that point all
+ * cached nodes of the LEB are dropped (see 'ubifs_lc_invalidate()').
+ *
+ * Nodes are added to the LC only while the TNC mutex is held and a zbranch
+ * refers to them, so they cannot be garbage-collected while being added.
+ *
+ * On a cache miss the neighbouring leaf nodes of the same znode which are
+ * close on the flash are read in one go and added to the LC as well. This
+ * speeds up cold directory walks, because the inode nodes of files created
+ * together usually sit next to each other. The LC size is limited and the
+ * least recently used nodes are evicted first, also by the shrinker.
+ */
+
+#include <linux/hash.h>
+#include "ubifs.h"
+
+/* Maximum amount of node data in the leaf node cache of a file-system */
+#define LC_MAX_SIZE (128 * 1024)
+
+/* Global leaf node cache node counter (for all mounted UBIFS instances) */
+atomic_long_t ubifs_lc_cnt;
+
+/**
+ * struct lc_node - a leaf node cache entry.
+ * @hnode: link in the hash table
+ * @lru: link in the LRU list
+ * @lnum: LEB number of the node
+ * @offs: offset of the node
+ * @len: node length
+ * @node: node data
+ */
+struct lc_node {
+	struct hlist_node hnode;
+	struct list_head lru;
+	int lnum;
+	int offs;
+	int len;
+	u8 node[];
+};
+
+static inline struct hlist_head *lc_bucket(struct ubifs_info *c, int lnum,
+					   int offs)
+{
+	return &c->lc_hash[hash_32((lnum << 16) ^ (offs >> 3),
+				   UBIFS_LC_HASH_SHIFT)];
+}
+
+static struct lc_node *lc_find(struct ubifs_info *c, int lnum, int offs)
+{
+	struct lc_node *lcn;
+	struct hlist_node *p;
+
+	hlist_for_each_entry(lcn, p, lc_bucket(c, lnum, offs), hnode)
+		if (lcn->lnum == lnum && lcn->offs == offs)
+			return lcn;
+	return NULL;
+}
+
+static void lc_free(struct ubifs_info *c, struct lc_node *lcn)
+{
+	hlist_del(&lcn->hnode);
+	list_del(&lcn->lru);
+	c->lc_size -= lcn->len;
+	atomic_long_dec(&ubifs_lc_cnt);
+	kfree(lcn);
+}
+
+/**
+ * ubifs_lc_lookup - look up a leaf node in the leaf node cache.
+ * @c: UBIFS file-system description object
+ * @zbr: zbranch of the leaf node
+ * @node: node is returned here
+ *
+ * This function returns %1 if the node was found in the cache and copied to
+ * @node, and %0 if it was not found.
+ */
+int ubifs_lc_lookup(struct ubifs_info *c, const struct ubifs_zbranch *zbr,
+		    void *node)
+{
+	struct lc_node *lcn;
+
+	spin_lock(&c->lc_lock);
+	lcn = lc_find(c, zbr->lnum, zbr->offs);
+	if (!lcn || lcn->len != zbr->len) {
+		spin_unlock(&c->lc_lock);
+		return 0;
+	}
+	memcpy(node, lcn->node, lcn->len);
+	list_move_tail(&lcn->lru, &c->lc_lru);
+	spin_unlock(&c->lc_lock);
+	return 1;
+}
+
+/**
+ * lc_add - add a leaf node to the leaf node cache.
+ * @c: UBIFS file-system description object
+ * @zbr: zbranch of the leaf node
+ * @node: node to add
+ *
+ * The caller has to hold the TNC mutex and @zbr has to be a zbranch of the
+ * TNC. Failing to add a node is not an error, the cache is only an
+ * optimization.
+ */
+static void lc_add(struct ubifs_info *c, const struct ubifs_zbranch *zbr,
+		   const void *node)
+{
+	struct lc_node *lcn;
+
+	ubifs_assert(mutex_is_locked(&c->tnc_mutex));
+
+	lcn = kmalloc(sizeof(struct lc_node) + zbr->len,
+		      GFP_NOFS | __GFP_NOWARN);
+	if (!lcn)
+		return;
+
+	lcn->lnum = zbr->lnum;
+	lcn->offs = zbr->offs;
+	lcn->len = zbr->len;
+	memcpy(lcn->node, node, zbr->len);
+
+	spin_lock(&c->lc_lock);
+	if (lc_find(c, zbr->lnum, zbr->offs)) {
+		spin_unlock(&c->lc_lock);
+		kfree(lcn);
+		return;
+	}
+
+	while (c->lc_size + lcn->len > LC_MAX_SIZE && !list_empty(&c->lc_lru))
+		lc_free(c, list_entry(c->lc_lru.next, struct lc_node, lru));
+
+	hlist_add_head(&lcn->hnode, lc_bucket(c, lcn->lnum, lcn->offs));
+	list_add_tail(&lcn->lru, &c->lc_lru);
+	c->lc_size += lcn->len;
+	atomic_long_inc(&ubifs_lc_cnt);
+	spin_unlock(&c->lc_lock);
+}
+
+/**
+ * ubifs_lc_invalidate - drop all cached leaf nodes of a LEB.
+ * @c: UBIFS file-system description object
+ * @lnum: LEB number
+ *
+ * This function has to be called before LEB @lnum is unmapped or changed.
+ */
+void ubifs_lc_invalidate(struct ubifs_info *c, int lnum)
+{
+	struct lc_node *lcn, *tmp;
+
+	spin_lock(&c->lc_lock);
+	list_for_each_entry_safe(lcn, tmp, &c->lc_lru, lru)
+		if (lcn->lnum == lnum)
+			lc_free(c, lcn);
+	spin_unlock(&c->lc_lock);
+}
+
+/**
+ * ubifs_lc_shrink - evict least recently used nodes from the leaf node cache.
+ * @c: UBIFS file-system description object
+ * @nr: number of nodes to evict
+ *
+ * Returns the number of evicted nodes.
+ */
+int ubifs_lc_shrink(struct ubifs_info *c, int nr)
+{
+	int freed = 0;
+
+	spin_lock(&c->lc_lock);
+	while (freed < nr && !list_empty(&c->lc_lru)) {
+		lc_free(c, list_entry(c->lc_lru.next, struct lc_node, lru));
+		freed += 1;
+	}
+	spin_unlock(&c->lc_lock);
+	return freed;
+}
+
+/**
+ * ubifs_lc_destroy - free all nodes of the leaf node cache.
+ * @c: UBIFS file-system description object
+ */
+void ubifs_lc_destroy(struct ubifs_info *c)
+{
+	ubifs_lc_shrink(c, INT_MAX);
+}
+
+/**
+ * leaf_node_type - get the type of the leaf node a key refers to.
+ * @c: UBIFS file-system description object
+ * @key: key of the node
+ *
+ * Returns the node type or %-1 if the node is not cached.
+ */
+static int leaf_node_type(const struct ubifs_info *c,
+			  const union ubifs_key *key)
+{
+	switch (key_type(c, key)) {
+	case UBIFS_INO_KEY:
+		return UBIFS_INO_NODE;
+	case UBIFS_DENT_KEY:
+		return UBIFS_DENT_NODE;
+	case UBIFS_XENT_KEY:
+		return UBIFS_XENT_NODE;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * ubifs_lc_prefetch - read a leaf node and its neighbours into the cache.
+ * @c: UBIFS file-system description object
+ * @znode: level 0 znode
+ * @n: zbranch slot of the leaf node to read
+ *
+ * This function reads leaf node @n of @znode together with the other inode
+ * and directory entry nodes of @znode which are in the same LEB within
+ * %UBIFS_PREFETCH_SPAN bytes, and adds them to the leaf node cache. Nothing is
+ * read if the node is already cached or sits in a journal head LEB, and only
+ * the nodes which pass validation are added. The caller has to hold the TNC
+ * mutex and has to look the node up in the cache afterwards; if it is not
+ * there, it has to be read the normal way, which also reports any errors.
+ */
+void ubifs_lc_prefetch(struct ubifs_info *c, struct ubifs_znode *znode, int n)
+{
+	int i, start, end, err;
+	const struct ubifs_zbranch *zt = &znode->zbranch[n];
+	struct lc_node *lcn;
+	void *buf;
+
+	ubifs_assert(mutex_is_locked(&c->tnc_mutex));
+	ubifs_assert(znode->level == 0);
+
+	if (leaf_node_type(c, &zt->key) < 0 || ubifs_get_wbuf(c, zt->lnum))
+		return;
+
+	spin_lock(&c->lc_lock);
+	lcn = lc_find(c, zt->lnum, zt->offs);
+	spin_unlock(&c->lc_lock);
+	if (lcn)
+		return;
+
+	start = zt->offs;
+	end = zt->offs + zt->len;
+	for (i = 0; i < znode->child_cnt; i++) {
+		const struct ubifs_zbranch *zbr = &znode->zbranch[i];
+
+		if (zbr->lnum != zt->lnum || leaf_node_type(c, &zbr->key) < 0)
+			continue;
+		if (max(end, zbr->offs + zbr->len) - min(start, zbr->offs) >
+		    UBIFS_PREFETCH_SPAN)
+			continue;
+		start = min(start, zbr->offs);
+		end = max(end, zbr->offs + zbr->len);
+	}
+
+	buf = kmalloc(end - start, GFP_NOFS | __GFP_NOWARN);
+	if (!buf)
+		return;
+
+	err = ubifs_leb_read(c, zt->lnum, buf, start, end - start, 0);
+	if (err && err != -EBADMSG)
+		goto out;
+
+	for (i = 0; i < znode->child_cnt; i++) {
+		const struct ubifs_zbranch *zbr = &znode->zbranch[i];
+		void *node = buf + zbr->offs - start;
+		union ubifs_key key;
+		int type = leaf_node_type(c, &zbr->key);
+
+		if (zbr->lnum != zt->lnum || type < 0 || zbr->offs < start ||
+		    zbr->offs + zbr->len > end)
+			continue;
+
+		if (ubifs_check_read_node(c, node, type, zbr->len, zbr->lnum,
+					  zbr->offs))
+			continue;
+		key_read(c, node + UBIFS_KEY_OFFSET, &key);
+		if (!keys_eq(c, &zbr->key, &key))
+			continue;
+		if (type != UBIFS_INO_NODE && ubifs_validate_entry(c, node))
+			continue;
+
+		lc_add(c, zbr, node);
+	}
+
+out:
+	kfree(buf);
+}
@@ -81,7 +81,7 @@ static int create_default_filesystem(struct ubifs_info *c)
 	union ubifs_key key;
 	int err, tmp, jnl_lebs, log_lebs, max_buds, main_lebs, main_first;
 	int lpt_lebs, lpt_first, orph_lebs, big_lpt, ino_waste, sup_flags = 0;
-	int min_leb_cnt = UBIFS_MIN_LEB_CNT;
+	int min_leb_cnt = UBIFS_MIN_LEB_CNT, jhead_cnt = DEFAULT_JHEADS_CNT;
 	long long tmp64, main_bytes;
 	__le64 tmp_le64;
 
@@ -117,11 +117,18 @@ static int create_default_filesystem(struct ubifs_info *c)
 		/* And some extra space to allow writes while committing */
 		log_lebs += 1;
 		min_leb_cnt += 1;
+		/*
+		 * Separate cold data only if asked to, because kernels which
+		 * support one data head refuse to mount such file-systems.
+		 */
+		if (c->mount_opts.cold_jhead)
+			jhead_cnt = UBIFS_MAX_JHEADS;
 	}
 
+	/* Every data head beyond the first needs a bud LEB of its own */
 	max_buds = jnl_lebs - log_lebs;
-	if (max_buds < UBIFS_MIN_BUD_LEBS)
-		max_buds = UBIFS_MIN_BUD_LEBS;
+	if (max_buds < UBIFS_MIN_BUD_LEBS + jhead_cnt - 1)
+		max_buds = UBIFS_MIN_BUD_LEBS + jhead_cnt - 1;
 
 	/*
 	 * Orphan nodes are stored in a separate area. One node can store a lot
@@ -175,7 +182,7 @@ static int create_default_filesystem(struct ubifs_info *c)
 	sup->log_lebs      = cpu_to_le32(log_lebs);
 	sup->lpt_lebs      = cpu_to_le32(lpt_lebs);
 	sup->orph_lebs     = cpu_to_le32(orph_lebs);
-	sup->jhead_cnt     = cpu_to_le32(DEFAULT_JHEADS_CNT);
+	sup->jhead_cnt     = cpu_to_le32(jhead_cnt);
 	sup->fanout        = cpu_to_le32(DEFAULT_FANOUT);
 	sup->lsave_cnt     = cpu_to_le32(c->lsave_cnt);
 	sup->fmt_version   = cpu_to_le32(UBIFS_FORMAT_VERSION);
@@ -409,7 +416,15 @@ static int validate_sb(struct ubifs_info *c, struct ubifs_sb_node *sup)
 		goto failed;
 	}
 
-	max_bytes = (long long)c->leb_size * UBIFS_MIN_BUD_LEBS;
+	if (c->jhead_cnt < NONDATA_JHEADS_CNT + 1 ||
+	    c->jhead_cnt > NONDATA_JHEADS_CNT + UBIFS_MAX_JHEADS) {
+		err = 9;
+		goto failed;
+	}
+
+	/* Each data head beyond the first needs one more bud LEB */
+	max_bytes = (long long)c->leb_size *
+		    (UBIFS_MIN_BUD_LEBS + c->jhead_cnt - NONDATA_JHEADS_CNT - 1);
 	if (c->max_bud_bytes < max_bytes) {
 		ubifs_err("too small journal (%lld bytes), must be at least "
 			  "%lld bytes",  c->max_bud_bytes, max_bytes);
@@ -424,12 +439,6 @@ static int validate_sb(struct ubifs_info *c, struct ubifs_sb_node *sup)
 		goto failed;
 	}
 
-	if (c->jhead_cnt < NONDATA_JHEADS_CNT + 1 ||
-	    c->jhead_cnt > NONDATA_JHEADS_CNT + UBIFS_MAX_JHEADS) {
-		err = 9;
-		goto failed;
-	}
-
 	if (c->fanout < UBIFS_MIN_FANOUT ||
 	    ubifs_idx_node_sz(c, c->fanout) > c->leb_size) {
 		err = 10;
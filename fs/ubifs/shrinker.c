@@ -215,6 +215,30 @@ static int shrink_tnc_trees(int nr, int age, int *contention)
 	return freed;
 }
 
+/**
+ * shrink_leaf_caches - free cached leaf nodes of all mounted file-systems.
+ * @nr: number of nodes to free
+ *
+ * This function walks the list of mounted UBIFS file-systems and frees the
+ * least recently used nodes of their leaf node caches (see lcache.c) until
+ * @nr nodes are freed. Returns the number of freed nodes.
+ */
+static int shrink_leaf_caches(int nr)
+{
+	struct ubifs_info *c;
+	int freed = 0;
+
+	/* The file-systems cannot go away while we are holding the lock */
+	spin_lock(&ubifs_infos_lock);
+	list_for_each_entry(c, &ubifs_infos, infos_list) {
+		freed += ubifs_lc_shrink(c, nr - freed);
+		if (freed >= nr)
+			break;
+	}
+	spin_unlock(&ubifs_infos_lock);
+	return freed;
+}
+
 /**
  * kick_a_thread - kick a background thread to start commit.
  *
@@ -280,17 +304,30 @@ static int kick_a_thread(void)
 int ubifs_shrinker(struct shrinker *shrink, struct shrink_control *sc)
 {
 	int nr = sc->nr_to_scan;
-	int freed, contention = 0;
+	int freed = 0, contention = 0;
 	long clean_zn_cnt = atomic_long_read(&ubifs_clean_zn_cnt);
+	long lc_cnt = atomic_long_read(&ubifs_lc_cnt);
 
 	if (nr == 0)
 		/*
 		 * Due to the way UBIFS updates the clean znode counter it may
 		 * temporarily be negative.
 		 */
-		return clean_zn_cnt >= 0 ? clean_zn_cnt : 1;
+		return (clean_zn_cnt >= 0 ? clean_zn_cnt : 1) + lc_cnt;
+
+	/*
+	 * Cached leaf nodes are cheap to read again, unlike znodes which may
+	 * have a whole sub-tree hanging off them, so free them first.
+	 */
+	if (lc_cnt) {
+		freed = shrink_leaf_caches(nr);
+		if (freed >= nr)
+			goto out;
+	}
 
 	if (!clean_zn_cnt) {
+		if (freed)
+			goto out;
 		/*
 		 * No clean znodes, nothing to reap. All we can do in this case
 		 * is to kick background threads to start commit, which will
@@ -302,7 +339,7 @@ int ubifs_shrinker(struct shrinker *shrink, struct shrink_control *sc)
 		return kick_a_thread();
 	}
 
-	freed = shrink_tnc_trees(nr, OLD_ZNODE_AGE, &contention);
+	freed += shrink_tnc_trees(nr - freed, OLD_ZNODE_AGE, &contention);
 	if (freed >= nr)
 		goto out;
 
@@ -320,6 +357,6 @@ int ubifs_shrinker(struct shrinker *shrink, struct shrink_control *sc)
 	}
 
 out:
-	dbg_tnc("%d znodes were freed, requested %d", freed, nr);
+	dbg_tnc("%d znodes and leaf nodes were freed, requested %d", freed, nr);
 	return freed;
 }
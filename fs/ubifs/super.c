@@ -443,6 +443,9 @@ static int ubifs_show_options(struct seq_file *s, struct dentry *root)
 			   ubifs_compr_name(c->mount_opts.compr_type));
 	}
 
+	if (c->mount_opts.cold_jhead)
+		seq_printf(s, ",cold_jhead");
+
 	return 0;
 }
 
@@ -934,6 +937,7 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
  * Opt_override_compr: override default compressor
+ * Opt_cold_jhead: format an empty volume with a separate cold data head
  * Opt_err: just end of array marker
  */
 enum {
@@ -944,6 +948,7 @@ enum {
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
 	Opt_override_compr,
+	Opt_cold_jhead,
 	Opt_err,
 };
 
@@ -955,6 +960,7 @@ static const match_table_t tokens = {
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
 	{Opt_override_compr, "compr=%s"},
+	{Opt_cold_jhead, "cold_jhead"},
 	{Opt_err, NULL},
 };
 
@@ -1044,6 +1050,8 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 				c->mount_opts.compr_type = UBIFS_COMPR_LZO;
 			else if (!strcmp(name, "zlib"))
 				c->mount_opts.compr_type = UBIFS_COMPR_ZLIB;
+			else if (!strcmp(name, "lz4"))
+				c->mount_opts.compr_type = UBIFS_COMPR_LZ4;
 			else {
 				ubifs_err("unknown compressor \"%s\"", name);
 				kfree(name);
@@ -1054,6 +1062,10 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->default_compr = c->mount_opts.compr_type;
 			break;
 		}
+		case Opt_cold_jhead:
+			/* Only matters when an empty volume is formatted */
+			c->mount_opts.cold_jhead = 1;
+			break;
 		default:
 		{
 			unsigned long flag;
@@ -1101,6 +1113,7 @@ static void destroy_journal(struct ubifs_info *c)
 	ubifs_destroy_idx_gc(c);
 	ubifs_destroy_size_tree(c);
 	ubifs_tnc_close(c);
+	ubifs_lc_destroy(c);
 	free_buds(c);
 }
 
@@ -1974,6 +1987,7 @@ static struct ubifs_info *alloc_ubifs_info(struct ubi_volume_desc *ubi)
 		spin_lock_init(&c->buds_lock);
 		spin_lock_init(&c->space_lock);
 		spin_lock_init(&c->orphan_lock);
+		spin_lock_init(&c->lc_lock);
 		init_rwsem(&c->commit_sem);
 		mutex_init(&c->lp_mutex);
 		mutex_init(&c->tnc_mutex);
@@ -1999,6 +2013,7 @@ static struct ubifs_info *alloc_ubifs_info(struct ubi_volume_desc *ubi)
 		INIT_LIST_HEAD(&c->old_buds);
 		INIT_LIST_HEAD(&c->orph_list);
 		INIT_LIST_HEAD(&c->orph_new);
+		INIT_LIST_HEAD(&c->lc_lru);
 		c->no_chk_data_crc = 1;
 
 		c->highest_inum = UBIFS_FIRST_INO;
@@ -402,8 +402,9 @@ static void lnc_free(struct ubifs_zbranch *zbr)
  *
  * This function reads a "hashed" node defined by @zbr from the leaf node cache
  * (in it is there) or from the hash media, in which case the node is also
- * added to LNC. Returns zero in case of success or a negative negative error
- * code in case of failure.
+ * added to LNC. Nodes which are not in LNC are looked up in the per-FS leaf
+ * node cache before they are read (see lcache.c). Returns zero in case of
+ * success or a negative negative error code in case of failure.
  */
 static int tnc_read_node_nm(struct ubifs_info *c, struct ubifs_zbranch *zbr,
 			    void *node)
@@ -419,9 +420,11 @@ static int tnc_read_node_nm(struct ubifs_info *c, struct ubifs_zbranch *zbr,
 		return 0;
 	}
 
-	err = ubifs_tnc_read_node(c, zbr, node);
-	if (err)
-		return err;
+	if (!ubifs_lc_lookup(c, zbr, node)) {
+		err = ubifs_tnc_read_node(c, zbr, node);
+		if (err)
+			return err;
+	}
 
 	/* Add the node to the leaf node cache */
 	err = lnc_add(c, zbr, node);
@@ -1465,6 +1468,13 @@ again:
 		*lnum = zt->lnum;
 		*offs = zt->offs;
 	}
+	if (!zt->leaf && key_type(c, key) != UBIFS_DATA_KEY)
+		/*
+		 * Inode and directory entry nodes are usually read in bursts
+		 * (e.g., when a directory is listed), so read the neighbours
+		 * of the node to the leaf node cache as well.
+		 */
+		ubifs_lc_prefetch(c, znode, n);
 	if (is_hash_key(c, key)) {
 		/*
 		 * In this case the leaf node cache gets used, so we pass the
@@ -1473,6 +1483,10 @@ again:
 		err = tnc_read_node_nm(c, zt, node);
 		goto out;
 	}
+	if (key_type(c, key) == UBIFS_INO_KEY && ubifs_lc_lookup(c, zt, node)) {
+		err = 0;
+		goto out;
+	}
 	if (safely) {
 		err = ubifs_tnc_read_node(c, zt, node);
 		goto out;
@@ -2830,6 +2844,9 @@ struct ubifs_dent_node *ubifs_tnc_next_ent(struct ubifs_info *c,
 		goto out_free;
 	}
 
+	if (!zbr->leaf)
+		/* 'readdir()' is going to need the following entries too */
+		ubifs_lc_prefetch(c, znode, n);
 	err = tnc_read_node_nm(c, zbr, dent);
 	if (unlikely(err))
 		goto out_free;
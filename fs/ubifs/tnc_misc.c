@@ -257,34 +257,22 @@ long ubifs_destroy_tnc_subtree(struct ubifs_znode *znode)
 }
 
 /**
- * read_znode - read an indexing node from flash and fill znode.
+ * validate_znode - fill znode from an indexing node and validate it.
  * @c: UBIFS file-system description object
- * @lnum: LEB of the indexing node to read
+ * @idx: the indexing node
+ * @lnum: LEB of the indexing node
  * @offs: node offset
- * @len: node length
- * @znode: znode to read to
+ * @znode: znode to fill
  *
- * This function reads an indexing node from the flash media and fills znode
- * with the read data. Returns zero in case of success and a negative error
- * code in case of failure. The read indexing node is validated and if anything
- * is wrong with it, this function prints complaint messages and returns
- * %-EINVAL.
+ * This function fills @znode with the data of indexing node @idx, which has
+ * already been read from the flash media and checked. Returns zero in case of
+ * success and %-EINVAL if anything is wrong with the node, in which case it
+ * prints complaint messages.
  */
-static int read_znode(struct ubifs_info *c, int lnum, int offs, int len,
-		      struct ubifs_znode *znode)
+static int validate_znode(struct ubifs_info *c, struct ubifs_idx_node *idx,
+			  int lnum, int offs, struct ubifs_znode *znode)
 {
 	int i, err, type, cmp;
-	struct ubifs_idx_node *idx;
-
-	idx = kmalloc(c->max_idx_node_sz, GFP_NOFS);
-	if (!idx)
-		return -ENOMEM;
-
-	err = ubifs_read_node(c, idx, UBIFS_IDX_NODE, len, lnum, offs);
-	if (err < 0) {
-		kfree(idx);
-		return err;
-	}
 
 	znode->child_cnt = le16_to_cpu(idx->child_cnt);
 	znode->level = le16_to_cpu(idx->level);
@@ -382,16 +370,155 @@ static int read_znode(struct ubifs_info *c, int lnum, int offs, int len,
 		}
 	}
 
-	kfree(idx);
 	return 0;
 
 out_dump:
 	ubifs_err("bad indexing node at LEB %d:%d, error %d", lnum, offs, err);
 	ubifs_dump_node(c, idx);
-	kfree(idx);
 	return -EINVAL;
 }
 
+/**
+ * read_znode - read an indexing node from flash and fill znode.
+ * @c: UBIFS file-system description object
+ * @lnum: LEB of the indexing node to read
+ * @offs: node offset
+ * @len: node length
+ * @znode: znode to read to
+ *
+ * This function reads an indexing node from the flash media and fills znode
+ * with the read data. Returns zero in case of success and a negative error
+ * code in case of failure. The read indexing node is validated and if anything
+ * is wrong with it, this function prints complaint messages and returns
+ * %-EINVAL.
+ */
+static int read_znode(struct ubifs_info *c, int lnum, int offs, int len,
+		      struct ubifs_znode *znode)
+{
+	int err;
+	struct ubifs_idx_node *idx;
+
+	idx = kmalloc(c->max_idx_node_sz, GFP_NOFS);
+	if (!idx)
+		return -ENOMEM;
+
+	err = ubifs_read_node(c, idx, UBIFS_IDX_NODE, len, lnum, offs);
+	if (!err)
+		err = validate_znode(c, idx, lnum, offs, znode);
+
+	kfree(idx);
+	return err;
+}
+
+/**
+ * add_znode - add a freshly read znode to TNC.
+ * @c: UBIFS file-system description object
+ * @zbr: znode branch
+ * @znode: the znode
+ * @parent: znode's parent
+ * @iip: index in parent
+ */
+static void add_znode(struct ubifs_info *c, struct ubifs_zbranch *zbr,
+		      struct ubifs_znode *znode, struct ubifs_znode *parent,
+		      int iip)
+{
+	atomic_long_inc(&c->clean_zn_cnt);
+
+	/*
+	 * Increment the global clean znode counter as well. It is OK that
+	 * global and per-FS clean znode counters may be inconsistent for some
+	 * short time (because we might be preempted at this point), the global
+	 * one is only used in shrinker.
+	 */
+	atomic_long_inc(&ubifs_clean_zn_cnt);
+
+	zbr->znode = znode;
+	znode->parent = parent;
+	znode->time = get_seconds();
+	znode->iip = iip;
+}
+
+/**
+ * prefetch_znode - read a znode together with its siblings.
+ * @c: UBIFS file-system description object
+ * @parent: znode's parent
+ * @iip: index in parent
+ * @znode: znode to read to
+ *
+ * Index nodes which are written during the same commit are usually placed
+ * next to each other, so this function reads indexing node @iip of @parent in
+ * one go with those of its siblings which are not in TNC yet and sit in the
+ * same LEB within %UBIFS_PREFETCH_SPAN bytes. The siblings which pass
+ * validation are added to TNC, the others are left alone and will be read
+ * the usual way if they are needed. Returns zero if @znode was filled and %1
+ * if there was nothing to prefetch or something went wrong, in which case the
+ * caller has to read the indexing node with 'read_znode()'.
+ */
+static int prefetch_znode(struct ubifs_info *c, struct ubifs_znode *parent,
+			  int iip, struct ubifs_znode *znode)
+{
+	int i, start, end, err, ret = 1;
+	struct ubifs_zbranch *zt = &parent->zbranch[iip];
+	void *buf;
+
+	start = zt->offs;
+	end = zt->offs + zt->len;
+	for (i = 0; i < parent->child_cnt; i++) {
+		struct ubifs_zbranch *zbr = &parent->zbranch[i];
+
+		if (zbr->znode || zbr->lnum != zt->lnum)
+			continue;
+		if (max(end, zbr->offs + zbr->len) - min(start, zbr->offs) >
+		    UBIFS_PREFETCH_SPAN)
+			continue;
+		start = min(start, zbr->offs);
+		end = max(end, zbr->offs + zbr->len);
+	}
+	if (end - start == zt->len)
+		return 1;
+
+	buf = kmalloc(end - start, GFP_NOFS | __GFP_NOWARN);
+	if (!buf)
+		return 1;
+
+	err = ubifs_leb_read(c, zt->lnum, buf, start, end - start, 0);
+	if (err && err != -EBADMSG)
+		goto out;
+
+	if (ubifs_check_read_node(c, buf + zt->offs - start, UBIFS_IDX_NODE,
+				  zt->len, zt->lnum, zt->offs) ||
+	    validate_znode(c, buf + zt->offs - start, zt->lnum, zt->offs,
+			   znode))
+		goto out;
+	ret = 0;
+
+	for (i = 0; i < parent->child_cnt; i++) {
+		struct ubifs_zbranch *zbr = &parent->zbranch[i];
+		struct ubifs_znode *sibling;
+		void *idx = buf + zbr->offs - start;
+
+		if (i == iip || zbr->znode || zbr->lnum != zt->lnum ||
+		    zbr->offs < start || zbr->offs + zbr->len > end)
+			continue;
+		if (ubifs_check_read_node(c, idx, UBIFS_IDX_NODE, zbr->len,
+					  zbr->lnum, zbr->offs))
+			continue;
+
+		sibling = kzalloc(c->max_znode_sz, GFP_NOFS | __GFP_NOWARN);
+		if (!sibling)
+			break;
+		if (validate_znode(c, idx, zbr->lnum, zbr->offs, sibling)) {
+			kfree(sibling);
+			continue;
+		}
+		add_znode(c, zbr, sibling, parent, i);
+	}
+
+out:
+	kfree(buf);
+	return ret;
+}
+
 /**
  * ubifs_load_znode - load znode to TNC cache.
  * @c: UBIFS file-system description object
@@ -419,25 +546,13 @@ struct ubifs_znode *ubifs_load_znode(struct ubifs_info *c,
 	if (!znode)
 		return ERR_PTR(-ENOMEM);
 
-	err = read_znode(c, zbr->lnum, zbr->offs, zbr->len, znode);
-	if (err)
-		goto out;
-
-	atomic_long_inc(&c->clean_zn_cnt);
-
-	/*
-	 * Increment the global clean znode counter as well. It is OK that
-	 * global and per-FS clean znode counters may be inconsistent for some
-	 * short time (because we might be preempted at this point), the global
-	 * one is only used in shrinker.
-	 */
-	atomic_long_inc(&ubifs_clean_zn_cnt);
-
-	zbr->znode = znode;
-	znode->parent = parent;
-	znode->time = get_seconds();
-	znode->iip = iip;
+	if (!parent || prefetch_znode(c, parent, iip, znode)) {
+		err = read_znode(c, zbr->lnum, zbr->offs, zbr->len, znode);
+		if (err)
+			goto out;
+	}
 
+	add_znode(c, zbr, znode, parent, iip);
 	return znode;
 
 out:
@@ -93,7 +93,7 @@
 #define UBIFS_MAX_NLEN 255
 
 /* Maximum number of data journal heads */
-#define UBIFS_MAX_JHEADS 1
+#define UBIFS_MAX_JHEADS 2
 
 /*
  * Size of UBIFS data block. Note, UBIFS is not a block oriented file-system,
@@ -141,6 +141,8 @@
 #define UBIFS_BASE_HEAD 1
 /* Data journal head number */
 #define UBIFS_DATA_HEAD 2
+/* Cold data journal head number (if the file-system has 2 data heads) */
+#define UBIFS_COLD_HEAD 3
 
 /*
  * LEB Properties Tree node types.
@@ -332,12 +334,14 @@ enum {
  * UBIFS_COMPR_NONE: no compression
  * UBIFS_COMPR_LZO: LZO compression
  * UBIFS_COMPR_ZLIB: ZLIB compression
+ * UBIFS_COMPR_LZ4: LZ4 compression
  * UBIFS_COMPR_TYPES_CNT: count of supported compression types
  */
 enum {
 	UBIFS_COMPR_NONE,
 	UBIFS_COMPR_LZO,
 	UBIFS_COMPR_ZLIB,
+	UBIFS_COMPR_LZ4,
 	UBIFS_COMPR_TYPES_CNT,
 };
 
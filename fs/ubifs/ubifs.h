@@ -107,6 +107,13 @@
 #define GCHD   UBIFS_GC_HEAD
 #define BASEHD UBIFS_BASE_HEAD
 #define DATAHD UBIFS_DATA_HEAD
+#define COLDHD UBIFS_COLD_HEAD
+
+/*
+ * Data of inodes which were synchronized with 'fsync()' within this amount of
+ * seconds is considered hot (see 'ubifs_jnl_write_data()').
+ */
+#define UBIFS_HOT_DATA_AGE 30
 
 /* 'No change' value for 'ubifs_change_lp()' */
 #define LPROPS_NC 0x80000001
@@ -160,6 +167,16 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/*
+ * How many bytes around a node which is read from the flash may be read as
+ * well in order to prefetch its neighbours (index nodes of the same parent or
+ * leaf nodes of the same znode).
+ */
+#define UBIFS_PREFETCH_SPAN 8192
+
+/* Leaf node cache hash table size (log2) */
+#define UBIFS_LC_HASH_SHIFT 6
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -357,11 +374,22 @@ struct ubifs_gced_idx_leb {
  * @ui_size: inode size used by UBIFS when writing to flash
  * @flags: inode flags (@UBIFS_COMPR_FL, etc)
  * @compr_type: default compression type used for this inode
+ * @compr_misses: number of data blocks in a row which did not compress
+ * @compr_window: number of data blocks written uncompressed after the last
+ *                failed sample
+ * @compr_skip: number of data blocks to write uncompressed before trying to
+ *              compress again
+ * @sync_time: when the inode was last synchronized by 'fsync()' (seconds)
  * @last_page_read: page number of last page read (for bulk read)
  * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
  * @data_len: length of the data attached to the inode
  * @data: inode's data
  *
+ * The @compr_misses, @compr_window and @compr_skip fields are not protected
+ * by any lock. They only serve the incompressible data heuristic (see
+ * 'ubifs_compr_skip()'), so a lost update does no harm. The same is true for
+ * @sync_time, which only selects the journal head for data nodes.
+ *
  * @ui_mutex exists for two main reasons. At first it prevents inodes from
  * being written back while UBIFS changing them, being in the middle of an VFS
  * operation. This way UBIFS makes sure the inode fields are consistent. For
@@ -407,6 +435,10 @@ struct ubifs_inode {
 	loff_t synced_i_size;
 	loff_t ui_size;
 	int flags;
+	int compr_misses;
+	int compr_window;
+	int compr_skip;
+	unsigned long sync_time;
 	pgoff_t last_page_read;
 	pgoff_t read_in_a_row;
 	int data_len;
@@ -819,17 +851,27 @@ struct ubifs_node_range {
 /**
  * struct ubifs_compressor - UBIFS compressor description structure.
  * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
- * @cc: cryptoapi compressor handle
- * @comp_mutex: mutex used during compression
- * @decomp_mutex: mutex used during decompression
+ * @cc: cryptoapi compressor handles
+ * @cc_cnt: count of handles in @cc
+ * @free_cc: stack of handles which are not in use
+ * @free_cnt: count of handles in @free_cc
+ * @lock: protects @free_cc and @free_cnt
+ * @wait: tasks waiting for a free handle
+ * @comp_excl: non-zero if compression needs a handle for exclusive use
+ * @decomp_excl: non-zero if decompression needs a handle for exclusive use
  * @name: compressor name
  * @capi_name: cryptoapi compressor name
  */
 struct ubifs_compressor {
 	int compr_type;
-	struct crypto_comp *cc;
-	struct mutex *comp_mutex;
-	struct mutex *decomp_mutex;
+	struct crypto_comp **cc;
+	int cc_cnt;
+	struct crypto_comp **free_cc;
+	int free_cnt;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	unsigned int comp_excl:1;
+	unsigned int decomp_excl:1;
 	const char *name;
 	const char *capi_name;
 };
@@ -927,6 +969,8 @@ struct ubifs_orphan {
  *                  specified in @compr_type)
  * @compr_type: compressor type to override the superblock compressor with
  *              (%UBIFS_COMPR_NONE, etc)
+ * @cold_jhead: create a separate cold data journal head when formatting an
+ *              empty volume
  */
 struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
@@ -934,6 +978,7 @@ struct ubifs_mount_opts {
 	unsigned int chk_data_crc:2;
 	unsigned int override_compr:1;
 	unsigned int compr_type:2;
+	unsigned int cold_jhead:1;
 };
 
 /**
@@ -1091,6 +1136,11 @@ struct ubifs_debug_info;
  * @dirty_zn_cnt: number of dirty znodes
  * @clean_zn_cnt: number of clean znodes
  *
+ * @lc_hash: leaf node cache hash table (see lcache.c)
+ * @lc_lru: leaf node cache LRU list
+ * @lc_size: amount of node data in the leaf node cache
+ * @lc_lock: protects @lc_hash, @lc_lru and @lc_size
+ *
  * @space_lock: protects @bi and @lst
  * @lst: lprops statistics
  * @bi: budgeting information
@@ -1326,6 +1376,11 @@ struct ubifs_info {
 	atomic_long_t dirty_zn_cnt;
 	atomic_long_t clean_zn_cnt;
 
+	struct hlist_head lc_hash[1 << UBIFS_LC_HASH_SHIFT];
+	struct list_head lc_lru;
+	int lc_size;
+	spinlock_t lc_lock;
+
 	spinlock_t space_lock;
 	struct ubifs_lp_stats lst;
 	struct ubifs_budg_info bi;
@@ -1453,6 +1508,7 @@ struct ubifs_info {
 extern struct list_head ubifs_infos;
 extern spinlock_t ubifs_infos_lock;
 extern atomic_long_t ubifs_clean_zn_cnt;
+extern atomic_long_t ubifs_lc_cnt;
 extern struct kmem_cache *ubifs_inode_slab;
 extern const struct super_operations ubifs_super_operations;
 extern const struct address_space_operations ubifs_file_address_operations;
@@ -1463,6 +1519,8 @@ extern const struct inode_operations ubifs_dir_inode_operations;
 extern const struct inode_operations ubifs_symlink_inode_operations;
 extern struct backing_dev_info ubifs_backing_dev_info;
 extern struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
+int ubifs_compr_skip(struct ubifs_inode *ui);
+void ubifs_compr_account(struct ubifs_inode *ui, int compressed);
 
 /* io.c */
 void ubifs_ro_mode(struct ubifs_info *c, int err);
@@ -1481,6 +1539,8 @@ int ubifs_read_node(const struct ubifs_info *c, void *buf, int type, int len,
 		    int lnum, int offs);
 int ubifs_read_node_wbuf(struct ubifs_wbuf *wbuf, void *buf, int type, int len,
 			 int lnum, int offs);
+int ubifs_check_read_node(const struct ubifs_info *c, const void *buf,
+			  int type, int len, int lnum, int offs);
 int ubifs_write_node(struct ubifs_info *c, void *node, int len, int lnum,
 		     int offs);
 int ubifs_check_node(const struct ubifs_info *c, const void *buf, int lnum,
@@ -1616,6 +1676,14 @@ struct ubifs_znode *ubifs_load_znode(struct ubifs_info *c,
 int ubifs_tnc_read_node(struct ubifs_info *c, struct ubifs_zbranch *zbr,
 			void *node);
 
+/* lcache.c */
+int ubifs_lc_lookup(struct ubifs_info *c, const struct ubifs_zbranch *zbr,
+		    void *node);
+void ubifs_lc_prefetch(struct ubifs_info *c, struct ubifs_znode *znode, int n);
+void ubifs_lc_invalidate(struct ubifs_info *c, int lnum);
+int ubifs_lc_shrink(struct ubifs_info *c, int nr);
+void ubifs_lc_destroy(struct ubifs_info *c);
+
 /* tnc_commit.c */
 int ubifs_tnc_start_commit(struct ubifs_info *c, struct ubifs_zbranch *zroot);
 int ubifs_tnc_end_commit(struct ubifs_info *c);
@@ -171,6 +171,8 @@ extern void sk_unattached_filter_destroy(struct sk_filter *fp);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
 extern int sk_detach_filter(struct sock *sk);
 extern int sk_chk_filter(struct sock_filter *filter, unsigned int flen);
+extern void *bpf_internal_load_pointer_neg_helper(const struct sk_buff *skb,
+						  int k, unsigned int size);
 
 #ifdef CONFIG_BPF_JIT
 extern void bpf_jit_compile(struct sk_filter *fp);
@@ -186,6 +188,21 @@ static inline void bpf_jit_free(struct sk_filter *fp)
 #define SK_RUN_FILTER(FILTER, SKB) sk_run_filter(SKB, FILTER->insns)
 #endif
 
+#ifdef CONFIG_SECCOMP_FILTER_JIT
+extern void *seccomp_jit_compile(const struct sock_filter *filter,
+				 unsigned int flen);
+extern void seccomp_jit_free(void *bpf_func);
+#else
+static inline void *seccomp_jit_compile(const struct sock_filter *filter,
+					unsigned int flen)
+{
+	return NULL;
+}
+static inline void seccomp_jit_free(void *bpf_func)
+{
+}
+#endif
+
 enum {
 	BPF_S_RET_K = 1,
 	BPF_S_RET_A,
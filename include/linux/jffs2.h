@@ -64,6 +64,7 @@
 #define JFFS2_NODETYPE_PADDING (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 4)
 
 #define JFFS2_NODETYPE_SUMMARY (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 6)
+#define JFFS2_NODETYPE_CHECKPOINT (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 7)
 
 #define JFFS2_NODETYPE_XATTR (JFFS2_FEATURE_INCOMPAT | JFFS2_NODE_ACCURATE | 8)
 #define JFFS2_NODETYPE_XREF (JFFS2_FEATURE_INCOMPAT | JFFS2_NODE_ACCURATE | 9)
@@ -78,7 +79,6 @@
 #define JFFS2_ACL_VERSION		0x0001
 
 // Maybe later...
-//#define JFFS2_NODETYPE_CHECKPOINT (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 3)
 //#define JFFS2_NODETYPE_OPTIONS (JFFS2_FEATURE_RWCOMPAT_COPY | JFFS2_NODE_ACCURATE | 4)
 
 
@@ -204,6 +204,23 @@ struct jffs2_raw_summary
 	jint32_t sum[0]; 	/* inode summary info */
 };
 
+/* One node per eraseblock of the checkpoint area. The checkpoint data
+   is split into 'pieces', piece N living at the start of area block N. */
+struct jffs2_raw_checkpoint
+{
+	jint16_t magic;
+	jint16_t nodetype;	/* = JFFS2_NODETYPE_CHECKPOINT */
+	jint32_t totlen;
+	jint32_t hdr_crc;
+	jint32_t version;	/* checkpoint version */
+	jint32_t blocks;	/* size of the checkpoint area in eraseblocks */
+	jint16_t piece;		/* index of this piece */
+	jint16_t pieces;	/* number of pieces, 0 = no checkpoint */
+	jint32_t data_crc;	/* crc of data[] */
+	jint32_t node_crc;	/* crc of the fields above */
+	uint8_t data[0];
+};
+
 union jffs2_node_union
 {
 	struct jffs2_raw_inode i;
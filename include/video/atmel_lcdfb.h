@@ -25,6 +25,7 @@
 #include <linux/workqueue.h>
 #include <linux/interrupt.h>
 #include <linux/backlight.h>
+#include <linux/dmaengine.h>
 
 /* Way LCD wires are connected to the chip:
  * Some Atmel chips use BGR color mode (instead of standard RGB)
@@ -57,6 +58,12 @@ extern int __atmel_lcdfb_probe(struct platform_device *pdev,
 				struct atmel_lcdfb_devdata *devdata);
 extern int __atmel_lcdfb_remove(struct platform_device *pdev);
 
+/* Region of the virtual frame buffer drawn since the last page flip */
+struct atmel_lcdfb_dirty {
+	u32			x1, y1;		/* inclusive */
+	u32			x2, y2;		/* exclusive */
+};
+
  /* LCD Controller info data structure, stored in device platform_data */
 struct atmel_lcdfb_info {
 	spinlock_t		lock;
@@ -70,6 +77,13 @@ struct atmel_lcdfb_info {
 	void			*dma_desc;
 	dma_addr_t		dma_desc_phys;
 
+#ifdef CONFIG_FB_ATMEL_DMA_ACCEL
+	struct dma_chan		*dma_chan;	/* memcpy channel for fill/copy */
+	dma_cookie_t		dma_cookie;
+#endif
+	struct atmel_lcdfb_dirty dirty;		/* protected by lock */
+	u32			front_yoffset;	/* frame currently scanned out */
+
 	unsigned int		guard_time;
 	unsigned int 		smem_len;
 	struct platform_device	*pdev;
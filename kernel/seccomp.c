@@ -38,6 +38,7 @@
  *         outside of a lifetime-guarded section.  In general, this
  *         is only needed for handling filters shared across tasks.
  * @prev: points to a previously installed, or inherited, filter
+ * @bpf_func: sk_run_filter() or the JIT compiled version of @insns
  * @len: the number of instructions in the program
  * @insns: the BPF program instructions to evaluate
  *
@@ -54,6 +55,8 @@
 struct seccomp_filter {
 	atomic_t usage;
 	struct seccomp_filter *prev;
+	unsigned int (*bpf_func)(const struct sk_buff *skb,
+				 const struct sock_filter *filter);
 	unsigned short len;  /* Instruction count */
 	struct sock_filter insns[];
 };
@@ -211,7 +214,7 @@ static u32 seccomp_run_filters(int syscall)
 	 * value always takes priority (ignoring the DATA).
 	 */
 	for (f = current->seccomp.filter; f; f = f->prev) {
-		u32 cur_ret = sk_run_filter(NULL, f->insns);
+		u32 cur_ret = f->bpf_func(NULL, f->insns);
 		if ((cur_ret & SECCOMP_RET_ACTION) < (ret & SECCOMP_RET_ACTION))
 			ret = cur_ret;
 	}
@@ -273,6 +276,10 @@ static long seccomp_attach_filter(struct sock_fprog *fprog)
 	if (ret)
 		goto fail;
 
+	filter->bpf_func = seccomp_jit_compile(filter->insns, filter->len);
+	if (!filter->bpf_func)
+		filter->bpf_func = sk_run_filter;
+
 	/*
 	 * If there is an existing filter, make it the prev and don't drop its
 	 * task reference.
@@ -330,6 +337,8 @@ void put_seccomp_filter(struct task_struct *tsk)
 	while (orig && atomic_dec_and_test(&orig->usage)) {
 		struct seccomp_filter *freeme = orig;
 		orig = orig->prev;
+		if (freeme->bpf_func != sk_run_filter)
+			seccomp_jit_free(freeme->bpf_func);
 		kfree(freeme);
 	}
 }
@@ -0,0 +1,150 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return (get_unaligned((const u32 *)p) * 2654435761U) >>
+	       (32 - HASH_LOG);
+}
+
+/*
+ * Store a length which does not fit into its token field. Returns the new
+ * output position.
+ */
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/* Worst case number of bytes needed to store a run of @lit literals */
+static inline size_t lz4_lit_cost(size_t lit)
+{
+	return 1 + lit + (lit + 255 - RUN_MASK) / 255;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 * const table = wrkmem;
+	const unsigned char *ip = src, *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char * const oend = dst + *dst_len;
+	size_t lit;
+
+	BUILD_BUG_ON(LZ4_MEM_COMPRESS < HASH_SIZE * sizeof(u32));
+
+	if (src_len > LZ4_MAX_INPUT_SIZE)
+		return -1;
+
+	if (src_len < MIN_LENGTH)
+		goto last_literals;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	ip++;
+
+	for (;;) {
+		const unsigned char *ref, *p, *r;
+		unsigned int search = 1U << SKIP_TRIGGER;
+		unsigned char *token;
+		size_t mlen;
+
+		/* Find a match */
+		for (;;) {
+			u32 h;
+
+			if (ip > mflimit)
+				goto last_literals;
+
+			h = lz4_hash(ip);
+			ref = src + table[h];
+			table[h] = ip - src;
+			if (ip - ref <= MAX_DISTANCE &&
+			    get_unaligned((const u32 *)ref) ==
+			    get_unaligned((const u32 *)ip))
+				break;
+			ip += search++ >> SKIP_TRIGGER;
+		}
+
+		/* Extend it backwards and forwards */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		p = ip + MINMATCH;
+		r = ref + MINMATCH;
+		while (p < matchlimit && *p == *r) {
+			p++;
+			r++;
+		}
+		mlen = p - ip - MINMATCH;
+
+		lit = ip - anchor;
+		if (lz4_lit_cost(lit) + 2 + mlen / 255 + 1 >
+		    (size_t)(oend - op))
+			return -1;
+
+		token = op++;
+		if (lit >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, lit - RUN_MASK);
+		} else
+			*token = lit << ML_BITS;
+		memcpy(op, anchor, lit);
+		op += lit;
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		if (mlen >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, mlen - ML_MASK);
+		} else
+			*token |= mlen;
+
+		anchor = ip = p;
+		if (ip > mflimit)
+			break;
+
+		/* Index a position inside the match to find the next one */
+		table[lz4_hash(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	lit = iend - anchor;
+	if (lz4_lit_cost(lit) > (size_t)(oend - op))
+		return -1;
+
+	if (lit >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit - RUN_MASK);
+	} else
+		*op++ = lit << ML_BITS;
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
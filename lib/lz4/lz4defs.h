@@ -0,0 +1,45 @@
+/*
+ *  lz4defs.h -- LZ4 block format definitions
+ *
+ *  LZ4 is an LZ77 type compressor by Yann Collet. A block is a sequence of
+ *  "sequences", each of which is made of a token, a run of literals and a
+ *  match. The high 4 bits of the token hold the literal run length, the low
+ *  4 bits hold the match length minus MINMATCH. A value of 15 in either field
+ *  means the length continues in the following bytes, each of which adds up
+ *  to 255 to it. The match is given by a 16-bit little-endian offset back
+ *  into the already decoded data. The last sequence of a block carries
+ *  literals only.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+
+/* The last 5 bytes of a block are always literals */
+#define LASTLITERALS	5
+/* The last match must start at least 12 bytes before the end of a block */
+#define MFLIMIT		(8 + MINMATCH)
+/* Blocks shorter than this are stored as literals only */
+#define MIN_LENGTH	(MFLIMIT + 1)
+
+#define MAX_DISTANCE	65535
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define HASH_LOG	12
+#define HASH_SIZE	(1U << HASH_LOG)
+
+/*
+ * The compressor skips input faster and faster as long as it does not find a
+ * match, it moves by one byte at a time for the first 1 << SKIP_TRIGGER
+ * positions.
+ */
+#define SKIP_TRIGGER	6
+
+/* Input positions are stored as 32-bit offsets in the hash table */
+#define LZ4_MAX_INPUT_SIZE	0x7E000000
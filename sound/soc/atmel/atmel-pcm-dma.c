@@ -30,6 +30,7 @@
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
 #include <linux/dmaengine.h>
+#include <linux/hrtimer.h>
 #include <linux/atmel-ssc.h>
 #include <linux/platform_data/dma-atmel.h>
 
@@ -49,15 +50,40 @@ static const struct snd_pcm_hardware atmel_pcm_dma_hardware = {
 				  SNDRV_PCM_INFO_MMAP_VALID |
 				  SNDRV_PCM_INFO_INTERLEAVED |
 				  SNDRV_PCM_INFO_RESUME |
-				  SNDRV_PCM_INFO_PAUSE,
+				  SNDRV_PCM_INFO_PAUSE |
+				  SNDRV_PCM_INFO_NO_PERIOD_WAKEUP,
 	.formats		= SNDRV_PCM_FMTBIT_S16_LE,
-	.period_bytes_min	= 256,		/* lighting DMA overhead */
+	.period_bytes_min	= 32,		/* timer driven below 256 */
 	.period_bytes_max	= 2 * 0xffff,	/* if 2 bytes format */
-	.periods_min		= 8,
+	.periods_min		= 2,
 	.periods_max		= 1024,		/* no limit */
 	.buffer_bytes_max	= ATMEL_SSC_DMABUF_SIZE,
 };
 
+/*
+ * Periods shorter than this are not worth one DMA interrupt each: the
+ * DMA then runs in larger chunks and a hrtimer reports the periods,
+ * reading the position from the DMA residue.
+ */
+#define ATMEL_PCM_DMA_PERIOD_MIN	256
+#define ATMEL_PCM_DMA_CHUNK_MAX		4096
+
+/*--------------------------------------------------------------------------*\
+ * Data types
+\*--------------------------------------------------------------------------*/
+struct atmel_pcm_dma_runtime {
+	struct atmel_pcm_dma_params *params;
+	struct snd_pcm_substream *substream;
+	dma_cookie_t cookie;
+	size_t chunk_bytes;		/* bytes per DMA interrupt */
+
+	/* period reporting for small periods */
+	bool timer_mode;
+	struct hrtimer hrt;
+	ktime_t period_time;
+	atomic_t running;
+};
+
 /**
  * atmel_pcm_dma_irq: SSC interrupt handler for DMAENGINE enabled SSC
  *
@@ -67,9 +93,11 @@ static const struct snd_pcm_hardware atmel_pcm_dma_hardware = {
 static void atmel_pcm_dma_irq(u32 ssc_sr,
 	struct snd_pcm_substream *substream)
 {
+	struct atmel_pcm_dma_runtime *rtd;
 	struct atmel_pcm_dma_params *prtd;
 
-	prtd = snd_dmaengine_pcm_get_data(substream);
+	rtd = snd_dmaengine_pcm_get_data(substream);
+	prtd = rtd->params;
 
 	if (ssc_sr & prtd->mask->ssc_error) {
 		if (snd_pcm_running(substream))
@@ -88,6 +116,30 @@ static void atmel_pcm_dma_irq(u32 ssc_sr,
 	}
 }
 
+static enum hrtimer_restart atmel_pcm_hrtimer_callback(struct hrtimer *hrt)
+{
+	struct atmel_pcm_dma_runtime *rtd =
+		container_of(hrt, struct atmel_pcm_dma_runtime, hrt);
+
+	if (!atomic_read(&rtd->running))
+		return HRTIMER_NORESTART;
+
+	/* the core reads the exact position back through .pointer */
+	snd_pcm_period_elapsed(rtd->substream);
+
+	hrtimer_forward_now(hrt, rtd->period_time);
+
+	return HRTIMER_RESTART;
+}
+
+static void atmel_pcm_dma_complete(void *arg)
+{
+	struct atmel_pcm_dma_runtime *rtd = arg;
+
+	if (!rtd->timer_mode)
+		snd_pcm_period_elapsed(rtd->substream);
+}
+
 /*--------------------------------------------------------------------------*\
  * DMAENGINE operations
 \*--------------------------------------------------------------------------*/
@@ -106,14 +158,14 @@ static bool filter(struct dma_chan *chan, void *slave)
 static int atmel_pcm_configure_dma(struct snd_pcm_substream *substream,
 	struct snd_pcm_hw_params *params)
 {
-	struct atmel_pcm_dma_params *prtd;
+	struct atmel_pcm_dma_runtime *rtd;
 	struct ssc_device *ssc;
 	struct dma_chan *dma_chan;
 	struct dma_slave_config slave_config;
 	int ret;
 
-	prtd = snd_dmaengine_pcm_get_data(substream);
-	ssc = prtd->ssc;
+	rtd = snd_dmaengine_pcm_get_data(substream);
+	ssc = rtd->params->ssc;
 
 	ret = snd_hwparams_to_dma_slave_config(substream, params,
 			&slave_config);
@@ -142,10 +194,50 @@ static int atmel_pcm_configure_dma(struct snd_pcm_substream *substream,
 	return 0;
 }
 
+/*
+ * Choose how much data the DMA moves between two interrupts. Normal
+ * periods map one to one on DMA periods. Small periods and streams that
+ * asked for no period wakeups are grouped into the largest chunk that
+ * still divides the buffer, the position being read from the residue.
+ */
+static void atmel_pcm_setup_chunks(struct atmel_pcm_dma_runtime *rtd,
+	struct snd_pcm_hw_params *params)
+{
+	size_t period_bytes = params_period_bytes(params);
+	unsigned int periods = params_periods(params);
+	/* runtime->no_period_wakeup is only set after hw_params returns */
+	bool no_wakeup = params->flags & SNDRV_PCM_HW_PARAMS_NO_PERIOD_WAKEUP;
+	size_t max_chunk;
+	unsigned int n;
+
+	rtd->timer_mode = false;
+	rtd->chunk_bytes = period_bytes;
+
+	if (no_wakeup)
+		max_chunk = params_buffer_bytes(params);
+	else if (period_bytes < ATMEL_PCM_DMA_PERIOD_MIN)
+		max_chunk = ATMEL_PCM_DMA_CHUNK_MAX;
+	else
+		return;
+
+	for (n = periods; n > 1; n--)
+		if (!(periods % n) && n * period_bytes <= max_chunk)
+			break;
+	rtd->chunk_bytes = n * period_bytes;
+
+	if (!no_wakeup) {
+		rtd->timer_mode = true;
+		rtd->period_time = ns_to_ktime(div_u64((u64)NSEC_PER_SEC
+				* params_period_size(params),
+				params_rate(params)));
+	}
+}
+
 static int atmel_pcm_hw_params(struct snd_pcm_substream *substream,
 	struct snd_pcm_hw_params *params)
 {
 	struct snd_soc_pcm_runtime *rtd = substream->private_data;
+	struct atmel_pcm_dma_runtime *dma_rtd;
 	struct atmel_pcm_dma_params *prtd;
 	struct ssc_device *ssc;
 	struct at_dma_slave *sdata = NULL;
@@ -158,13 +250,25 @@ static int atmel_pcm_hw_params(struct snd_pcm_substream *substream,
 	if (ssc->pdev)
 		sdata = ssc->pdev->dev.platform_data;
 
+	dma_rtd = kzalloc(sizeof(*dma_rtd), GFP_KERNEL);
+	if (!dma_rtd)
+		return -ENOMEM;
+
+	dma_rtd->params = prtd;
+	dma_rtd->substream = substream;
+	atomic_set(&dma_rtd->running, 0);
+	hrtimer_init(&dma_rtd->hrt, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dma_rtd->hrt.function = atmel_pcm_hrtimer_callback;
+	atmel_pcm_setup_chunks(dma_rtd, params);
+
 	ret = snd_dmaengine_pcm_open(substream, filter, sdata);
 	if (ret) {
 		pr_err("atmel-pcm: dmaengine pcm open failed\n");
+		kfree(dma_rtd);
 		return -EINVAL;
 	}
 
-	snd_dmaengine_pcm_set_data(substream, prtd);
+	snd_dmaengine_pcm_set_data(substream, dma_rtd);
 
 	ret = atmel_pcm_configure_dma(substream, params);
 	if (ret) {
@@ -177,14 +281,17 @@ static int atmel_pcm_hw_params(struct snd_pcm_substream *substream,
 	return 0;
 err:
 	snd_dmaengine_pcm_close(substream);
+	kfree(dma_rtd);
 	return ret;
 }
 
 static int atmel_pcm_dma_prepare(struct snd_pcm_substream *substream)
 {
+	struct atmel_pcm_dma_runtime *rtd;
 	struct atmel_pcm_dma_params *prtd;
 
-	prtd = snd_dmaengine_pcm_get_data(substream);
+	rtd = snd_dmaengine_pcm_get_data(substream);
+	prtd = rtd->params;
 
 	ssc_writex(prtd->ssc->regs, SSC_IER, prtd->mask->ssc_error);
 	ssc_writex(prtd->ssc->regs, SSC_CR, prtd->mask->ssc_enable);
@@ -192,17 +299,121 @@ static int atmel_pcm_dma_prepare(struct snd_pcm_substream *substream)
 	return 0;
 }
 
+static int atmel_pcm_dma_submit(struct snd_pcm_substream *substream)
+{
+	struct atmel_pcm_dma_runtime *rtd = snd_dmaengine_pcm_get_data(substream);
+	struct dma_chan *chan = snd_dmaengine_pcm_get_chan(substream);
+	struct dma_async_tx_descriptor *desc;
+
+	desc = dmaengine_prep_dma_cyclic(chan,
+		substream->runtime->dma_addr,
+		snd_pcm_lib_buffer_bytes(substream),
+		rtd->chunk_bytes,
+		snd_pcm_substream_to_dma_direction(substream));
+	if (!desc)
+		return -ENOMEM;
+
+	desc->callback = atmel_pcm_dma_complete;
+	desc->callback_param = rtd;
+	rtd->cookie = dmaengine_submit(desc);
+
+	return 0;
+}
+
+static void atmel_pcm_timer_start(struct atmel_pcm_dma_runtime *rtd)
+{
+	if (!rtd->timer_mode)
+		return;
+
+	atomic_set(&rtd->running, 1);
+	hrtimer_start(&rtd->hrt, rtd->period_time, HRTIMER_MODE_REL);
+}
+
+static void atmel_pcm_timer_stop(struct atmel_pcm_dma_runtime *rtd)
+{
+	/* trigger runs atomic: the callback sees !running and stops */
+	atomic_set(&rtd->running, 0);
+	hrtimer_try_to_cancel(&rtd->hrt);
+}
+
+static int atmel_pcm_dma_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct atmel_pcm_dma_runtime *rtd = snd_dmaengine_pcm_get_data(substream);
+	struct dma_chan *chan = snd_dmaengine_pcm_get_chan(substream);
+	int ret;
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+		ret = atmel_pcm_dma_submit(substream);
+		if (ret)
+			return ret;
+		dma_async_issue_pending(chan);
+		atmel_pcm_timer_start(rtd);
+		break;
+	case SNDRV_PCM_TRIGGER_RESUME:
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		dmaengine_resume(chan);
+		atmel_pcm_timer_start(rtd);
+		break;
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		atmel_pcm_timer_stop(rtd);
+		dmaengine_pause(chan);
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+		atmel_pcm_timer_stop(rtd);
+		dmaengine_terminate_all(chan);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Report the position from the DMA residue so that it has sample rather
+ * than period granularity.
+ */
+static snd_pcm_uframes_t atmel_pcm_dma_pointer(
+	struct snd_pcm_substream *substream)
+{
+	struct atmel_pcm_dma_runtime *rtd = snd_dmaengine_pcm_get_data(substream);
+	struct dma_chan *chan = snd_dmaengine_pcm_get_chan(substream);
+	struct dma_tx_state state;
+	enum dma_status status;
+	unsigned int buf_size;
+	unsigned int pos = 0;
+
+	status = dmaengine_tx_status(chan, rtd->cookie, &state);
+	if (status == DMA_IN_PROGRESS || status == DMA_PAUSED) {
+		buf_size = snd_pcm_lib_buffer_bytes(substream);
+		if (state.residue > 0 && state.residue <= buf_size)
+			pos = buf_size - state.residue;
+	}
+
+	return bytes_to_frames(substream->runtime, pos);
+}
+
 static int atmel_pcm_open(struct snd_pcm_substream *substream)
 {
 	snd_soc_set_runtime_hwparams(substream, &atmel_pcm_dma_hardware);
 
-	return 0;
+	/* chunks are made of whole periods and must divide the buffer */
+	return snd_pcm_hw_constraint_integer(substream->runtime,
+			SNDRV_PCM_HW_PARAM_PERIODS);
 }
 
 static int atmel_pcm_close(struct snd_pcm_substream *substream)
 {
-	if (substream->runtime->private_data)
+	struct atmel_pcm_dma_runtime *rtd;
+
+	if (substream->runtime->private_data) {
+		rtd = snd_dmaengine_pcm_get_data(substream);
+		hrtimer_cancel(&rtd->hrt);
+		kfree(rtd);
 		snd_dmaengine_pcm_close(substream);
+	}
 
 	return 0;
 }
@@ -213,8 +424,8 @@ static struct snd_pcm_ops atmel_pcm_ops = {
 	.ioctl		= snd_pcm_lib_ioctl,
 	.hw_params	= atmel_pcm_hw_params,
 	.prepare	= atmel_pcm_dma_prepare,
-	.trigger	= snd_dmaengine_pcm_trigger,
-	.pointer	= snd_dmaengine_pcm_pointer_no_residue,
+	.trigger	= atmel_pcm_dma_trigger,
+	.pointer	= atmel_pcm_dma_pointer,
 	.mmap		= atmel_pcm_mmap,
 };
 